@@ -39,6 +39,26 @@
 #include "audio/FreeDVMessage.h"
 #endif // CONFIG_EZDV_ENABLE_TX_RX_AUTOMATED_TEST
 
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+#include "audio/AudioLatency.h"
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+#if CONFIG_EZDV_PRINT_JITTER_BUFFER_STATS
+#include "audio/AudioJitterBuffer.h"
+#endif // CONFIG_EZDV_PRINT_JITTER_BUFFER_STATS
+
+#if CONFIG_EZDV_PRINT_CLOCK_DRIFT_STATS
+#include "audio/AudioDriftCompensator.h"
+#endif // CONFIG_EZDV_PRINT_CLOCK_DRIFT_STATS
+
+#if CONFIG_EZDV_PRINT_TIMER_WHEEL_STATS
+#include "task/DVTimerWheel.h"
+#endif // CONFIG_EZDV_PRINT_TIMER_WHEEL_STATS
+
+#if CONFIG_EZDV_PRINT_TASK_STATS
+#include <map>
+#endif // CONFIG_EZDV_PRINT_TASK_STATS
+
 #define CURRENT_LOG_TAG ("app")
 
 #define BOOTUP_VOL_DOWN_GPIO (GPIO_NUM_7)
@@ -81,6 +101,8 @@ App::App()
     , audioMixer_(nullptr)
     , beeperTask_(nullptr)
     , freedvTask_(nullptr)
+    , freedvSpeechTask_(nullptr)
+    , freedvScanTask_(nullptr)
     , max17048_(&i2cMaster_)
     , tlv320Device_(nullptr)
     , networkTask_(nullptr)
@@ -361,7 +383,13 @@ void App::onTaskStart_()
     
         if (!rfComplianceEnabled_)
         {
-            freedvTask_ = new audio::FreeDVTask();
+            freedvSpeechTask_ = new audio::FreeDVSpeechTask();
+            assert(freedvSpeechTask_ != nullptr);
+
+            freedvScanTask_ = new audio::FreeDVScanTask();
+            assert(freedvScanTask_ != nullptr);
+
+            freedvTask_ = new audio::FreeDVTask(freedvSpeechTask_, freedvScanTask_);
             assert(freedvTask_ != nullptr);
             
             audioMixer_ = new audio::AudioMixer();
@@ -370,43 +398,50 @@ void App::onTaskStart_()
             beeperTask_ = new audio::BeeperTask();
             assert(beeperTask_ != nullptr);
             
-            // Link TLV320 output FIFOs to FreeDVTask
-            tlv320Device_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-                freedvTask_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-            );
-
-            tlv320Device_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RIGHT_CHANNEL, 
-                freedvTask_->getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
-            );
-
-            // Link FreeDVTask output FIFOs to:
-            //    * RX: AudioMixer left channel
-            //    * TX: TLV320 right channel
-            freedvTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::USER_CHANNEL, 
-                audioMixer_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-            );
-
-            freedvTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
-
-            // Link beeper output to AudioMixer right channel
-            beeperTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                audioMixer_->getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
-            );
-
-            // Link audio mixer to TLV320 left channel
-            audioMixer_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
+            auto audioGraph = audio::AudioGraph::GetInstance();
+            audioGraph->addNode("TLV320", tlv320Device_);
+            audioGraph->addNode("FreeDV", freedvTask_);
+            audioGraph->addNode("FreeDVSpeech", freedvSpeechTask_);
+            audioGraph->addNode("Mixer", audioMixer_);
+            audioGraph->addNode("Beeper", beeperTask_);
+
+            {
+                audio::AudioGraph::Patch patch;
+
+                // Link TLV320 output FIFOs to FreeDVTask
+                patch.connect(
+                    tlv320Device_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
+                    freedvTask_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
+                patch.connect(
+                    tlv320Device_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL, 
+                    freedvTask_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
+
+                // Link FreeDV output FIFOs to:
+                //    * RX: AudioMixer left channel (via FreeDVSpeechTask)
+                //    * TX: TLV320 right channel
+                patch.connect(
+                    freedvSpeechTask_, audio::AudioInput::ChannelLabel::USER_CHANNEL, 
+                    audioMixer_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
+                patch.connect(
+                    freedvTask_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
+                    tlv320Device_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+
+                // Link beeper output to AudioMixer right channel
+                patch.connect(
+                    beeperTask_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
+                    audioMixer_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
+
+                // Link audio mixer to TLV320 left channel
+                patch.connect(
+                    audioMixer_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
+                    tlv320Device_, audio::AudioInput::ChannelLabel::USER_CHANNEL);
+
+                auto rv = patch.commit();
+                assert(rv);
+            }
                 
             // Start audio processing
+            start(freedvSpeechTask_, pdMS_TO_TICKS(1000));
             start(freedvTask_, pdMS_TO_TICKS(1000));
             start(audioMixer_, pdMS_TO_TICKS(1000));
             start(beeperTask_, pdMS_TO_TICKS(1000));
@@ -414,6 +449,7 @@ void App::onTaskStart_()
             // Start UI
             voiceKeyerTask_ = new audio::VoiceKeyerTask(tlv320Device_, freedvTask_);
             assert(voiceKeyerTask_ != nullptr);
+            audioGraph->addNode("VoiceKeyer", voiceKeyerTask_);
             start(voiceKeyerTask_, pdMS_TO_TICKS(1000));
             
             uiTask_ = new ui::UserInterfaceTask();
@@ -444,16 +480,23 @@ void App::onTaskStart_()
             rfComplianceTask_ = new ui::RfComplianceTestTask(&ledArray_, tlv320Device_);
             assert(rfComplianceTask_ != nullptr);
             
+            auto audioGraph = audio::AudioGraph::GetInstance();
+            audioGraph->addNode("TLV320", tlv320Device_);
+            audioGraph->addNode("RfComplianceTest", rfComplianceTask_);
+
             // RF compliance task should be piped to TLV320.
-            rfComplianceTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
-            
-            rfComplianceTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
-                tlv320Device_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
+            {
+                audio::AudioGraph::Patch patch;
+                patch.connect(
+                    rfComplianceTask_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
+                    tlv320Device_, audio::AudioInput::ChannelLabel::USER_CHANNEL);
+                patch.connect(
+                    rfComplianceTask_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
+                    tlv320Device_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+
+                auto rv = patch.commit();
+                assert(rv);
+            }
             
             start(rfComplianceTask_, pdMS_TO_TICKS(1000));
         }
@@ -518,6 +561,11 @@ void App::onTaskSleep_()
             {
                 sleep(freedvTask_, pdMS_TO_TICKS(1000));
             }
+
+            if (freedvSpeechTask_ != nullptr)
+            {
+                sleep(freedvSpeechTask_, pdMS_TO_TICKS(1000));
+            }
             
             if (audioMixer_ != nullptr)
             {
@@ -716,6 +764,185 @@ void App::onTaskTick_()
     //esp_dump_per_task_heap_info();
 #endif // CONFIG_EZDV_PRINT_HEAP_USAGE
 
+#if CONFIG_EZDV_PRINT_MESSAGE_POOL_STATS
+    for (int index = 0; index < DVTask::GetNumMessagePools(); index++)
+    {
+        DVMessagePool::Statistics stats;
+        DVTask::GetMessagePoolStatistics(index, &stats);
+        ESP_LOGI(
+            CURRENT_LOG_TAG, 
+            "message pool %d (%" PRIu32 " x %" PRIu32 " bytes): in use %" PRIu32 ", high water %" PRIu32 ", allocations %" PRIu32 ", exhausted %" PRIu32, 
+            index, stats.numBlocks, stats.blockSize, stats.numInUse, stats.highWaterMark, stats.numAllocations, stats.numExhausted);
+    }
+    ESP_LOGI(CURRENT_LOG_TAG, "message heap allocations: %" PRIu32, DVTask::GetNumHeapMessageAllocations());
+    ESP_LOGI(
+        CURRENT_LOG_TAG, 
+        "message copies: %" PRIu32 " (%" PRIu32 " bytes), publish deliveries: %" PRIu32, 
+        DVTask::GetNumMessageCopies(), DVTask::GetNumMessageBytesCopied(), DVTask::GetNumPublishDeliveries());
+#endif // CONFIG_EZDV_PRINT_MESSAGE_POOL_STATS
+
+#if CONFIG_EZDV_PRINT_MESSAGE_LATENCY_STATS
+    std::vector<DVTask*> tasks;
+    DVTask::GetAllTasks(tasks);
+    for (auto& task : tasks)
+    {
+        std::vector<DVTask::MessageStatistics> messageStats;
+        task->getMessageStatistics(messageStats);
+        task->resetMessageStatistics();
+
+        for (auto& stats : messageStats)
+        {
+            ESP_LOGI(
+                CURRENT_LOG_TAG, 
+                "%s: %s:%" PRId32 " count %" PRIu32 ", queue wait avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us, handler avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+                task->getName(), stats.eventBase, stats.eventId, stats.queueWait.getCount(),
+                stats.queueWait.getAverageUs(), stats.queueWait.getPercentileUs(99), stats.queueWait.getMaxUs(),
+                stats.handlerTime.getAverageUs(), stats.handlerTime.getPercentileUs(99), stats.handlerTime.getMaxUs());
+        }
+    }
+#endif // CONFIG_EZDV_PRINT_MESSAGE_LATENCY_STATS
+
+#if CONFIG_EZDV_PRINT_MESSAGE_OVERFLOW_STATS
+    std::vector<DVTask*> overflowTasks;
+    DVTask::GetAllTasks(overflowTasks);
+    for (auto& task : overflowTasks)
+    {
+        DVTask::OverflowStatistics overflowStats;
+        task->getOverflowStatistics(&overflowStats);
+
+        if (overflowStats.numBlocked == 0 && overflowStats.numBlockTimeouts == 0 &&
+            overflowStats.numDroppedNewest == 0 && overflowStats.numDroppedOldest == 0 &&
+            overflowStats.numCoalesced == 0)
+        {
+            continue;
+        }
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "%s: queue overflows: blocked %" PRIu32 ", block timeouts %" PRIu32 ", dropped newest %" PRIu32 ", dropped oldest %" PRIu32 ", coalesced %" PRIu32,
+            task->getName(), overflowStats.numBlocked, overflowStats.numBlockTimeouts,
+            overflowStats.numDroppedNewest, overflowStats.numDroppedOldest, overflowStats.numCoalesced);
+    }
+#endif // CONFIG_EZDV_PRINT_MESSAGE_OVERFLOW_STATS
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    std::vector<audio::AudioGraph::RouteLatencyStatistics> routeStats;
+    audio::AudioGraph::GetInstance()->getRouteLatencyStatistics(routeStats, true);
+    for (auto& stats : routeStats)
+    {
+        if (stats.waitTime.getCount() == 0)
+        {
+            continue;
+        }
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Audio route %s[%d] -> %s[%d]: %" PRIu32 " tags, wait avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+            stats.sourceName, (int)stats.sourceChannel, stats.destinationName, (int)stats.destinationChannel,
+            stats.waitTime.getCount(), stats.waitTime.getAverageUs(), stats.waitTime.getPercentileUs(99),
+            stats.waitTime.getMaxUs());
+    }
+
+    std::vector<audio::AudioLatencyStatistics::Path> latencyPaths;
+    audio::AudioLatencyStatistics::GetPaths(latencyPaths, true);
+    for (auto& path : latencyPaths)
+    {
+        if (path.latency.getCount() == 0)
+        {
+            continue;
+        }
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Audio latency %s -> %s: %" PRIu32 " tags, avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+            path.origin, path.destination, path.latency.getCount(), path.latency.getAverageUs(), 
+            path.latency.getPercentileUs(99), path.latency.getMaxUs());
+    }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+#if CONFIG_EZDV_PRINT_JITTER_BUFFER_STATS
+    std::vector<audio::AudioJitterBuffer::Statistics> jitterStats;
+    audio::AudioJitterBuffer::GetAllStatistics(jitterStats, true);
+    for (auto& stats : jitterStats)
+    {
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Jitter buffer %s: received %" PRIu32 ", played %" PRIu32 ", reordered %" PRIu32 ", late %" PRIu32 ", duplicate %" PRIu32 ", concealed %" PRIu32 ", underruns %" PRIu32 ", discarded %" PRIu32 ", resyncs %" PRIu32,
+            stats.name, stats.numReceived, stats.numPlayed, stats.numReordered, stats.numLate, stats.numDuplicate,
+            stats.numConcealed, stats.numUnderruns, stats.numDiscarded, stats.numResyncs);
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Jitter buffer %s: jitter %" PRIu32 " us, peak %" PRIu32 " us, target %" PRIu32 " us, depth avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+            stats.name, stats.jitterUs, stats.peakJitterUs, stats.targetDepthUs, stats.depth.getAverageUs(),
+            stats.depth.getPercentileUs(99), stats.depth.getMaxUs());
+    }
+#endif // CONFIG_EZDV_PRINT_JITTER_BUFFER_STATS
+
+#if CONFIG_EZDV_PRINT_CLOCK_DRIFT_STATS
+    std::vector<audio::AudioDriftCompensator::Statistics> driftStats;
+    audio::AudioDriftCompensator::GetAllStatistics(driftStats, true);
+    for (auto& stats : driftStats)
+    {
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Clock drift %s: drift %.1f ppm, correction %.1f ppm, fill %" PRId32 " us, target %" PRId32 " us, resets %" PRIu32 ", process avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+            stats.name, stats.driftPpm, stats.correctionPpm, stats.fillUs, stats.targetUs, stats.numResets,
+            stats.processTime.getAverageUs(), stats.processTime.getPercentileUs(99), stats.processTime.getMaxUs());
+    }
+#endif // CONFIG_EZDV_PRINT_CLOCK_DRIFT_STATS
+
+#if CONFIG_EZDV_PRINT_TIMER_WHEEL_STATS
+    for (int index = 0; index < DVTimerWheel::GetNumWheels(); index++)
+    {
+        DVTimerWheel* wheel = DVTimerWheel::Get(index);
+        DVTimerWheel::Statistics wheelStats;
+        wheel->getStatistics(&wheelStats);
+        wheel->resetStatistics();
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "Timer wheel %d: %" PRIu32 " timers, %" PRIu32 " wakeups, %" PRIu32 " expirations, %" PRIu32 " messages, %" PRIu32 " dropped, %" PRIu32 " missed, drift avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+            index, wheelStats.numTimers, wheelStats.numWakeups, wheelStats.numExpirations, wheelStats.numMessages,
+            wheelStats.numDroppedMessages, wheelStats.numMissedExpirations, wheelStats.drift.getAverageUs(), wheelStats.drift.getPercentileUs(99),
+            wheelStats.drift.getMaxUs());
+    }
+#endif // CONFIG_EZDV_PRINT_TIMER_WHEEL_STATS
+
+#if CONFIG_EZDV_PRINT_TASK_STATS
+    // CPU usage is computed relative to the previous tick's sample.
+    static std::map<DVTask*, DVTask::TaskStatistics> lastTaskStats;
+    std::vector<DVTask*> statsTasks;
+    DVTask::GetAllTasks(statsTasks);
+    for (auto& task : statsTasks)
+    {
+        DVTask::TaskStatistics taskStats;
+        task->getTaskStatistics(&taskStats);
+
+        uint32_t cpuPermille = 0;
+        auto lastStats = lastTaskStats.find(task);
+        if (lastStats != lastTaskStats.end() && taskStats.sampleTimeUs > lastStats->second.sampleTimeUs)
+        {
+            cpuPermille = 
+                (taskStats.busyTimeUs - lastStats->second.busyTimeUs) * 1000 / 
+                (taskStats.sampleTimeUs - lastStats->second.sampleTimeUs);
+        }
+        lastTaskStats[task] = taskStats;
+
+        if (taskStats.lastCoreId < 0)
+        {
+            // Never ran.
+            continue;
+        }
+
+        ESP_LOGI(
+            CURRENT_LOG_TAG,
+            "%s: core %d, cpu %" PRIu32 ".%" PRIu32 "%%, %" PRIu32 " messages, %" PRIu32 " ticks, queue peak %" PRIu32 "/%" PRIu32 ", stack free %" PRIu32 "/%" PRIu32 " bytes, %" PRIu32 " migrations",
+            task->getName(), taskStats.lastCoreId, cpuPermille / 10, cpuPermille % 10, 
+            taskStats.numMessagesHandled, taskStats.numTicks, taskStats.peakQueueDepth, taskStats.queueCapacity,
+            taskStats.minStackFree, taskStats.stackSize, taskStats.numCoreMigrations);
+    }
+#endif // CONFIG_EZDV_PRINT_TASK_STATS
+
 #if CONFIG_EZDV_OUTPUT_TASK_LIST
     print_real_time_stats(pdMS_TO_TICKS(1000));
 #endif // CONFIG_EZDV_OUTPUT_TASK_LIST
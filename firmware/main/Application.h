@@ -20,8 +20,11 @@
 
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
+#include "audio/AudioGraph.h"
 #include "audio/AudioMixer.h"
 #include "audio/BeeperTask.h"
+#include "audio/FreeDVScanTask.h"
+#include "audio/FreeDVSpeechTask.h"
 #include "audio/FreeDVTask.h"
 #include "audio/VoiceKeyerTask.h"
 #include "driver/ButtonArray.h"
@@ -65,6 +68,8 @@ private:
     audio::AudioMixer* audioMixer_;
     audio::BeeperTask* beeperTask_;
     audio::FreeDVTask* freedvTask_;
+    audio::FreeDVSpeechTask* freedvSpeechTask_;
+    audio::FreeDVScanTask* freedvScanTask_;
     driver::ButtonArray buttonArray_;
     driver::I2CMaster i2cMaster_;
     driver::LedArray ledArray_;
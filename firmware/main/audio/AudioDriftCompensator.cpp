@@ -0,0 +1,226 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "esp_timer.h"
+#include "AudioDriftCompensator.h"
+#include "util/StatisticsRegistry.h"
+
+// Time constant of the low pass filter on the fill level. Long enough to
+// smooth out network jitter and block sized steps.
+#define DRIFT_FILTER_TIME_CONSTANT_S (2.0f)
+
+// How long to let the fill level settle before using it as the target
+// (if one wasn't provided).
+#define DRIFT_SETTLE_TIME_S (5)
+
+// Controller gains. With the proportional gain below, the fill level 
+// returns to the target with a time constant of ~30 seconds; the integral
+// gain makes the loop critically damped. Corrections are too small and 
+// too gradual to hear.
+#define DRIFT_PROPORTIONAL_PPM_PER_MS (32.0f)
+#define DRIFT_INTEGRAL_PPM_PER_MS_S (0.256f)
+
+// Real crystals are within ~100ppm of each other, so anything beyond
+// this is a discontinuity rather than drift.
+#define DRIFT_MAX_CORRECTION_PPM (1000.0f)
+#define DRIFT_MAX_ERROR_MS (500.0f)
+
+// Errors larger than this are due to something other than drift (e.g. a 
+// jitter buffer changing its target), so they don't feed the drift estimate.
+#define DRIFT_MAX_INTEGRATION_ERROR_MS (20.0f)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static util::StatisticsRegistry<AudioDriftCompensator, AUDIO_DRIFT_COMPENSATOR_MAX_INSTANCES> Instances_;
+
+AudioDriftCompensator::AudioDriftCompensator(const char* name, int sampleRate)
+    : name_(name)
+    , sampleRate_(sampleRate)
+    , hasTarget_(false)
+    , targetFixed_(false)
+    , targetFill_(0)
+    , integralPpm_(0)
+    , correctionPpm_(0)
+{
+    assert(sampleRate > 0);
+
+    spinlock_initialize(&lock_);
+
+    stats_ = Statistics{};
+    stats_.name = name_;
+
+    restart_();
+
+    Instances_.add(this);
+}
+
+AudioDriftCompensator::~AudioDriftCompensator()
+{
+    Instances_.remove(this);
+}
+
+void AudioDriftCompensator::reset()
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    restart_();
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioDriftCompensator::setTargetFill(int32_t numSamples)
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    targetFill_ = numSamples;
+    hasTarget_ = true;
+    targetFixed_ = true;
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioDriftCompensator::update(int32_t fillSamples, int numSamplesElapsed)
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    float elapsedS = (float)numSamplesElapsed / sampleRate_;
+    if (!hasFill_)
+    {
+        filteredFill_ = fillSamples;
+        hasFill_ = true;
+    }
+    else
+    {
+        filteredFill_ += (fillSamples - filteredFill_) * std::min(1.0f, elapsedS / DRIFT_FILTER_TIME_CONSTANT_S);
+    }
+
+    numSamplesSinceStart_ += numSamplesElapsed;
+    if (!hasTarget_)
+    {
+        if (numSamplesSinceStart_ < (uint32_t)(DRIFT_SETTLE_TIME_S * sampleRate_))
+        {
+            // Keep compensating for whatever drift we already know about.
+            portEXIT_CRITICAL_SAFE(&lock_);
+            return;
+        }
+
+        targetFill_ = filteredFill_;
+        hasTarget_ = true;
+    }
+
+    float samplesPerMs = sampleRate_ / 1000.0f;
+    if (std::fabs(fillSamples - targetFill_) / samplesPerMs > DRIFT_MAX_ERROR_MS)
+    {
+        // The buffer was flushed, the stream paused, etc. Start measuring 
+        // again but keep the drift estimate, which is still valid.
+        stats_.numResets++;
+        restart_();
+        portEXIT_CRITICAL_SAFE(&lock_);
+        return;
+    }
+
+    float errorMs = (filteredFill_ - targetFill_) / samplesPerMs;
+    if (std::fabs(errorMs) < DRIFT_MAX_INTEGRATION_ERROR_MS)
+    {
+        integralPpm_ += DRIFT_INTEGRAL_PPM_PER_MS_S * errorMs * elapsedS;
+        integralPpm_ = std::min(std::max(integralPpm_, -DRIFT_MAX_CORRECTION_PPM), DRIFT_MAX_CORRECTION_PPM);
+    }
+
+    correctionPpm_ = DRIFT_PROPORTIONAL_PPM_PER_MS * errorMs + integralPpm_;
+    correctionPpm_ = std::min(std::max(correctionPpm_, -DRIFT_MAX_CORRECTION_PPM), DRIFT_MAX_CORRECTION_PPM);
+    resampler_.setRatio(correctionPpm_);
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioDriftCompensator::updateFromLocalClock(int numSamplesWritten, int64_t timeUs)
+{
+    if (!hasLocalClock_)
+    {
+        // Anchor the clock to the start of the first write.
+        hasLocalClock_ = true;
+        localClockStartUs_ = timeUs;
+        lastLocalClockUs_ = timeUs;
+        localClockSamples_ = 0;
+    }
+
+    // Fill level of an imaginary buffer drained at exactly the nominal rate.
+    localClockSamples_ += numSamplesWritten;
+    int64_t numSamplesConsumed = (timeUs - localClockStartUs_) * sampleRate_ / 1000000;
+    int numSamplesElapsed = (timeUs - lastLocalClockUs_) * sampleRate_ / 1000000;
+    lastLocalClockUs_ = timeUs;
+
+    update(localClockSamples_ - numSamplesConsumed, numSamplesElapsed);
+}
+
+void AudioDriftCompensator::process(const int16_t* input, int16_t* output, int numOutputSamples)
+{
+    auto startTime = esp_timer_get_time();
+    resampler_.process(input, output, numOutputSamples);
+    auto endTime = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&lock_);
+    stats_.processTime.add(endTime - startTime);
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioDriftCompensator::getStatistics(Statistics* stats, bool reset)
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    stats_.driftPpm = integralPpm_;
+    stats_.correctionPpm = correctionPpm_;
+    stats_.fillUs = hasFill_ ? (int32_t)(filteredFill_ * 1000000 / sampleRate_) : 0;
+    stats_.targetUs = hasTarget_ ? (int32_t)(targetFill_ * 1000000 / sampleRate_) : 0;
+    *stats = stats_;
+
+    if (reset)
+    {
+        stats_.numResets = 0;
+        stats_.processTime.reset();
+    }
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioDriftCompensator::GetAllStatistics(std::vector<Statistics>& stats, bool reset)
+{
+    Instances_.getAllStatistics(stats, reset);
+}
+
+void AudioDriftCompensator::restart_()
+{
+    hasFill_ = false;
+    filteredFill_ = 0;
+    hasTarget_ = targetFixed_;
+    numSamplesSinceStart_ = 0;
+    hasLocalClock_ = false;
+    localClockStartUs_ = 0;
+    lastLocalClockUs_ = 0;
+    localClockSamples_ = 0;
+
+    correctionPpm_ = integralPpm_;
+    resampler_.setRatio(correctionPpm_);
+}
+
+}
+
+}
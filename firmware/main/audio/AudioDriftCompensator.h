@@ -0,0 +1,143 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_DRIFT_COMPENSATOR_H
+#define AUDIO_DRIFT_COMPENSATOR_H
+
+#include <cstdint>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "AudioResampler.h"
+#include "task/DVLatencyHistogram.h"
+
+// Maximum number of compensators reported by GetAllStatistics().
+#define AUDIO_DRIFT_COMPENSATOR_MAX_INSTANCES (8)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Keeps the fill level of a buffer between two clock domains (e.g. a
+///        radio's sample clock and TLV320's I2S clock) steady by resampling the
+///        audio going through it.
+///
+/// The fill level is low pass filtered to remove network jitter and block
+/// effects, and a PI controller turns the difference from the target level into
+/// a resampling ratio. The integral term converges on the actual difference 
+/// between the two clocks. If no target is given, the filtered level a few
+/// seconds after starting is used.
+///
+/// The ESP32 supplies TLV320's master clock, so esp_timer and I2S run from the
+/// same crystal and the local clock can be used in place of a real buffer
+/// (see updateFromLocalClock()).
+class AudioDriftCompensator
+{
+public:
+    struct Statistics
+    {
+        const char* name;
+        float driftPpm; // estimated clock difference
+        float correctionPpm; // current resampling ratio
+        int32_t fillUs; // filtered fill level
+        int32_t targetUs; // target fill level
+        uint32_t numResets; // fill level jumps that restarted estimation
+        task::DVLatencyHistogram processTime; // resampling time per process() call
+    };
+
+    /// @brief Creates a new drift compensator.
+    /// @param name The name to report statistics under. Must remain valid for the
+    ///        life of the object.
+    /// @param sampleRate The sample rate of the audio.
+    AudioDriftCompensator(const char* name, int sampleRate);
+    ~AudioDriftCompensator();
+
+    AudioDriftCompensator(const AudioDriftCompensator&) = delete;
+    AudioDriftCompensator& operator=(const AudioDriftCompensator&) = delete;
+
+    /// @brief Starts over, e.g. when a stream restarts. The drift estimate is kept.
+    void reset();
+
+    /// @brief Sets the fill level to aim for. If never called, the level the 
+    ///        buffer settles at after starting is used.
+    /// @param numSamples The target fill level in samples.
+    void setTargetFill(int32_t numSamples);
+
+    /// @brief Updates the drift estimate. Should be called once per block.
+    /// @param fillSamples The buffer's current fill level in samples.
+    /// @param numSamplesElapsed How many samples' worth of time has passed since the
+    ///        previous update.
+    void update(int32_t fillSamples, int numSamplesElapsed);
+
+    /// @brief Updates the drift estimate for a stream with no buffer of its own,
+    ///        by comparing the number of samples produced against the local clock.
+    /// @param numSamplesWritten The number of samples produced since the previous call.
+    /// @param timeUs The current time (esp_timer_get_time()).
+    void updateFromLocalClock(int numSamplesWritten, int64_t timeUs);
+
+    /// @brief Returns how many input samples process() needs to produce the given
+    ///        number of output samples.
+    int getInputSamplesNeeded(int numOutputSamples) const { return resampler_.getInputSamplesNeeded(numOutputSamples); }
+
+    /// @brief Resamples a block of audio using the current ratio.
+    /// @param input getInputSamplesNeeded(numOutputSamples) samples of input.
+    /// @param output Where to put the resampled audio.
+    /// @param numOutputSamples The number of samples to produce.
+    void process(const int16_t* input, int16_t* output, int numOutputSamples);
+
+    /// @brief Retrieves this compensator's statistics.
+    /// @param stats Where to store the statistics.
+    /// @param reset Whether to clear the reset count and timing histogram afterward.
+    void getStatistics(Statistics* stats, bool reset);
+
+    /// @brief Retrieves the statistics for every drift compensator that currently exists.
+    /// @param stats The vector to fill in. Existing contents are replaced.
+    /// @param reset Whether to clear the reset counts and timing histograms afterward.
+    static void GetAllStatistics(std::vector<Statistics>& stats, bool reset);
+
+private:
+    const char* name_;
+    int sampleRate_;
+    AudioResampler resampler_;
+
+    bool hasFill_;
+    bool hasTarget_;
+    bool targetFixed_;
+    float filteredFill_;
+    float targetFill_;
+    float integralPpm_;
+    float correctionPpm_;
+    uint32_t numSamplesSinceStart_;
+
+    bool hasLocalClock_;
+    int64_t localClockStartUs_;
+    int64_t lastLocalClockUs_;
+    int64_t localClockSamples_;
+
+    Statistics stats_;
+    portMUX_TYPE lock_;
+
+    void restart_();
+};
+
+}
+
+}
+
+#endif // AUDIO_DRIFT_COMPENSATOR_H
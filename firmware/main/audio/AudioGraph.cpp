@@ -0,0 +1,352 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#include "AudioGraph.h"
+#include "AudioMessage.h"
+
+// Every producer runs at least one frame per 40ms or so while active,
+// so this is only hit if a task is stuck.
+#define AUDIO_GRAPH_LATCH_TIMEOUT_US (100 * 1000)
+
+#define CURRENT_LOG_TAG "AudioGraph"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioGraph::Patch::Patch()
+    : graph_(AudioGraph::GetInstance())
+    , committed_(false)
+{
+    auto rv = xSemaphoreTake(graph_->graphSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    // Start from the current routes so that callers only need to
+    // describe what's changing.
+    edges_ = graph_->edges_;
+}
+
+AudioGraph::Patch::~Patch()
+{
+    xSemaphoreGive(graph_->graphSemaphore_);
+}
+
+void AudioGraph::Patch::connect(AudioInput* source, AudioInput::ChannelLabel sourceChannel, AudioInput* destination, AudioInput::ChannelLabel destinationChannel)
+{
+    assert(!committed_);
+
+    // An output feeds exactly one FIFO and a FIFO has exactly one producer,
+    // so the new route replaces anything using either end.
+    edges_.erase(
+        std::remove_if(edges_.begin(), edges_.end(), [&](const Edge& edge) {
+            return
+                (edge.source == source && edge.sourceChannel == sourceChannel) ||
+                (edge.destination == destination && edge.destinationChannel == destinationChannel);
+        }),
+        edges_.end());
+
+    edges_.push_back({ source, sourceChannel, destination, destinationChannel });
+}
+
+void AudioGraph::Patch::disconnect(AudioInput* source, AudioInput::ChannelLabel sourceChannel)
+{
+    assert(!committed_);
+
+    edges_.erase(
+        std::remove_if(edges_.begin(), edges_.end(), [&](const Edge& edge) {
+            return edge.source == source && edge.sourceChannel == sourceChannel;
+        }),
+        edges_.end());
+}
+
+bool AudioGraph::Patch::commit()
+{
+    assert(!committed_);
+
+    if (!graph_->validate_(edges_))
+    {
+        return false;
+    }
+
+    for (auto& edge : edges_)
+    {
+        ESP_LOGI(
+            CURRENT_LOG_TAG, "route: %s[%d] -> %s[%d]",
+            graph_->getNodeName_(edge.source), (int)edge.sourceChannel,
+            graph_->getNodeName_(edge.destination), (int)edge.destinationChannel);
+    }
+
+    graph_->apply_(edges_);
+    committed_ = true;
+    return true;
+}
+
+AudioGraph* AudioGraph::GetInstance()
+{
+    static AudioGraph Instance;
+    return &Instance;
+}
+
+AudioGraph::AudioGraph()
+{
+    graphSemaphore_ = xSemaphoreCreateMutex();
+    assert(graphSemaphore_ != nullptr);
+}
+
+void AudioGraph::addNode_(const char* name, AudioInput* audio, task::DVTask* task)
+{
+    assert(audio != nullptr);
+
+    auto rv = xSemaphoreTake(graphSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    assert(findNode_(audio) == nullptr);
+    nodes_.push_back({ name, audio, task });
+
+    xSemaphoreGive(graphSemaphore_);
+}
+
+void AudioGraph::removeNode(AudioInput* node)
+{
+    auto rv = xSemaphoreTake(graphSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    std::vector<Edge> edges;
+    for (auto& edge : edges_)
+    {
+        if (edge.source != node && edge.destination != node)
+        {
+            edges.push_back(edge);
+        }
+    }
+
+    // Make sure nobody is still writing into the node's FIFOs
+    // before it goes away.
+    apply_(edges);
+
+    nodes_.erase(
+        std::remove_if(nodes_.begin(), nodes_.end(), [&](const Node& n) { return n.audio == node; }),
+        nodes_.end());
+
+    xSemaphoreGive(graphSemaphore_);
+}
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+void AudioGraph::getRouteLatencyStatistics(std::vector<RouteLatencyStatistics>& stats, bool reset)
+{
+    stats.clear();
+
+    auto rv = xSemaphoreTake(graphSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    for (auto& edge : edges_)
+    {
+        RouteLatencyStatistics routeStats;
+        routeStats.sourceName = getNodeName_(edge.source);
+        routeStats.sourceChannel = edge.sourceChannel;
+        routeStats.destinationName = getNodeName_(edge.destination);
+        routeStats.destinationChannel = edge.destinationChannel;
+        edge.destination->getAudioInput(edge.destinationChannel)->getLatencyStatistics(&routeStats.waitTime, reset);
+        stats.push_back(routeStats);
+    }
+
+    xSemaphoreGive(graphSemaphore_);
+}
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+const AudioGraph::Node* AudioGraph::findNode_(AudioInput* audio) const
+{
+    for (auto& node : nodes_)
+    {
+        if (node.audio == audio)
+        {
+            return &node;
+        }
+    }
+
+    return nullptr;
+}
+
+const char* AudioGraph::getNodeName_(AudioInput* audio) const
+{
+    auto node = findNode_(audio);
+    return node != nullptr ? node->name : "(unknown)";
+}
+
+bool AudioGraph::validate_(const std::vector<Edge>& edges) const
+{
+    for (size_t index = 0; index < edges.size(); index++)
+    {
+        auto& edge = edges[index];
+
+        if (findNode_(edge.source) == nullptr || findNode_(edge.destination) == nullptr)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "route references a node that hasn't been added");
+            return false;
+        }
+
+        if ((int)edge.sourceChannel >= edge.source->getNumOutputChannels() ||
+            (int)edge.destinationChannel >= edge.destination->getNumInputChannels())
+        {
+            ESP_LOGE(
+                CURRENT_LOG_TAG, "route %s[%d] -> %s[%d] uses a channel that doesn't exist",
+                getNodeName_(edge.source), (int)edge.sourceChannel,
+                getNodeName_(edge.destination), (int)edge.destinationChannel);
+            return false;
+        }
+
+        for (size_t otherIndex = index + 1; otherIndex < edges.size(); otherIndex++)
+        {
+            auto& other = edges[otherIndex];
+            if ((edge.source == other.source && edge.sourceChannel == other.sourceChannel) ||
+                (edge.destination == other.destination && edge.destinationChannel == other.destinationChannel))
+            {
+                ESP_LOGE(
+                    CURRENT_LOG_TAG, "routes %s[%d] -> %s[%d] and %s[%d] -> %s[%d] conflict",
+                    getNodeName_(edge.source), (int)edge.sourceChannel,
+                    getNodeName_(edge.destination), (int)edge.destinationChannel,
+                    getNodeName_(other.source), (int)other.sourceChannel,
+                    getNodeName_(other.destination), (int)other.destinationChannel);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void AudioGraph::apply_(const std::vector<Edge>& edges)
+{
+    // Phase 1: detach every output that's moving away from its current FIFO
+    // and wait for its producer to finish the frame it's working on. After
+    // this, none of the FIFOs being re-patched have a producer.
+    std::vector<AudioInput*> nodesToWaitFor;
+    for (auto& node : nodes_)
+    {
+        for (int channel = 0; channel < node.audio->getNumOutputChannels(); channel++)
+        {
+            auto oldFifo = GetDestination_(edges_, node.audio, channel);
+            auto newFifo = GetDestination_(edges, node.audio, channel);
+            if (oldFifo != nullptr && oldFifo != newFifo)
+            {
+                node.audio->setAudioOutput((AudioInput::ChannelLabel)channel, nullptr);
+                if (std::find(nodesToWaitFor.begin(), nodesToWaitFor.end(), node.audio) == nodesToWaitFor.end())
+                {
+                    nodesToWaitFor.push_back(node.audio);
+                }
+            }
+        }
+    }
+
+    waitForLatch_(nodesToWaitFor);
+
+    // Phase 2: attach the new routes. Producers pick them up at the
+    // start of their next frame.
+    for (auto& node : nodes_)
+    {
+        bool changed = false;
+        for (int channel = 0; channel < node.audio->getNumOutputChannels(); channel++)
+        {
+            auto oldFifo = GetDestination_(edges_, node.audio, channel);
+            auto newFifo = GetDestination_(edges, node.audio, channel);
+            if (newFifo != nullptr && oldFifo != newFifo)
+            {
+                node.audio->setAudioOutput((AudioInput::ChannelLabel)channel, newFifo);
+                changed = true;
+            }
+        }
+
+        if (changed && (node.task == nullptr || !node.task->isAwake() || node.task->isCurrentTask()))
+        {
+            node.audio->latchAudioOutputs();
+        }
+    }
+
+    edges_ = edges;
+}
+
+void AudioGraph::waitForLatch_(const std::vector<AudioInput*>& nodes)
+{
+    AudioDataAvailableMessage wakeMessage;
+    for (auto audio : nodes)
+    {
+        auto node = findNode_(audio);
+        if (node->task == nullptr || !node->task->isAwake() || node->task->isCurrentTask())
+        {
+            // Not in the middle of a frame, so it's safe to latch on its behalf.
+            audio->latchAudioOutputs();
+        }
+        else
+        {
+            // Tasks that only run when audio arrives may not have anything
+            // coming in, so give them a nudge.
+            node->task->post(&wakeMessage);
+        }
+    }
+
+    // Latching on behalf of a task that's still running could leave it
+    // writing to a FIFO that's about to get a new producer, so keep waiting
+    // for it (nudging it again every so often) rather than giving up.
+    auto startTime = esp_timer_get_time();
+    for (auto audio : nodes)
+    {
+        auto node = findNode_(audio);
+        while (!audio->hasLatchedAudioOutputs())
+        {
+            if (!node->task->isAwake())
+            {
+                audio->latchAudioOutputs();
+            }
+            else if (esp_timer_get_time() - startTime >= AUDIO_GRAPH_LATCH_TIMEOUT_US)
+            {
+                ESP_LOGW(CURRENT_LOG_TAG, "%s has not switched outputs yet, still waiting", node->name);
+                node->task->post(&wakeMessage);
+                startTime = esp_timer_get_time();
+            }
+            else
+            {
+                vTaskDelay(1);
+            }
+        }
+    }
+}
+
+AudioRingBuffer* AudioGraph::GetDestination_(const std::vector<Edge>& edges, AudioInput* source, int sourceChannel)
+{
+    for (auto& edge : edges)
+    {
+        if (edge.source == source && (int)edge.sourceChannel == sourceChannel)
+        {
+            return edge.destination->getAudioInput(edge.destinationChannel);
+        }
+    }
+
+    return nullptr;
+}
+
+}
+
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_GRAPH_H
+#define AUDIO_GRAPH_H
+
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "AudioInput.h"
+#include "task/DVTask.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Owns the routes between audio tasks. Routes are changed through
+///        Patch objects, which are validated and then applied so that every
+///        FIFO has at most one producer at any point in time and producers
+///        only ever switch FIFOs between frames.
+class AudioGraph
+{
+public:
+    /// @brief A set of route changes that are applied together.
+    ///        Holds the graph lock for as long as the object exists.
+    class Patch
+    {
+    public:
+        Patch();
+        ~Patch();
+
+        Patch(const Patch&) = delete;
+        Patch& operator=(const Patch&) = delete;
+
+        /// @brief Routes a source's output channel to a destination's input channel.
+        ///        Any existing route from the same output or into the same input
+        ///        is replaced.
+        /// @param source The node producing the audio.
+        /// @param sourceChannel The output channel on the source.
+        /// @param destination The node consuming the audio.
+        /// @param destinationChannel The input channel on the destination.
+        void connect(AudioInput* source, AudioInput::ChannelLabel sourceChannel, AudioInput* destination, AudioInput::ChannelLabel destinationChannel);
+
+        /// @brief Removes any route from the given output channel.
+        /// @param source The node producing the audio.
+        /// @param sourceChannel The output channel on the source.
+        void disconnect(AudioInput* source, AudioInput::ChannelLabel sourceChannel);
+
+        /// @brief Validates and applies the changes made to this patch.
+        ///        Blocks until every running producer whose output moved has
+        ///        finished its current frame.
+        /// @return true if applied, false if the resulting graph was invalid
+        ///         (in which case the current routes are left untouched).
+        bool commit();
+
+    private:
+        friend class AudioGraph;
+
+        struct Edge
+        {
+            AudioInput* source;
+            AudioInput::ChannelLabel sourceChannel;
+            AudioInput* destination;
+            AudioInput::ChannelLabel destinationChannel;
+        };
+
+        AudioGraph* graph_;
+        std::vector<Edge> edges_;
+        bool committed_;
+    };
+
+    /// @brief Returns the global audio graph.
+    static AudioGraph* GetInstance();
+
+    /// @brief Registers an audio task with the graph. Must be done before the
+    ///        task appears in a Patch.
+    /// @param name The name to use when logging routes.
+    /// @param node The task to register.
+    template<typename T>
+    void addNode(const char* name, T* node);
+
+    /// @brief Removes all routes to and from a task and unregisters it. Must be
+    ///        called before the task is deleted.
+    /// @param node The task to remove.
+    void removeNode(AudioInput* node);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    /// @brief How long tagged audio waited in the FIFO at the end of a route.
+    struct RouteLatencyStatistics
+    {
+        const char* sourceName;
+        AudioInput::ChannelLabel sourceChannel;
+        const char* destinationName;
+        AudioInput::ChannelLabel destinationChannel;
+        task::DVLatencyHistogram waitTime;
+    };
+
+    /// @brief Retrieves latency statistics for every current route.
+    /// @param stats The vector to fill in. Existing contents are replaced.
+    /// @param reset Whether to clear the statistics afterward.
+    void getRouteLatencyStatistics(std::vector<RouteLatencyStatistics>& stats, bool reset);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+private:
+    struct Node
+    {
+        const char* name;
+        AudioInput* audio;
+        task::DVTask* task;
+    };
+
+    using Edge = Patch::Edge;
+
+    SemaphoreHandle_t graphSemaphore_;
+    std::vector<Node> nodes_;
+    std::vector<Edge> edges_;
+
+    AudioGraph();
+
+    void addNode_(const char* name, AudioInput* audio, task::DVTask* task);
+    const Node* findNode_(AudioInput* audio) const;
+    const char* getNodeName_(AudioInput* audio) const;
+
+    bool validate_(const std::vector<Edge>& edges) const;
+    void apply_(const std::vector<Edge>& edges);
+    void waitForLatch_(const std::vector<AudioInput*>& nodes);
+
+    static AudioRingBuffer* GetDestination_(const std::vector<Edge>& edges, AudioInput* source, int sourceChannel);
+};
+
+template<typename T>
+void AudioGraph::addNode(const char* name, T* node)
+{
+    addNode_(name, static_cast<AudioInput*>(node), static_cast<task::DVTask*>(node));
+}
+
+}
+
+}
+
+#endif // AUDIO_GRAPH_H
@@ -25,27 +25,35 @@ namespace ezdv
 namespace audio
 {
 
-AudioInput::AudioInput(int8_t numInputChannels, int8_t numOutputChannels, uint32_t numSamplesInFifo)
-    : numChannels_(numInputChannels)
+AudioInput::AudioInput(int8_t numInputChannels, int8_t numOutputChannels, uint32_t numSamplesInFifo, uint32_t maxLeaseSamples)
+    : pendingOutputVersion_(0)
+    , latchedOutputVersion_(0)
+    , numChannels_(numInputChannels)
+    , numOutputChannels_(numOutputChannels)
 {
-    assert(numInputChannels > 0);
+    // Tasks that only produce audio don't need input FIFOs.
+    assert(numInputChannels >= 0);
     assert(numSamplesInFifo > 0);
 
-    inputAudioFifos_ = new FIFO*[numInputChannels];
+    inputAudioFifos_ = new AudioRingBuffer*[numInputChannels];
     assert(inputAudioFifos_ != nullptr);
 
-    outputAudioFifos_ = new FIFO*[numOutputChannels];
+    outputAudioFifos_ = new std::atomic<AudioRingBuffer*>[numOutputChannels];
     assert(outputAudioFifos_ != nullptr);
 
+    pendingOutputAudioFifos_ = new std::atomic<AudioRingBuffer*>[numOutputChannels];
+    assert(pendingOutputAudioFifos_ != nullptr);
+
     for (int index = 0; index < numInputChannels; index++)
     {
-        inputAudioFifos_[index] = codec2_fifo_create(numSamplesInFifo);
+        inputAudioFifos_[index] = new AudioRingBuffer(numSamplesInFifo, maxLeaseSamples);
         assert(inputAudioFifos_[index] != nullptr);
     }
 
     for (int index = 0; index < numOutputChannels; index++)
     {
-        outputAudioFifos_[index] = nullptr;
+        outputAudioFifos_[index].store(nullptr, std::memory_order_relaxed);
+        pendingOutputAudioFifos_[index].store(nullptr, std::memory_order_relaxed);
     }
 }
 
@@ -53,25 +61,58 @@ AudioInput::~AudioInput()
 {
     for (int index = 0; index < numChannels_; index++)
     {
-        codec2_fifo_free(inputAudioFifos_[index]);
+        delete inputAudioFifos_[index];
     }
 
     delete[] inputAudioFifos_;
+    delete[] outputAudioFifos_;
+    delete[] pendingOutputAudioFifos_;
 }
 
-struct FIFO* AudioInput::getAudioInput(ChannelLabel channel)
+AudioRingBuffer* AudioInput::getAudioInput(ChannelLabel channel)
 {
+    assert((int)channel < numChannels_);
     return inputAudioFifos_[(int)channel];
 }
 
-void AudioInput::setAudioOutput(ChannelLabel channel, struct FIFO* fifo)
+void AudioInput::setAudioOutput(ChannelLabel channel, AudioRingBuffer* fifo)
+{
+    assert((int)channel < numOutputChannels_);
+    pendingOutputAudioFifos_[(int)channel].store(fifo, std::memory_order_relaxed);
+
+    // Release ordering publishes the new link along with the version.
+    pendingOutputVersion_.fetch_add(1, std::memory_order_release);
+}
+
+AudioRingBuffer* AudioInput::getAudioOutput(ChannelLabel channel)
+{
+    return outputAudioFifos_[(int)channel].load(std::memory_order_relaxed);
+}
+
+void AudioInput::latchAudioOutputs()
 {
-    outputAudioFifos_[(int)channel] = fifo;
+    uint32_t version = pendingOutputVersion_.load(std::memory_order_acquire);
+    if (version == latchedOutputVersion_.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    for (int index = 0; index < numOutputChannels_; index++)
+    {
+        outputAudioFifos_[index].store(
+            pendingOutputAudioFifos_[index].load(std::memory_order_relaxed), 
+            std::memory_order_relaxed);
+    }
+
+    // Release ordering lets AudioGraph know that we're done with the old links.
+    latchedOutputVersion_.store(version, std::memory_order_release);
 }
 
-struct FIFO* AudioInput::getAudioOutput(ChannelLabel channel)
+bool AudioInput::hasLatchedAudioOutputs() const
 {
-    return outputAudioFifos_[(int)channel];
+    return 
+        latchedOutputVersion_.load(std::memory_order_acquire) == 
+        pendingOutputVersion_.load(std::memory_order_acquire);
 }
 
 }
@@ -19,8 +19,9 @@
 #define AUDIO_INPUT_H
 
 #include <inttypes.h>
+#include <atomic>
 
-#include "codec2_fifo.h"
+#include "AudioRingBuffer.h"
 
 // 0.5s @ 8000 Hz
 #define DEFAULT_NUM_SAMPLES_FOR_FIFO 4000
@@ -48,25 +49,52 @@ public:
     /// @param numInputChannels The number of input channels to support.
     /// @param numOutputChannels The number of output channels to support.
     /// @param numSamplesInFifo The number of input samples per FIFO.
-    AudioInput(int8_t numInputChannels, int8_t numOutputChannels, uint32_t numSamplesInFifo = DEFAULT_NUM_SAMPLES_FOR_FIFO);
+    /// @param maxLeaseSamples The largest span that can be leased from each input FIFO at once.
+    AudioInput(
+        int8_t numInputChannels, int8_t numOutputChannels, uint32_t numSamplesInFifo = DEFAULT_NUM_SAMPLES_FOR_FIFO, 
+        uint32_t maxLeaseSamples = DEFAULT_MAX_LEASE_SAMPLES);
     virtual ~AudioInput();
 
-    /// @brief Retrieves the input FIFO for the given channel.
+    /// @brief Retrieves the input FIFO for the given channel. This object is 
+    ///        the FIFO's only consumer.
     /// @param channel The channel to retrieve the FIFO for.
-    struct FIFO* getAudioInput(ChannelLabel channel);
+    AudioRingBuffer* getAudioInput(ChannelLabel channel);
 
-    /// @brief Stores a link to the output FIFO on the given channel.
+    /// @brief Stages a link to the output FIFO on the given channel. The link
+    ///        takes effect the next time this object calls latchAudioOutputs(),
+    ///        at which point it becomes the FIFO's only producer.
     /// @param channel The channel to set the output FIFO for.
     /// @param fifo The FIFO to set the channel's output to.
-    void setAudioOutput(ChannelLabel channel, struct FIFO* fifo);
+    /// @note Routes between tasks should normally be changed through AudioGraph,
+    ///       which makes sure that a FIFO never has two producers at once.
+    void setAudioOutput(ChannelLabel channel, AudioRingBuffer* fifo);
 
-    /// @brief Retrieves the output FIFO for the given channel.
+    /// @brief Retrieves the output FIFO for the given channel as of the last
+    ///        call to latchAudioOutputs().
     /// @param channel The channel to retrieve the FIFO for.
-    struct FIFO* getAudioOutput(ChannelLabel channel);
+    AudioRingBuffer* getAudioOutput(ChannelLabel channel);
+
+    /// @brief Applies any output links staged by setAudioOutput(). Producers call
+    ///        this from their own task at the start of each frame so that routes
+    ///        only ever change between frames.
+    void latchAudioOutputs();
+
+    /// @brief Returns whether every staged output link has been latched.
+    bool hasLatchedAudioOutputs() const;
+
+    /// @brief Returns the number of input channels.
+    int8_t getNumInputChannels() const { return numChannels_; }
+
+    /// @brief Returns the number of output channels.
+    int8_t getNumOutputChannels() const { return numOutputChannels_; }
 private:
-    struct FIFO** inputAudioFifos_;
-    struct FIFO** outputAudioFifos_;
+    AudioRingBuffer** inputAudioFifos_;
+    std::atomic<AudioRingBuffer*>* outputAudioFifos_;
+    std::atomic<AudioRingBuffer*>* pendingOutputAudioFifos_;
+    std::atomic<uint32_t> pendingOutputVersion_;
+    std::atomic<uint32_t> latchedOutputVersion_;
     int8_t numChannels_;
+    int8_t numOutputChannels_;
 };
 
 }
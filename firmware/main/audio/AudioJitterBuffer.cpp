@@ -0,0 +1,503 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "AudioJitterBuffer.h"
+#include "util/StatisticsRegistry.h"
+
+// Arrival delay spread is measured over windows of this many packets
+// (~2 seconds at 20ms/packet). The target depth follows the larger of the
+// current and previous windows, so it rises immediately on new jitter and
+// falls back a few seconds after it goes away.
+#define JITTER_WINDOW_PACKETS (100)
+
+// How many consecutive pops the buffer needs to be at least a packet
+// over its target before a packet is dropped to catch up.
+#define JITTER_SHRINK_HOLD_POPS (25)
+
+// Number of samples over which a dropped packet is crossfaded into the next.
+#define JITTER_CROSSFADE_SAMPLES (32)
+
+// Number of consecutive concealed blocks over which the repeated audio
+// fades to silence. Playout stops and buffering starts over after this.
+#define JITTER_MAX_CONCEALED (3)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static util::StatisticsRegistry<AudioJitterBuffer, AUDIO_JITTER_BUFFER_MAX_INSTANCES> Instances_;
+
+AudioJitterBuffer::AudioJitterBuffer(const char* name, int sampleRate, int minDepthMs, int maxDepthMs)
+    : name_(name)
+    , sampleRate_(sampleRate)
+    , minDepthUs_(minDepthMs * 1000)
+    , maxDepthUs_(maxDepthMs * 1000)
+{
+    assert(sampleRate > 0);
+    assert(minDepthMs >= 0 && minDepthMs <= maxDepthMs);
+
+    // Only the network tasks touch this, so slower RAM is fine.
+    slots_ = (Slot*)heap_caps_malloc(sizeof(Slot) * AUDIO_JITTER_BUFFER_NUM_SLOTS, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (slots_ == nullptr)
+    {
+        slots_ = (Slot*)heap_caps_malloc(sizeof(Slot) * AUDIO_JITTER_BUFFER_NUM_SLOTS, MALLOC_CAP_8BIT);
+    }
+    assert(slots_ != nullptr);
+
+    spinlock_initialize(&lock_);
+
+    stats_ = Statistics{};
+    stats_.name = name_;
+
+    reset();
+
+    Instances_.add(this);
+}
+
+AudioJitterBuffer::~AudioJitterBuffer()
+{
+    Instances_.remove(this);
+
+    heap_caps_free(slots_);
+}
+
+void AudioJitterBuffer::reset()
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    reset_();
+
+    // A new stream may have completely different timing.
+    jitterUs16_ = 0;
+    previousWindowSpreadUs_ = 0;
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioJitterBuffer::push(uint16_t seq, const int16_t* audio, int numSamples, int64_t arrivalTimeUs)
+{
+    if (numSamples <= 0)
+    {
+        return;
+    }
+    numSamples = std::min(numSamples, AUDIO_JITTER_BUFFER_MAX_PACKET_SAMPLES);
+
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    stats_.numReceived++;
+
+    if (!hasNextSeq_)
+    {
+        nextSeq_ = seq;
+        hasNextSeq_ = true;
+    }
+
+    int diff = (int16_t)(seq - nextSeq_);
+    if (diff < -AUDIO_JITTER_BUFFER_NUM_SLOTS || diff >= 2 * AUDIO_JITTER_BUFFER_NUM_SLOTS)
+    {
+        // Way outside of anything we'd expect from jitter, so the sender
+        // probably restarted. Start over from this packet.
+        stats_.numResyncs++;
+        reset_();
+
+        nextSeq_ = seq;
+        hasNextSeq_ = true;
+        diff = 0;
+    }
+
+    // Late packets still count toward the jitter estimate, since they're
+    // exactly what the estimate is supposed to account for.
+    bool reordered = hasLastArrival_ && (int16_t)(seq - lastArrivalSeq_) < 0;
+    updateJitter_(seq, numSamples, arrivalTimeUs);
+
+    if (diff < 0)
+    {
+        stats_.numLate++;
+        portEXIT_CRITICAL_SAFE(&lock_);
+        return;
+    }
+
+    // Make room if the packet is too far ahead of playout. This only
+    // happens if a large burst arrives while we're not being drained.
+    while (diff >= AUDIO_JITTER_BUFFER_NUM_SLOTS)
+    {
+        discardOldest_();
+        diff--;
+    }
+
+    Slot& slot = slots_[seq & (AUDIO_JITTER_BUFFER_NUM_SLOTS - 1)];
+    if (slot.valid)
+    {
+        assert(slot.seq == seq);
+
+        // A concealed slot means the packet was already needed and
+        // we gave up waiting for it.
+        if (slot.concealed)
+        {
+            stats_.numLate++;
+        }
+        else
+        {
+            stats_.numDuplicate++;
+        }
+    }
+    else
+    {
+        if (reordered)
+        {
+            stats_.numReordered++;
+        }
+
+        slot.valid = true;
+        slot.concealed = false;
+        slot.seq = seq;
+        slot.numSamples = numSamples;
+        slot.arrivalTimeUs = arrivalTimeUs;
+        memcpy(slot.samples, audio, numSamples * sizeof(int16_t));
+
+        numBufferedPackets_++;
+        numBufferedSamples_ += numSamples;
+    }
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+bool AudioJitterBuffer::pop(int16_t* audio, int numSamples, int64_t* arrivalTimeUs)
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    *arrivalTimeUs = -1;
+
+    uint32_t targetDepthUs = getTargetDepthUs_();
+    if (!playing_)
+    {
+        if (numBufferedPackets_ == 0 || getDepthUs_() < targetDepthUs)
+        {
+            portEXIT_CRITICAL_SAFE(&lock_);
+            return false;
+        }
+
+        playing_ = true;
+        numExcessPops_ = 0;
+    }
+
+    // Drop audio if we've been holding more than we need for a while
+    // (e.g. after a burst of jitter that has since gone away).
+    if (getDepthUs_() >= targetDepthUs + samplesToUs_(lastArrivalSamples_))
+    {
+        numExcessPops_++;
+    }
+    else
+    {
+        numExcessPops_ = 0;
+    }
+
+    if (numExcessPops_ >= JITTER_SHRINK_HOLD_POPS && readOffset_ == 0)
+    {
+        shrink_();
+    }
+
+    stats_.depth.add(getDepthUs_());
+
+    int numFilled = 0;
+    while (numFilled < numSamples)
+    {
+        Slot& slot = slots_[nextSeq_ & (AUDIO_JITTER_BUFFER_NUM_SLOTS - 1)];
+        if (slot.valid)
+        {
+            int numToCopy = std::min(numSamples - numFilled, slot.numSamples - readOffset_);
+            memcpy(audio + numFilled, slot.samples + readOffset_, numToCopy * sizeof(int16_t));
+            if (*arrivalTimeUs < 0 && !slot.concealed)
+            {
+                *arrivalTimeUs = slot.arrivalTimeUs;
+            }
+
+            numFilled += numToCopy;
+            readOffset_ += numToCopy;
+            numBufferedSamples_ -= numToCopy;
+
+            if (readOffset_ == slot.numSamples)
+            {
+                if (!slot.concealed)
+                {
+                    // Keep a copy in case we need to conceal the next one.
+                    memcpy(concealSource_, slot.samples, slot.numSamples * sizeof(int16_t));
+                    concealSourceSamples_ = slot.numSamples;
+                    concealPhase_ = 0;
+                    numConsecutiveConcealed_ = 0;
+                    stats_.numPlayed++;
+                }
+
+                slot.valid = false;
+                numBufferedPackets_--;
+                nextSeq_++;
+                readOffset_ = 0;
+            }
+        }
+        else if (numBufferedPackets_ > 0)
+        {
+            // Later packets are here, so this one is lost or too late
+            // to be useful. Fill in for it.
+            slot.valid = true;
+            slot.concealed = true;
+            slot.seq = nextSeq_;
+            slot.numSamples = concealSourceSamples_ > 0 ? concealSourceSamples_ : lastArrivalSamples_;
+            slot.arrivalTimeUs = 0;
+            conceal_(slot.samples, slot.numSamples);
+
+            numBufferedPackets_++;
+            numBufferedSamples_ += slot.numSamples;
+            stats_.numConcealed++;
+        }
+        else
+        {
+            // Nothing left. Fill in for the rest of the block without moving
+            // on, so that the packet can still be played if it's just late.
+            conceal_(audio + numFilled, numSamples - numFilled);
+            numFilled = numSamples;
+            stats_.numUnderruns++;
+
+            if (numConsecutiveConcealed_ > JITTER_MAX_CONCEALED)
+            {
+                // Faded out completely, so build up the buffer again.
+                playing_ = false;
+            }
+        }
+    }
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+    return true;
+}
+
+uint32_t AudioJitterBuffer::getDepthUs() const
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    uint32_t result = getDepthUs_();
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return result;
+}
+
+uint32_t AudioJitterBuffer::getTargetDepthUs() const
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    uint32_t result = getTargetDepthUs_();
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return result;
+}
+
+void AudioJitterBuffer::getStatistics(Statistics* stats, bool reset)
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    stats_.jitterUs = jitterUs16_ >> 4;
+    stats_.peakJitterUs = std::max((uint32_t)(windowMaxDelayUs_ - windowMinDelayUs_), previousWindowSpreadUs_);
+    stats_.targetDepthUs = getTargetDepthUs_();
+    *stats = stats_;
+
+    if (reset)
+    {
+        stats_.numReceived = 0;
+        stats_.numPlayed = 0;
+        stats_.numReordered = 0;
+        stats_.numLate = 0;
+        stats_.numDuplicate = 0;
+        stats_.numConcealed = 0;
+        stats_.numUnderruns = 0;
+        stats_.numDiscarded = 0;
+        stats_.numResyncs = 0;
+        stats_.depth.reset();
+    }
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void AudioJitterBuffer::GetAllStatistics(std::vector<Statistics>& stats, bool reset)
+{
+    Instances_.getAllStatistics(stats, reset);
+}
+
+void AudioJitterBuffer::reset_()
+{
+    for (int index = 0; index < AUDIO_JITTER_BUFFER_NUM_SLOTS; index++)
+    {
+        slots_[index].valid = false;
+    }
+
+    playing_ = false;
+    hasNextSeq_ = false;
+    nextSeq_ = 0;
+    readOffset_ = 0;
+    numBufferedPackets_ = 0;
+    numBufferedSamples_ = 0;
+    numExcessPops_ = 0;
+
+    concealSourceSamples_ = 0;
+    concealPhase_ = 0;
+    numConsecutiveConcealed_ = 0;
+
+    hasLastArrival_ = false;
+    lastArrivalSeq_ = 0;
+    lastArrivalTimeUs_ = 0;
+    lastArrivalSamples_ = 0;
+    relativeDelayUs_ = 0;
+    windowMinDelayUs_ = 0;
+    windowMaxDelayUs_ = 0;
+    numWindowPackets_ = 0;
+}
+
+void AudioJitterBuffer::updateJitter_(uint16_t seq, int numSamples, int64_t arrivalTimeUs)
+{
+    if (!hasLastArrival_)
+    {
+        hasLastArrival_ = true;
+        lastArrivalSeq_ = seq;
+        lastArrivalTimeUs_ = arrivalTimeUs;
+        lastArrivalSamples_ = numSamples;
+        return;
+    }
+
+    int diff = (int16_t)(seq - lastArrivalSeq_);
+    if (diff <= 0)
+    {
+        // Reordered or duplicate packets don't tell us anything new.
+        return;
+    }
+
+    // How much later (or earlier) this packet arrived than it would have
+    // if the network added a constant delay. Lost packets in between are
+    // assumed to be the same length as the previous one.
+    int64_t delayChangeUs = 
+        (arrivalTimeUs - lastArrivalTimeUs_) - (int64_t)samplesToUs_(lastArrivalSamples_) * diff;
+
+    if (diff == 1)
+    {
+        uint32_t absDelayChangeUs = delayChangeUs < 0 ? -delayChangeUs : delayChangeUs;
+        jitterUs16_ += absDelayChangeUs - ((jitterUs16_ + 8) >> 4);
+    }
+
+    // Track the spread between the least and most delayed packets, which
+    // is how much audio we need to hold to ride through the jitter.
+    relativeDelayUs_ += delayChangeUs;
+    windowMinDelayUs_ = std::min(windowMinDelayUs_, relativeDelayUs_);
+    windowMaxDelayUs_ = std::max(windowMaxDelayUs_, relativeDelayUs_);
+    if (++numWindowPackets_ >= JITTER_WINDOW_PACKETS)
+    {
+        previousWindowSpreadUs_ = windowMaxDelayUs_ - windowMinDelayUs_;
+        windowMinDelayUs_ = relativeDelayUs_;
+        windowMaxDelayUs_ = relativeDelayUs_;
+        numWindowPackets_ = 0;
+    }
+
+    lastArrivalSeq_ = seq;
+    lastArrivalTimeUs_ = arrivalTimeUs;
+    lastArrivalSamples_ = numSamples;
+}
+
+uint32_t AudioJitterBuffer::getTargetDepthUs_() const
+{
+    uint32_t spreadUs = std::max((uint32_t)(windowMaxDelayUs_ - windowMinDelayUs_), previousWindowSpreadUs_);
+
+    // Playout happens a block at a time, so allow an extra packet on top.
+    uint32_t targetUs = spreadUs + samplesToUs_(lastArrivalSamples_);
+    return std::min(std::max(targetUs, minDepthUs_), maxDepthUs_);
+}
+
+uint32_t AudioJitterBuffer::getDepthUs_() const
+{
+    return samplesToUs_(numBufferedSamples_);
+}
+
+uint32_t AudioJitterBuffer::samplesToUs_(uint32_t numSamples) const
+{
+    return (uint64_t)numSamples * 1000000 / sampleRate_;
+}
+
+void AudioJitterBuffer::discardOldest_()
+{
+    Slot& slot = slots_[nextSeq_ & (AUDIO_JITTER_BUFFER_NUM_SLOTS - 1)];
+    if (slot.valid)
+    {
+        if (!slot.concealed)
+        {
+            stats_.numDiscarded++;
+        }
+
+        slot.valid = false;
+        numBufferedPackets_--;
+        numBufferedSamples_ -= slot.numSamples - readOffset_;
+    }
+
+    nextSeq_++;
+    readOffset_ = 0;
+}
+
+void AudioJitterBuffer::shrink_()
+{
+    Slot& current = slots_[nextSeq_ & (AUDIO_JITTER_BUFFER_NUM_SLOTS - 1)];
+    Slot& next = slots_[(uint16_t)(nextSeq_ + 1) & (AUDIO_JITTER_BUFFER_NUM_SLOTS - 1)];
+    if (!current.valid || !next.valid)
+    {
+        // Wait until there's something to crossfade into.
+        return;
+    }
+
+    // Fade from the start of the packet being dropped into the start of 
+    // the next one so that there's no discontinuity.
+    int numFade = std::min(JITTER_CROSSFADE_SAMPLES, (int)std::min(current.numSamples, next.numSamples));
+    for (int index = 0; index < numFade; index++)
+    {
+        next.samples[index] = 
+            ((int32_t)current.samples[index] * (numFade - index) + (int32_t)next.samples[index] * index) / numFade;
+    }
+
+    discardOldest_();
+    numExcessPops_ = 0;
+}
+
+void AudioJitterBuffer::conceal_(int16_t* audio, int numSamples)
+{
+    numConsecutiveConcealed_++;
+    if (concealSourceSamples_ == 0 || numConsecutiveConcealed_ > JITTER_MAX_CONCEALED)
+    {
+        memset(audio, 0, numSamples * sizeof(int16_t));
+        return;
+    }
+
+    // Repeat the last good packet, fading linearly (Q15) across this
+    // block from where the previous concealed block left off.
+    int32_t startGain = ((JITTER_MAX_CONCEALED - numConsecutiveConcealed_ + 1) << 15) / JITTER_MAX_CONCEALED;
+    int32_t endGain = ((JITTER_MAX_CONCEALED - numConsecutiveConcealed_) << 15) / JITTER_MAX_CONCEALED;
+    for (int index = 0; index < numSamples; index++)
+    {
+        int32_t gain = startGain + (endGain - startGain) * index / numSamples;
+        audio[index] = ((int32_t)concealSource_[concealPhase_] * gain) >> 15;
+        concealPhase_ = (concealPhase_ + 1) % concealSourceSamples_;
+    }
+}
+
+}
+
+}
@@ -0,0 +1,183 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_JITTER_BUFFER_H
+#define AUDIO_JITTER_BUFFER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "task/DVLatencyHistogram.h"
+
+// Number of packets that can be held at once. Must be a power of two
+// so that slot indexes stay consistent when sequence numbers wrap.
+#define AUDIO_JITTER_BUFFER_NUM_SLOTS (32)
+
+// Largest packet accepted. Anything longer is truncated.
+#define AUDIO_JITTER_BUFFER_MAX_PACKET_SAMPLES (320)
+
+// Maximum number of jitter buffers reported by GetAllStatistics().
+#define AUDIO_JITTER_BUFFER_MAX_INSTANCES (4)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Reorders and smooths out audio packets received over the network.
+///
+/// Packets are stored by sequence number as they arrive and played out at a
+/// fixed rate by pop(). Playout starts once the buffer holds the target depth,
+/// which follows the peak arrival jitter seen over the last few seconds (within
+/// the configured limits). Packets arriving after their playout time are dropped.
+/// Missing packets are concealed by repeating the previous packet with a fade
+/// to silence, and excess depth is removed by crossfading over one packet.
+///
+/// push() and pop() must be called from the same task.
+class AudioJitterBuffer
+{
+public:
+    struct Statistics
+    {
+        const char* name;
+        uint32_t numReceived; // packets pushed
+        uint32_t numPlayed; // packets played out
+        uint32_t numReordered; // arrived out of order, but in time to be played
+        uint32_t numLate; // arrived after their playout time and were dropped
+        uint32_t numDuplicate; // already in the buffer
+        uint32_t numConcealed; // missing at playout time and replaced
+        uint32_t numUnderruns; // blocks played while the buffer was empty
+        uint32_t numDiscarded; // dropped to reduce latency or due to overflow
+        uint32_t numResyncs; // sequence number jumps that restarted the buffer
+        uint32_t jitterUs; // RFC 3550 interarrival jitter
+        uint32_t peakJitterUs; // largest spread in arrival delay recently
+        uint32_t targetDepthUs; // current playout delay target
+        task::DVLatencyHistogram depth; // buffer depth, sampled on each pop()
+    };
+
+    /// @brief Creates a new jitter buffer.
+    /// @param name The name to report statistics under. Must remain valid for the
+    ///        life of the object.
+    /// @param sampleRate The sample rate of the audio.
+    /// @param minDepthMs The smallest playout delay to use.
+    /// @param maxDepthMs The largest playout delay to use.
+    AudioJitterBuffer(const char* name, int sampleRate, int minDepthMs, int maxDepthMs);
+    ~AudioJitterBuffer();
+
+    AudioJitterBuffer(const AudioJitterBuffer&) = delete;
+    AudioJitterBuffer& operator=(const AudioJitterBuffer&) = delete;
+
+    /// @brief Discards all buffered audio and starts over with the next packet.
+    void reset();
+
+    /// @brief Adds a received packet to the buffer.
+    /// @param seq The packet's sequence number.
+    /// @param audio The samples in the packet.
+    /// @param numSamples The number of samples in the packet.
+    /// @param arrivalTimeUs When the packet was received (esp_timer_get_time()).
+    void push(uint16_t seq, const int16_t* audio, int numSamples, int64_t arrivalTimeUs);
+
+    /// @brief Gets the next block of audio to play. Should be called at the same
+    ///        rate that audio is consumed.
+    /// @param audio Where to put the audio.
+    /// @param numSamples The number of samples to get.
+    /// @param arrivalTimeUs Set to when the first received (i.e. not concealed) packet
+    ///        in the block arrived, or -1 if the block is entirely concealed.
+    /// @return true if audio was returned, false if nothing should be played yet.
+    bool pop(int16_t* audio, int numSamples, int64_t* arrivalTimeUs);
+
+    /// @brief Returns the amount of audio currently buffered, in microseconds.
+    uint32_t getDepthUs() const;
+
+    /// @brief Returns the current playout delay target, in microseconds.
+    uint32_t getTargetDepthUs() const;
+
+    /// @brief Retrieves this buffer's statistics.
+    /// @param stats Where to store the statistics.
+    /// @param reset Whether to clear the counters and depth histogram afterward.
+    void getStatistics(Statistics* stats, bool reset);
+
+    /// @brief Retrieves the statistics for every jitter buffer that currently exists.
+    /// @param stats The vector to fill in. Existing contents are replaced.
+    /// @param reset Whether to clear the counters and depth histograms afterward.
+    static void GetAllStatistics(std::vector<Statistics>& stats, bool reset);
+
+private:
+    struct Slot
+    {
+        bool valid;
+        bool concealed;
+        uint16_t seq;
+        uint16_t numSamples;
+        int64_t arrivalTimeUs;
+        int16_t samples[AUDIO_JITTER_BUFFER_MAX_PACKET_SAMPLES];
+    };
+
+    const char* name_;
+    int sampleRate_;
+    uint32_t minDepthUs_;
+    uint32_t maxDepthUs_;
+    Slot* slots_;
+
+    // Playout state
+    bool playing_;
+    bool hasNextSeq_;
+    uint16_t nextSeq_;
+    uint16_t readOffset_;
+    int numBufferedPackets_;
+    uint32_t numBufferedSamples_;
+    int numExcessPops_;
+
+    // Concealment state
+    int16_t concealSource_[AUDIO_JITTER_BUFFER_MAX_PACKET_SAMPLES];
+    int concealSourceSamples_;
+    int concealPhase_;
+    int numConsecutiveConcealed_;
+
+    // Jitter estimation state
+    bool hasLastArrival_;
+    uint16_t lastArrivalSeq_;
+    int64_t lastArrivalTimeUs_;
+    int lastArrivalSamples_;
+    int64_t relativeDelayUs_;
+    int64_t windowMinDelayUs_;
+    int64_t windowMaxDelayUs_;
+    uint32_t previousWindowSpreadUs_;
+    int numWindowPackets_;
+    uint32_t jitterUs16_; // scaled by 16, as in RFC 3550
+
+    Statistics stats_;
+    mutable portMUX_TYPE lock_;
+
+    void reset_();
+    void updateJitter_(uint16_t seq, int numSamples, int64_t arrivalTimeUs);
+    uint32_t getTargetDepthUs_() const;
+    uint32_t getDepthUs_() const;
+    uint32_t samplesToUs_(uint32_t numSamples) const;
+
+    void discardOldest_();
+    void shrink_();
+    void conceal_(int16_t* audio, int numSamples);
+};
+
+}
+
+}
+
+#endif // AUDIO_JITTER_BUFFER_H
@@ -0,0 +1,224 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <climits>
+
+#include "AudioKernels.h"
+
+#if defined(__XTENSA__)
+#include "sdkconfig.h"
+#endif // defined(__XTENSA__)
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+// The ESP32-S3's PIE extensions operate on 128 bit (8 sample) vectors
+// that must be loaded from and stored to 16 byte aligned addresses.
+#define AUDIO_KERNELS_USE_PIE
+#define PIE_FRAMES_PER_BLOCK (8)
+#define PIE_IS_ALIGNED(ptr) ((((uintptr_t)(ptr)) & 0xF) == 0)
+
+static bool AllInputsAligned_(const int16_t* const* inputs, uint32_t numInputs)
+{
+    for (uint32_t index = 0; index < numInputs; index++)
+    {
+        if (inputs[index] != nullptr && !PIE_IS_ALIGNED(inputs[index]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+#endif // defined(CONFIG_IDF_TARGET_ESP32S3)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+void DeinterleaveStereo(const int16_t* in, int16_t* left, int16_t* right, uint32_t numFrames)
+{
+    uint32_t index = 0;
+
+#if defined(AUDIO_KERNELS_USE_PIE)
+    if (left != nullptr && right != nullptr &&
+        PIE_IS_ALIGNED(in) && PIE_IS_ALIGNED(left) && PIE_IS_ALIGNED(right))
+    {
+        const int16_t* inPtr = in;
+        int16_t* leftPtr = left;
+        int16_t* rightPtr = right;
+        uint32_t numBlocks = numFrames / PIE_FRAMES_PER_BLOCK;
+
+        for (uint32_t block = 0; block < numBlocks; block++)
+        {
+            asm volatile(
+                "ee.vld.128.ip q0, %0, 16\n"     // q0 = L0 R0 L1 R1 L2 R2 L3 R3
+                "ee.vld.128.ip q1, %0, 16\n"     // q1 = L4 R4 L5 R5 L6 R6 L7 R7
+                "ee.vunzip.16 q0, q1\n"          // q0 = L0..L7, q1 = R0..R7
+                "ee.vst.128.ip q0, %1, 16\n"     // Save left channel
+                "ee.vst.128.ip q1, %2, 16\n"     // Save right channel
+                : "=r"(inPtr), "=r"(leftPtr), "=r"(rightPtr)
+                : "0"(inPtr), "1"(leftPtr), "2"(rightPtr)
+                : "memory"
+            );
+        }
+
+        index = numBlocks * PIE_FRAMES_PER_BLOCK;
+    }
+#endif // defined(AUDIO_KERNELS_USE_PIE)
+
+    // Portable version, also used for whatever the SIMD version couldn't handle.
+    if (left != nullptr)
+    {
+        for (uint32_t leftIndex = index; leftIndex < numFrames; leftIndex++)
+        {
+            left[leftIndex] = in[2 * leftIndex];
+        }
+    }
+
+    if (right != nullptr)
+    {
+        for (uint32_t rightIndex = index; rightIndex < numFrames; rightIndex++)
+        {
+            right[rightIndex] = in[2 * rightIndex + 1];
+        }
+    }
+}
+
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* out, uint32_t numFrames)
+{
+    uint32_t index = 0;
+
+#if defined(AUDIO_KERNELS_USE_PIE)
+    if (left != nullptr && right != nullptr &&
+        PIE_IS_ALIGNED(out) && PIE_IS_ALIGNED(left) && PIE_IS_ALIGNED(right))
+    {
+        const int16_t* leftPtr = left;
+        const int16_t* rightPtr = right;
+        int16_t* outPtr = out;
+        uint32_t numBlocks = numFrames / PIE_FRAMES_PER_BLOCK;
+
+        for (uint32_t block = 0; block < numBlocks; block++)
+        {
+            asm volatile(
+                "ee.vld.128.ip q0, %1, 16\n"     // q0 = L0..L7
+                "ee.vld.128.ip q1, %2, 16\n"     // q1 = R0..R7
+                "ee.vzip.16 q0, q1\n"            // q0 = L0 R0..L3 R3, q1 = L4 R4..L7 R7
+                "ee.vst.128.ip q0, %0, 16\n"     // Save first four frames
+                "ee.vst.128.ip q1, %0, 16\n"     // Save last four frames
+                : "=r"(outPtr), "=r"(leftPtr), "=r"(rightPtr)
+                : "0"(outPtr), "1"(leftPtr), "2"(rightPtr)
+                : "memory"
+            );
+        }
+
+        index = numBlocks * PIE_FRAMES_PER_BLOCK;
+    }
+#endif // defined(AUDIO_KERNELS_USE_PIE)
+
+    // Portable version, also used for whatever the SIMD version couldn't handle.
+    if (left != nullptr && right != nullptr)
+    {
+        for (; index < numFrames; index++)
+        {
+            out[2 * index] = left[index];
+            out[2 * index + 1] = right[index];
+        }
+    }
+    else
+    {
+        for (; index < numFrames; index++)
+        {
+            out[2 * index] = left != nullptr ? left[index] : 0;
+            out[2 * index + 1] = right != nullptr ? right[index] : 0;
+        }
+    }
+}
+
+void MixSaturate(const int16_t* const* inputs, const int16_t* gainsQ10, uint32_t numInputs, int16_t* out, uint32_t numSamples)
+{
+    uint32_t index = 0;
+
+#if defined(AUDIO_KERNELS_USE_PIE)
+    if (PIE_IS_ALIGNED(out) && AllInputsAligned_(inputs, numInputs))
+    {
+        int16_t* outPtr = out;
+        uint32_t numBlocks = numSamples / PIE_FRAMES_PER_BLOCK;
+
+        for (uint32_t block = 0; block < numBlocks; block++)
+        {
+            // The products are summed in the 40 bit QACC accumulators, so
+            // nothing saturates until the final shift back down to 16 bits.
+            asm volatile("ee.zero.qacc\n");
+
+            for (uint32_t input = 0; input < numInputs; input++)
+            {
+                if (inputs[input] == nullptr) continue;
+
+                const int16_t* inPtr = &inputs[input][block * PIE_FRAMES_PER_BLOCK];
+                const int16_t* gainPtr = &gainsQ10[input];
+                asm volatile(
+                    "ld.qr q0, %0, 0\n"                 // Load 8 input samples into q0
+                    "ee.vldbc.16 q1, %1\n"              // Load the gain 8 times into q1
+                    "ee.vmulas.s16.qacc q0, q1\n"       // QACC += q0 * q1
+                    :
+                    : "r"(inPtr), "r"(gainPtr)
+                    : "memory"
+                );
+            }
+
+            asm volatile(
+                "movi a10, %1\n"
+                "ee.srcmb.s16.qacc q0, a10, 0\n"       // q0 = saturate(QACC >> 10)
+                "ee.vst.128.ip q0, %0, 16\n"           // Save mixed samples
+                : "=r"(outPtr)
+                : "i"(MIX_GAIN_Q10_SHIFT), "0"(outPtr)
+                : "a10", "memory"
+            );
+        }
+
+        index = numBlocks * PIE_FRAMES_PER_BLOCK;
+    }
+#endif // defined(AUDIO_KERNELS_USE_PIE)
+
+    // Portable version, also used for whatever the SIMD version couldn't handle.
+    for (; index < numSamples; index++)
+    {
+        int32_t sum = 0;
+        for (uint32_t input = 0; input < numInputs; input++)
+        {
+            if (inputs[input] != nullptr)
+            {
+                sum += (int32_t)inputs[input][index] * gainsQ10[input];
+            }
+        }
+
+        sum >>= MIX_GAIN_Q10_SHIFT;
+        if (sum > SHRT_MAX)
+        {
+            sum = SHRT_MAX;
+        }
+        else if (sum < SHRT_MIN)
+        {
+            sum = SHRT_MIN;
+        }
+        out[index] = (int16_t)sum;
+    }
+}
+
+}
+
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <cstdint>
+
+// Gains passed to MixSaturate() are Q10 fixed point numbers (i.e. 1024 = 1.0).
+#define MIX_GAIN_Q10_SHIFT (10)
+#define MIX_GAIN_Q10_UNITY (1 << MIX_GAIN_Q10_SHIFT)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Splits interleaved stereo audio (L, R, L, R...) into separate channel blocks.
+/// @param in The interleaved samples (2 * numFrames samples).
+/// @param left Destination for the left channel, or nullptr to drop it.
+/// @param right Destination for the right channel, or nullptr to drop it.
+/// @param numFrames The number of stereo frames to split.
+/// @note Runs fastest when all pointers are 16 byte aligned (ESP32-S3 SIMD).
+void DeinterleaveStereo(const int16_t* in, int16_t* left, int16_t* right, uint32_t numFrames);
+
+/// @brief Combines separate channel blocks into interleaved stereo audio.
+/// @param left The left channel, or nullptr for silence.
+/// @param right The right channel, or nullptr for silence.
+/// @param out Destination for the interleaved samples (2 * numFrames samples).
+/// @param numFrames The number of stereo frames to combine.
+/// @note Runs fastest when all pointers are 16 byte aligned (ESP32-S3 SIMD).
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* out, uint32_t numFrames);
+
+/// @brief Mixes several blocks of audio together, i.e. 
+///        out = saturate((inputs[0] * gains[0] + inputs[1] * gains[1] + ...) >> 10).
+/// @param inputs The blocks to mix (numSamples samples each). nullptr entries are skipped.
+/// @param gainsQ10 The Q10 gain to apply to each input.
+/// @param numInputs The number of entries in inputs and gainsQ10.
+/// @param out Destination for the mixed samples.
+/// @param numSamples The number of samples to mix.
+/// @note Runs fastest when all pointers are 16 byte aligned (ESP32-S3 SIMD).
+void MixSaturate(const int16_t* const* inputs, const int16_t* gainsQ10, uint32_t numInputs, int16_t* out, uint32_t numSamples);
+
+}
+
+}
+
+#endif // AUDIO_KERNELS_H
@@ -0,0 +1,129 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AudioLatency.h"
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+#include <cstring>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+// There are only a handful of sources and sinks, so this
+// is plenty for every combination that can actually happen.
+#define AUDIO_LATENCY_MAX_PATHS (16)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+static AudioLatencyStatistics::Path Paths_[AUDIO_LATENCY_MAX_PATHS];
+static int NumPaths_ = 0;
+static portMUX_TYPE PathsLock_ = portMUX_INITIALIZER_UNLOCKED;
+
+AudioLatencyTagger::AudioLatencyTagger(const char* origin)
+    : origin_(origin)
+    , lastTagTimeUs_(0)
+{
+    // empty
+}
+
+void AudioLatencyTagger::tag(AudioRingBuffer* fifo, int64_t captureTimeUs)
+{
+    if (fifo == nullptr ||
+        (lastTagTimeUs_ != 0 && captureTimeUs - lastTagTimeUs_ < CONFIG_EZDV_AUDIO_LATENCY_TAG_INTERVAL_MS * 1000))
+    {
+        return;
+    }
+
+    fifo->setLatencyTag({ origin_, captureTimeUs });
+    lastTagTimeUs_ = captureTimeUs;
+}
+
+void AudioLatencyStatistics::Record(const char* origin, const char* destination, int64_t latencyUs)
+{
+    if (latencyUs < 0)
+    {
+        latencyUs = 0;
+    }
+
+    portENTER_CRITICAL_SAFE(&PathsLock_);
+
+    int index = 0;
+    for (; index < NumPaths_; index++)
+    {
+        if (!strcmp(Paths_[index].origin, origin) && !strcmp(Paths_[index].destination, destination))
+        {
+            break;
+        }
+    }
+
+    if (index == NumPaths_ && NumPaths_ < AUDIO_LATENCY_MAX_PATHS)
+    {
+        Paths_[index].origin = origin;
+        Paths_[index].destination = destination;
+        Paths_[index].latency.reset();
+        NumPaths_++;
+    }
+
+    if (index < NumPaths_)
+    {
+        Paths_[index].latency.add(latencyUs);
+    }
+
+    portEXIT_CRITICAL_SAFE(&PathsLock_);
+}
+
+void AudioLatencyStatistics::GetPaths(std::vector<Path>& paths, bool reset)
+{
+    // Copy under the lock, then build the vector outside of it
+    // since that may allocate.
+    Path snapshot[AUDIO_LATENCY_MAX_PATHS];
+    int numPaths = 0;
+
+    portENTER_CRITICAL_SAFE(&PathsLock_);
+    numPaths = NumPaths_;
+    for (int index = 0; index < numPaths; index++)
+    {
+        snapshot[index] = Paths_[index];
+        if (reset)
+        {
+            Paths_[index].latency.reset();
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&PathsLock_);
+
+    paths.assign(snapshot, snapshot + numPaths);
+}
+
+void RecordAudioLatency(AudioRingBuffer* from, const char* destination)
+{
+    AudioLatencyTag tag;
+    if (from != nullptr && from->takeLatencyTag(&tag))
+    {
+        AudioLatencyStatistics::Record(tag.origin, destination, esp_timer_get_time() - tag.captureTimeUs);
+    }
+}
+
+}
+
+}
+
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
@@ -0,0 +1,118 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Audio latency instrumentation (CONFIG_EZDV_AUDIO_LATENCY_TAGS).
+//
+// Audio sources (e.g. TLV320's ADC or a radio's network stream) periodically
+// tag the audio they capture with the time it was captured. Each
+// AudioRingBuffer records how long tagged samples wait in it, and each task
+// that moves audio from one buffer to another carries the tag along with it.
+// When the tagged audio leaves ezDV (e.g. to TLV320's DAC or the network),
+// the total time since capture is recorded for that origin and destination.
+//
+// With the option disabled, everything here compiles to nothing.
+
+#ifndef AUDIO_LATENCY_H
+#define AUDIO_LATENCY_H
+
+#include <vector>
+
+#include "AudioRingBuffer.h"
+#include "task/DVLatencyHistogram.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Tags audio entering the system, at most once every
+///        CONFIG_EZDV_AUDIO_LATENCY_TAG_INTERVAL_MS.
+class AudioLatencyTagger
+{
+public:
+    /// @brief Creates a new tagger.
+    /// @param origin The name to report for audio tagged by this object. Must
+    ///        remain valid for the life of the program.
+    AudioLatencyTagger(const char* origin);
+
+    /// @brief Tags the next write to the given FIFO if enough time has passed
+    ///        since the previous tag.
+    /// @param fifo The FIFO that the captured audio is about to be written to.
+    /// @param captureTimeUs When the first sample of the write was captured.
+    void tag(AudioRingBuffer* fifo, int64_t captureTimeUs);
+
+private:
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    const char* origin_;
+    int64_t lastTagTimeUs_;
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+};
+
+/// @brief End-to-end latency statistics, by where audio entered and left the system.
+class AudioLatencyStatistics
+{
+public:
+    struct Path
+    {
+        const char* origin;
+        const char* destination;
+        task::DVLatencyHistogram latency;
+    };
+
+    /// @brief Records the latency of a single tagged sample.
+    static void Record(const char* origin, const char* destination, int64_t latencyUs);
+
+    /// @brief Retrieves statistics for every path seen so far. Safe to call from any task.
+    /// @param paths The vector to fill in. Existing contents are replaced.
+    /// @param reset Whether to clear the statistics afterward.
+    static void GetPaths(std::vector<Path>& paths, bool reset);
+};
+
+/// @brief Carries the newest tag read from one FIFO over to the next write
+///        to another. Called by tasks after reading the input that a write
+///        is derived from.
+inline void ForwardAudioLatencyTag(AudioRingBuffer* from, AudioRingBuffer* to)
+{
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    AudioLatencyTag tag;
+    if (from != nullptr && from->takeLatencyTag(&tag) && to != nullptr)
+    {
+        to->setLatencyTag(tag);
+    }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+}
+
+/// @brief Records end-to-end latency for the newest tag read from a FIFO whose
+///        audio is leaving the system.
+/// @param from The FIFO that was just read from.
+/// @param destination Where the audio is going. Must remain valid for the life of the program.
+void RecordAudioLatency(AudioRingBuffer* from, const char* destination);
+
+#if !CONFIG_EZDV_AUDIO_LATENCY_TAGS
+inline AudioLatencyTagger::AudioLatencyTagger(const char*) { }
+inline void AudioLatencyTagger::tag(AudioRingBuffer*, int64_t) { }
+inline void AudioLatencyStatistics::Record(const char*, const char*, int64_t) { }
+inline void AudioLatencyStatistics::GetPaths(std::vector<Path>& paths, bool) { paths.clear(); }
+inline void RecordAudioLatency(AudioRingBuffer*, const char*) { }
+#endif // !CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+}
+
+}
+
+#endif // AUDIO_LATENCY_H
@@ -0,0 +1,57 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_MESSAGE_H
+#define AUDIO_MESSAGE_H
+
+#include "task/DVTaskMessage.h"
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(AUDIO_MESSAGE);
+}
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+enum AudioMessageTypes
+{
+    DATA_AVAILABLE = 1,
+};
+
+/// @brief Posted to a task when audio has been committed to one of the rings it
+///        consumes from. Only the latest copy is kept in the queue, so a single
+///        message may cover several commits (and several rings).
+class AudioDataAvailableMessage : public DVTaskMessageBase<DATA_AVAILABLE, AudioDataAvailableMessage, PRIORITY_REALTIME, OVERFLOW_COALESCE_LATEST>
+{
+public:
+    AudioDataAvailableMessage()
+        : DVTaskMessageBase<DATA_AVAILABLE, AudioDataAvailableMessage, PRIORITY_REALTIME, OVERFLOW_COALESCE_LATEST>(AUDIO_MESSAGE)
+        {}
+    virtual ~AudioDataAvailableMessage() = default;
+};
+
+}
+
+}
+
+#endif // AUDIO_MESSAGE_H
@@ -15,10 +15,18 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "esp_heap_caps.h"
 #include "AudioMixer.h"
+#include "AudioKernels.h"
+#include "AudioLatency.h"
 
-#define AUDIO_MIXER_TIMER_TICK_US (20000)
 #define AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL 160
+#define AUDIO_MIXER_BACKLOG_SAMPLES (2 * AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL) /* 40ms @ 8000 Hz */
 
 namespace ezdv
 {
@@ -26,72 +34,137 @@ namespace ezdv
 namespace audio
 {
 
-AudioMixer::AudioMixer()
-    : DVTask("AudioMixer", 15, 3144, tskNO_AFFINITY, 16, pdMS_TO_TICKS(20))
-    , AudioInput(2, 1)
-    , mixerTick_(this, this, &AudioMixer::onTimerTick_, AUDIO_MIXER_TIMER_TICK_US, "AudioMixerTimer")
+AudioMixer::AudioMixer(int8_t numInputChannels)
+    : DVTask("AudioMixer", 15, 3144, tskNO_AFFINITY, 16)
+    , AudioInput(numInputChannels, 1)
+    , numInputChannels_(numInputChannels)
 {
-    // empty
+    assert(numInputChannels > 0);
+
+    // See https://dsp.stackexchange.com/questions/3581/algorithms-to-mix-audio-signals-without-clipping
+    // for more info. This is basically (1/sqrt(N)) * (a + b + ...) but done in a way that avoids the use
+    // of float or SW division at runtime (e.g. multiplies the sum by 724/1024 or ~0.707 for two inputs).
+    channelGains_ = new int16_t[numInputChannels_];
+    assert(channelGains_ != nullptr);
+    for (int index = 0; index < numInputChannels_; index++)
+    {
+        channelGains_[index] = (int16_t)(MIX_GAIN_Q10_UNITY / sqrt(numInputChannels_));
+    }
+
+    scratch_ = (int16_t*)heap_caps_aligned_alloc(
+        16, (numInputChannels_ + 1) * AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL * sizeof(int16_t), 
+        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(scratch_ != nullptr);
+
+    inputBufs_ = new int16_t*[numInputChannels_];
+    assert(inputBufs_ != nullptr);
+    for (int index = 0; index < numInputChannels_; index++)
+    {
+        inputBufs_[index] = &scratch_[index * AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL];
+    }
+    outputBuf_ = &scratch_[numInputChannels_ * AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL];
+
+    registerMessageHandler(this, &AudioMixer::onAudioDataAvailable_);
 }
 
 AudioMixer::~AudioMixer()
 {
-    mixerTick_.stop();
+    delete[] inputBufs_;
+    heap_caps_free(scratch_);
+    delete[] channelGains_;
+}
+
+void AudioMixer::setChannelGain(ChannelLabel channel, int16_t gainQ10)
+{
+    assert(channel < numInputChannels_);
+    channelGains_[channel] = gainQ10;
 }
 
 void AudioMixer::onTaskStart_()
 {
-    mixerTick_.start();
+    // Mix as soon as the first input has something for us, or once the
+    // others start backing up without it.
+    getAudioInput(AudioInput::LEFT_CHANNEL)->setConsumerNotification(this);
+    for (int index = 1; index < numInputChannels_; index++)
+    {
+        getAudioInput((ChannelLabel)index)->setConsumerNotification(this, AUDIO_MIXER_BACKLOG_SAMPLES);
+    }
 }
 
 void AudioMixer::onTaskSleep_()
 {
-    mixerTick_.stop();
+    for (int index = 0; index < numInputChannels_; index++)
+    {
+        getAudioInput((ChannelLabel)index)->setConsumerNotification(nullptr);
+    }
 
     // Flush anything remaining in the fifos.
-    struct FIFO* leftInputFifo = getAudioInput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* rightInputFifo = getAudioInput(AudioInput::RIGHT_CHANNEL);
     int ctr = 2; // Should only need to run twice to flush everything
-    while (ctr-- > 0 && (codec2_fifo_used(leftInputFifo) > 0 || codec2_fifo_used(rightInputFifo) > 0))
+    while (ctr-- > 0 && mixBlock_(true) > 0)
+    {
+        // empty
+    }
+}
+
+void AudioMixer::onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message)
+{
+    // One notification may cover several commits, so mix everything that's waiting.
+    while (mixBlock_() > 0)
     {
-        onTimerTick_(nullptr);
+        // empty
     }
 }
 
-void AudioMixer::onTimerTick_(DVTimer*)
+uint32_t AudioMixer::mixBlock_(bool flush)
 {
-    struct FIFO* leftInputFifo = getAudioInput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* rightInputFifo = getAudioInput(AudioInput::RIGHT_CHANNEL);
-    struct FIFO* outputFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
-
-    // Process on a sample by sample basis
-    int ctr = AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL;
-    short bufLeft;
-    short bufRight;
-    while (ctr-- > 0 && (codec2_fifo_used(leftInputFifo) > 0 || codec2_fifo_used(rightInputFifo) > 0))
+    latchAudioOutputs();
+
+    // The first input paces the mixer. Other inputs that have run dry 
+    // (e.g. the beeper when it's not beeping) are padded with silence 
+    // rather than treated as an underrun.
+    uint32_t numSamples = getAudioInput(AudioInput::LEFT_CHANNEL)->getUsed();
+    if (numSamples == 0)
     {
-        bufLeft = 0;
-        bufRight = 0;
-        
-        codec2_fifo_read(leftInputFifo, &bufLeft, 1);
-        codec2_fifo_read(rightInputFifo, &bufRight, 1);
-        
-        // See https://dsp.stackexchange.com/questions/3581/algorithms-to-mix-audio-signals-without-clipping
-        // for more info. This is basically (1/sqrt(2)) * (a + b) but done in a way that avoids the use
-        // of float or SW division (i.e. multiplies the sum by 724/1024 or ~0.707).
-        int32_t addedSample = ((bufLeft + bufRight) * 724) >> 10;
-        if (addedSample >= SHRT_MAX)
+        // Nothing from the first input (e.g. FreeDV while transmitting). Only
+        // mix the others by themselves once they've started to back up, so 
+        // that audio that's about to be mixed with the first input doesn't 
+        // get played separately from it instead.
+        uint32_t maxUsed = 0;
+        for (int index = 1; index < numInputChannels_; index++)
         {
-            addedSample = SHRT_MAX;
+            maxUsed = std::max(maxUsed, getAudioInput((ChannelLabel)index)->getUsed());
         }
-        else if (addedSample <= SHRT_MIN)
+
+        if (flush || maxUsed >= AUDIO_MIXER_BACKLOG_SAMPLES)
         {
-            addedSample = SHRT_MIN;
+            numSamples = maxUsed;
         }
-        short resultShort = (short)addedSample;
-        
-        codec2_fifo_write(outputFifo, &resultShort, 1);
     }
+
+    numSamples = std::min(numSamples, (uint32_t)AUDIO_MIXER_NUM_SAMPLES_PER_INTERVAL);
+    if (numSamples == 0)
+    {
+        return 0;
+    }
+
+    AudioRingBuffer* outputFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
+    for (int index = 0; index < numInputChannels_; index++)
+    {
+        AudioRingBuffer* inputFifo = getAudioInput((ChannelLabel)index);
+        uint32_t numToRead = std::min(numSamples, inputFifo->getUsed());
+        inputFifo->read(inputBufs_[index], numToRead);
+        memset(&inputBufs_[index][numToRead], 0, (numSamples - numToRead) * sizeof(int16_t));
+        ForwardAudioLatencyTag(inputFifo, outputFifo);
+    }
+
+    MixSaturate(inputBufs_, channelGains_, numInputChannels_, outputBuf_, numSamples);
+
+    if (outputFifo != nullptr)
+    {
+        outputFifo->write(outputBuf_, numSamples);
+    }
+
+    return numSamples;
 }
 
 }
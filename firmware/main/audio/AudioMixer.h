@@ -19,8 +19,8 @@
 #define AUDIO_MIXER_H
 
 #include "AudioInput.h"
+#include "AudioMessage.h"
 #include "task/DVTask.h"
-#include "task/DVTimer.h"
 
 namespace ezdv
 {
@@ -30,20 +30,45 @@ namespace audio
 
 using namespace ezdv::task;
 
+/// @brief Mixes several audio sources (e.g. FreeDV output and UI beeps) into 
+///        a single output channel.
 class AudioMixer : public DVTask, public AudioInput
 {
 public:
-    AudioMixer();
+    /// @brief Creates a new mixer.
+    /// @param numInputChannels The number of sources to mix. By default, each source is 
+    ///        scaled by 1/sqrt(numInputChannels) to reduce the chance of clipping.
+    ///        The first input (i.e. FreeDV) determines when mixing happens; the 
+    ///        others are mixed in as it arrives.
+    AudioMixer(int8_t numInputChannels = 2);
     virtual ~AudioMixer();
 
+    /// @brief Sets the gain applied to the given input channel. Must be called
+    ///        before the mixer is started.
+    /// @param channel The channel to set the gain for.
+    /// @param gainQ10 The new gain as a Q10 fixed point number (i.e. 1024 = 1.0).
+    void setChannelGain(ChannelLabel channel, int16_t gainQ10);
+
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
 
 private:
-    DVTimer mixerTick_;
+    int8_t numInputChannels_;
+    int16_t* channelGains_;
+
+    // Scratch buffers for one block of audio from each input plus 
+    // the mixed output, aligned for the SIMD mixing kernel.
+    int16_t* scratch_;
+    int16_t** inputBufs_;
+    int16_t* outputBuf_;
     
-    void onTimerTick_(DVTimer*);
+    void onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message);
+
+    /// @brief Mixes up to one block of audio.
+    /// @param flush Mix the other inputs even if they haven't backed up yet.
+    /// @return The number of samples mixed (0 if there's nothing waiting).
+    uint32_t mixBlock_(bool flush = false);
 };
 
 }
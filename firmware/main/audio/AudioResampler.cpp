@@ -0,0 +1,95 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "AudioResampler.h"
+
+#define Q32_ONE (1LL << 32)
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioResampler::AudioResampler()
+{
+    reset();
+}
+
+void AudioResampler::reset()
+{
+    step_ = Q32_ONE;
+    phase_ = 0;
+    memset(buffer_, 0, sizeof(buffer_));
+}
+
+void AudioResampler::setRatio(float ratioPpm)
+{
+    step_ = Q32_ONE + (int64_t)(ratioPpm * (Q32_ONE / 1000000.0f));
+}
+
+int AudioResampler::getInputSamplesNeeded(int numOutputSamples) const
+{
+    return (int)((phase_ + step_ * numOutputSamples) >> 32);
+}
+
+void AudioResampler::process(const int16_t* input, int16_t* output, int numOutputSamples)
+{
+    int numInputSamples = getInputSamplesNeeded(numOutputSamples);
+    assert(numInputSamples <= AUDIO_RESAMPLER_MAX_INPUT_SAMPLES);
+
+    // buffer_ holds the last few samples of the previous call followed by
+    // this call's input, so that interpolation never has to look at two
+    // different arrays.
+    memcpy(&buffer_[NUM_HISTORY_SAMPLES], input, numInputSamples * sizeof(int16_t));
+
+    uint64_t position = phase_;
+    for (int index = 0; index < numOutputSamples; index++)
+    {
+        // Interpolate between x0 and x1, with x0 one sample into the buffer
+        // so that x-1 is always available.
+        const int16_t* x = &buffer_[(position >> 32) + 1];
+        float mu = (uint32_t)position * (1.0f / Q32_ONE);
+
+        float xm1 = x[-1];
+        float x0 = x[0];
+        float x1 = x[1];
+        float x2 = x[2];
+
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+        float y = ((c3 * mu + c2) * mu + c1) * mu + x0;
+
+        if (y > 32767.0f) y = 32767.0f;
+        else if (y < -32768.0f) y = -32768.0f;
+        output[index] = (int16_t)y;
+
+        position += step_;
+    }
+
+    // Keep the tail around for next time.
+    memmove(buffer_, &buffer_[numInputSamples], NUM_HISTORY_SAMPLES * sizeof(int16_t));
+    phase_ = (uint32_t)position;
+}
+
+}
+
+}
@@ -0,0 +1,441 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "AudioRingBuffer.h"
+#include "AudioMessage.h"
+#include "task/DVTask.h"
+
+#define CURRENT_LOG_TAG ("AudioRingBuffer")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+AudioRingBuffer::AudioRingBuffer(uint32_t capacity, uint32_t maxLeaseSamples)
+    : writeIndex_(0)
+    , producerReadIndex_(0)
+    , writeLeaseSamples_(0)
+    , highWaterMark_(0)
+    , numOverruns_(0)
+    , numOverrunSamples_(0)
+    , readIndex_(0)
+    , consumerWriteIndex_(0)
+    , readLeaseSamples_(0)
+    , numUnderruns_(0)
+    , capacity_(capacity)
+    , maxLeaseSamples_(maxLeaseSamples)
+    , consumer_(nullptr)
+    , notifyThreshold_(1)
+    , notificationPending_(false)
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    , latencyTagWriteCount_(0)
+    , latencyTagReadCount_(0)
+    , hasPendingLatencyTag_(false)
+    , hasLastReadLatencyTag_(false)
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+{
+    assert(capacity > 0);
+    assert(maxLeaseSamples > 0 && maxLeaseSamples <= capacity);
+
+    // The padding after the end of the buffer holds the part of a 
+    // leased span that wraps around.
+    uint32_t numBytes = (capacity_ + maxLeaseSamples_) * sizeof(int16_t);
+    buffer_ = (int16_t*)heap_caps_aligned_alloc(
+        AUDIO_RING_BUFFER_CACHE_LINE_SIZE, numBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr)
+    {
+        ESP_LOGW(CURRENT_LOG_TAG, "Not enough internal RAM for %" PRIu32 " byte ring buffer, using SPIRAM", numBytes);
+        buffer_ = (int16_t*)heap_caps_aligned_alloc(
+            AUDIO_RING_BUFFER_CACHE_LINE_SIZE, numBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    assert(buffer_ != nullptr);
+
+    memset(buffer_, 0, numBytes);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    spinlock_initialize(&latencyLock_);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+    heap_caps_free(buffer_);
+}
+
+uint32_t AudioRingBuffer::getUsed() const
+{
+    clearNotificationPending_();
+
+    // Read index first so that the result is never larger than what the
+    // consumer will actually see.
+    uint32_t readIndex = readIndex_.load(std::memory_order_acquire);
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_acquire);
+    return getUsed_(writeIndex, readIndex);
+}
+
+uint32_t AudioRingBuffer::getFree() const
+{
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_acquire);
+    uint32_t readIndex = readIndex_.load(std::memory_order_acquire);
+    return capacity_ - getUsed_(writeIndex, readIndex);
+}
+
+int16_t* AudioRingBuffer::acquireWrite(uint32_t numSamples)
+{
+    assert(numSamples <= maxLeaseSamples_);
+
+    if (getProducerFree_(numSamples) < numSamples)
+    {
+        numOverruns_.fetch_add(1, std::memory_order_relaxed);
+        numOverrunSamples_.fetch_add(numSamples, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    writeLeaseSamples_ = numSamples;
+    return &buffer_[getOffset_(writeIndex_.load(std::memory_order_relaxed))];
+}
+
+void AudioRingBuffer::commitWrite(uint32_t numSamples)
+{
+    assert(numSamples <= writeLeaseSamples_);
+    writeLeaseSamples_ = 0;
+
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+    uint32_t offset = getOffset_(writeIndex);
+    if (offset + numSamples > capacity_)
+    {
+        // Move the part of the span that landed in the padding
+        // to the beginning of the buffer.
+        memcpy(buffer_, &buffer_[capacity_], (offset + numSamples - capacity_) * sizeof(int16_t));
+    }
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    if (numSamples > 0)
+    {
+        pushLatencyTag_(writeIndex);
+    }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+    writeIndex = advance_(writeIndex, numSamples);
+    writeIndex_.store(writeIndex, std::memory_order_release);
+    onCommitted_(writeIndex);
+}
+
+bool AudioRingBuffer::write(const int16_t* samples, uint32_t numSamples)
+{
+    if (getProducerFree_(numSamples) < numSamples)
+    {
+        numOverruns_.fetch_add(1, std::memory_order_relaxed);
+        numOverrunSamples_.fetch_add(numSamples, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+    uint32_t offset = getOffset_(writeIndex);
+    uint32_t numBeforeEnd = std::min(numSamples, capacity_ - offset);
+    memcpy(&buffer_[offset], samples, numBeforeEnd * sizeof(int16_t));
+    memcpy(buffer_, &samples[numBeforeEnd], (numSamples - numBeforeEnd) * sizeof(int16_t));
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    if (numSamples > 0)
+    {
+        pushLatencyTag_(writeIndex);
+    }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+    writeIndex = advance_(writeIndex, numSamples);
+    writeIndex_.store(writeIndex, std::memory_order_release);
+    onCommitted_(writeIndex);
+
+    return true;
+}
+
+int16_t* AudioRingBuffer::acquireRead(uint32_t numSamples)
+{
+    assert(numSamples <= maxLeaseSamples_);
+
+    if (getConsumerUsed_(numSamples) < numSamples)
+    {
+        numUnderruns_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    uint32_t offset = getOffset_(readIndex_.load(std::memory_order_relaxed));
+    if (offset + numSamples > capacity_)
+    {
+        // Copy the wrapped part of the span into the padding so that
+        // it's contiguous. The producer can't be using the padding
+        // right now since the span hasn't been released yet.
+        memcpy(&buffer_[capacity_], buffer_, (offset + numSamples - capacity_) * sizeof(int16_t));
+    }
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    // Tags are picked up when leased so that the consumer can pass them
+    // along with whatever it produces from the lease.
+    popLatencyTags_(readIndex_.load(std::memory_order_relaxed), numSamples);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+    readLeaseSamples_ = numSamples;
+    return &buffer_[offset];
+}
+
+void AudioRingBuffer::commitRead(uint32_t numSamples)
+{
+    assert(numSamples <= readLeaseSamples_);
+    readLeaseSamples_ = 0;
+
+    uint32_t readIndex = readIndex_.load(std::memory_order_relaxed);
+    readIndex_.store(advance_(readIndex, numSamples), std::memory_order_release);
+}
+
+bool AudioRingBuffer::read(int16_t* samples, uint32_t numSamples)
+{
+    if (getConsumerUsed_(numSamples) < numSamples)
+    {
+        numUnderruns_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t readIndex = readIndex_.load(std::memory_order_relaxed);
+    uint32_t offset = getOffset_(readIndex);
+    uint32_t numBeforeEnd = std::min(numSamples, capacity_ - offset);
+    memcpy(samples, &buffer_[offset], numBeforeEnd * sizeof(int16_t));
+    memcpy(&samples[numBeforeEnd], buffer_, (numSamples - numBeforeEnd) * sizeof(int16_t));
+
+    readIndex_.store(advance_(readIndex, numSamples), std::memory_order_release);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    popLatencyTags_(readIndex, numSamples);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+    return true;
+}
+
+uint32_t AudioRingBuffer::discard(uint32_t numSamples)
+{
+    uint32_t numToDiscard = std::min(numSamples, getConsumerUsed_(numSamples));
+    
+    uint32_t readIndex = readIndex_.load(std::memory_order_relaxed);
+    readIndex_.store(advance_(readIndex, numToDiscard), std::memory_order_release);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    popLatencyTags_(readIndex, numToDiscard);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+    return numToDiscard;
+}
+
+void AudioRingBuffer::getStatistics(Statistics* stats) const
+{
+    assert(stats != nullptr);
+
+    stats->capacity = capacity_;
+    stats->used = getUsed();
+    stats->highWaterMark = highWaterMark_.load(std::memory_order_relaxed);
+    stats->numOverruns = numOverruns_.load(std::memory_order_relaxed);
+    stats->numOverrunSamples = numOverrunSamples_.load(std::memory_order_relaxed);
+    stats->numUnderruns = numUnderruns_.load(std::memory_order_relaxed);
+}
+
+void AudioRingBuffer::setConsumerNotification(task::DVTask* consumer, uint32_t thresholdSamples)
+{
+    notifyThreshold_.store(thresholdSamples, std::memory_order_relaxed);
+    consumer_.store(consumer, std::memory_order_release);
+    clearNotificationPending_();
+}
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+void AudioRingBuffer::setLatencyTag(const AudioLatencyTag& tag)
+{
+    pendingLatencyTag_ = tag;
+    hasPendingLatencyTag_ = true;
+}
+
+bool AudioRingBuffer::takeLatencyTag(AudioLatencyTag* tag)
+{
+    assert(tag != nullptr);
+
+    if (!hasLastReadLatencyTag_)
+    {
+        return false;
+    }
+
+    *tag = lastReadLatencyTag_;
+    hasLastReadLatencyTag_ = false;
+    return true;
+}
+
+void AudioRingBuffer::getLatencyStatistics(task::DVLatencyHistogram* waitTime, bool reset)
+{
+    assert(waitTime != nullptr);
+
+    portENTER_CRITICAL_SAFE(&latencyLock_);
+    *waitTime = waitTime_;
+    if (reset)
+    {
+        waitTime_.reset();
+    }
+    portEXIT_CRITICAL_SAFE(&latencyLock_);
+}
+
+void AudioRingBuffer::pushLatencyTag_(uint32_t writeIndex)
+{
+    if (!hasPendingLatencyTag_)
+    {
+        return;
+    }
+    hasPendingLatencyTag_ = false;
+
+    uint32_t writeCount = latencyTagWriteCount_.load(std::memory_order_relaxed);
+    if (writeCount - latencyTagReadCount_.load(std::memory_order_acquire) >= AUDIO_RING_BUFFER_NUM_LATENCY_TAGS)
+    {
+        // Consumer isn't keeping up; this tag just goes unmeasured.
+        return;
+    }
+
+    auto& entry = latencyTags_[writeCount % AUDIO_RING_BUFFER_NUM_LATENCY_TAGS];
+    entry.tag = pendingLatencyTag_;
+    entry.index = writeIndex;
+    entry.commitTimeUs = esp_timer_get_time();
+    latencyTagWriteCount_.store(writeCount + 1, std::memory_order_release);
+}
+
+void AudioRingBuffer::popLatencyTags_(uint32_t readIndex, uint32_t numSamples)
+{
+    uint32_t readCount = latencyTagReadCount_.load(std::memory_order_relaxed);
+    uint32_t writeCount = latencyTagWriteCount_.load(std::memory_order_acquire);
+    if (readCount == writeCount)
+    {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    while (readCount != writeCount)
+    {
+        auto& entry = latencyTags_[readCount % AUDIO_RING_BUFFER_NUM_LATENCY_TAGS];
+
+        // Tags are in sample order, so stop at the first one that's still
+        // ahead of what was just consumed.
+        if (getUsed_(entry.index, readIndex) >= numSamples)
+        {
+            break;
+        }
+
+        portENTER_CRITICAL_SAFE(&latencyLock_);
+        waitTime_.add(now - entry.commitTimeUs);
+        portEXIT_CRITICAL_SAFE(&latencyLock_);
+
+        lastReadLatencyTag_ = entry.tag;
+        hasLastReadLatencyTag_ = true;
+        readCount++;
+    }
+
+    latencyTagReadCount_.store(readCount, std::memory_order_release);
+}
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+void AudioRingBuffer::onCommitted_(uint32_t writeIndex)
+{
+    uint32_t used = getUsed_(writeIndex, readIndex_.load(std::memory_order_relaxed));
+    if (used > highWaterMark_.load(std::memory_order_relaxed))
+    {
+        highWaterMark_.store(used, std::memory_order_relaxed);
+    }
+
+    // Wake up the consumer unless it hasn't looked at the buffer since the
+    // last notification, which will also cover this commit. The fence pairs
+    // with the one in clearNotificationPending_() so that either we see the
+    // flag cleared or the consumer sees this commit.
+    task::DVTask* consumer = consumer_.load(std::memory_order_acquire);
+    if (consumer != nullptr && used >= notifyThreshold_.load(std::memory_order_relaxed))
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!notificationPending_.load(std::memory_order_relaxed) &&
+            !notificationPending_.exchange(true, std::memory_order_relaxed))
+        {
+            AudioDataAvailableMessage message;
+            consumer->post(&message);
+        }
+    }
+}
+
+void AudioRingBuffer::clearNotificationPending_() const
+{
+    // Must happen before the consumer loads writeIndex_ (see onCommitted_()).
+    if (notificationPending_.load(std::memory_order_relaxed))
+    {
+        notificationPending_.store(false, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+uint32_t AudioRingBuffer::getUsed_(uint32_t writeIndex, uint32_t readIndex) const
+{
+    return writeIndex >= readIndex ? writeIndex - readIndex : writeIndex + 2 * capacity_ - readIndex;
+}
+
+uint32_t AudioRingBuffer::advance_(uint32_t index, uint32_t numSamples) const
+{
+    index += numSamples;
+    if (index >= 2 * capacity_)
+    {
+        index -= 2 * capacity_;
+    }
+    return index;
+}
+
+uint32_t AudioRingBuffer::getProducerFree_(uint32_t numSamplesNeeded)
+{
+    // Only look at the consumer's index (and its cache line) when the
+    // cached copy doesn't show enough space.
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+    uint32_t numFree = capacity_ - getUsed_(writeIndex, producerReadIndex_);
+    if (numFree < numSamplesNeeded)
+    {
+        producerReadIndex_ = readIndex_.load(std::memory_order_acquire);
+        numFree = capacity_ - getUsed_(writeIndex, producerReadIndex_);
+    }
+    return numFree;
+}
+
+uint32_t AudioRingBuffer::getConsumerUsed_(uint32_t numSamplesNeeded)
+{
+    clearNotificationPending_();
+
+    uint32_t readIndex = readIndex_.load(std::memory_order_relaxed);
+    uint32_t numUsed = getUsed_(consumerWriteIndex_, readIndex);
+    if (numUsed < numSamplesNeeded)
+    {
+        consumerWriteIndex_ = writeIndex_.load(std::memory_order_acquire);
+        numUsed = getUsed_(consumerWriteIndex_, readIndex);
+    }
+    return numUsed;
+}
+
+}
+
+}
@@ -0,0 +1,227 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_RING_BUFFER_H
+#define AUDIO_RING_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(ESP_PLATFORM)
+#include "sdkconfig.h"
+#endif // defined(ESP_PLATFORM)
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+#include "freertos/FreeRTOS.h"
+#include "task/DVLatencyHistogram.h"
+
+// Maximum number of tags in flight in a single buffer. Tags are sent a 
+// few times a second at most, so this only fills up if the consumer stalls.
+#define AUDIO_RING_BUFFER_NUM_LATENCY_TAGS (8)
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+// Largest span that can be leased at once. Large enough for a full 
+// FreeDV modem or speech frame in any of the supported modes.
+#define DEFAULT_MAX_LEASE_SAMPLES (2048)
+
+// Producer and consumer state are kept on separate cache lines so that
+// the two cores don't keep invalidating each other's copies.
+#define AUDIO_RING_BUFFER_CACHE_LINE_SIZE (64)
+
+namespace ezdv
+{
+
+namespace task
+{
+    class DVTask;
+}
+
+namespace audio
+{
+
+/// @brief Marks a sample for end-to-end latency measurement (see AudioLatency.h).
+struct AudioLatencyTag
+{
+    const char* origin; // where the audio entered the system, e.g. "TLV320 mic"
+    int64_t captureTimeUs; // esp_timer_get_time() when the sample was captured
+};
+
+/// @brief Lock-free single-producer/single-consumer ring buffer for audio samples.
+///
+/// Besides copying reads and writes, producers and consumers can lease a contiguous
+/// span of the buffer (acquireWrite()/acquireRead()), work on it in place and then
+/// commit it. Spans that would wrap around the end of the buffer are made contiguous
+/// using a padding area after the end of the buffer, so leases never need to be 
+/// split. Only one task may produce and only one (other) task may consume at a time.
+///
+/// Failed acquires, reads and writes are counted as overruns (producer) or underruns
+/// (consumer). Callers that just want to wait for space or data should check 
+/// getFree()/getUsed() first.
+///
+/// The consumer can also ask to be sent an AudioDataAvailableMessage whenever
+/// the producer commits audio, so that it doesn't need to poll. Only one
+/// notification is sent until the consumer next checks how much audio is
+/// waiting (getUsed(), reads and leases) or calls setConsumerNotification().
+class AudioRingBuffer
+{
+public:
+    struct Statistics
+    {
+        uint32_t capacity;
+        uint32_t used;
+        uint32_t highWaterMark; // most samples ever waiting at once
+        uint32_t numOverruns; // failed producer acquires/writes
+        uint32_t numOverrunSamples; // samples the producer couldn't write
+        uint32_t numUnderruns; // failed consumer acquires/reads
+    };
+
+    /// @brief Creates a new ring buffer, preferably in internal RAM.
+    /// @param capacity The maximum number of samples that can be waiting at once.
+    /// @param maxLeaseSamples The largest span that can be leased at once.
+    AudioRingBuffer(uint32_t capacity, uint32_t maxLeaseSamples = DEFAULT_MAX_LEASE_SAMPLES);
+    ~AudioRingBuffer();
+
+    uint32_t getCapacity() const { return capacity_; }
+    uint32_t getMaxLeaseSamples() const { return maxLeaseSamples_; }
+
+    /// @brief Returns the number of samples waiting to be read.
+    uint32_t getUsed() const;
+
+    /// @brief Returns the number of samples that can currently be written.
+    uint32_t getFree() const;
+
+    /// @brief Leases space for exactly numSamples samples (producer only).
+    /// @return Pointer to the leased span, or nullptr if there isn't enough space.
+    int16_t* acquireWrite(uint32_t numSamples);
+
+    /// @brief Makes the first numSamples samples of the current write lease
+    ///        visible to the consumer (producer only).
+    void commitWrite(uint32_t numSamples);
+
+    /// @brief Writes all of the given samples, or none if there isn't enough space (producer only).
+    bool write(const int16_t* samples, uint32_t numSamples);
+
+    /// @brief Leases exactly numSamples waiting samples (consumer only). The 
+    ///        consumer may modify the span in place.
+    /// @return Pointer to the leased span, or nullptr if not enough samples are waiting.
+    int16_t* acquireRead(uint32_t numSamples);
+
+    /// @brief Releases the first numSamples samples of the current read lease
+    ///        back to the producer (consumer only).
+    void commitRead(uint32_t numSamples);
+
+    /// @brief Reads exactly numSamples samples, or none if not enough are waiting (consumer only).
+    bool read(int16_t* samples, uint32_t numSamples);
+
+    /// @brief Throws away up to numSamples waiting samples (consumer only). Not counted as an underrun.
+    /// @return The number of samples discarded.
+    uint32_t discard(uint32_t numSamples = UINT32_MAX);
+
+    /// @brief Retrieves usage statistics. Safe to call from any task.
+    void getStatistics(Statistics* stats) const;
+
+    /// @brief Requests an AudioDataAvailableMessage be posted to the given task 
+    ///        whenever a write or commit leaves at least thresholdSamples waiting. 
+    ///        Can be called at any time (e.g. to change the threshold as the amount 
+    ///        of audio the consumer needs changes).
+    /// @param consumer The task to notify, or nullptr to disable notifications.
+    /// @param thresholdSamples The minimum number of samples to notify for.
+    void setConsumerNotification(task::DVTask* consumer, uint32_t thresholdSamples = 1);
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    /// @brief Attaches a latency tag to the next sample written (producer only).
+    ///        Only the most recent tag set before a write is kept.
+    void setLatencyTag(const AudioLatencyTag& tag);
+
+    /// @brief Retrieves the newest tag whose sample has been read, leased or 
+    ///        discarded since the last call (consumer only).
+    /// @return true if a tag was retrieved, false otherwise.
+    bool takeLatencyTag(AudioLatencyTag* tag);
+
+    /// @brief Retrieves how long tagged samples spent waiting in this buffer. 
+    ///        Safe to call from any task.
+    /// @param waitTime The histogram to copy into.
+    /// @param reset Whether to clear the statistics afterward.
+    void getLatencyStatistics(task::DVLatencyHistogram* waitTime, bool reset);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+private:
+    // Indices run from 0 to 2 * capacity_ - 1 so that a full buffer can be
+    // told apart from an empty one without requiring a power of two capacity.
+    alignas(AUDIO_RING_BUFFER_CACHE_LINE_SIZE) std::atomic<uint32_t> writeIndex_;
+    uint32_t producerReadIndex_; // producer's cached copy of readIndex_
+    uint32_t writeLeaseSamples_;
+    std::atomic<uint32_t> highWaterMark_;
+    std::atomic<uint32_t> numOverruns_;
+    std::atomic<uint32_t> numOverrunSamples_;
+
+    alignas(AUDIO_RING_BUFFER_CACHE_LINE_SIZE) std::atomic<uint32_t> readIndex_;
+    uint32_t consumerWriteIndex_; // consumer's cached copy of writeIndex_
+    uint32_t readLeaseSamples_;
+    std::atomic<uint32_t> numUnderruns_;
+
+    alignas(AUDIO_RING_BUFFER_CACHE_LINE_SIZE) int16_t* buffer_;
+    uint32_t capacity_;
+    uint32_t maxLeaseSamples_;
+    std::atomic<task::DVTask*> consumer_;
+    std::atomic<uint32_t> notifyThreshold_;
+    mutable std::atomic<bool> notificationPending_; // set by producer, cleared by consumer
+
+    uint32_t getUsed_(uint32_t writeIndex, uint32_t readIndex) const;
+    uint32_t getOffset_(uint32_t index) const { return index < capacity_ ? index : index - capacity_; }
+    uint32_t advance_(uint32_t index, uint32_t numSamples) const;
+
+    uint32_t getProducerFree_(uint32_t numSamplesNeeded);
+    uint32_t getConsumerUsed_(uint32_t numSamplesNeeded);
+
+    void onCommitted_(uint32_t writeIndex);
+    void clearNotificationPending_() const;
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    struct LatencyTagEntry
+    {
+        AudioLatencyTag tag;
+        uint32_t index; // buffer index of the tagged sample
+        int64_t commitTimeUs;
+    };
+
+    // Written by the producer before it publishes the tagged sample, so the 
+    // consumer always sees a tag no later than the sample itself.
+    LatencyTagEntry latencyTags_[AUDIO_RING_BUFFER_NUM_LATENCY_TAGS];
+    std::atomic<uint32_t> latencyTagWriteCount_;
+    std::atomic<uint32_t> latencyTagReadCount_;
+
+    // Producer only.
+    AudioLatencyTag pendingLatencyTag_;
+    bool hasPendingLatencyTag_;
+
+    // Consumer only (except for the statistics, which are under latencyLock_).
+    AudioLatencyTag lastReadLatencyTag_;
+    bool hasLastReadLatencyTag_;
+    task::DVLatencyHistogram waitTime_;
+    portMUX_TYPE latencyLock_;
+
+    void pushLatencyTag_(uint32_t writeIndex);
+    void popLatencyTags_(uint32_t readIndex, uint32_t numSamples);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+};
+
+}
+
+}
+
+#endif // AUDIO_RING_BUFFER_H
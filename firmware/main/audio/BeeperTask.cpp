@@ -82,7 +82,7 @@ std::map<char, std::string> BeeperTask::CharacterToMorse_ = {
 
 BeeperTask::BeeperTask()
     : DVTask("BeeperTask", 10, 4096, tskNO_AFFINITY, 16, pdMS_TO_TICKS(10))
-    , AudioInput(1, 1) // we don't need the input FIFO, just the output one
+    , AudioInput(0, 1) // we don't need an input FIFO, just the output one
     , beeperTimer_(this, this, &BeeperTask::onTimerTick_, BEEPER_TIMER_TICK_US, "BeeperTimer")
     , sineGenerator_(CW_SIDETONE_FREQ_HZ, 10000)
     , sineCounter_(0)
@@ -145,7 +145,8 @@ void BeeperTask::onClearBeeperText_(DVTask* origin, ClearBeeperTextMessage* mess
 void BeeperTask::onTimerTick_(DVTimer*)
 {
     // TBD -- assuming 8KHz sample rate
-    struct FIFO* outputFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
+    latchAudioOutputs();
+    AudioRingBuffer* outputFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
 
     if (beeperList_.size() > 0)
     {
@@ -167,7 +168,7 @@ void BeeperTask::onTimerTick_(DVTimer*)
             memset(bufToQueue, 0, sizeof(bufToQueue));
         }
 
-        codec2_fifo_write(outputFifo, bufToQueue, sizeof(bufToQueue) / sizeof(short));
+        outputFifo->write(bufToQueue, sizeof(bufToQueue) / sizeof(short));
     }
     else
     {
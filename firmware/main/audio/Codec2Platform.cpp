@@ -0,0 +1,91 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Platform hooks Codec2 expects to be provided by the application when
+// built with __EMBEDDED__. These are shared by FreeDVTask and anything
+// else that runs a modem (including host builds).
+
+#include <cstddef>
+
+#include "esp_heap_caps.h"
+#include "codec2_math.h"
+
+#if defined(ESP_PLATFORM)
+#include "esp_dsp.h"
+#endif // defined(ESP_PLATFORM)
+
+// Implement required Codec2 math methods below as CMSIS doesn't work on ESP32.
+extern "C"
+{
+    void codec2_dot_product_f32(float* left, float* right, size_t len, float* result)
+    {
+#if defined(ESP_PLATFORM)
+        dsps_dotprod_f32(left, right, result, len);
+#else
+        float sum = 0;
+        for (size_t index = 0; index < len; index++)
+        {
+            sum += left[index] * right[index];
+        }
+        *result = sum;
+#endif // defined(ESP_PLATFORM)
+    }
+
+    void codec2_complex_dot_product_f32(COMP* left, COMP* right, size_t len, float* resultReal, float* resultImag)
+    {
+        float realTimesRealResult = 0; // ac
+        float realTimesImag1Result = 0; // bc
+        float realTimesImag2Result = 0; // ad
+        float imagTimesImagResult = 0; // bi * di
+        
+#if defined(ESP_PLATFORM)
+        dsps_dotprode_f32((float*)left, (float*)right, &realTimesRealResult, len, 2, 2);
+        dsps_dotprode_f32((float*)left + 1, (float*)right, &realTimesImag1Result, len, 2, 2);
+        dsps_dotprode_f32((float*)left, (float*)right + 1, &realTimesImag2Result, len, 2, 2);
+        dsps_dotprode_f32((float*)left + 1, (float*)right + 1, &imagTimesImagResult, len, 2, 2);
+#else
+        for (size_t index = 0; index < len; index++)
+        {
+            realTimesRealResult += left[index].real * right[index].real;
+            realTimesImag1Result += left[index].imag * right[index].real;
+            realTimesImag2Result += left[index].real * right[index].imag;
+            imagTimesImagResult += left[index].imag * right[index].imag;
+        }
+#endif // defined(ESP_PLATFORM)
+        
+        *resultReal = realTimesRealResult - imagTimesImagResult;
+        *resultImag = realTimesImag1Result + realTimesImag2Result;
+    }
+
+    /* Required memory allocation wrapper for embedded platforms. For ezDV, we want to allocate as much as possible
+    on external RAM. */
+
+    void* codec2_malloc(size_t size)
+    {
+        return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    }
+
+    void* codec2_calloc(size_t nmemb, size_t size)
+    {
+        return heap_caps_calloc(nmemb, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    }
+
+    void codec2_free(void* ptr)
+    {
+        heap_caps_free(ptr);
+    }
+}
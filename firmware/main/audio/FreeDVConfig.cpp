@@ -0,0 +1,99 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "FreeDVConfig.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+int GetFreeDVApiMode(FreeDVMode mode)
+{
+    switch (mode)
+    {
+        case FREEDV_700D:
+            return FREEDV_MODE_700D;
+        case FREEDV_700E:
+            return FREEDV_MODE_700E;
+        case FREEDV_1600:
+            return FREEDV_MODE_1600;
+        default:
+            assert(0);
+            return FREEDV_MODE_700D;
+    }
+}
+
+struct freedv* OpenFreeDV(FreeDVMode mode)
+{
+    struct freedv* dv = freedv_open(GetFreeDVApiMode(mode));
+    assert(dv != nullptr);
+
+    switch (mode)
+    {
+        case FREEDV_700D:
+        case FREEDV_700E:
+            freedv_set_eq(dv, 1);
+            freedv_set_clip(dv, 1);
+            freedv_set_tx_bpf(dv, 1);
+            break;
+        case FREEDV_1600:
+        default:
+            freedv_set_clip(dv, 0);
+            freedv_set_tx_bpf(dv, 0);
+            break;
+    }
+
+    bool squelchEnabled = false;
+    float squelchThresholdDb = 0;
+    GetFreeDVSquelch(mode, &squelchEnabled, &squelchThresholdDb);
+    freedv_set_squelch_en(dv, squelchEnabled ? 1 : 0);
+    freedv_set_snr_squelch_thresh(dv, squelchThresholdDb);
+
+    return dv;
+}
+
+void GetFreeDVSquelch(FreeDVMode mode, bool* enabled, float* thresholdDb)
+{
+    switch (mode)
+    {
+        case FREEDV_700D:
+            *enabled = true;
+            *thresholdDb = -2.0;  /* squelch at -2.0 dB      */
+            break;
+        case FREEDV_700E:
+            *enabled = true;
+            *thresholdDb = 1.0;  /* squelch at 1.0 dB      */
+            break;
+        case FREEDV_1600:
+            *enabled = false;
+            *thresholdDb = 0.0;
+            break;
+        default:
+            assert(0);
+            *enabled = true;
+            *thresholdDb = 0.0;  /* squelch at 0.0 dB      */
+            break;
+    }
+}
+
+}
+
+}
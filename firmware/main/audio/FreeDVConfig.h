@@ -0,0 +1,48 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_CONFIG_H
+#define FREEDV_CONFIG_H
+
+#include "FreeDVMessage.h"
+
+#include "freedv_api.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Returns the FreeDV API mode (FREEDV_MODE_*) for one of ezDV's digital modes.
+int GetFreeDVApiMode(FreeDVMode mode);
+
+/// @brief Opens a modem configured the way ezDV uses it on the air (equalizer,
+///        clipping, TX filter and squelch).
+/// @param mode The digital mode to open. Must not be ANALOG or FREEDV_SCAN.
+struct freedv* OpenFreeDV(FreeDVMode mode);
+
+/// @brief Retrieves the squelch settings for the given mode. FreeDV only 
+///        applies these itself in freedv_rx(), so users of freedv_codecrx()
+///        need to apply them on their own.
+void GetFreeDVSquelch(FreeDVMode mode, bool* enabled, float* thresholdDb);
+
+}
+
+}
+
+#endif // FREEDV_CONFIG_H
@@ -20,4 +20,17 @@
 extern "C"
 {
     DV_EVENT_DEFINE_BASE(FREEDV_MESSAGE);
-}
\ No newline at end of file
+}
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+DVStateTopic<bool> FreeDVSyncStateTopic(false);
+DVStateTopic<FreeDVMode> FreeDVModeTopic(ANALOG);
+
+}
+
+}
@@ -20,6 +20,7 @@
 
 #include <cstring>
 #include "task/DVTaskMessage.h"
+#include "task/DVStateTopic.h"
 
 extern "C"
 {
@@ -40,7 +41,6 @@ enum FreeDVMessageTypes
     SET_FREEDV_MODE = 2,
     SET_PTT_STATE = 3,
     REQUEST_SET_FREEDV_MODE = 4,
-    REQUEST_GET_FREEDV_MODE = 5,
     FREEDV_RX_CALLSIGN = 6,
 
     // Indicates that we've processed all remaining input and 
@@ -48,11 +48,11 @@ enum FreeDVMessageTypes
     TX_COMPLETE = 7,
 };
 
-class FreeDVSyncStateMessage : public DVTaskMessageBase<SYNC_STATE, FreeDVSyncStateMessage>
+class FreeDVSyncStateMessage : public DVTaskMessageBase<SYNC_STATE, FreeDVSyncStateMessage, PRIORITY_CONTROL, OVERFLOW_COALESCE_LATEST>
 {
 public:
     FreeDVSyncStateMessage(bool syncStateProvided = false)
-        : DVTaskMessageBase<SYNC_STATE, FreeDVSyncStateMessage>(FREEDV_MESSAGE)
+        : DVTaskMessageBase<SYNC_STATE, FreeDVSyncStateMessage, PRIORITY_CONTROL, OVERFLOW_COALESCE_LATEST>(FREEDV_MESSAGE)
         , syncState(syncStateProvided)
         {}
     virtual ~FreeDVSyncStateMessage() = default;
@@ -66,6 +66,7 @@ enum FreeDVMode
     FREEDV_700D,
     FREEDV_700E,
     FREEDV_1600,
+    FREEDV_SCAN, // detect 700D/700E/1600 automatically, then switch to it
 
     MAX_FREEDV_MODES
 };
@@ -86,15 +87,6 @@ public:
 using SetFreeDVModeMessage = FreeDVModeMessageCommon<SET_FREEDV_MODE>;
 using RequestSetFreeDVModeMessage = FreeDVModeMessageCommon<REQUEST_SET_FREEDV_MODE>;
 
-class RequestGetFreeDVModeMessage : public DVTaskMessageBase<REQUEST_GET_FREEDV_MODE, RequestGetFreeDVModeMessage>
-{
-public:
-    RequestGetFreeDVModeMessage()
-        : DVTaskMessageBase<REQUEST_GET_FREEDV_MODE, RequestGetFreeDVModeMessage>(FREEDV_MESSAGE)
-        {}
-    virtual ~RequestGetFreeDVModeMessage() = default;
-};
-
 class FreeDVSetPTTStateMessage : public DVTaskMessageBase<SET_PTT_STATE, FreeDVSetPTTStateMessage>
 {
 public:
@@ -135,6 +127,10 @@ public:
     virtual ~TransmitCompleteMessage() = default;
 };
 
+// Current FreeDV state. Published by FreeDVTask; readable from any task.
+extern DVStateTopic<bool> FreeDVSyncStateTopic;
+extern DVStateTopic<FreeDVMode> FreeDVModeTopic;
+
 }
 
 }
@@ -0,0 +1,275 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "FreeDVConfig.h"
+#include "FreeDVModeScanner.h"
+
+// Enough for a couple of frames of the slowest mode in case the other 
+// core falls behind for a bit.
+#define FREEDV_SCAN_FIFO_SAMPLES (4000)
+
+#define CURRENT_LOG_TAG ("FreeDVScan")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+// The OFDM modes (700D/700E) are by far the most expensive to demodulate,
+// so they go on different workers. 1600 is cheap and shares with 700E.
+static const struct
+{
+    FreeDVMode mode;
+    int worker;
+} CandidateModes_[FREEDV_SCAN_NUM_CANDIDATES] = {
+    { FREEDV_700D, 0 },
+    { FREEDV_700E, 1 },
+    { FREEDV_1600, 1 },
+};
+
+FreeDVModeScanner::FreeDVModeScanner()
+    : isScanning_(false)
+    , lockedMode_(ANALOG)
+{
+    for (int index = 0; index < FREEDV_SCAN_NUM_CANDIDATES; index++)
+    {
+        auto& candidate = candidates_[index];
+        candidate.mode = CandidateModes_[index].mode;
+        candidate.worker = CandidateModes_[index].worker;
+        candidate.dv = nullptr;
+        candidate.fifo = nullptr;
+        candidate.framesInSync = 0;
+        candidate.numFrames = 0;
+        candidate.numSamples = 0;
+    }
+
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        workerSemaphores_[worker] = xSemaphoreCreateMutex();
+        assert(workerSemaphores_[worker] != nullptr);
+    }
+}
+
+FreeDVModeScanner::~FreeDVModeScanner()
+{
+    stop();
+
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        vSemaphoreDelete(workerSemaphores_[worker]);
+    }
+}
+
+void FreeDVModeScanner::start()
+{
+    stop();
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Starting mode scan");
+
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        auto rv = xSemaphoreTake(workerSemaphores_[worker], portMAX_DELAY);
+        assert(rv == pdTRUE);
+    }
+
+    for (auto& candidate : candidates_)
+    {
+        candidate.dv = OpenFreeDV(candidate.mode);
+        assert((freedv_get_bits_per_modem_frame(candidate.dv) + 7) / 8 <= FREEDV_SCAN_MAX_BYTES_PER_FRAME);
+
+        candidate.fifo = new AudioRingBuffer(FREEDV_SCAN_FIFO_SAMPLES);
+        assert(candidate.fifo != nullptr);
+        assert((uint32_t)freedv_get_n_max_modem_samples(candidate.dv) <= candidate.fifo->getMaxLeaseSamples());
+
+        candidate.framesInSync = 0;
+    }
+
+    lockedMode_.store(ANALOG, std::memory_order_release);
+    isScanning_.store(true, std::memory_order_release);
+
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        xSemaphoreGive(workerSemaphores_[worker]);
+    }
+}
+
+void FreeDVModeScanner::stop()
+{
+    stop_(ANALOG);
+}
+
+struct freedv* FreeDVModeScanner::takeLockedModem()
+{
+    FreeDVMode lockedMode = getLockedMode();
+    if (lockedMode == ANALOG)
+    {
+        return nullptr;
+    }
+
+    return stop_(lockedMode);
+}
+
+void FreeDVModeScanner::write(const short* samples, uint32_t numSamples)
+{
+    if (!isScanning() || getLockedMode() != ANALOG)
+    {
+        return;
+    }
+
+    for (auto& candidate : candidates_)
+    {
+        // If a worker falls behind, its candidates just miss some audio
+        // (counted as an overrun) and have to re-acquire.
+        candidate.fifo->write(samples, numSamples);
+    }
+}
+
+void FreeDVModeScanner::process(int worker)
+{
+    assert(worker >= 0 && worker < FREEDV_SCAN_NUM_WORKERS);
+
+    auto rv = xSemaphoreTake(workerSemaphores_[worker], portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    if (isScanning())
+    {
+        for (auto& candidate : candidates_)
+        {
+            if (candidate.worker == worker)
+            {
+                processCandidate_(&candidate);
+            }
+        }
+    }
+
+    xSemaphoreGive(workerSemaphores_[worker]);
+}
+
+void FreeDVModeScanner::getStatistics(std::vector<CandidateStatistics>& stats, bool reset)
+{
+    stats.clear();
+
+    for (auto& candidate : candidates_)
+    {
+        auto rv = xSemaphoreTake(workerSemaphores_[candidate.worker], portMAX_DELAY);
+        assert(rv == pdTRUE);
+
+        CandidateStatistics candidateStats;
+        candidateStats.mode = candidate.mode;
+        candidateStats.worker = candidate.worker;
+        candidateStats.numFrames = candidate.numFrames;
+        candidateStats.numSamples = candidate.numSamples;
+        candidateStats.demodTime = candidate.demodTime;
+        stats.push_back(candidateStats);
+
+        if (reset)
+        {
+            candidate.numFrames = 0;
+            candidate.numSamples = 0;
+            candidate.demodTime.reset();
+        }
+
+        xSemaphoreGive(workerSemaphores_[candidate.worker]);
+    }
+}
+
+void FreeDVModeScanner::processCandidate_(Candidate* candidate)
+{
+    uint32_t numInputSamples = freedv_nin(candidate->dv);
+    while (getLockedMode() == ANALOG && candidate->fifo->getUsed() >= numInputSamples)
+    {
+        short* inputBuf = candidate->fifo->acquireRead(numInputSamples);
+
+        auto timeBegin = esp_timer_get_time();
+        freedv_codecrx(candidate->dv, candidate->codecBits, inputBuf);
+        auto timeEnd = esp_timer_get_time();
+
+        candidate->fifo->commitRead(numInputSamples);
+
+        candidate->numFrames++;
+        candidate->numSamples += numInputSamples;
+        candidate->demodTime.add((uint32_t)(timeEnd - timeBegin));
+
+        int rxStatus = freedv_get_rx_status(candidate->dv);
+        if ((rxStatus & FREEDV_RX_SYNC) == 0)
+        {
+            candidate->framesInSync = 0;
+        }
+        else if ((rxStatus & FREEDV_RX_BITS) && ++candidate->framesInSync >= FREEDV_SCAN_FRAMES_TO_LOCK)
+        {
+            // Whichever candidate gets here first wins.
+            int expected = ANALOG;
+            if (lockedMode_.compare_exchange_strong(expected, candidate->mode, std::memory_order_acq_rel))
+            {
+                ESP_LOGI(CURRENT_LOG_TAG, "Locked onto mode %d", (int)candidate->mode);
+            }
+        }
+
+        numInputSamples = freedv_nin(candidate->dv);
+    }
+}
+
+struct freedv* FreeDVModeScanner::stop_(FreeDVMode keepMode)
+{
+    struct freedv* keptDv = nullptr;
+
+    // Wait for any in progress demodulation to finish before pulling
+    // the modems out from under the workers.
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        auto rv = xSemaphoreTake(workerSemaphores_[worker], portMAX_DELAY);
+        assert(rv == pdTRUE);
+    }
+
+    isScanning_.store(false, std::memory_order_release);
+
+    for (auto& candidate : candidates_)
+    {
+        if (candidate.dv != nullptr)
+        {
+            if (candidate.mode == keepMode)
+            {
+                keptDv = candidate.dv;
+            }
+            else
+            {
+                freedv_close(candidate.dv);
+            }
+            candidate.dv = nullptr;
+        }
+
+        delete candidate.fifo;
+        candidate.fifo = nullptr;
+    }
+
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        xSemaphoreGive(workerSemaphores_[worker]);
+    }
+
+    return keptDv;
+}
+
+}
+
+}
@@ -0,0 +1,140 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_MODE_SCANNER_H
+#define FREEDV_MODE_SCANNER_H
+
+#include <atomic>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "AudioRingBuffer.h"
+#include "FreeDVMessage.h"
+#include "task/DVLatencyHistogram.h"
+
+#include "freedv_api.h"
+
+// Demodulators are split between the two cores: worker 0 runs on whichever
+// task is feeding the scanner and worker 1 runs on the other core.
+#define FREEDV_SCAN_NUM_WORKERS 2
+#define FREEDV_SCAN_NUM_CANDIDATES 3
+
+// Number of consecutive synced frames with valid bits before a candidate
+// is accepted. A single frame is too easy to get by chance from noise
+// (or from a neighboring mode's signal).
+#define FREEDV_SCAN_FRAMES_TO_LOCK 3
+
+#define FREEDV_SCAN_MAX_BYTES_PER_FRAME 32
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Runs several FreeDV demodulators over the same radio audio to
+///        figure out which mode is on the air.
+///
+/// The producer writes audio with write(), which copies it into one FIFO
+/// per candidate mode. Each worker then calls process() to demodulate
+/// whatever's waiting for the candidates assigned to it. Once a candidate
+/// has been in sync long enough, the scan locks onto it and the other 
+/// candidates stop; the producer then takes over the winning modem with
+/// takeLockedModem().
+///
+/// start(), stop(), write() and takeLockedModem() must all be called from
+/// the same task. process() may be called from any task.
+class FreeDVModeScanner
+{
+public:
+    struct CandidateStatistics
+    {
+        FreeDVMode mode;
+        int worker;
+        uint32_t numFrames; // modem frames demodulated
+        uint32_t numSamples; // audio samples demodulated
+        task::DVLatencyHistogram demodTime; // per freedv_codecrx() call
+    };
+
+    FreeDVModeScanner();
+    ~FreeDVModeScanner();
+
+    /// @brief Opens all candidate modems and starts scanning.
+    void start();
+
+    /// @brief Stops scanning and closes all candidate modems.
+    void stop();
+
+    /// @brief Returns whether a scan is in progress (including one that has
+    ///        locked but whose modem hasn't been taken yet).
+    bool isScanning() const { return isScanning_.load(std::memory_order_acquire); }
+
+    /// @brief Queues radio audio for every candidate still running.
+    void write(const short* samples, uint32_t numSamples);
+
+    /// @brief Demodulates all queued audio for the candidates on the given worker.
+    /// @param worker The worker number (0 to FREEDV_SCAN_NUM_WORKERS - 1).
+    void process(int worker);
+
+    /// @brief Returns the mode the scan has locked onto, or ANALOG if it hasn't yet.
+    FreeDVMode getLockedMode() const { return (FreeDVMode)lockedMode_.load(std::memory_order_acquire); }
+
+    /// @brief Stops scanning and hands over the modem the scan locked onto.
+    ///        The caller becomes responsible for closing it.
+    /// @return The locked modem, or nullptr if the scan hasn't locked.
+    struct freedv* takeLockedModem();
+
+    /// @brief Retrieves per-candidate statistics. Safe to call from any task.
+    /// @param stats The vector to fill in.
+    /// @param reset Whether to clear the statistics afterward.
+    void getStatistics(std::vector<CandidateStatistics>& stats, bool reset);
+
+private:
+    struct Candidate
+    {
+        FreeDVMode mode;
+        int worker;
+        struct freedv* dv;
+        AudioRingBuffer* fifo;
+        int framesInSync;
+        uint8_t codecBits[FREEDV_SCAN_MAX_BYTES_PER_FRAME]; // demodulated bits are thrown away
+
+        uint32_t numFrames;
+        uint32_t numSamples;
+        task::DVLatencyHistogram demodTime;
+    };
+
+    Candidate candidates_[FREEDV_SCAN_NUM_CANDIDATES];
+    SemaphoreHandle_t workerSemaphores_[FREEDV_SCAN_NUM_WORKERS];
+    std::atomic<bool> isScanning_;
+    std::atomic<int> lockedMode_;
+
+    /// @brief Demodulates everything waiting for one candidate.
+    void processCandidate_(Candidate* candidate);
+
+    /// @brief Stops all workers and closes every candidate except the given mode.
+    /// @return The modem for keepMode, or nullptr if there isn't one.
+    struct freedv* stop_(FreeDVMode keepMode);
+};
+
+}
+
+}
+
+#endif // FREEDV_MODE_SCANNER_H
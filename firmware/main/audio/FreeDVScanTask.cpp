@@ -0,0 +1,65 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FreeDVScanTask.h"
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+FreeDVScanTask::FreeDVScanTask()
+    // Same core as FreeDVSpeechTask, which is idle while scanning. Stack 
+    // is sized the same as FreeDVTask's as it runs the same demodulators.
+    : DVTask("FreeDVScanTask", 15, 47000, 1, 16)
+{
+    registerMessageHandler(this, &FreeDVScanTask::onAudioDataAvailable_);
+}
+
+FreeDVScanTask::~FreeDVScanTask()
+{
+    // empty
+}
+
+void FreeDVScanTask::notify()
+{
+    if (scanner_.isScanning())
+    {
+        AudioDataAvailableMessage message;
+        post(&message);
+    }
+}
+
+void FreeDVScanTask::onTaskStart_()
+{
+    // empty
+}
+
+void FreeDVScanTask::onTaskSleep_()
+{
+    // empty
+}
+
+void FreeDVScanTask::onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message)
+{
+    scanner_.process(FREEDV_SCAN_WORKER_SCAN_TASK);
+}
+
+}
+
+}
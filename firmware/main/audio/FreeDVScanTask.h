@@ -0,0 +1,67 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_SCAN_TASK_H
+#define FREEDV_SCAN_TASK_H
+
+#include "AudioMessage.h"
+#include "FreeDVModeScanner.h"
+#include "task/DVTask.h"
+
+// Worker numbers used with FreeDVModeScanner::process().
+#define FREEDV_SCAN_WORKER_FREEDV_TASK 0
+#define FREEDV_SCAN_WORKER_SCAN_TASK 1
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Runs the second half of FREEDV_SCAN's demodulators on the core
+///        opposite FreeDVTask. FreeDVTask feeds the scanner and runs the
+///        other half itself. FreeDVTask also starts this task when a scan
+///        begins and puts it to sleep when the scan ends.
+class FreeDVScanTask : public DVTask
+{
+public:
+    FreeDVScanTask();
+    virtual ~FreeDVScanTask();
+
+    /// @brief Returns the scanner shared with FreeDVTask.
+    FreeDVModeScanner* getScanner() { return &scanner_; }
+
+    /// @brief Wakes up the task to demodulate newly written audio.
+    void notify();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    FreeDVModeScanner scanner_;
+
+    void onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message);
+};
+
+}
+
+}
+
+#endif // FREEDV_SCAN_TASK_H
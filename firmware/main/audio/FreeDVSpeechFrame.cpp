@@ -0,0 +1,133 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "esp_log.h"
+
+#include "FreeDVSpeechFrame.h"
+
+#define CURRENT_LOG_TAG ("FreeDVSpeech")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief Copies numBits bits starting at startBit into out, MSB first.
+static void ExtractBits_(const uint8_t* in, int startBit, int numBits, uint8_t* out)
+{
+    memset(out, 0, (numBits + 7) / 8);
+    for (int index = 0; index < numBits; index++)
+    {
+        int inBit = startBit + index;
+        if (in[inBit >> 3] & (0x80 >> (inBit & 7)))
+        {
+            out[index >> 3] |= 0x80 >> (index & 7);
+        }
+    }
+}
+
+bool DemodulateFreeDVFrame(struct freedv* dv, bool squelchEnabled, float squelchThresholdDb, short* inputBuf, FreeDVSpeechFrame* frame)
+{
+    uint32_t numInputSamples = freedv_nin(dv);
+    bool hasFrame = true;
+
+    // Only demodulation and FEC happen here. Codec2 decoding (and 
+    // therefore squelch, which freedv_rx() would normally handle) is 
+    // done separately, e.g. by the speech task on the other core.
+    //auto timeBegin = esp_timer_get_time();
+    int numBytes = freedv_codecrx(dv, frame->codecBits, inputBuf);
+    //auto timeEnd = esp_timer_get_time();
+    //ESP_LOGI(CURRENT_LOG_TAG, "freedv_codecrx ran in %lld us on %d samples", timeEnd - timeBegin, (int)numInputSamples);
+
+    int rxStatus = freedv_get_rx_status(dv);
+    if (rxStatus & FREEDV_RX_SYNC)
+    {
+        int sync = 0;
+        float snr = 0;
+        freedv_get_modem_stats(dv, &sync, &snr);
+
+        // Synced frames without bits (e.g. while 700D is still filling
+        // its interleaver) don't produce any audio.
+        hasFrame = numBytes > 0;
+        frame->type = 
+            (!squelchEnabled || snr > squelchThresholdDb) ? 
+            FreeDVSpeechFrame::CODEC_BITS : 
+            FreeDVSpeechFrame::SILENCE;
+        frame->numSamples = freedv_get_n_speech_samples(dv);
+        frame->numBits = freedv_get_bits_per_modem_frame(dv);
+    }
+    else if (!squelchEnabled)
+    {
+        // Pass through received audio so we can hear what's going on,
+        // e.g. during tuning.
+        frame->type = FreeDVSpeechFrame::AUDIO;
+        frame->numSamples = numInputSamples;
+        memcpy(frame->audio, inputBuf, numInputSamples * sizeof(short));
+    }
+    else
+    {
+        frame->type = FreeDVSpeechFrame::SILENCE;
+        frame->numSamples = numInputSamples;
+    }
+
+    return hasFrame;
+}
+
+void DecodeFreeDVSpeechFrame(struct CODEC2* codec2, const FreeDVSpeechFrame* frame, short* outputBuf)
+{
+    switch (frame->type)
+    {
+        case FreeDVSpeechFrame::CODEC_BITS:
+        {
+            // Modem frames carry one or more codec frames back to back, but
+            // Codec2 expects each one to start on a byte boundary.
+            int bitsPerCodecFrame = codec2 != nullptr ? codec2_bits_per_frame(codec2) : 0;
+            int samplesPerCodecFrame = codec2 != nullptr ? codec2_samples_per_frame(codec2) : 0;
+            if (codec2 == nullptr || frame->numSamples != (frame->numBits / bitsPerCodecFrame) * samplesPerCodecFrame)
+            {
+                ESP_LOGW(CURRENT_LOG_TAG, "Dropping frame that doesn't match the current mode");
+                memset(outputBuf, 0, frame->numSamples * sizeof(short));
+                break;
+            }
+
+            uint8_t codecFrame[FREEDV_SPEECH_FRAME_MAX_BYTES];
+            for (int bit = 0; bit + bitsPerCodecFrame <= frame->numBits; bit += bitsPerCodecFrame)
+            {
+                ExtractBits_(frame->codecBits, bit, bitsPerCodecFrame, codecFrame);
+                codec2_decode(codec2, outputBuf, codecFrame);
+                outputBuf += samplesPerCodecFrame;
+            }
+            break;
+        }
+        case FreeDVSpeechFrame::AUDIO:
+            memcpy(outputBuf, frame->audio, frame->numSamples * sizeof(short));
+            break;
+        case FreeDVSpeechFrame::SILENCE:
+            memset(outputBuf, 0, frame->numSamples * sizeof(short));
+            break;
+        default:
+            assert(0);
+    }
+}
+
+}
+
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_SPEECH_FRAME_H
+#define FREEDV_SPEECH_FRAME_H
+
+#include <cstdint>
+
+#include "AudioRingBuffer.h"
+
+#include "freedv_api.h"
+#include "codec2.h"
+
+#define FREEDV_SPEECH_FRAME_MAX_BYTES 32
+#define FREEDV_SPEECH_FRAME_MAX_SAMPLES 2048
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+/// @brief One modem frame's worth of output from the demodulator.
+struct FreeDVSpeechFrame
+{
+    enum Type
+    {
+        CODEC_BITS, // decode codecBits to numSamples of speech
+        AUDIO, // play audio as-is (analog mode or unsquelched, unsynced FreeDV)
+        SILENCE, // play numSamples of silence (squelched)
+    };
+
+    Type type;
+    uint16_t numSamples; // samples of output this frame produces
+    uint16_t numBits; // packed, MSB first, for CODEC_BITS frames
+    uint8_t codecBits[FREEDV_SPEECH_FRAME_MAX_BYTES];
+    short audio[FREEDV_SPEECH_FRAME_MAX_SAMPLES];
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    bool hasLatencyTag;
+    AudioLatencyTag latencyTag;
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+};
+
+/// @brief Carries the newest tag read from a FIFO over to a queued frame.
+inline void ForwardAudioLatencyTag(AudioRingBuffer* from, FreeDVSpeechFrame* to)
+{
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    to->hasLatencyTag = from->takeLatencyTag(&to->latencyTag);
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+}
+
+/// @brief Demodulates one modem frame worth of radio audio into a frame,
+///        deciding what to play the way freedv_rx() would (including squelch).
+/// @param dv The modem. Must be set up with OpenFreeDV().
+/// @param squelchEnabled Whether squelch is enabled (see GetFreeDVSquelch()).
+/// @param squelchThresholdDb The SNR below which received speech is muted.
+/// @param inputBuf freedv_nin() samples of radio audio.
+/// @param frame The frame to fill in.
+/// @return Whether the frame produces any output. Synced frames without bits 
+///         (e.g. while 700D is still filling its interleaver) don't.
+bool DemodulateFreeDVFrame(struct freedv* dv, bool squelchEnabled, float squelchThresholdDb, short* inputBuf, FreeDVSpeechFrame* frame);
+
+/// @brief Turns a frame into frame->numSamples samples of audio.
+/// @param codec2 The Codec2 instance to decode CODEC_BITS frames with, or 
+///        nullptr if there isn't one (CODEC_BITS frames then produce silence).
+/// @param frame The frame to decode.
+/// @param outputBuf Where to write the resulting audio.
+void DecodeFreeDVSpeechFrame(struct CODEC2* codec2, const FreeDVSpeechFrame* frame, short* outputBuf);
+
+}
+
+}
+
+#endif // FREEDV_SPEECH_FRAME_H
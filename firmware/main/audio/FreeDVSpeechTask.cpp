@@ -0,0 +1,167 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "FreeDVSpeechTask.h"
+
+#define CURRENT_LOG_TAG ("FreeDVSpeech")
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+FreeDVSpeechTask::FreeDVSpeechTask()
+    // Runs on the opposite core from FreeDVTask so that speech synthesis
+    // overlaps with demodulation of the next frame.
+    : DVTask("FreeDVSpeechTask", 15, 16384, 1, 16)
+    , AudioInput(0, 1)
+    , codec2_(nullptr)
+    , readIndex_(0)
+    , writeIndex_(0)
+{
+    decoderSemaphore_ = xSemaphoreCreateMutex();
+    assert(decoderSemaphore_ != nullptr);
+
+    frames_ = (FreeDVSpeechFrame*)heap_caps_calloc(
+        FREEDV_SPEECH_QUEUE_LENGTH, sizeof(FreeDVSpeechFrame), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+    assert(frames_ != nullptr);
+
+    registerMessageHandler(this, &FreeDVSpeechTask::onAudioDataAvailable_);
+}
+
+FreeDVSpeechTask::~FreeDVSpeechTask()
+{
+    heap_caps_free(frames_);
+    vSemaphoreDelete(decoderSemaphore_);
+}
+
+void FreeDVSpeechTask::setDecoder(struct CODEC2* codec2)
+{
+    auto rv = xSemaphoreTake(decoderSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    codec2_ = codec2;
+
+    // Queued frames may have come from the previous instance. The consumer
+    // only touches the read index while holding the semaphore, so it's
+    // safe to update from here.
+    readIndex_.store(writeIndex_.load(std::memory_order_relaxed), std::memory_order_release);
+
+    xSemaphoreGive(decoderSemaphore_);
+}
+
+FreeDVSpeechFrame* FreeDVSpeechTask::acquireFrame()
+{
+    uint32_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+    if (writeIndex - readIndex_.load(std::memory_order_acquire) >= FREEDV_SPEECH_QUEUE_LENGTH)
+    {
+        return nullptr;
+    }
+
+    auto frame = &frames_[writeIndex % FREEDV_SPEECH_QUEUE_LENGTH];
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    frame->hasLatencyTag = false;
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    return frame;
+}
+
+void FreeDVSpeechTask::commitFrame()
+{
+    writeIndex_.fetch_add(1, std::memory_order_release);
+
+    AudioDataAvailableMessage message;
+    post(&message);
+}
+
+void FreeDVSpeechTask::notify()
+{
+    if (writeIndex_.load(std::memory_order_acquire) != readIndex_.load(std::memory_order_relaxed))
+    {
+        AudioDataAvailableMessage message;
+        post(&message);
+    }
+}
+
+void FreeDVSpeechTask::onTaskStart_()
+{
+    // empty
+}
+
+void FreeDVSpeechTask::onTaskSleep_()
+{
+    // Play out whatever's left.
+    processFrames_();
+}
+
+void FreeDVSpeechTask::onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message)
+{
+    processFrames_();
+}
+
+void FreeDVSpeechTask::processFrames_()
+{
+    latchAudioOutputs();
+
+    auto outputFifo = getAudioOutput(AudioInput::ChannelLabel::USER_CHANNEL);
+    if (outputFifo == nullptr)
+    {
+        // Output is being re-patched (see AudioGraph). Leave frames
+        // queued until the new route is in place.
+        return;
+    }
+
+    auto rv = xSemaphoreTake(decoderSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    uint32_t readIndex = readIndex_.load(std::memory_order_relaxed);
+    while (readIndex != writeIndex_.load(std::memory_order_acquire))
+    {
+        auto frame = &frames_[readIndex % FREEDV_SPEECH_QUEUE_LENGTH];
+        if (outputFifo->getFree() < frame->numSamples)
+        {
+            // FreeDVTask pokes us again when more radio audio comes in.
+            break;
+        }
+
+#if CONFIG_EZDV_AUDIO_LATENCY_TAGS
+        if (frame->hasLatencyTag)
+        {
+            outputFifo->setLatencyTag(frame->latencyTag);
+        }
+#endif // CONFIG_EZDV_AUDIO_LATENCY_TAGS
+
+        short* outputBuf = outputFifo->acquireWrite(frame->numSamples);
+        DecodeFreeDVSpeechFrame(codec2_, frame, outputBuf);
+        outputFifo->commitWrite(frame->numSamples);
+
+        readIndex++;
+        readIndex_.store(readIndex, std::memory_order_release);
+    }
+
+    xSemaphoreGive(decoderSemaphore_);
+}
+
+}
+
+}
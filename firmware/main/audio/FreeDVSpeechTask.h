@@ -0,0 +1,100 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEDV_SPEECH_TASK_H
+#define FREEDV_SPEECH_TASK_H
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "AudioInput.h"
+#include "AudioMessage.h"
+#include "AudioRingBuffer.h"
+#include "FreeDVSpeechFrame.h"
+#include "task/DVTask.h"
+
+#include "codec2.h"
+
+// Several hundred ms of audio at any mode. The queue only fills up if
+// the output does, at which point the demodulator stops queueing and
+// the radio FIFO backs up instead.
+#define FREEDV_SPEECH_QUEUE_LENGTH 8
+
+namespace ezdv
+{
+
+namespace audio
+{
+
+using namespace ezdv::task;
+
+/// @brief Second half of the FreeDV receive chain. FreeDVTask demodulates and
+///        FEC decodes radio audio into codec frames, which are queued here and
+///        synthesized into speech on the other core.
+///
+/// The queue is single producer (FreeDVTask) and single consumer (this task).
+/// Output goes to LEFT/USER_CHANNEL.
+class FreeDVSpeechTask : public DVTask, public AudioInput
+{
+public:
+    FreeDVSpeechTask();
+    virtual ~FreeDVSpeechTask();
+
+    /// @brief Sets the Codec2 instance to decode CODEC_BITS frames with and
+    ///        discards anything still queued. Blocks until any frame being
+    ///        decoded is done, so the previous instance can be freed once this
+    ///        returns. Producer only.
+    /// @param codec2 The Codec2 instance, or nullptr if there isn't one (analog mode).
+    void setDecoder(struct CODEC2* codec2);
+
+    /// @brief Returns the next free frame to fill in, or nullptr if the queue
+    ///        is full. Producer only.
+    FreeDVSpeechFrame* acquireFrame();
+
+    /// @brief Queues the frame returned by acquireFrame() and wakes up the task.
+    ///        Producer only.
+    void commitFrame();
+
+    /// @brief Wakes up the task if there's anything queued. Used by the producer
+    ///        to retry frames that didn't fit in the output FIFO earlier.
+    void notify();
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    SemaphoreHandle_t decoderSemaphore_;
+    struct CODEC2* codec2_;
+
+    FreeDVSpeechFrame* frames_;
+    std::atomic<uint32_t> readIndex_;
+    std::atomic<uint32_t> writeIndex_;
+
+    void onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message);
+
+    /// @brief Writes as many queued frames to the output as will fit.
+    void processFrames_();
+};
+
+}
+
+}
+
+#endif // FREEDV_SPEECH_TASK_H
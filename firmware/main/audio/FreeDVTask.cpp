@@ -18,9 +18,9 @@
 #include <cstring>
 
 #include "FreeDVTask.h"
+#include "FreeDVConfig.h"
+#include "AudioLatency.h"
 
-#include "esp_dsp.h"
-#include "codec2_math.h"
 #include "modem_stats.h"
 
 #define FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP 160
@@ -32,102 +32,191 @@ namespace ezdv
 namespace audio
 {
 
-FreeDVTask::FreeDVTask()
-    : DVTask("FreeDVTask", 15, 47000, 0, 16, pdMS_TO_TICKS(10))
+FreeDVTask::FreeDVTask(FreeDVSpeechTask* speechTask, FreeDVScanTask* scanTask)
+    : DVTask("FreeDVTask", 15, 47000, 0, 16)
     , AudioInput(2, 2)
-    , dv_(nullptr)
-    , rText_(nullptr)
-    , currentMode_(0)
+    , speechTask_(speechTask)
+    , scanTask_(scanTask)
+    , scanner_(scanTask->getScanner())
+    , currentMode_(ANALOG)
+    , scanTaskRunning_(false)
+    , scanTaskStopping_(false)
+    , txDv_(nullptr)
+    , rxDv_(nullptr)
+    , txText_(nullptr)
+    , rxText_(nullptr)
     , isTransmitting_(false)
     , isEndingTransmit_(false)
     , isActive_(false)
     , samplesBeforeEnd_(0)
+    , padFinalFrame_(false)
+    , squelchEnabled_(false)
+    , squelchThresholdDb_(0)
     , stats_(nullptr)
+#if CONFIG_EZDV_FREEDV_TX_MONITOR
+    , txMonitorFifo_(DEFAULT_NUM_SAMPLES_FOR_FIFO)
+#endif // CONFIG_EZDV_FREEDV_TX_MONITOR
 {
+    assert(speechTask_ != nullptr);
+    assert(scanTask_ != nullptr);
+
     registerMessageHandler(this, &FreeDVTask::onSetFreeDVMode_);
     registerMessageHandler(this, &FreeDVTask::onSetPTTState_);
     registerMessageHandler(this, &FreeDVTask::onReportingSettingsUpdate_);
-    registerMessageHandler(this, &FreeDVTask::onRequestGetFreeDVMode_);
+    registerMessageHandler(this, &FreeDVTask::onAudioDataAvailable_);
+    registerMessageHandler(this, &FreeDVTask::onTaskAsleep_);
 }
 
 FreeDVTask::~FreeDVTask()
 {
-    if (dv_ != nullptr)
-    {
-        if (rText_ != nullptr)
-        {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
-        }
-
-        freedv_close(dv_);
-        dv_ = nullptr;
-    }
+    closeFreeDV_();
 }
 
 void FreeDVTask::onTaskStart_()
 {
     isActive_ = true;
+    updateAudioNotifications_();
 }
 
 void FreeDVTask::onTaskSleep_()
 {
     isActive_ = false;
 
-    if (dv_ != nullptr)
+    getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)->setConsumerNotification(nullptr);
+    getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)->setConsumerNotification(nullptr);
+
+    closeFreeDV_();
+    currentMode_ = ANALOG;
+}
+
+void FreeDVTask::onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message)
+{
+    processAudio_();
+}
+
+void FreeDVTask::onTaskAsleep_(DVTask* origin, TaskAsleepMessage* message)
+{
+    if (origin != scanTask_ || !scanTaskStopping_)
     {
-        if (rText_ != nullptr)
-        {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
-        }
+        return;
+    }
 
-        freedv_close(dv_);
-        dv_ = nullptr;
+    scanTaskStopping_ = false;
+    if (scanner_->isScanning())
+    {
+        // Scan mode was entered again while the task was going to sleep.
+        startScanTask_();
     }
 }
 
-void FreeDVTask::onTaskTick_()
+void FreeDVTask::startScanTask_()
 {
-    if (!isActive_) return;
+    // Restarting the task before it has finished going to sleep would
+    // give it new queues that its old thread then deletes, so wait for
+    // onTaskAsleep_() in that case.
+    if (scanTaskRunning_ || scanTaskStopping_)
+    {
+        return;
+    }
 
-    bool syncLed = false;
+    // Don't use the blocking DVTask::start(task, ticks) here, since
+    // waiting would handle other messages in the middle of a mode change.
+    scanTask_->start();
+    scanTaskRunning_ = true;
+}
 
-    //ESP_LOGI(CURRENT_LOG_TAG, "timer tick");
+void FreeDVTask::sleepScanTask_()
+{
+    if (!scanTaskRunning_)
+    {
+        return;
+    }
+
+    scanTask_->sleep();
+    scanTaskRunning_ = false;
+    scanTaskStopping_ = true;
+}
 
-    struct FIFO* codecInputFifo = nullptr;
-    struct FIFO* codecOutputFifo = nullptr;
-    if (isTransmitting_)
+void FreeDVTask::updateAudioNotifications_()
+{
+    uint32_t txSamplesNeeded = FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP;
+    uint32_t rxSamplesNeeded = FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP;
+    if (txDv_ != nullptr)
     {
-        // Input is microphone, output is radio
-        codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
-        codecOutputFifo = getAudioOutput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+        txSamplesNeeded = freedv_get_n_speech_samples(txDv_);
+        rxSamplesNeeded = freedv_nin(rxDv_);
     }
-    else
+
+    // Note: if there's no room for our output, we rely on the next commit
+    // from upstream (which is clocked by either the codec or the radio) 
+    // to try again.
+    getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)->setConsumerNotification(this, txSamplesNeeded);
+    getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)->setConsumerNotification(this, rxSamplesNeeded);
+}
+
+void FreeDVTask::processAudio_()
+{
+    latchAudioOutputs();
+    if (!isActive_) return;
+
+    //ESP_LOGI(CURRENT_LOG_TAG, "timer tick");
+
+    // TX goes first so that the monitor (if enabled) sees this round's audio.
+    transmitAudio_();
+    bool syncLed = receiveAudio_();
+
+    // Broadcast sync state only when it changes.
+    FreeDVSyncStateMessage message(syncLed);
+    FreeDVSyncStateTopic.publish(this, syncLed, &message);
+
+    // nin changes from frame to frame depending on the modem's timing.
+    updateAudioNotifications_();
+}
+
+void FreeDVTask::transmitAudio_()
+{
+    if (!isTransmitting_) return;
+
+    // Input is microphone, output is radio
+    audio::AudioRingBuffer* codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
+    audio::AudioRingBuffer* codecOutputFifo = getAudioOutput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
+
+    if (codecOutputFifo == nullptr)
     {
-        // Input is radio, output is microphone
-        codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
-        codecOutputFifo = getAudioOutput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
+        // Output is being re-patched (see AudioGraph). Leave the input
+        // where it is until the new route is in place.
+        return;
     }
 
-    if (dv_ == nullptr)
+    if (txDv_ == nullptr && currentMode_ == FREEDV_SCAN)
     {
-        // Analog mode, just pipe through the audio.
-        short inputBuf[FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP];
-        memset(inputBuf, 0, sizeof(inputBuf));
+        // We don't know which mode to transmit in until the scan locks, and
+        // analog audio doesn't belong on a digital frequency. Send nothing.
+        codecInputFifo->discard();
 
-        if (codec2_fifo_free(codecOutputFifo) < FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP) return;
-        
-        while (!(isTransmitting_ && isEndingTransmit_) && 
-               codec2_fifo_used(codecInputFifo) >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP)
+        if (isEndingTransmit_)
         {
-            codec2_fifo_read(codecInputFifo, inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
-            codec2_fifo_write(codecOutputFifo, inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            TransmitCompleteMessage message;
+            publish(&message);
+
+            isEndingTransmit_ = false;
+            isTransmitting_ = false;
+        }
+    }
+    else if (txDv_ == nullptr)
+    {
+        // Analog mode, just pipe through the audio.
+        while (!isEndingTransmit_ && 
+               codecOutputFifo->getFree() >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP &&
+               codecInputFifo->getUsed() >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP)
+        {
+            short* inputBuf = codecInputFifo->acquireRead(FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            ForwardAudioLatencyTag(codecInputFifo, codecOutputFifo);
+            codecOutputFifo->write(inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+            codecInputFifo->commitRead(FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
         }
 
-        if (isTransmitting_ && isEndingTransmit_)
+        if (isEndingTransmit_)
         {
             // We've finished processing everything that's left, end TX now.
             TransmitCompleteMessage message;
@@ -139,160 +228,313 @@ void FreeDVTask::onTaskTick_()
     }
     else
     {
-        if (isTransmitting_)
+        int numSpeechSamples = freedv_get_n_speech_samples(txDv_);
+        int numModemSamples = freedv_get_n_nom_modem_samples(txDv_);
+        short paddedInputBuf[numSpeechSamples];
+    
+        while (codecOutputFifo->getFree() >= (uint32_t)numModemSamples)
         {
-            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
-            int numModemSamples = freedv_get_n_nom_modem_samples(dv_);
-            short inputBuf[numSpeechSamples];
-            short outputBuf[numModemSamples];
+            short* inputBuf = nullptr;
+            uint32_t numInputSamples = codecInputFifo->getUsed();
+            if (numInputSamples >= (uint32_t)numSpeechSamples)
+            {
+                numInputSamples = numSpeechSamples;
+                inputBuf = codecInputFifo->acquireRead(numInputSamples);
+            }
+            else if (isEndingTransmit_ && padFinalFrame_)
+            {
+                // Flush out whatever's left of the last frame with trailing silence.
+                codecInputFifo->read(paddedInputBuf, numInputSamples);
+                memset(&paddedInputBuf[numInputSamples], 0, (numSpeechSamples - numInputSamples) * sizeof(short));
+                inputBuf = paddedInputBuf;
+                numInputSamples = 0;
+                padFinalFrame_ = false;
+            }
+            else
+            {
+                break;
+            }
 
-            if (codec2_fifo_free(codecOutputFifo) < numModemSamples) return;
-        
-            while (codec2_fifo_read(codecInputFifo, inputBuf, numSpeechSamples) == 0)
+            // Limit the amount of time we spend here so we don't end up
+            // stuck transmitting forever.
+            if (isEndingTransmit_)
             {
-                // Limit the amount of time we spend here so we don't end up
-                // stuck transmitting forever.
-                if (isEndingTransmit_)
+                samplesBeforeEnd_ -= numSpeechSamples;
+                if (samplesBeforeEnd_ <= 0)
                 {
-                    samplesBeforeEnd_ -= numSpeechSamples;
-                    if (samplesBeforeEnd_ <= 0)
-                    {
-                        break;
-                    }
+                    codecInputFifo->commitRead(numInputSamples);
+                    break;
                 }
-                //auto timeBegin = esp_timer_get_time();
-
-                freedv_tx(dv_, outputBuf, inputBuf);
-                //auto timeEnd = esp_timer_get_time();
-                //ESP_LOGI(CURRENT_LOG_TAG, "freedv_tx ran in %d us on %d samples and generated %d samples", (int)(timeEnd - timeBegin), numSpeechSamples, numModemSamples);
-                codec2_fifo_write(codecOutputFifo, outputBuf, numModemSamples);
             }
-            
-            if (isEndingTransmit_ && samplesBeforeEnd_ < numSpeechSamples)
-            {
-                // We've finished processing everything that's left, end TX now.
-                TransmitCompleteMessage message;
-                publish(&message);
+            //auto timeBegin = esp_timer_get_time();
 
-                isEndingTransmit_ = false;
-                isTransmitting_ = false;
+            ForwardAudioLatencyTag(codecInputFifo, codecOutputFifo);
+            short* outputBuf = codecOutputFifo->acquireWrite(numModemSamples);
+            freedv_tx(txDv_, outputBuf, inputBuf);
+            //auto timeEnd = esp_timer_get_time();
+            //ESP_LOGI(CURRENT_LOG_TAG, "freedv_tx ran in %d us on %d samples and generated %d samples", (int)(timeEnd - timeBegin), numSpeechSamples, numModemSamples);
+
+#if CONFIG_EZDV_FREEDV_TX_MONITOR
+            if (!isEndingTransmit_)
+            {
+                txMonitorFifo_.write(outputBuf, numModemSamples);
             }
+#endif // CONFIG_EZDV_FREEDV_TX_MONITOR
+
+            codecOutputFifo->commitWrite(numModemSamples);
+            codecInputFifo->commitRead(numInputSamples);
         }
-        else
+        
+        if (isEndingTransmit_ && samplesBeforeEnd_ < numSpeechSamples)
         {
-            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
-            short inputBuf[freedv_get_n_max_modem_samples(dv_)];
-            short outputBuf[numSpeechSamples];
-            int nin = freedv_nin(dv_);
+            // We've finished processing everything that's left, end TX now.
+            TransmitCompleteMessage message;
+            publish(&message);
 
-            if (codec2_fifo_free(codecOutputFifo) < numSpeechSamples) return;
-        
-            int rv = codec2_fifo_read(codecInputFifo, inputBuf, nin);
-            if (rv == 0)
-            {
-                //auto timeBegin = esp_timer_get_time();
+            isEndingTransmit_ = false;
+            isTransmitting_ = false;
+        }
+    }
+}
 
-                int nout = freedv_rx(dv_, outputBuf, inputBuf);
+bool FreeDVTask::receiveAudio_()
+{
+    audio::AudioRingBuffer* radioInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
 
-                //auto timeEnd = esp_timer_get_time();
-                //ESP_LOGI(CURRENT_LOG_TAG, "freedv_rx ran in %lld us on %d samples and generated %d samples", timeEnd - timeBegin, nin, nout);
-                codec2_fifo_write(codecOutputFifo, outputBuf, nout);
-                nin = freedv_nin(dv_);
-            }
-        
-            syncLed = freedv_get_sync(dv_) > 0;
+    // The radio isn't receiving while PTT is held, so there's nothing
+    // useful in its audio. RX picks back up as soon as PTT is released, 
+    // even if TX is still draining.
+    if (isTransmitting_ && !isEndingTransmit_)
+    {
+        radioInputFifo->discard();
+
+#if CONFIG_EZDV_FREEDV_TX_MONITOR
+        // Decode our own signal instead so the user can hear what's going out.
+        if (rxDv_ != nullptr)
+        {
+            receiveFrame_(&txMonitorFifo_);
         }
+#endif // CONFIG_EZDV_FREEDV_TX_MONITOR
+
+        return false;
     }
 
-    // Broadcast current sync state
-    FreeDVSyncStateMessage* message = new FreeDVSyncStateMessage(syncLed);
-    publish(message);
-    delete message;
+    if (scanner_->isScanning())
+    {
+        scanAudio_(radioInputFifo);
+        if (rxDv_ == nullptr)
+        {
+            return false;
+        }
+    }
+
+    receiveFrame_(radioInputFifo);
+    return rxDv_ != nullptr && freedv_get_sync(rxDv_) > 0;
 }
 
-void FreeDVTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+void FreeDVTask::scanAudio_(AudioRingBuffer* inputFifo)
 {
-    ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV mode to %d", (int)message->mode);
-    currentMode_ = (int)message->mode;
-
-    if (dv_ != nullptr)
+    while (inputFifo->getUsed() >= FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP)
     {
-        if (rText_ != nullptr)
+        FreeDVSpeechFrame* frame = speechTask_->acquireFrame();
+        if (frame == nullptr)
         {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
+            speechTask_->notify();
+            break;
         }
 
+        short* inputBuf = inputFifo->acquireRead(FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+        ForwardAudioLatencyTag(inputFifo, frame);
+        scanner_->write(inputBuf, FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+        inputFifo->commitRead(FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP);
+
+        // Stay quiet until we know what we're listening to, same as
+        // squelched 700D/700E.
+        frame->type = FreeDVSpeechFrame::SILENCE;
+        frame->numSamples = FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP;
+        speechTask_->commitFrame();
+    }
+
+    // Both halves of the scan run in parallel over the same audio.
+    scanTask_->notify();
+    scanner_->process(FREEDV_SCAN_WORKER_FREEDV_TASK);
+
+    FreeDVMode lockedMode = scanner_->getLockedMode();
+    if (lockedMode == ANALOG)
+    {
+        return;
+    }
+
+    ESP_LOGI(CURRENT_LOG_TAG, "Detected FreeDV mode %d", (int)lockedMode);
+
+    // Keep the modem that found the signal so we don't have to re-acquire.
+    rxDv_ = scanner_->takeLockedModem();
+    assert(rxDv_ != nullptr);
+    sleepScanTask_();
+    txDv_ = OpenFreeDV(lockedMode);
+    onModemsOpened_(lockedMode);
+
+    // Go through the same path as a user initiated mode change so that the
+    // UI announces the new mode and everything else (settings, radio filters,
+    // FreeDV Reporter) follows along. We'll ignore the resulting 
+    // SetFreeDVModeMessage since we're already in that mode.
+    currentMode_ = lockedMode;
+    FreeDVModeTopic.set(lockedMode);
+
+    RequestSetFreeDVModeMessage request(lockedMode);
+    publish(&request);
+}
+
+void FreeDVTask::receiveFrame_(AudioRingBuffer* inputFifo)
+{
+    uint32_t numInputSamples = rxDv_ != nullptr ? freedv_nin(rxDv_) : FREEDV_ANALOG_NUM_SAMPLES_PER_LOOP;
+    if (inputFifo->getUsed() < numInputSamples)
+    {
+        return;
+    }
+
+    FreeDVSpeechFrame* frame = speechTask_->acquireFrame();
+    if (frame == nullptr)
+    {
+        // Speech synthesis is behind (or its output is full). Make sure it
+        // has another go; the radio FIFO holds our input until then.
+        speechTask_->notify();
+        return;
+    }
+
+    // Demodulate straight out of the radio FIFO without any intermediate copies.
+    short* inputBuf = inputFifo->acquireRead(numInputSamples);
+    ForwardAudioLatencyTag(inputFifo, frame);
+
+    bool hasFrame = true;
+    if (rxDv_ == nullptr)
+    {
+        // Analog mode, just pipe through the audio.
+        frame->type = FreeDVSpeechFrame::AUDIO;
+        frame->numSamples = numInputSamples;
+        memcpy(frame->audio, inputBuf, numInputSamples * sizeof(short));
+    }
+    else
+    {
+        hasFrame = DemodulateFreeDVFrame(rxDv_, squelchEnabled_, squelchThresholdDb_, inputBuf, frame);
+    }
+
+    inputFifo->commitRead(numInputSamples);
+    if (hasFrame)
+    {
+        speechTask_->commitFrame();
+    }
+}
+
+void FreeDVTask::closeFreeDV_()
+{
+    scanner_->stop();
+    sleepScanTask_();
+
+    if (rxDv_ != nullptr)
+    {
+        // Make sure speech synthesis is done with this instance before it goes away.
+        speechTask_->setDecoder(nullptr);
+    }
+
+    if (rxText_ != nullptr)
+    {
+        reliable_text_unlink_from_freedv(rxText_);
+        reliable_text_destroy(rxText_);
+        rxText_ = nullptr;
+    }
+
+    if (txText_ != nullptr)
+    {
+        reliable_text_unlink_from_freedv(txText_);
+        reliable_text_destroy(txText_);
+        txText_ = nullptr;
+    }
+
+    if (stats_ != nullptr)
+    {
         modem_stats_close(stats_);
         delete stats_;
+        stats_ = nullptr;
+    }
 
-        freedv_close(dv_);
-        dv_ = nullptr;
+    if (rxDv_ != nullptr)
+    {
+        freedv_close(rxDv_);
+        rxDv_ = nullptr;
     }
 
-    if (message->mode != FreeDVMode::ANALOG)
+    if (txDv_ != nullptr)
     {
-        int freedvApiMode = 0;
-        switch (message->mode)
-        {
-            case FREEDV_700D:
-                freedvApiMode = FREEDV_MODE_700D;
-                break;
-            case FREEDV_700E:
-                freedvApiMode = FREEDV_MODE_700E;
-                break;
-            case FREEDV_1600:
-                freedvApiMode = FREEDV_MODE_1600;
-                break;
-            default:
-                assert(0);
-        }
+        freedv_close(txDv_);
+        txDv_ = nullptr;
+    }
+}
 
-        dv_ = freedv_open(freedvApiMode);
-        assert(dv_ != nullptr);
-        
-        switch (freedvApiMode)
-        {
-            case FREEDV_MODE_700D:
-                freedv_set_eq(dv_, 1);
-                freedv_set_clip(dv_, 1);
-                freedv_set_tx_bpf(dv_, 1);
-                freedv_set_squelch_en(dv_, 1);
-                freedv_set_snr_squelch_thresh(dv_, -2.0);  /* squelch at -2.0 dB      */
-                break;
-            case FREEDV_MODE_700E:
-                freedv_set_eq(dv_, 1);
-                freedv_set_clip(dv_, 1);
-                freedv_set_tx_bpf(dv_, 1);
-                freedv_set_squelch_en(dv_, 1);
-                freedv_set_snr_squelch_thresh(dv_, 1);  /* squelch at 1.0 dB      */
-                break;
-            case FREEDV_MODE_1600:
-                freedv_set_clip(dv_, 0);
-                freedv_set_tx_bpf(dv_, 0);
-                freedv_set_squelch_en(dv_, 0);
-                break;
-            default:
-                assert(0);
-                freedv_set_clip(dv_, 0);
-                freedv_set_tx_bpf(dv_, 0);
-                freedv_set_squelch_en(dv_, 1);
-                freedv_set_snr_squelch_thresh(dv_, 0.0);  /* squelch at 0.0 dB      */
-                break;
-        }
+void FreeDVTask::onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message)
+{
+    ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV mode to %d", (int)message->mode);
+    FreeDVModeTopic.set(message->mode);
+
+    if (message->mode == currentMode_ && message->mode != FREEDV_SCAN)
+    {
+        // Already there, e.g. after a scan detects a mode.
+        return;
+    }
+
+    closeFreeDV_();
+    currentMode_ = message->mode;
 
-        stats_ = new MODEM_STATS();
-        assert(stats_ != nullptr);
-        modem_stats_open(stats_);
+    if (message->mode == FREEDV_SCAN)
+    {
+        // RX stays on the scanner until it detects something. Nothing is
+        // transmitted in the meantime since we don't know which mode to use
+        // (see transmitAudio_()).
+        speechTask_->setDecoder(nullptr);
+        scanner_->start();
+        startScanTask_();
+    }
+    else if (message->mode != FreeDVMode::ANALOG)
+    {
+        txDv_ = OpenFreeDV(message->mode);
+        rxDv_ = OpenFreeDV(message->mode);
+        onModemsOpened_(message->mode);
+    }
+    else
+    {
+        // Drop any frames queued by the previous mode.
+        speechTask_->setDecoder(nullptr);
+    }
 
-        // Note: reliable_text setup is deferred until we know for sure whether
-        // we have a valid callsign saved.
-        storage::RequestReportingSettingsMessage requestReportingSettings;
-        publish(&requestReportingSettings);
+    if (isActive_)
+    {
+        updateAudioNotifications_();
     }
 }
 
+void FreeDVTask::onModemsOpened_(FreeDVMode mode)
+{
+    assert((freedv_get_bits_per_modem_frame(rxDv_) + 7) / 8 <= FREEDV_SPEECH_FRAME_MAX_BYTES);
+    assert(freedv_get_n_max_modem_samples(rxDv_) <= FREEDV_SPEECH_FRAME_MAX_SAMPLES);
+    
+    // Squelch is applied by us rather than freedv_rx() (see receiveFrame_()),
+    // but is still configured on the modem for consistency.
+    GetFreeDVSquelch(mode, &squelchEnabled_, &squelchThresholdDb_);
+
+    stats_ = new MODEM_STATS();
+    assert(stats_ != nullptr);
+    modem_stats_open(stats_);
+
+    // Now that TX has its own modem, RX's Codec2 instance belongs
+    // to the speech task.
+    speechTask_->setDecoder(freedv_get_codec2(rxDv_));
+
+    // Note: reliable_text setup is deferred until we know for sure whether
+    // we have a valid callsign saved.
+    storage::RequestReportingSettingsMessage requestReportingSettings;
+    publish(&requestReportingSettings);
+}
+
 void FreeDVTask::onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message)
 {
     ESP_LOGI(CURRENT_LOG_TAG, "Setting FreeDV transmit state to %d", (int)message->pttState);
@@ -301,24 +543,33 @@ void FreeDVTask::onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* messag
     {
         // Delay ending TX until we've processed what's remaining. This means we'll need
         // to add a bit of silence at the end of the transmission as well depending on 
-        // the currently active mode.
+        // the currently active mode. RX resumes right away on its own modem.
         samplesBeforeEnd_ = 2000; // 250ms maximum @ 8000 Hz
         isEndingTransmit_ = true;
+        padFinalFrame_ = true;
 
-        if (dv_ != nullptr)
+#if CONFIG_EZDV_FREEDV_TX_MONITOR
+        // The RX modem was decoding our own signal up to now. Don't let a
+        // partially received copy of our callsign finish from radio audio.
+        if (rxText_ != nullptr)
         {
-            auto codecInputFifo = getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL);
-            int numSpeechSamples = freedv_get_n_speech_samples(dv_);
-            short* tmpBuffer = new short[numSpeechSamples];
-            assert(tmpBuffer != nullptr);
-
-            memset(tmpBuffer, 0, sizeof(short) * numSpeechSamples);
-            codec2_fifo_write(codecInputFifo, tmpBuffer, numSpeechSamples);
-            delete[] tmpBuffer;
+            reliable_text_reset(rxText_);
         }
+#endif // CONFIG_EZDV_FREEDV_TX_MONITOR
+
+        // Flush what's already waiting now rather than waiting for more audio.
+        processAudio_();
     }
     else
     {
+#if CONFIG_EZDV_FREEDV_TX_MONITOR
+        if (message->pttState && !isTransmitting_)
+        {
+            // Don't decode leftovers from the previous transmission.
+            txMonitorFifo_.discard();
+        }
+#endif // CONFIG_EZDV_FREEDV_TX_MONITOR
+
         isEndingTransmit_ = false;
         isTransmitting_ = message->pttState;
         if (!isTransmitting_)
@@ -331,23 +582,36 @@ void FreeDVTask::onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* messag
 
 void FreeDVTask::onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message)
 {
-    if (dv_ != nullptr && strlen(message->callsign) > 0)
+    if (txDv_ != nullptr && strlen(message->callsign) > 0)
     {
         ESP_LOGI(CURRENT_LOG_TAG, "Registering reliable_text handler");
 
-        if (rText_ != nullptr)
+        if (rxText_ != nullptr)
         {
-            reliable_text_unlink_from_freedv(rText_);
-            reliable_text_destroy(rText_);
-            rText_ = nullptr;
+            reliable_text_unlink_from_freedv(rxText_);
+            reliable_text_destroy(rxText_);
+            rxText_ = nullptr;
         }
 
-        // Non-null callsign means we should set up reliable_text.
-        rText_ = reliable_text_create();
-        assert(rText_ != nullptr);
+        if (txText_ != nullptr)
+        {
+            reliable_text_unlink_from_freedv(txText_);
+            reliable_text_destroy(txText_);
+            txText_ = nullptr;
+        }
 
-        reliable_text_set_string(rText_, message->callsign, strlen(message->callsign));
-        reliable_text_use_with_freedv(rText_, dv_, OnReliableTextRx_, this);
+        // Non-null callsign means we should set up reliable_text. Each modem 
+        // needs its own instance: the TX one sends our callsign and the RX
+        // one reports callsigns that we receive.
+        txText_ = reliable_text_create();
+        assert(txText_ != nullptr);
+        reliable_text_set_string(txText_, message->callsign, strlen(message->callsign));
+        reliable_text_use_with_freedv(txText_, txDv_, OnReliableTextRx_, this);
+
+        rxText_ = reliable_text_create();
+        assert(rxText_ != nullptr);
+        reliable_text_set_string(rxText_, message->callsign, strlen(message->callsign));
+        reliable_text_use_with_freedv(rxText_, rxDv_, OnReliableTextRx_, this);
     }
 }
 
@@ -355,9 +619,19 @@ void FreeDVTask::OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int
 {
     // Broadcast receipt to other components that may want it (such as FreeDV Reporter).
     FreeDVTask* thisPtr = (FreeDVTask*)state;
+
+    if (rt != thisPtr->rxText_ || (thisPtr->isTransmitting_ && !thisPtr->isEndingTransmit_))
+    {
+        // Either our own callsign coming back through the TX monitor or
+        // something unexpected from the TX modem. Neither should be reported.
+        // Once PTT is released the RX modem is back on the radio (see
+        // receiveAudio_()), so callsigns decoded while TX drains are real.
+        reliable_text_reset(rt);
+        return;
+    }
     
     // Get stats so we can provide updated SNR.
-    freedv_get_modem_extended_stats(thisPtr->dv_, thisPtr->stats_);
+    freedv_get_modem_extended_stats(thisPtr->rxDv_, thisPtr->stats_);
     
     float snr = thisPtr->stats_->snr_est;
     ESP_LOGI(CURRENT_LOG_TAG, "Received TX from %s" /*at %.1f SNR"*/, txt_ptr /*, (float)snr*/);
@@ -365,59 +639,9 @@ void FreeDVTask::OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int
     FreeDVReceivedCallsignMessage message((char*)txt_ptr, snr);
     thisPtr->publish(&message);
 
-    FreeDVTask* task = (FreeDVTask*)state;
-    reliable_text_reset(task->rText_);
-}
-
-void FreeDVTask::onRequestGetFreeDVMode_(DVTask* origin, RequestGetFreeDVModeMessage* message)
-{
-    SetFreeDVModeMessage msg((FreeDVMode)currentMode_);
-    origin->post(&msg);
-}
-
+    reliable_text_reset(rt);
 }
 
 }
 
-// Implement required Codec2 math methods below as CMSIS doesn't work on ESP32.
-extern "C"
-{
-    void codec2_dot_product_f32(float* left, float* right, size_t len, float* result)
-    {
-        dsps_dotprod_f32(left, right, result, len);
-    }
-
-    void codec2_complex_dot_product_f32(COMP* left, COMP* right, size_t len, float* resultReal, float* resultImag)
-    {
-        float realTimesRealResult = 0; // ac
-        float realTimesImag1Result = 0; // bc
-        float realTimesImag2Result = 0; // ad
-        float imagTimesImagResult = 0; // bi * di
-        
-        dsps_dotprode_f32((float*)left, (float*)right, &realTimesRealResult, len, 2, 2);
-        dsps_dotprode_f32((float*)left + 1, (float*)right, &realTimesImag1Result, len, 2, 2);
-        dsps_dotprode_f32((float*)left, (float*)right + 1, &realTimesImag2Result, len, 2, 2);
-        dsps_dotprode_f32((float*)left + 1, (float*)right + 1, &imagTimesImagResult, len, 2, 2);
-        
-        *resultReal = realTimesRealResult - imagTimesImagResult;
-        *resultImag = realTimesImag1Result + realTimesImag2Result;
-    }
-
-    /* Required memory allocation wrapper for embedded platforms. For ezDV, we want to allocate as much as possible
-    on external RAM. */
-
-    void* codec2_malloc(size_t size)
-    {
-        return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    }
-
-    void* codec2_calloc(size_t nmemb, size_t size)
-    {
-        return heap_caps_calloc(nmemb, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-    }
-
-    void codec2_free(void* ptr)
-    {
-        heap_caps_free(ptr);
-    }
 }
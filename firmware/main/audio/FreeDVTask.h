@@ -19,7 +19,10 @@
 #define FREEDV_TASK_H
 
 #include "AudioInput.h"
+#include "AudioMessage.h"
 #include "FreeDVMessage.h"
+#include "FreeDVScanTask.h"
+#include "FreeDVSpeechTask.h"
 #include "storage/SettingsMessage.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
@@ -35,34 +38,98 @@ namespace audio
 
 using namespace ezdv::task;
 
+/// @brief Runs the FreeDV modem. Transmit audio goes out RIGHT/RADIO_CHANNEL as 
+///        before, but receive audio is handed to a FreeDVSpeechTask for speech 
+///        synthesis instead of being written to LEFT/USER_CHANNEL.
+///
+/// In FREEDV_SCAN mode, radio audio goes to a FreeDVModeScanner instead (with
+/// its demodulators split between this task and a FreeDVScanTask) until one of
+/// the supported modes is detected, after which the task switches to that mode.
+/// The FreeDVScanTask only runs while scanning so that its stack isn't taking
+/// up internal RAM the rest of the time.
 class FreeDVTask : public DVTask, public AudioInput
 {
 public:
-    FreeDVTask();
+    /// @brief Creates a new FreeDV task.
+    /// @param speechTask The task that turns received codec frames into speech.
+    /// @param scanTask The task that helps with mode detection in FREEDV_SCAN mode.
+    FreeDVTask(FreeDVSpeechTask* speechTask, FreeDVScanTask* scanTask);
     virtual ~FreeDVTask();
 
 protected:
     virtual void onTaskStart_() override;
     virtual void onTaskSleep_() override;
-
-    virtual void onTaskTick_() override;
     
 private:
-    struct freedv* dv_;
-    reliable_text_t rText_;
-    int currentMode_;
+    FreeDVSpeechTask* speechTask_;
+    FreeDVScanTask* scanTask_;
+    FreeDVModeScanner* scanner_;
+    FreeDVMode currentMode_;
+    bool scanTaskRunning_; // started and not yet told to sleep
+    bool scanTaskStopping_; // told to sleep but hasn't finished yet
+
+    // TX and RX each get their own modem so that neither has to wait for
+    // the other (e.g. RX can resume as soon as PTT is released while TX is
+    // still draining).
+    struct freedv* txDv_;
+    struct freedv* rxDv_;
+    reliable_text_t txText_;
+    reliable_text_t rxText_;
 
     bool isTransmitting_;
     bool isEndingTransmit_;
     bool isActive_;
     int samplesBeforeEnd_;
+    bool padFinalFrame_; // pad out the last partial frame with silence when ending TX
+    bool squelchEnabled_;
+    float squelchThresholdDb_;
 
     MODEM_STATS* stats_;
 
+#if CONFIG_EZDV_FREEDV_TX_MONITOR
+    // Copy of our own modulated TX audio for rxDv_ to decode while PTT is held.
+    AudioRingBuffer txMonitorFifo_;
+#endif // CONFIG_EZDV_FREEDV_TX_MONITOR
+
     void onSetFreeDVMode_(DVTask* origin, SetFreeDVModeMessage* message);
     void onSetPTTState_(DVTask* origin, FreeDVSetPTTStateMessage* message);
     void onReportingSettingsUpdate_(DVTask* origin, storage::ReportingSettingsMessage* message);
-    void onRequestGetFreeDVMode_(DVTask* origin, RequestGetFreeDVModeMessage* message);
+    void onAudioDataAvailable_(DVTask* origin, AudioDataAvailableMessage* message);
+    void onTaskAsleep_(DVTask* origin, TaskAsleepMessage* message);
+
+    /// @brief Runs modulation and demodulation on whatever audio is waiting.
+    void processAudio_();
+
+    /// @brief Modulates whatever microphone audio is waiting while transmitting.
+    void transmitAudio_();
+
+    /// @brief Demodulates whatever radio audio is waiting.
+    /// @return Whether the receiver is in sync.
+    bool receiveAudio_();
+
+    /// @brief Asks to be woken up once a full frame for the current mode is waiting.
+    void updateAudioNotifications_();
+
+    /// @brief Demodulates one modem frame and queues the result for speech synthesis.
+    /// @param inputFifo The FIFO containing radio audio.
+    void receiveFrame_(AudioRingBuffer* inputFifo);
+
+    /// @brief Feeds waiting radio audio to the mode scanner and switches modes
+    ///        once it detects one.
+    void scanAudio_(AudioRingBuffer* inputFifo);
+
+    /// @brief Finishes setting up for the given mode once rxDv_ is open.
+    void onModemsOpened_(FreeDVMode mode);
+
+    /// @brief Closes both modems and everything attached to them.
+    void closeFreeDV_();
+
+    /// @brief Starts the scan task if it isn't already running. If it's still
+    ///        going to sleep from a previous scan, it's started once it has.
+    void startScanTask_();
+
+    /// @brief Tells the scan task to go to sleep without waiting for it.
+    void sleepScanTask_();
 
     static void OnReliableTextRx_(reliable_text_t rt, const char* txt_ptr, int length, void* state);
 };
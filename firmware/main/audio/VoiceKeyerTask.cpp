@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include "VoiceKeyerTask.h"
+#include "AudioGraph.h"
 
 #define CURRENT_LOG_TAG "VoiceKeyerTask"
 #define VOICE_KEYER_FILE ("/vk/keyer.wav")
@@ -52,10 +53,9 @@ namespace audio
 
 VoiceKeyerTask::VoiceKeyerTask(AudioInput* micDeviceTask, AudioInput* fdvTask)
     : DVTask("VoiceKeyerTask", 15, 4096, tskNO_AFFINITY, 256, portMAX_DELAY)
-    , AudioInput(1, 1)
+    , AudioInput(0, 1)
     , currentState_(VoiceKeyerTask::IDLE)
     , voiceKeyerTickTimer_(this, this, &VoiceKeyerTask::tickKeyer_, TIMER_TICK_INTERVAL, "VKSendTimer")
-    , lastTimeInTick_(0)
     , voiceKeyerFile_(nullptr)
     , wavReader_(nullptr)
     , timeAtBeginningOfState_(0)
@@ -159,8 +159,10 @@ void VoiceKeyerTask::onTaskTick_()
     // empty
 }
 
-void VoiceKeyerTask::tickKeyer_(DVTimer*)
+void VoiceKeyerTask::tickKeyer_(DVTimer* timer)
 {
+    latchAudioOutputs();
+
     auto currentTime = esp_timer_get_time();
 
     switch (currentState_)
@@ -169,14 +171,12 @@ void VoiceKeyerTask::tickKeyer_(DVTimer*)
             break;
         case VoiceKeyerTask::TX:
         {
-            short samples[SAMPLES_TO_SEND_PER_CYCLE];
             auto fifo = getAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL);
             assert(fifo != nullptr);
 
-            // If it takes longer than expected to get into this handler,
+            // If the timer had to skip periods because we were running behind,
             // we should send enough extra samples to compensate. 
-            int numTimesToRead = std::max(1, (int)(currentTime - lastTimeInTick_) / TIMER_TICK_INTERVAL);
-            numTimesToRead = std::min(numTimesToRead, MAXIMUM_NUMBER_OF_LOOPS_PER_TICK);
+            int numTimesToRead = std::min((int)timer->getPeriodsDue(), MAXIMUM_NUMBER_OF_LOOPS_PER_TICK);
             if (numTimesToRead > 1)
             {
                 ESP_LOGW(CURRENT_LOG_TAG, "Took longer than expected to enter tick handler, now sending %d samples", numTimesToRead * SAMPLES_TO_SEND_PER_CYCLE);
@@ -186,13 +186,15 @@ void VoiceKeyerTask::tickKeyer_(DVTimer*)
             {
                 auto numToRead = std::min(codec2_fifo_used(fileReadFifo_), SAMPLES_TO_SEND_PER_CYCLE);
 
-                if (codec2_fifo_free(fifo) < numToRead)
+                if ((int)fifo->getFree() < numToRead)
                 {
                     break;
                 }
 
+                // Read from the file FIFO directly into FreeDV's input.
+                short* samples = fifo->acquireWrite(numToRead);
                 codec2_fifo_read(fileReadFifo_, samples, numToRead);
-                codec2_fifo_write(fifo, samples, numToRead);
+                fifo->commitWrite(numToRead);
 
                 if (numToRead < SAMPLES_TO_SEND_PER_CYCLE)
                 {
@@ -234,8 +236,6 @@ void VoiceKeyerTask::tickKeyer_(DVTimer*)
             break;
         }
     }
-
-    lastTimeInTick_ = currentTime;
 }
 
 void VoiceKeyerTask::startKeyer_()
@@ -265,10 +265,12 @@ void VoiceKeyerTask::startKeyer_()
         // Only do this if we just started the keyer for the first time.
         if (timesTransmitted_ == 0)
         {
-            micDeviceTask_->setAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL, nullptr);
-            setAudioOutput(
-                ezdv::audio::AudioInput::LEFT_CHANNEL,
-                fdvTask_->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL));
+            // Taking over FreeDV's input disconnects the mic device.
+            AudioGraph::Patch patch;
+            patch.connect(
+                this, ezdv::audio::AudioInput::LEFT_CHANNEL,
+                fdvTask_, ezdv::audio::AudioInput::LEFT_CHANNEL);
+            patch.commit();
         }
 
         // Request TX
@@ -277,7 +279,6 @@ void VoiceKeyerTask::startKeyer_()
 
         currentState_ = VoiceKeyerTask::TX;
         voiceKeyerTickTimer_.start();
-        lastTimeInTick_ = esp_timer_get_time();
     }
     else
     {
@@ -288,13 +289,13 @@ void VoiceKeyerTask::startKeyer_()
 void VoiceKeyerTask::stopKeyer_()
 {
     // Reroute input audio so it's coming from mic
-    micDeviceTask_->setAudioOutput(
-        ezdv::audio::AudioInput::LEFT_CHANNEL, 
-        fdvTask_->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL));
-
-    setAudioOutput(
-        ezdv::audio::AudioInput::LEFT_CHANNEL,
-        nullptr);
+    {
+        AudioGraph::Patch patch;
+        patch.connect(
+            micDeviceTask_, ezdv::audio::AudioInput::LEFT_CHANNEL, 
+            fdvTask_, ezdv::audio::AudioInput::LEFT_CHANNEL);
+        patch.commit();
+    }
 
     if (wavReader_ != nullptr)
     {
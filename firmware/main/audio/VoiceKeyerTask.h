@@ -59,7 +59,6 @@ private:
     enum { IDLE, TX, WAITING } currentState_;
 
     DVTimer voiceKeyerTickTimer_;
-    uint64_t lastTimeInTick_;
     FILE* voiceKeyerFile_;
     WAVFileReader* wavReader_;
     uint64_t timeAtBeginningOfState_;
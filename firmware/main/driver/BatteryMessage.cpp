@@ -20,4 +20,16 @@
 extern "C"
 {
     DV_EVENT_DEFINE_BASE(BATTERY_MESSAGE);
-}
\ No newline at end of file
+}
+
+namespace ezdv
+{
+
+namespace driver
+{
+
+DVStateTopic<BatteryState> BatteryStateTopic;
+
+}
+
+}
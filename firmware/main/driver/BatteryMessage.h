@@ -19,6 +19,7 @@
 #define BATTERY_MESSAGE_H
 
 #include "task/DVTaskMessage.h"
+#include "task/DVStateTopic.h"
 
 extern "C"
 {
@@ -40,11 +41,11 @@ enum BatteryMessageTypes
     REQUEST_BATTERY_STATE = 3,
 };
 
-class BatteryStateMessage : public DVTaskMessageBase<BATTERY_STATE, BatteryStateMessage>
+class BatteryStateMessage : public DVTaskMessageBase<BATTERY_STATE, BatteryStateMessage, PRIORITY_CONTROL, OVERFLOW_COALESCE_LATEST>
 {
 public:
     BatteryStateMessage(float voltageProvided = 0, float socProvided = 0, float socChangeRateProvided = 0, bool usbPowerProvided = false)
-        : DVTaskMessageBase<BATTERY_STATE, BatteryStateMessage>(BATTERY_MESSAGE)
+        : DVTaskMessageBase<BATTERY_STATE, BatteryStateMessage, PRIORITY_CONTROL, OVERFLOW_COALESCE_LATEST>(BATTERY_MESSAGE)
         , voltage(voltageProvided)
         , soc(socProvided)
         , socChangeRate(socChangeRateProvided)
@@ -58,6 +59,23 @@ public:
     bool usbPowerEnabled;
 };
 
+// Last battery reading taken by MAX17048. Readable from any task.
+struct BatteryState
+{
+    float voltage;
+    float soc;
+    float socChangeRate;
+    bool usbPowerEnabled;
+
+    bool operator==(const BatteryState& other) const
+    {
+        return voltage == other.voltage && soc == other.soc &&
+            socChangeRate == other.socChangeRate && usbPowerEnabled == other.usbPowerEnabled;
+    }
+};
+
+extern DVStateTopic<BatteryState> BatteryStateTopic;
+
 class LowBatteryShutdownMessage : public DVTaskMessageBase<LOW_POWER_SHUTDOWN, BatteryStateMessage>
 {
 public:
@@ -250,7 +250,8 @@ void MAX17048::onRequestBatteryStateMessage_(DVTask* origin, RequestBatteryState
         calcSoc = 0;
     }
     BatteryStateMessage message(voltage * 0.000078125, calcSoc, (int16_t)socChangeRate * 0.208, usbPower_.getCurrentValue());
-    publish(&message);
+    BatteryState state = { message.voltage, message.soc, message.socChangeRate, message.usbPowerEnabled };
+    BatteryStateTopic.publish(this, state, &message);
     
     //ESP_LOGI(CURRENT_LOG_TAG, "Current battery stats: STATUS = %x, CONFIG = %x, V = %.2f, SOC = %.2f%%, CRATE = %.2f%%/hr", status, config, message.voltage, message.soc, message.socChangeRate);
 
@@ -18,11 +18,13 @@
 #include <cstring>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/i2s_std.h"
 
 #include "TLV320.h"
 #include "TLV320Message.h"
+#include "audio/AudioKernels.h"
 
 // TLV320 reset pin GPIO
 #define TLV320_RESET_GPIO GPIO_NUM_13
@@ -41,6 +43,7 @@
 #define CURRENT_LOG_TAG ("TLV320Driver")
 
 // Timer constants below are for 8000 Hz sample rate
+#define I2S_SAMPLE_RATE (8000)
 #define I2S_NUM_SAMPLES_PER_INTERVAL (160)
 
 namespace ezdv
@@ -59,6 +62,8 @@ TLV320::TLV320(I2CMaster* i2cMaster)
     , i2sRxDevice_(nullptr)
     , int1Gpio_(this, std::bind(&TLV320::onInterrupt1Fire_, this, _2), false, true, false)
     , int2Gpio_(this, std::bind(&TLV320::onInterrupt2Fire_, this, _2), false, true, false)
+    , micLatencyTagger_("TLV320 mic")
+    , radioLatencyTagger_("TLV320 radio")
 {
     // Register message handlers
     registerMessageHandler<storage::LeftChannelVolumeMessage>(this, &TLV320::onLeftChannelVolume_);
@@ -147,7 +152,8 @@ void TLV320::onTaskTick_()
 {
     if (i2sRxDevice_ == nullptr || i2sTxDevice_ == nullptr) return;
 
-    short tempData[I2S_NUM_SAMPLES_PER_INTERVAL * 2];
+    // Aligned so that the SIMD (de)interleave kernels can be used.
+    alignas(16) short tempData[I2S_NUM_SAMPLES_PER_INTERVAL * 2];
     memset(tempData, 0, sizeof(tempData));
     
     // Perform read from I2S. 
@@ -155,26 +161,35 @@ void TLV320::onTaskTick_()
     ESP_ERROR_CHECK(i2s_channel_read(i2sRxDevice_, tempData, sizeof(tempData), &bytesRead, portMAX_DELAY));
 
     // Output channel bytes to configured output FIFOs.
-    struct FIFO* leftChannelFifo = getAudioOutput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
-    struct FIFO* rightChannelFifo = getAudioOutput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
-    for (int index = 0; index < bytesRead / 2 / sizeof(short); index++)
-    {
-        if (leftChannelFifo != nullptr) codec2_fifo_write(leftChannelFifo, &tempData[2*index], 1);
-        if (rightChannelFifo != nullptr) codec2_fifo_write(rightChannelFifo, &tempData[2*index + 1], 1);
-    }
+    latchAudioOutputs();
+    audio::AudioRingBuffer* leftChannelFifo = getAudioOutput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
+    audio::AudioRingBuffer* rightChannelFifo = getAudioOutput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
+    int numSamplesRead = bytesRead / 2 / sizeof(short);
+    short* leftSamples = leftChannelFifo != nullptr ? leftChannelFifo->acquireWrite(numSamplesRead) : nullptr;
+    short* rightSamples = rightChannelFifo != nullptr ? rightChannelFifo->acquireWrite(numSamplesRead) : nullptr;
+    audio::DeinterleaveStereo(tempData, leftSamples, rightSamples, numSamplesRead);
+
+    // The first sample of the block was captured one block ago (ignoring
+    // any time spent in the I2S DMA buffers).
+    int64_t captureTimeUs = esp_timer_get_time() - (int64_t)numSamplesRead * 1000000 / I2S_SAMPLE_RATE;
+    if (leftSamples != nullptr) micLatencyTagger_.tag(leftChannelFifo, captureTimeUs);
+    if (rightSamples != nullptr) radioLatencyTagger_.tag(rightChannelFifo, captureTimeUs);
+    if (leftSamples != nullptr) leftChannelFifo->commitWrite(numSamplesRead);
+    if (rightSamples != nullptr) rightChannelFifo->commitWrite(numSamplesRead);
 
     leftChannelFifo = getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
     rightChannelFifo = getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
-    if ((leftChannelFifo && codec2_fifo_used(leftChannelFifo) >= I2S_NUM_SAMPLES_PER_INTERVAL) || 
-        (rightChannelFifo && codec2_fifo_used(rightChannelFifo) >= I2S_NUM_SAMPLES_PER_INTERVAL))
+    if (leftChannelFifo->getUsed() >= I2S_NUM_SAMPLES_PER_INTERVAL || 
+        rightChannelFifo->getUsed() >= I2S_NUM_SAMPLES_PER_INTERVAL)
     {
-        memset(tempData, 0, sizeof(tempData));
-        
-        for (auto index = 0; index < I2S_NUM_SAMPLES_PER_INTERVAL; index++)
-        {
-            if (leftChannelFifo) codec2_fifo_read(leftChannelFifo, &tempData[2*index], 1);
-            if (rightChannelFifo) codec2_fifo_read(rightChannelFifo, &tempData[2*index + 1], 1);
-        }
+        // A channel without enough audio is silent (and counted as an underrun).
+        leftSamples = leftChannelFifo->acquireRead(I2S_NUM_SAMPLES_PER_INTERVAL);
+        rightSamples = rightChannelFifo->acquireRead(I2S_NUM_SAMPLES_PER_INTERVAL);
+        audio::InterleaveStereo(leftSamples, rightSamples, tempData, I2S_NUM_SAMPLES_PER_INTERVAL);
+        if (leftSamples != nullptr) leftChannelFifo->commitRead(I2S_NUM_SAMPLES_PER_INTERVAL);
+        if (rightSamples != nullptr) rightChannelFifo->commitRead(I2S_NUM_SAMPLES_PER_INTERVAL);
+        audio::RecordAudioLatency(leftChannelFifo, "TLV320 headset");
+        audio::RecordAudioLatency(rightChannelFifo, "TLV320 radio");
         
         size_t bytesWritten = 0;
         ESP_ERROR_CHECK(i2s_channel_write(i2sTxDevice_, tempData, sizeof(tempData), &bytesWritten, portMAX_DELAY));
@@ -23,6 +23,7 @@
 #include "InputGPIO.h"
 #include "I2CMaster.h"
 #include "audio/AudioInput.h"
+#include "audio/AudioLatency.h"
 #include "storage/SettingsMessage.h"
 #include "task/DVTask.h"
 #include "task/DVTimer.h"
@@ -58,6 +59,8 @@ private:
     i2s_chan_handle_t i2sRxDevice_;
     InputGPIO<GPIO_TLV320_INT1> int1Gpio_;
     InputGPIO<GPIO_TLV320_INT2> int2Gpio_;
+    audio::AudioLatencyTagger micLatencyTagger_;
+    audio::AudioLatencyTagger radioLatencyTagger_;
     
     void onLeftChannelVolume_(DVTask* origin, storage::LeftChannelVolumeMessage* message);
     void onRightChannelVolume_(DVTask* origin, storage::RightChannelVolumeMessage* message);
@@ -0,0 +1,179 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "HostAudioFile.h"
+
+#define HOST_AUDIO_SAMPLE_RATE (8000)
+#define HOST_AUDIO_BLOCK_SAMPLES (160) /* 20ms, same as TLV320 */
+#define HOST_AUDIO_BLOCK_US ((uint64_t)HOST_AUDIO_BLOCK_SAMPLES * 1000000 / HOST_AUDIO_SAMPLE_RATE)
+
+#define CURRENT_LOG_TAG ("HostAudioFile")
+
+namespace ezdv
+{
+
+namespace host
+{
+
+HostAudioFileSource::HostAudioFileSource(const char* name, const char* path)
+    : DVTask(name, 15, 4096, tskNO_AFFINITY, 16)
+    , audio::AudioInput(0, 1)
+    , path_(path)
+    , file_(nullptr)
+    , blockTimer_(this, this, &HostAudioFileSource::onBlockTimer_, HOST_AUDIO_BLOCK_US, "HostAudioSourceTimer")
+    , latencyTagger_(name)
+    , finished_(false)
+{
+    // empty
+}
+
+HostAudioFileSource::~HostAudioFileSource()
+{
+    if (file_ != nullptr)
+    {
+        fclose(file_);
+    }
+}
+
+void HostAudioFileSource::onTaskStart_()
+{
+    file_ = fopen(path_, "rb");
+    if (file_ == nullptr)
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not open %s for reading", path_);
+        finished_.store(true, std::memory_order_release);
+        return;
+    }
+
+    finished_.store(false, std::memory_order_release);
+    blockTimer_.start();
+}
+
+void HostAudioFileSource::onTaskSleep_()
+{
+    blockTimer_.stop();
+
+    if (file_ != nullptr)
+    {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+void HostAudioFileSource::onBlockTimer_(DVTimer* timer)
+{
+    latchAudioOutputs();
+    audio::AudioRingBuffer* fifo = getAudioOutput(audio::AudioInput::LEFT_CHANNEL);
+
+    // Catch up on any blocks we were late for, like real hardware would.
+    for (uint32_t period = 0; period < timer->getPeriodsDue() && file_ != nullptr; period++)
+    {
+        int16_t block[HOST_AUDIO_BLOCK_SAMPLES];
+        size_t numRead = fread(block, sizeof(int16_t), HOST_AUDIO_BLOCK_SAMPLES, file_);
+        if (numRead > 0 && fifo != nullptr)
+        {
+            // The first sample of the block "arrived" one block ago.
+            latencyTagger_.tag(fifo, esp_timer_get_time() - numRead * 1000000 / HOST_AUDIO_SAMPLE_RATE);
+            fifo->write(block, numRead);
+        }
+
+        if (numRead < HOST_AUDIO_BLOCK_SAMPLES)
+        {
+            blockTimer_.stop();
+            fclose(file_);
+            file_ = nullptr;
+            finished_.store(true, std::memory_order_release);
+        }
+    }
+}
+
+HostAudioFileSink::HostAudioFileSink(const char* name, const char* path)
+    : DVTask(name, 15, 4096, tskNO_AFFINITY, 16)
+    , audio::AudioInput(1, 0)
+    , name_(name)
+    , path_(path)
+    , file_(nullptr)
+    , blockTimer_(this, this, &HostAudioFileSink::onBlockTimer_, HOST_AUDIO_BLOCK_US, "HostAudioSinkTimer")
+    , numSamplesWritten_(0)
+{
+    // empty
+}
+
+HostAudioFileSink::~HostAudioFileSink()
+{
+    if (file_ != nullptr)
+    {
+        fclose(file_);
+    }
+}
+
+void HostAudioFileSink::onTaskStart_()
+{
+    if (path_ != nullptr)
+    {
+        file_ = fopen(path_, "wb");
+        if (file_ == nullptr)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not open %s for writing", path_);
+        }
+    }
+
+    blockTimer_.start();
+}
+
+void HostAudioFileSink::onTaskSleep_()
+{
+    blockTimer_.stop();
+
+    if (file_ != nullptr)
+    {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+void HostAudioFileSink::onBlockTimer_(DVTimer* timer)
+{
+    audio::AudioRingBuffer* fifo = getAudioInput(audio::AudioInput::LEFT_CHANNEL);
+
+    for (uint32_t period = 0; period < timer->getPeriodsDue(); period++)
+    {
+        // Like TLV320, only play full blocks.
+        int16_t* block = fifo->getUsed() >= HOST_AUDIO_BLOCK_SAMPLES ? fifo->acquireRead(HOST_AUDIO_BLOCK_SAMPLES) : nullptr;
+        if (block == nullptr)
+        {
+            break;
+        }
+
+        if (file_ != nullptr)
+        {
+            fwrite(block, sizeof(int16_t), HOST_AUDIO_BLOCK_SAMPLES, file_);
+        }
+        fifo->commitRead(HOST_AUDIO_BLOCK_SAMPLES);
+        audio::RecordAudioLatency(fifo, name_);
+
+        numSamplesWritten_.fetch_add(HOST_AUDIO_BLOCK_SAMPLES, std::memory_order_relaxed);
+    }
+}
+
+}
+
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// File-backed audio endpoints for host builds. These stand in for TLV320
+// (or a network radio) so that audio paths can be run, recorded and timed
+// on a workstation. Files are raw 16-bit signed, native endian, mono audio
+// at 8000 Hz.
+
+#ifndef HOST_AUDIO_FILE_H
+#define HOST_AUDIO_FILE_H
+
+#include <atomic>
+#include <cstdio>
+
+#include "audio/AudioInput.h"
+#include "audio/AudioLatency.h"
+#include "task/DVTask.h"
+#include "task/DVTimer.h"
+
+namespace ezdv
+{
+
+namespace host
+{
+
+using namespace ezdv::task;
+
+/// @brief Plays a file into its LEFT output in real time (or virtual time,
+///        in simulation mode), one block every 20ms.
+class HostAudioFileSource : public DVTask, public audio::AudioInput
+{
+public:
+    /// @brief Creates a new file source.
+    /// @param name The task name. Also used as the origin of latency tags.
+    /// @param path The file to play.
+    HostAudioFileSource(const char* name, const char* path);
+    virtual ~HostAudioFileSource();
+
+    /// @brief Returns whether the entire file has been played.
+    bool isFinished() const { return finished_.load(std::memory_order_acquire); }
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    const char* path_;
+    FILE* file_;
+    DVTimer blockTimer_;
+    audio::AudioLatencyTagger latencyTagger_;
+    std::atomic<bool> finished_;
+
+    void onBlockTimer_(DVTimer* timer);
+};
+
+/// @brief Records its LEFT input to a file, one block every 20ms, and
+///        records the end-to-end latency of any tagged audio it receives.
+class HostAudioFileSink : public DVTask, public audio::AudioInput
+{
+public:
+    /// @brief Creates a new file sink.
+    /// @param name The task name. Also used as the destination in latency statistics.
+    /// @param path The file to write to.
+    HostAudioFileSink(const char* name, const char* path);
+    virtual ~HostAudioFileSink();
+
+    /// @brief Returns the number of samples written so far.
+    uint32_t getNumSamplesWritten() const { return numSamplesWritten_.load(std::memory_order_relaxed); }
+
+protected:
+    virtual void onTaskStart_() override;
+    virtual void onTaskSleep_() override;
+
+private:
+    const char* name_;
+    const char* path_;
+    FILE* file_;
+    DVTimer blockTimer_;
+    std::atomic<uint32_t> numSamplesWritten_;
+
+    void onBlockTimer_(DVTimer* timer);
+};
+
+}
+
+}
+
+#endif // HOST_AUDIO_FILE_H
@@ -0,0 +1,94 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+// Host (POSIX) implementations of ESP-IDF logging and capability based
+// heap allocation.
+
+namespace
+{
+
+std::mutex LogMutex_;
+
+}
+
+extern "C"
+{
+
+void HostLogWrite(char level, const char* tag, const char* format, ...)
+{
+    // Uses the esp_timer clock so that simulation mode logs virtual time.
+    int64_t elapsedMs = esp_timer_get_time() / 1000;
+
+    // Same layout as the ESP-IDF console, i.e. "I (1234) tag: message".
+    std::unique_lock<std::mutex> lock(LogMutex_);
+    fprintf(stdout, "%c (%lld) %s: ", level, (long long)elapsedMs, tag);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stdout, format, args);
+    va_end(args);
+
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return calloc(n, size);
+}
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps)
+{
+    return realloc(ptr, size);
+}
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+    {
+        return nullptr;
+    }
+    return ptr;
+}
+
+void heap_caps_free(void* ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    // Not tracked on the host.
+    return SIZE_MAX;
+}
+
+}
@@ -0,0 +1,353 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "esp_timer.h"
+#include "HostScheduler.h"
+
+// Host (POSIX) implementation of esp_timer. A single service thread
+// sleeps until the earliest deadline and runs callbacks in order, mirroring
+// the ESP_TIMER_TASK dispatch method on the ESP32. In simulation mode the
+// service thread is scheduled by HostScheduler and deadlines are in
+// virtual time.
+
+namespace
+{
+
+using HostClock = std::chrono::steady_clock;
+using TimerDeadlineMap = std::multimap<HostClock::time_point, esp_timer_handle_t>;
+
+}
+
+struct HostTimer
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    std::string name;
+    bool skipUnhandledEvents;
+
+    bool active;
+    std::chrono::microseconds period; // zero for one-shot timers
+    TimerDeadlineMap::iterator deadlineIter;
+};
+
+namespace
+{
+
+const HostClock::time_point StartTime_ = HostClock::now();
+
+// Priority of the esp_timer task on the ESP32 (ESP_TASK_TIMER_PRIO).
+constexpr unsigned int TIMER_SERVICE_PRIORITY = 22;
+
+HostClock::time_point Now_()
+{
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        return StartTime_ + std::chrono::microseconds(scheduler.getTimeUs());
+    }
+
+    return HostClock::now();
+}
+
+int64_t ToMicroseconds_(HostClock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - StartTime_).count();
+}
+
+class HostTimerService
+{
+public:
+    static HostTimerService& GetInstance();
+
+    void schedule(esp_timer_handle_t timer, HostClock::time_point deadline);
+    void unschedule(esp_timer_handle_t timer);
+
+    // Blocks until the given timer's callback is no longer executing.
+    void waitForCallback(esp_timer_handle_t timer);
+
+    std::mutex& getMutex() { return mutex_; }
+
+private:
+    HostTimerService();
+
+    std::mutex mutex_;
+    std::condition_variable deadlinesChanged_;
+    std::condition_variable callbackComplete_;
+    TimerDeadlineMap deadlines_;
+    esp_timer_handle_t runningTimer_;
+    std::thread::id serviceThreadId_;
+
+    // Waits (with mutex_ held) until the deadline passes or the deadline 
+    // list changes.
+    void waitUntil_(std::unique_lock<std::mutex>& lock, HostClock::time_point deadline);
+
+    void threadEntry_(HostScheduler::Thread* simulatedThread);
+};
+
+HostTimerService& HostTimerService::GetInstance()
+{
+    // Intentionally never destroyed as the service thread runs until exit.
+    static HostTimerService* instance = new HostTimerService();
+    return *instance;
+}
+
+HostTimerService::HostTimerService()
+    : runningTimer_(nullptr)
+{
+    HostScheduler::Thread* simulatedThread = nullptr;
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        simulatedThread = scheduler.createThread("esp_timer", TIMER_SERVICE_PRIORITY);
+    }
+
+    std::thread thread(&HostTimerService::threadEntry_, this, simulatedThread);
+    serviceThreadId_ = thread.get_id();
+    thread.detach();
+}
+
+void HostTimerService::schedule(esp_timer_handle_t timer, HostClock::time_point deadline)
+{
+    // mutex_ must be held by the caller.
+    timer->deadlineIter = deadlines_.emplace(deadline, timer);
+    timer->active = true;
+    deadlinesChanged_.notify_one();
+}
+
+void HostTimerService::unschedule(esp_timer_handle_t timer)
+{
+    // mutex_ must be held by the caller.
+    deadlines_.erase(timer->deadlineIter);
+    timer->active = false;
+}
+
+void HostTimerService::waitForCallback(esp_timer_handle_t timer)
+{
+    // mutex_ must be held by the caller. Callbacks deleting their own
+    // timer must not wait on themselves.
+    if (std::this_thread::get_id() == serviceThreadId_)
+    {
+        return;
+    }
+
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        mutex_.unlock();
+        scheduler.wait([&]() { return runningTimer_ != timer; }, HostScheduler::NO_DEADLINE);
+        mutex_.lock();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_, std::adopt_lock);
+    callbackComplete_.wait(lock, [&]() { return runningTimer_ != timer; });
+    lock.release();
+}
+
+void HostTimerService::waitUntil_(std::unique_lock<std::mutex>& lock, HostClock::time_point deadline)
+{
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        // Timers may be started or stopped while we're blocked, so the
+        // scheduler re-reads the earliest deadline every time it's needed.
+        lock.unlock();
+        scheduler.wait(
+            []() { return false; }, 
+            [this]() { return deadlines_.empty() ? HostScheduler::NO_DEADLINE : ToMicroseconds_(deadlines_.begin()->first); });
+        lock.lock();
+    }
+    else if (deadline == HostClock::time_point::max())
+    {
+        deadlinesChanged_.wait(lock);
+    }
+    else
+    {
+        deadlinesChanged_.wait_until(lock, deadline);
+    }
+}
+
+void HostTimerService::threadEntry_(HostScheduler::Thread* simulatedThread)
+{
+    if (simulatedThread != nullptr)
+    {
+        HostScheduler::GetInstance().attach(simulatedThread);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;)
+    {
+        if (deadlines_.empty())
+        {
+            waitUntil_(lock, HostClock::time_point::max());
+            continue;
+        }
+
+        auto earliest = deadlines_.begin();
+        auto deadline = earliest->first;
+        auto now = Now_();
+        if (deadline > now)
+        {
+            // The entry may be erased while waiting, so wait on a copy.
+            waitUntil_(lock, deadline);
+            continue;
+        }
+
+        esp_timer_handle_t timer = earliest->second;
+        deadlines_.erase(earliest);
+        timer->active = false;
+
+        if (timer->period.count() > 0)
+        {
+            // Periodic timers are anchored to their original deadline.
+            // Events that were missed entirely are optionally skipped.
+            auto nextDeadline = deadline + timer->period;
+            if (timer->skipUnhandledEvents && nextDeadline <= now)
+            {
+                nextDeadline = now + timer->period;
+            }
+            schedule(timer, nextDeadline);
+        }
+
+        runningTimer_ = timer;
+        lock.unlock();
+
+        timer->callback(timer->arg);
+
+        lock.lock();
+        runningTimer_ = nullptr;
+        callbackComplete_.notify_all();
+    }
+}
+
+esp_err_t StartTimer_(esp_timer_handle_t timer, uint64_t timeoutUs, bool periodic)
+{
+    if (timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto& service = HostTimerService::GetInstance();
+    std::unique_lock<std::mutex> lock(service.getMutex());
+
+    if (timer->active)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->period = std::chrono::microseconds(periodic ? timeoutUs : 0);
+    service.schedule(timer, Now_() + std::chrono::microseconds(timeoutUs));
+
+    return ESP_OK;
+}
+
+}
+
+extern "C"
+{
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* createArgs, esp_timer_handle_t* outHandle)
+{
+    if (createArgs == nullptr || createArgs->callback == nullptr || outHandle == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    HostTimer* timer = new HostTimer();
+    timer->callback = createArgs->callback;
+    timer->arg = createArgs->arg;
+    timer->name = createArgs->name != nullptr ? createArgs->name : "";
+    timer->skipUnhandledEvents = createArgs->skip_unhandled_events;
+    timer->active = false;
+    timer->period = std::chrono::microseconds(0);
+
+    *outHandle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto& service = HostTimerService::GetInstance();
+    std::unique_lock<std::mutex> lock(service.getMutex());
+
+    if (timer->active)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    service.waitForCallback(timer);
+    lock.unlock();
+
+    delete timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs)
+{
+    return StartTimer_(timer, timeoutUs, false);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs)
+{
+    return StartTimer_(timer, periodUs, true);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto& service = HostTimerService::GetInstance();
+    std::unique_lock<std::mutex> lock(service.getMutex());
+
+    if (!timer->active)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    service.unschedule(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    auto& service = HostTimerService::GetInstance();
+    std::unique_lock<std::mutex> lock(service.getMutex());
+    return timer->active;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return ToMicroseconds_(Now_());
+}
+
+}
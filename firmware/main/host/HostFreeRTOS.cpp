@@ -0,0 +1,497 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "HostScheduler.h"
+
+// Host (POSIX) implementation of the subset of FreeRTOS used by ezDV.
+// Each task runs on its own std::thread; queues, semaphores and task
+// notifications are built on std::mutex and std::condition_variable.
+// In simulation mode, all blocking is routed through HostScheduler instead
+// so that only one task runs at a time and time is virtual.
+
+struct HostTask
+{
+    std::string name;
+    BaseType_t coreId;
+    uint32_t stackDepth;
+
+    std::mutex notifyMutex;
+    std::condition_variable notifyCondition;
+    uint32_t notifyValue;
+};
+
+struct HostQueue
+{
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+
+    std::vector<char> storage;
+    UBaseType_t itemSize;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct HostSemaphore
+{
+    std::mutex mutex;
+    std::condition_variable available;
+
+    UBaseType_t count;
+    UBaseType_t maxCount;
+};
+
+namespace
+{
+
+// Thrown by vTaskDelete(nullptr) to unwind back to the thread entry point,
+// since FreeRTOS never returns from that call.
+struct HostTaskExit
+{
+};
+
+using HostClock = std::chrono::steady_clock;
+
+const HostClock::time_point StartTime_ = HostClock::now();
+
+std::recursive_mutex CriticalSectionLock_;
+
+thread_local HostTask* CurrentTask_ = nullptr;
+
+HostClock::time_point TicksToDeadline_(TickType_t ticks)
+{
+    return HostClock::now() + std::chrono::milliseconds((uint64_t)ticks * portTICK_PERIOD_MS);
+}
+
+int64_t TicksToSimulatedDeadline_(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        return HostScheduler::NO_DEADLINE;
+    }
+
+    return HostScheduler::GetInstance().getTimeUs() + (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+// Waits on the given condition until pred() is true or the timeout expires.
+template<typename PredType>
+bool WaitFor_(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticksToWait, PredType pred)
+{
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        // Nothing else runs until we block, so the object lock can be
+        // released while waiting without pred() changing underneath us.
+        lock.unlock();
+        bool result = scheduler.wait(pred, TicksToSimulatedDeadline_(ticksToWait));
+        lock.lock();
+        return result;
+    }
+
+    if (ticksToWait == portMAX_DELAY)
+    {
+        cv.wait(lock, pred);
+        return true;
+    }
+
+    return cv.wait_until(lock, TicksToDeadline_(ticksToWait), pred);
+}
+
+void TaskTrampoline_(HostTask* task, HostScheduler::Thread* simulatedThread, TaskFunction_t taskFn, void* param)
+{
+    if (simulatedThread != nullptr)
+    {
+        HostScheduler::GetInstance().attach(simulatedThread);
+    }
+
+    CurrentTask_ = task;
+
+    try
+    {
+        taskFn(param);
+    }
+    catch (HostTaskExit&)
+    {
+        // Task deleted itself.
+    }
+
+    CurrentTask_ = nullptr;
+    delete task;
+
+    if (simulatedThread != nullptr)
+    {
+        HostScheduler::GetInstance().exit();
+    }
+}
+
+HostTask* GetCurrentTask_()
+{
+    if (CurrentTask_ == nullptr)
+    {
+        // Threads not created via xTaskCreatePinnedToCore() (e.g. main())
+        // still need a handle for notifications.
+        static thread_local HostTask externalTask;
+        externalTask.name = "external";
+        externalTask.coreId = tskNO_AFFINITY;
+        externalTask.stackDepth = 0;
+        externalTask.notifyValue = 0;
+        CurrentTask_ = &externalTask;
+    }
+
+    return CurrentTask_;
+}
+
+BaseType_t QueueSend_(QueueHandle_t queue, const void* item, TickType_t ticksToWait, bool toFront)
+{
+    assert(queue != nullptr);
+
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!WaitFor_(queue->notFull, lock, ticksToWait, [&]() { return queue->count < queue->length; }))
+    {
+        return errQUEUE_FULL;
+    }
+
+    UBaseType_t slot;
+    if (toFront)
+    {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        slot = queue->head;
+    }
+    else
+    {
+        slot = (queue->head + queue->count) % queue->length;
+    }
+
+    memcpy(&queue->storage[slot * queue->itemSize], item, queue->itemSize);
+    queue->count++;
+
+    lock.unlock();
+    queue->notEmpty.notify_one();
+
+    return pdPASS;
+}
+
+BaseType_t QueueReceive_(QueueHandle_t queue, void* buffer, TickType_t ticksToWait, bool remove)
+{
+    assert(queue != nullptr);
+
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!WaitFor_(queue->notEmpty, lock, ticksToWait, [&]() { return queue->count > 0; }))
+    {
+        return errQUEUE_EMPTY;
+    }
+
+    memcpy(buffer, &queue->storage[queue->head * queue->itemSize], queue->itemSize);
+
+    if (remove)
+    {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+
+        lock.unlock();
+        queue->notFull.notify_one();
+    }
+
+    return pdTRUE;
+}
+
+SemaphoreHandle_t CreateSemaphore_(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+    HostSemaphore* semaphore = new HostSemaphore();
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    return semaphore;
+}
+
+}
+
+extern "C"
+{
+
+void HostEnterCritical(portMUX_TYPE* mux)
+{
+    CriticalSectionLock_.lock();
+}
+
+void HostExitCritical(portMUX_TYPE* mux)
+{
+    CriticalSectionLock_.unlock();
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    BaseType_t coreId = GetCurrentTask_()->coreId;
+    return coreId == tskNO_AFFINITY ? 0 : coreId;
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+    return pdFALSE;
+}
+
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t taskFn, const char* name, uint32_t stackDepth, void* param, 
+    UBaseType_t priority, TaskHandle_t* createdTask, BaseType_t coreId)
+{
+    // Priorities cannot be honored without elevated privileges on most
+    // hosts and are ignored, except in simulation mode.
+    HostTask* task = new HostTask();
+    task->name = name != nullptr ? name : "";
+    task->coreId = coreId;
+    task->stackDepth = stackDepth;
+    task->notifyValue = 0;
+
+    if (createdTask != nullptr)
+    {
+        *createdTask = task;
+    }
+
+    HostScheduler::Thread* simulatedThread = nullptr;
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        simulatedThread = scheduler.createThread(task->name.c_str(), priority);
+    }
+
+    std::thread thread(&TaskTrampoline_, task, simulatedThread, taskFn, param);
+    thread.detach();
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Other threads cannot be forcibly terminated; only self-deletion
+    // (the only form ezDV uses) is supported.
+    assert(task == nullptr || task == CurrentTask_);
+    throw HostTaskExit();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return GetCurrentTask_();
+}
+
+const char* pcTaskGetName(TaskHandle_t task)
+{
+    if (task == nullptr)
+    {
+        task = GetCurrentTask_();
+    }
+
+    return task->name.c_str();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        return (TickType_t)(scheduler.getTimeUs() / 1000 / portTICK_PERIOD_MS);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(HostClock::now() - StartTime_);
+    return (TickType_t)(elapsed.count() / portTICK_PERIOD_MS);
+}
+
+void vTaskDelay(TickType_t ticksToDelay)
+{
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        scheduler.wait([]() { return false; }, TicksToSimulatedDeadline_(ticksToDelay));
+        return;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds((uint64_t)ticksToDelay * portTICK_PERIOD_MS));
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    // Host threads have far larger stacks than requested and usage
+    // isn't tracked, so report the requested depth as always free.
+    if (task == nullptr)
+    {
+        task = GetCurrentTask_();
+    }
+
+    return task->stackDepth;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    assert(task != nullptr);
+
+    {
+        std::unique_lock<std::mutex> lock(task->notifyMutex);
+        task->notifyValue++;
+    }
+    task->notifyCondition.notify_one();
+
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken)
+{
+    xTaskNotifyGive(task);
+
+    if (higherPriorityTaskWoken != nullptr)
+    {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    HostTask* task = GetCurrentTask_();
+
+    std::unique_lock<std::mutex> lock(task->notifyMutex);
+    WaitFor_(task->notifyCondition, lock, ticksToWait, [&]() { return task->notifyValue > 0; });
+
+    uint32_t value = task->notifyValue;
+    if (value > 0)
+    {
+        task->notifyValue = clearCountOnExit ? 0 : value - 1;
+    }
+
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t queueLength, UBaseType_t itemSize)
+{
+    assert(queueLength > 0);
+
+    HostQueue* queue = new HostQueue();
+    queue->storage.resize(queueLength * itemSize);
+    queue->itemSize = itemSize;
+    queue->length = queueLength;
+    queue->head = 0;
+    queue->count = 0;
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t ticksToWait)
+{
+    return QueueSend_(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticksToWait)
+{
+    return QueueSend_(queue, item, ticksToWait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticksToWait)
+{
+    return QueueReceive_(queue, buffer, ticksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* buffer, TickType_t ticksToWait)
+{
+    return QueueReceive_(queue, buffer, ticksToWait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    return queue->length - queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return CreateSemaphore_(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return CreateSemaphore_(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+    return CreateSemaphore_(maxCount, initialCount);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+    assert(semaphore != nullptr);
+
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!WaitFor_(semaphore->available, lock, ticksToWait, [&]() { return semaphore->count > 0; }))
+    {
+        return pdFALSE;
+    }
+
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    assert(semaphore != nullptr);
+
+    {
+        std::unique_lock<std::mutex> lock(semaphore->mutex);
+        if (semaphore->count >= semaphore->maxCount)
+        {
+            return pdFALSE;
+        }
+        semaphore->count++;
+    }
+    semaphore->available.notify_one();
+
+    return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+{
+    assert(semaphore != nullptr);
+
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    return semaphore->count;
+}
+
+}
@@ -0,0 +1,246 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "HostScheduler.h"
+
+namespace
+{
+
+thread_local HostScheduler::Thread* CurrentThread_ = nullptr;
+
+}
+
+HostScheduler& HostScheduler::GetInstance()
+{
+    // Intentionally never destroyed as parked threads may still reference
+    // it during exit.
+    static HostScheduler* instance = new HostScheduler();
+    return *instance;
+}
+
+HostScheduler::HostScheduler()
+    : enabled_(false)
+    , nowUs_(0)
+    , nextThreadId_(0)
+    , runSequence_(0)
+    , stats_{}
+{
+    // empty
+}
+
+void HostScheduler::enable()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    assert(!enabled_);
+    enabled_ = true;
+
+    // The calling thread is the driver and starts out running. It has
+    // the lowest priority so that it only runs once everything else
+    // has settled.
+    Thread* thread = new Thread();
+    thread->name = "driver";
+    thread->priority = 0;
+    thread->id = nextThreadId_++;
+    thread->lastRunSequence = 0;
+    thread->running = true;
+    thread->blocked = false;
+    thread->timedOut = false;
+    threads_.push_back(thread);
+
+    CurrentThread_ = thread;
+}
+
+int64_t HostScheduler::getTimeUs()
+{
+    return nowUs_;
+}
+
+HostScheduler::Thread* HostScheduler::createThread(const char* name, unsigned int priority)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    assert(enabled_);
+
+    Thread* thread = new Thread();
+    thread->name = name != nullptr ? name : "";
+    thread->priority = priority;
+    thread->id = nextThreadId_++;
+    thread->lastRunSequence = 0;
+    thread->running = false;
+    thread->blocked = false;
+    thread->timedOut = false;
+    threads_.push_back(thread);
+
+    return thread;
+}
+
+void HostScheduler::attach(Thread* thread)
+{
+    CurrentThread_ = thread;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    thread->resume.wait(lock, [&]() { return thread->running; });
+}
+
+void HostScheduler::exit()
+{
+    Thread* current = CurrentThread_;
+    assert(current != nullptr);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto iter = threads_.begin(); iter != threads_.end(); iter++)
+    {
+        if (*iter == current)
+        {
+            threads_.erase(iter);
+            break;
+        }
+    }
+
+    switchTo_(lock, nullptr, pickNext_());
+    lock.unlock();
+
+    CurrentThread_ = nullptr;
+    delete current;
+}
+
+bool HostScheduler::wait(const std::function<bool()>& ready, const std::function<int64_t()>& deadline)
+{
+    // Threads not created through the shim can't be scheduled.
+    Thread* current = CurrentThread_;
+    assert(current != nullptr);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ready())
+    {
+        return true;
+    }
+    else if (deadline() <= nowUs_)
+    {
+        return false;
+    }
+
+    current->ready = ready;
+    current->deadline = deadline;
+    current->blocked = true;
+
+    switchTo_(lock, current, pickNext_());
+
+    current->ready = nullptr;
+    current->deadline = nullptr;
+    return !current->timedOut;
+}
+
+bool HostScheduler::wait(const std::function<bool()>& ready, int64_t deadlineUs)
+{
+    return wait(ready, [deadlineUs]() { return deadlineUs; });
+}
+
+void HostScheduler::getStatistics(Statistics* stats)
+{
+    assert(stats != nullptr);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    *stats = stats_;
+}
+
+HostScheduler::Thread* HostScheduler::pickNext_()
+{
+    // mutex_ must be held by the caller.
+    for (;;)
+    {
+        Thread* best = nullptr;
+        for (auto thread : threads_)
+        {
+            bool runnable = 
+                thread->blocked ? 
+                    (thread->ready() || thread->deadline() <= nowUs_) :
+                    !thread->running;
+            if (!runnable)
+            {
+                continue;
+            }
+
+            if (best == nullptr || 
+                thread->priority > best->priority ||
+                (thread->priority == best->priority && thread->lastRunSequence < best->lastRunSequence))
+            {
+                best = thread;
+            }
+        }
+
+        if (best != nullptr)
+        {
+            if (best->blocked)
+            {
+                best->timedOut = !best->ready();
+                best->blocked = false;
+            }
+            return best;
+        }
+
+        // Everything is blocked, so jump ahead to the earliest deadline.
+        int64_t nextUs = NO_DEADLINE;
+        for (auto thread : threads_)
+        {
+            int64_t deadlineUs = thread->blocked ? thread->deadline() : NO_DEADLINE;
+            if (deadlineUs < nextUs)
+            {
+                nextUs = deadlineUs;
+            }
+        }
+
+        if (nextUs == NO_DEADLINE)
+        {
+            fprintf(stderr, "Simulation deadlocked at %lld us; blocked threads:\n", (long long)nowUs_);
+            for (auto thread : threads_)
+            {
+                fprintf(stderr, "    %s\n", thread->name.c_str());
+            }
+            abort();
+        }
+
+        nowUs_ = nextUs;
+        stats_.numTimeAdvances++;
+    }
+}
+
+void HostScheduler::switchTo_(std::unique_lock<std::mutex>& lock, Thread* current, Thread* next)
+{
+    // mutex_ must be held by the caller.
+    next->lastRunSequence = ++runSequence_;
+    if (next == current)
+    {
+        return;
+    }
+
+    stats_.numContextSwitches++;
+    if (current != nullptr)
+    {
+        current->running = false;
+    }
+    next->running = true;
+    next->resume.notify_one();
+
+    if (current != nullptr)
+    {
+        current->resume.wait(lock, [&]() { return current->running; });
+    }
+}
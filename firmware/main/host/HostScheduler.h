@@ -0,0 +1,110 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Deterministic virtual-time scheduler used by the host shim when
+// simulation mode is enabled (see host_simulation.h). Internal to the
+// shim; tools should only use the API in host_simulation.h.
+//
+// In simulation mode every task (and the esp_timer service) still runs on
+// its own std::thread, but only one of them is allowed to execute at a 
+// time. A thread keeps running until it blocks in one of the shim's wait
+// functions, at which point the highest priority runnable thread (least
+// recently run first among equals) is resumed. When nothing is runnable,
+// virtual time jumps directly to the earliest pending deadline.
+
+#ifndef HOST_SCHEDULER_H
+#define HOST_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class HostScheduler
+{
+public:
+    // Deadline value for waits without a timeout.
+    static constexpr int64_t NO_DEADLINE = INT64_MAX;
+
+    struct Thread
+    {
+        std::string name;
+        unsigned int priority;
+        uint32_t id;
+        uint64_t lastRunSequence;
+
+        bool running;
+        bool blocked;
+        bool timedOut;
+        std::function<bool()> ready;
+        std::function<int64_t()> deadline;
+        std::condition_variable resume;
+    };
+
+    struct Statistics
+    {
+        uint64_t numContextSwitches;
+        uint64_t numTimeAdvances;
+    };
+
+    static HostScheduler& GetInstance();
+
+    bool isEnabled() const { return enabled_; }
+
+    // Switches the shim to virtual time. The calling thread becomes the
+    // driver thread and is the only one running until it blocks.
+    void enable();
+
+    int64_t getTimeUs();
+
+    // Registers a thread that is about to be created. Must be called by 
+    // the running thread; the new thread must then call attach() before
+    // doing anything else.
+    Thread* createThread(const char* name, unsigned int priority);
+    void attach(Thread* thread);
+
+    // Removes the calling thread and resumes the next runnable one.
+    void exit();
+
+    // Blocks the calling thread until ready() returns true (returns true)
+    // or virtual time reaches deadline() (returns false). Both functions
+    // are evaluated by whichever thread is scheduling and must not take 
+    // any locks.
+    bool wait(const std::function<bool()>& ready, const std::function<int64_t()>& deadline);
+    bool wait(const std::function<bool()>& ready, int64_t deadlineUs);
+
+    void getStatistics(Statistics* stats);
+
+private:
+    HostScheduler();
+
+    std::mutex mutex_;
+    bool enabled_;
+    std::atomic<int64_t> nowUs_;
+    uint32_t nextThreadId_;
+    uint64_t runSequence_;
+    std::vector<Thread*> threads_;
+    Statistics stats_;
+
+    Thread* pickNext_();
+    void switchTo_(std::unique_lock<std::mutex>& lock, Thread* current, Thread* next);
+};
+
+#endif // HOST_SCHEDULER_H
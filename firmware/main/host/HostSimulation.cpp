@@ -0,0 +1,225 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host_simulation.h"
+#include "HostScheduler.h"
+
+#define CURRENT_LOG_TAG ("HostSimulation")
+
+// Host simulation driver: virtual clock control and script replay on top
+// of HostScheduler.
+
+namespace
+{
+
+struct ScriptAction
+{
+    HostSimulationAction_t fn;
+    void* arg;
+};
+
+struct ScriptEvent
+{
+    int64_t timeUs;
+    int lineNumber;
+    std::vector<std::string> args;
+};
+
+std::mutex ActionMutex_;
+std::map<std::string, ScriptAction> Actions_;
+
+const std::chrono::steady_clock::time_point StartTime_ = std::chrono::steady_clock::now();
+
+bool ParseScript_(const char* path, std::vector<ScriptEvent>& events)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        ESP_LOGE(CURRENT_LOG_TAG, "Could not open script %s", path);
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    int64_t lastTimeUs = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+
+        auto commentPos = line.find('#');
+        if (commentPos != std::string::npos)
+        {
+            line.resize(commentPos);
+        }
+
+        std::istringstream stream(line);
+        std::string timeString;
+        if (!(stream >> timeString))
+        {
+            // Blank line.
+            continue;
+        }
+
+        char* end = nullptr;
+        double timeMs = strtod(timeString.c_str(), &end);
+        if (*end != '\0' || timeMs < 0)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "%s:%d: invalid time %s", path, lineNumber, timeString.c_str());
+            return false;
+        }
+
+        ScriptEvent event;
+        event.timeUs = (int64_t)(timeMs * 1000);
+        event.lineNumber = lineNumber;
+
+        std::string arg;
+        while (stream >> arg)
+        {
+            event.args.push_back(arg);
+        }
+
+        if (event.args.empty())
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "%s:%d: missing action", path, lineNumber);
+            return false;
+        }
+        else if (Actions_.find(event.args[0]) == Actions_.end())
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "%s:%d: unknown action %s", path, lineNumber, event.args[0].c_str());
+            return false;
+        }
+        else if (event.timeUs < lastTimeUs)
+        {
+            ESP_LOGE(CURRENT_LOG_TAG, "%s:%d: events must be in time order", path, lineNumber);
+            return false;
+        }
+
+        lastTimeUs = event.timeUs;
+        events.push_back(std::move(event));
+    }
+
+    return true;
+}
+
+}
+
+extern "C"
+{
+
+void HostSimulationEnable(void)
+{
+    HostScheduler::GetInstance().enable();
+}
+
+bool HostSimulationIsEnabled(void)
+{
+    return HostScheduler::GetInstance().isEnabled();
+}
+
+void HostSimulationRunUntil(int64_t timeUs)
+{
+    auto& scheduler = HostScheduler::GetInstance();
+    if (scheduler.isEnabled())
+    {
+        scheduler.wait([]() { return false; }, timeUs);
+    }
+    else
+    {
+        int64_t remainingUs = timeUs - esp_timer_get_time();
+        if (remainingUs > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(remainingUs));
+        }
+    }
+}
+
+void HostSimulationRunFor(int64_t durationUs)
+{
+    HostSimulationRunUntil(esp_timer_get_time() + durationUs);
+}
+
+void HostSimulationRegisterAction(const char* name, HostSimulationAction_t action, void* arg)
+{
+    assert(name != nullptr && action != nullptr);
+
+    std::unique_lock<std::mutex> lock(ActionMutex_);
+    Actions_[name] = ScriptAction { action, arg };
+}
+
+int HostSimulationRunScript(const char* path)
+{
+    std::vector<ScriptEvent> events;
+
+    {
+        std::unique_lock<std::mutex> lock(ActionMutex_);
+        if (!ParseScript_(path, events))
+        {
+            return -1;
+        }
+    }
+
+    int64_t startTimeUs = esp_timer_get_time();
+    for (auto& event : events)
+    {
+        HostSimulationRunUntil(startTimeUs + event.timeUs);
+
+        ScriptAction action;
+        {
+            std::unique_lock<std::mutex> lock(ActionMutex_);
+            action = Actions_[event.args[0]];
+        }
+
+        std::vector<const char*> argv;
+        for (auto& arg : event.args)
+        {
+            argv.push_back(arg.c_str());
+        }
+
+        (*action.fn)((int)argv.size(), argv.data(), action.arg);
+    }
+
+    return (int)events.size();
+}
+
+void HostSimulationGetStatistics(HostSimulationStatistics_t* stats)
+{
+    assert(stats != nullptr);
+
+    HostScheduler::Statistics schedulerStats;
+    HostScheduler::GetInstance().getStatistics(&schedulerStats);
+
+    stats->virtualTimeUs = esp_timer_get_time();
+    stats->wallTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - StartTime_).count();
+    stats->numContextSwitches = schedulerStats.numContextSwitches;
+    stats->numTimeAdvances = schedulerStats.numTimeAdvances;
+}
+
+}
@@ -0,0 +1,52 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host (POSIX) implementation of ESP-IDF capability based allocation.
+// All capabilities map to the regular C heap.
+
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps);
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+
+size_t heap_caps_get_free_size(uint32_t caps);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // HOST_ESP_HEAP_CAPS_H
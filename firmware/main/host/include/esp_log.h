@@ -0,0 +1,43 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host (POSIX) implementation of ESP-IDF logging.
+
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+void HostLogWrite(char level, const char* tag, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#define ESP_LOGE(tag, format, ...) HostLogWrite('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HostLogWrite('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HostLogWrite('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do { } while(0)
+#define ESP_LOGV(tag, format, ...) do { } while(0)
+
+#endif // HOST_ESP_LOG_H
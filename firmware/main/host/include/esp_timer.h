@@ -0,0 +1,67 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host (POSIX) implementation of esp_timer. Callbacks execute on a single 
+// timer service thread, equivalent to ESP_TIMER_TASK dispatch.
+
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+typedef struct HostTimer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum
+{
+    ESP_TIMER_TASK,
+    ESP_TIMER_MAX,
+} esp_timer_dispatch_t;
+
+typedef struct
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* createArgs, esp_timer_handle_t* outHandle);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodUs);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+bool esp_timer_is_active(esp_timer_handle_t timer);
+
+/// Microseconds since the host process started (virtual time in simulation mode).
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // HOST_ESP_TIMER_H
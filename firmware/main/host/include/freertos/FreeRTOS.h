@@ -0,0 +1,89 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host (POSIX) implementation of the subset of FreeRTOS used by ezDV. 
+// Only used when building outside of ESP-IDF.
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+typedef struct HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+// Matches CONFIG_FREERTOS_HZ in sdkconfig.
+#define configTICK_RATE_HZ (100)
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * (uint64_t)configTICK_RATE_HZ) / (uint64_t)1000U))
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL (pdFALSE)
+#define pdPASS (pdTRUE)
+#define errQUEUE_EMPTY ((BaseType_t)0)
+#define errQUEUE_FULL ((BaseType_t)0)
+
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+
+// Number of simulated cores (matches ESP32-S3).
+#define portNUM_PROCESSORS (2)
+
+// Critical sections. There are no interrupts on the host, so
+// all critical sections are serialized on a single recursive lock.
+typedef struct
+{
+    uint32_t unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define spinlock_initialize(mux) ((void)(mux))
+
+void HostEnterCritical(portMUX_TYPE* mux);
+void HostExitCritical(portMUX_TYPE* mux);
+
+#define portENTER_CRITICAL(mux) HostEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) HostExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) HostEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) HostExitCritical(mux)
+#define portENTER_CRITICAL_SAFE(mux) HostEnterCritical(mux)
+#define portEXIT_CRITICAL_SAFE(mux) HostExitCritical(mux)
+
+#define portYIELD_FROM_ISR(...) ((void)0)
+
+BaseType_t xPortGetCoreID(void);
+BaseType_t xPortInIsrContext(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,51 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_FREERTOS_QUEUE_H
+#define HOST_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+typedef struct HostQueue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t queueLength, UBaseType_t itemSize);
+void vQueueDelete(QueueHandle_t queue);
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t ticksToWait);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticksToWait);
+BaseType_t xQueuePeek(QueueHandle_t queue, void* buffer, TickType_t ticksToWait);
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+// There are no interrupts on the host; the ISR variants never block.
+#define xQueueSend(queue, item, ticks) xQueueSendToBack((queue), (item), (ticks))
+#define xQueueSendToBackFromISR(queue, item, woken) xQueueSendToBack((queue), (item), 0)
+#define xQueueSendToFrontFromISR(queue, item, woken) xQueueSendToFront((queue), (item), 0)
+#define xQueueReceiveFromISR(queue, buffer, woken) xQueueReceive((queue), (buffer), 0)
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // HOST_FREERTOS_QUEUE_H
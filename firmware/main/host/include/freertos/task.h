@@ -0,0 +1,49 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t taskFn, const char* name, uint32_t stackDepth, void* param, 
+    UBaseType_t priority, TaskHandle_t* createdTask, BaseType_t coreId);
+void vTaskDelete(TaskHandle_t task);
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char* pcTaskGetName(TaskHandle_t task);
+
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticksToDelay);
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // HOST_FREERTOS_TASK_H
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Host-only simulation API. When enabled, DVTask/DVTimer and everything 
+// else built on the shim run against a virtual clock: only one task runs 
+// at a time, and whenever every task is blocked, time jumps straight to 
+// the next timer or timeout. Runs are therefore deterministic and much
+// faster than real time.
+//
+// Typical use from a host tool's main():
+//
+//     HostSimulationEnable();
+//     ... create and start tasks ...
+//     HostSimulationRegisterAction("ptt", &onPtt, &state);
+//     HostSimulationRunScript("session.txt");
+//     ... dump task/timer statistics ...
+//
+// Scripts are plain text with one event per line:
+//
+//     # <time in ms since script start> <action> [arguments...]
+//     0      ptt  off
+//     1500.5 ptt  on
+//
+// Events run on the driver thread (the one that called 
+// HostSimulationEnable()) once the virtual clock reaches their time.
+
+#ifndef HOST_SIMULATION_H
+#define HOST_SIMULATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+typedef void (*HostSimulationAction_t)(int argc, const char** argv, void* arg);
+
+typedef struct
+{
+    int64_t virtualTimeUs;
+    int64_t wallTimeUs;
+    uint64_t numContextSwitches;
+    uint64_t numTimeAdvances;
+} HostSimulationStatistics_t;
+
+/// Switches to virtual time. Must be called before any tasks or timers 
+/// are created; the calling thread becomes the driver thread.
+void HostSimulationEnable(void);
+bool HostSimulationIsEnabled(void);
+
+/// Lets the rest of the system run until esp_timer_get_time() reaches timeUs.
+/// Also usable without simulation mode, in which case it simply sleeps.
+void HostSimulationRunUntil(int64_t timeUs);
+void HostSimulationRunFor(int64_t durationUs);
+
+/// Registers a script action. argv[0] is the action name.
+void HostSimulationRegisterAction(const char* name, HostSimulationAction_t action, void* arg);
+
+/// Runs the given script. Returns the number of events executed or -1 if
+/// the script couldn't be read or parsed (in which case nothing is run).
+int HostSimulationRunScript(const char* path);
+
+void HostSimulationGetStatistics(HostSimulationStatistics_t* stats);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // HOST_SIMULATION_H
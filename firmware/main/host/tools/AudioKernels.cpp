@@ -0,0 +1,249 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks the AudioKernels functions against straightforward scalar versions
+// of the same operations. Every case is run with lengths on either side of
+// the SIMD block size (including odd ones), with every combination of 16
+// byte aligned and misaligned pointers, with nullptr channels/inputs and
+// with inputs and gains that saturate the mixer. Output buffers are guarded
+// on both sides to catch writes past the requested length.
+//
+// On targets without SIMD versions, this checks the portable code only.
+//
+// Usage:
+//
+//     ezdv_audio_kernels
+
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "audio/AudioKernels.h"
+
+#define MAX_FRAMES (100)
+#define MAX_INPUTS (4)
+#define ALIGNMENT (16)
+#define GUARD_SAMPLES (16)
+#define GUARD_VALUE ((int16_t)0x5A5A)
+
+using namespace ezdv;
+
+namespace
+{
+
+std::mt19937 Random_(1234);
+int NumFailures_ = 0;
+int NumChecks_ = 0;
+
+/// @brief A block of samples starting the given number of samples past a 16 byte
+///        boundary, with guard samples on either side.
+class Buffer
+{
+public:
+    Buffer(uint32_t numSamples, uint32_t offset)
+        : storage_(GUARD_SAMPLES + ALIGNMENT + numSamples + GUARD_SAMPLES, GUARD_VALUE)
+        , numSamples_(numSamples)
+    {
+        // Find the first 16 byte aligned sample after the leading guard.
+        uintptr_t start = (uintptr_t)&storage_[GUARD_SAMPLES];
+        uint32_t skip = ((ALIGNMENT - (start % ALIGNMENT)) % ALIGNMENT) / sizeof(int16_t);
+        data_ = &storage_[GUARD_SAMPLES + skip + offset];
+    }
+
+    int16_t* data() { return data_; }
+    int16_t& operator[](uint32_t index) { return data_[index]; }
+
+    void fillRandom(bool saturating)
+    {
+        for (uint32_t index = 0; index < numSamples_; index++)
+        {
+            if (saturating)
+            {
+                data_[index] = (Random_() & 1) ? SHRT_MAX : SHRT_MIN;
+            }
+            else
+            {
+                data_[index] = (int16_t)Random_();
+            }
+        }
+    }
+
+    /// @brief Returns true if nothing outside the block was written.
+    bool guardsIntact() const
+    {
+        for (size_t index = 0; index < storage_.size(); index++)
+        {
+            const int16_t* sample = &storage_[index];
+            if ((sample < data_ || sample >= data_ + numSamples_) && *sample != GUARD_VALUE)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<int16_t> storage_;
+    int16_t* data_;
+    uint32_t numSamples_;
+};
+
+void Check(bool ok, const char* what, uint32_t numFrames, uint32_t offset)
+{
+    NumChecks_++;
+    if (!ok)
+    {
+        NumFailures_++;
+        printf("FAIL: %s (%" PRIu32 " frames, pointer offset %" PRIu32 " samples)\n", what, numFrames, offset);
+    }
+}
+
+void CheckDeinterleave(uint32_t numFrames, uint32_t inOffset, uint32_t outOffset, bool withLeft, bool withRight)
+{
+    Buffer in(2 * numFrames, inOffset);
+    Buffer left(numFrames, outOffset);
+    Buffer right(numFrames, outOffset);
+    in.fillRandom(false);
+
+    audio::DeinterleaveStereo(in.data(), withLeft ? left.data() : nullptr, withRight ? right.data() : nullptr, numFrames);
+
+    bool ok = true;
+    for (uint32_t index = 0; index < numFrames; index++)
+    {
+        ok &= !withLeft || left[index] == in[2 * index];
+        ok &= !withRight || right[index] == in[2 * index + 1];
+        ok &= withLeft || left[index] == GUARD_VALUE;
+        ok &= withRight || right[index] == GUARD_VALUE;
+    }
+    Check(ok, "DeinterleaveStereo output", numFrames, outOffset);
+    Check(in.guardsIntact() && left.guardsIntact() && right.guardsIntact(), "DeinterleaveStereo bounds", numFrames, outOffset);
+}
+
+void CheckInterleave(uint32_t numFrames, uint32_t inOffset, uint32_t outOffset, bool withLeft, bool withRight)
+{
+    Buffer left(numFrames, inOffset);
+    Buffer right(numFrames, inOffset);
+    Buffer out(2 * numFrames, outOffset);
+    left.fillRandom(false);
+    right.fillRandom(false);
+
+    audio::InterleaveStereo(withLeft ? left.data() : nullptr, withRight ? right.data() : nullptr, out.data(), numFrames);
+
+    bool ok = true;
+    for (uint32_t index = 0; index < numFrames; index++)
+    {
+        ok &= out[2 * index] == (withLeft ? left[index] : 0);
+        ok &= out[2 * index + 1] == (withRight ? right[index] : 0);
+    }
+    Check(ok, "InterleaveStereo output", numFrames, outOffset);
+    Check(left.guardsIntact() && right.guardsIntact() && out.guardsIntact(), "InterleaveStereo bounds", numFrames, outOffset);
+}
+
+void CheckMix(uint32_t numSamples, uint32_t inOffset, uint32_t outOffset, uint32_t numInputs, uint32_t nullMask, bool saturating)
+{
+    std::vector<Buffer> inputBuffers;
+    const int16_t* inputs[MAX_INPUTS];
+    int16_t gains[MAX_INPUTS];
+    for (uint32_t input = 0; input < numInputs; input++)
+    {
+        inputBuffers.emplace_back(numSamples, inOffset);
+        inputBuffers.back().fillRandom(saturating);
+
+        // Saturating cases use large gains of the same sign so that the 
+        // sum is well outside the 16 bit range. Gains are kept low enough
+        // that the sum itself fits in 32 bits.
+        if (saturating)
+        {
+            gains[input] = 4 * MIX_GAIN_Q10_UNITY;
+        }
+        else
+        {
+            gains[input] = (int16_t)(Random_() % (2 * MIX_GAIN_Q10_UNITY)) - MIX_GAIN_Q10_UNITY;
+        }
+    }
+    for (uint32_t input = 0; input < numInputs; input++)
+    {
+        inputs[input] = (nullMask & (1 << input)) ? nullptr : inputBuffers[input].data();
+    }
+
+    Buffer out(numSamples, outOffset);
+    audio::MixSaturate(inputs, gains, numInputs, out.data(), numSamples);
+
+    bool ok = true;
+    for (uint32_t index = 0; index < numSamples; index++)
+    {
+        int64_t sum = 0;
+        for (uint32_t input = 0; input < numInputs; input++)
+        {
+            if (inputs[input] != nullptr)
+            {
+                sum += (int64_t)inputs[input][index] * gains[input];
+            }
+        }
+
+        sum >>= MIX_GAIN_Q10_SHIFT;
+        int16_t expected = sum > SHRT_MAX ? SHRT_MAX : (sum < SHRT_MIN ? SHRT_MIN : (int16_t)sum);
+        ok &= out[index] == expected;
+    }
+    Check(ok, saturating ? "MixSaturate output (saturating)" : "MixSaturate output", numSamples, outOffset);
+
+    bool guardsOk = out.guardsIntact();
+    for (auto& buffer : inputBuffers)
+    {
+        guardsOk &= buffer.guardsIntact();
+    }
+    Check(guardsOk, "MixSaturate bounds", numSamples, outOffset);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    // Offsets of 0 are 16 byte aligned; the others aren't.
+    const uint32_t offsets[] = { 0, 1, 3, 8 };
+
+    for (uint32_t numFrames = 0; numFrames <= MAX_FRAMES; numFrames++)
+    {
+        for (auto inOffset : offsets)
+        {
+            for (auto outOffset : offsets)
+            {
+                for (int channels = 0; channels < 4; channels++)
+                {
+                    bool withLeft = (channels & 1) != 0;
+                    bool withRight = (channels & 2) != 0;
+                    CheckDeinterleave(numFrames, inOffset, outOffset, withLeft, withRight);
+                    CheckInterleave(numFrames, inOffset, outOffset, withLeft, withRight);
+                }
+
+                for (uint32_t numInputs = 0; numInputs <= MAX_INPUTS; numInputs++)
+                {
+                    for (uint32_t nullMask = 0; nullMask < (1u << numInputs); nullMask++)
+                    {
+                        CheckMix(numFrames, inOffset, outOffset, numInputs, nullMask, false);
+                        CheckMix(numFrames, inOffset, outOffset, numInputs, nullMask, true);
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%d of %d checks passed.\n", NumChecks_ - NumFailures_, NumChecks_);
+    return NumFailures_ > 0 ? 1 : 0;
+}
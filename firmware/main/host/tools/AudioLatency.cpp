@@ -0,0 +1,189 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Plays a file through part of the audio pipeline in simulated time and
+// reports per-route and end-to-end latency. The file endpoints stand in for
+// TLV320 and use the same 20ms block size. Paths:
+//
+// * mixer: file "mic" -> AudioMixer -> file "headset" (default)
+// * tx: file "mic" -> FreeDVTask (analog mode, PTT held) -> file "radio",
+//   i.e. the mic-to-radio path.
+// * rx: file "radio" -> FreeDVTask -> FreeDVSpeechTask -> AudioMixer ->
+//   file "headset" (analog mode), i.e. the radio-to-headset path.
+//
+// Optionally fails if the 99th percentile end-to-end latency exceeds a
+// limit, for use in regression runs:
+//
+//     ezdv_audio_latency [-p mixer|tx|rx] input.raw output.raw [max p99 latency in ms]
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "host_simulation.h"
+#include "audio/AudioGraph.h"
+#include "audio/AudioLatency.h"
+#include "audio/AudioMixer.h"
+#include "audio/FreeDVMessage.h"
+#include "audio/FreeDVScanTask.h"
+#include "audio/FreeDVSpeechTask.h"
+#include "audio/FreeDVTask.h"
+#include "host/HostAudioFile.h"
+
+using namespace ezdv;
+
+int main(int argc, char** argv)
+{
+    const char* path = "mixer";
+    if (argc > 2 && !strcmp(argv[1], "-p"))
+    {
+        path = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc < 3 || (strcmp(path, "mixer") && strcmp(path, "tx") && strcmp(path, "rx")))
+    {
+        fprintf(stderr, "Usage: %s [-p mixer|tx|rx] <input.raw> <output.raw> [max p99 latency in ms]\n", argv[0]);
+        return 2;
+    }
+
+#if !CONFIG_EZDV_AUDIO_LATENCY_TAGS
+    fprintf(stderr, "Latency tags are disabled in this build (see EZDV_HOST_AUDIO_LATENCY_TAGS).\n");
+    return 2;
+#else
+    HostSimulationEnable();
+    task::DVTask::Initialize();
+
+    bool isTx = !strcmp(path, "tx");
+    bool isRx = !strcmp(path, "rx");
+
+    host::HostAudioFileSource source(isRx ? "File radio" : "File mic", argv[1]);
+    audio::AudioMixer mixer;
+    audio::FreeDVSpeechTask speechTask;
+    audio::FreeDVScanTask scanTask;
+    audio::FreeDVTask freedv(&speechTask, &scanTask);
+    host::HostAudioFileSink sink(isTx ? "File radio" : "File headset", argv[2]);
+
+    auto graph = audio::AudioGraph::GetInstance();
+    graph->addNode("FileSource", &source);
+    graph->addNode("Mixer", &mixer);
+    graph->addNode("FreeDV", &freedv);
+    graph->addNode("FreeDVSpeech", &speechTask);
+    graph->addNode("FileSink", &sink);
+
+    {
+        // Same channels as Application uses with TLV320.
+        audio::AudioGraph::Patch patch;
+        if (isTx)
+        {
+            patch.connect(&source, audio::AudioInput::LEFT_CHANNEL, &freedv, audio::AudioInput::USER_CHANNEL);
+            patch.connect(&freedv, audio::AudioInput::RADIO_CHANNEL, &sink, audio::AudioInput::LEFT_CHANNEL);
+        }
+        else if (isRx)
+        {
+            patch.connect(&source, audio::AudioInput::LEFT_CHANNEL, &freedv, audio::AudioInput::RADIO_CHANNEL);
+            patch.connect(&speechTask, audio::AudioInput::USER_CHANNEL, &mixer, audio::AudioInput::LEFT_CHANNEL);
+            patch.connect(&mixer, audio::AudioInput::LEFT_CHANNEL, &sink, audio::AudioInput::LEFT_CHANNEL);
+        }
+        else
+        {
+            patch.connect(&source, audio::AudioInput::LEFT_CHANNEL, &mixer, audio::AudioInput::LEFT_CHANNEL);
+            patch.connect(&mixer, audio::AudioInput::LEFT_CHANNEL, &sink, audio::AudioInput::LEFT_CHANNEL);
+        }
+
+        if (!patch.commit())
+        {
+            return 2;
+        }
+    }
+
+    sink.start();
+    mixer.start();
+    if (isTx || isRx)
+    {
+        speechTask.start();
+        freedv.start();
+    }
+    if (isTx)
+    {
+        audio::FreeDVSetPTTStateMessage message(true);
+        freedv.post(&message);
+    }
+    source.start();
+
+    // Run until the whole file has been played, then give the pipeline a
+    // bit longer to drain.
+    while (!source.isFinished())
+    {
+        HostSimulationRunFor(100 * 1000);
+    }
+    HostSimulationRunFor(500 * 1000);
+
+    source.sleep();
+    if (isTx || isRx)
+    {
+        freedv.sleep();
+        speechTask.sleep();
+    }
+    mixer.sleep();
+    sink.sleep();
+    HostSimulationRunFor(100 * 1000);
+
+    std::vector<audio::AudioGraph::RouteLatencyStatistics> routeStats;
+    graph->getRouteLatencyStatistics(routeStats, false);
+    for (auto& stats : routeStats)
+    {
+        printf(
+            "route %s[%d] -> %s[%d]: %" PRIu32 " tags, wait avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us\n",
+            stats.sourceName, (int)stats.sourceChannel, stats.destinationName, (int)stats.destinationChannel,
+            stats.waitTime.getCount(), stats.waitTime.getAverageUs(), stats.waitTime.getPercentileUs(99),
+            stats.waitTime.getMaxUs());
+    }
+
+    bool failed = false;
+    uint32_t maxP99Us = argc > 3 ? (uint32_t)(atof(argv[3]) * 1000) : UINT32_MAX;
+
+    std::vector<audio::AudioLatencyStatistics::Path> paths;
+    audio::AudioLatencyStatistics::GetPaths(paths, false);
+    for (auto& path : paths)
+    {
+        uint32_t p99Us = path.latency.getPercentileUs(99);
+        printf(
+            "latency %s -> %s: %" PRIu32 " tags, avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us\n",
+            path.origin, path.destination, path.latency.getCount(), path.latency.getAverageUs(),
+            p99Us, path.latency.getMaxUs());
+
+        if (p99Us > maxP99Us)
+        {
+            printf("FAIL: %s -> %s p99 latency exceeds %" PRIu32 " us\n", path.origin, path.destination, maxP99Us);
+            failed = true;
+        }
+    }
+
+    if (paths.empty())
+    {
+        printf("FAIL: no tagged audio made it to the output\n");
+        failed = true;
+    }
+
+    printf("%" PRIu32 " samples written to %s\n", sink.getNumSamplesWritten(), argv[2]);
+    return failed ? 1 : 0;
+#endif // !CONFIG_EZDV_AUDIO_LATENCY_TAGS
+}
@@ -0,0 +1,240 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks AudioResampler and checks AudioDriftCompensator against 
+// simulated clock drift:
+//
+// * CPU time per 20ms block (and per Flex VITA packet) on this machine.
+// * Signal to noise ratio of a resampled tone.
+// * Hours-long runs with the sender's clock off by up to +/-300ppm, checking
+//   that the drift estimate converges and the buffer level stays put.
+//
+// Usage:
+//
+//     ezdv_resampler_benchmark
+
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "audio/AudioDriftCompensator.h"
+#include "audio/AudioResampler.h"
+
+#define SAMPLE_RATE (8000)
+#define BLOCK_SAMPLES (160) /* 20ms */
+#define VITA_BLOCK_SAMPLES (42) /* 5.25ms */
+#define SIMULATION_HOURS (4)
+
+using namespace ezdv;
+
+namespace
+{
+
+void Benchmark(int numSamples)
+{
+    const int numBlocks = 200000;
+
+    audio::AudioResampler resampler;
+    resampler.setRatio(123.0f);
+
+    std::vector<int16_t> input(AUDIO_RESAMPLER_MAX_INPUT_SAMPLES);
+    std::vector<int16_t> output(numSamples);
+    for (size_t index = 0; index < input.size(); index++)
+    {
+        input[index] = 8000 * sin(2 * M_PI * 1000 * index / SAMPLE_RATE);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int block = 0; block < numBlocks; block++)
+    {
+        resampler.process(input.data(), output.data(), numSamples);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double nsPerBlock = std::chrono::duration<double, std::nano>(end - start).count() / numBlocks;
+    double blockUs = numSamples * 1000000.0 / SAMPLE_RATE;
+    printf(
+        "%d sample block (%.2f ms): %.0f ns per block, %.4f%% of real time\n",
+        numSamples, blockUs / 1000, nsPerBlock, nsPerBlock / 10 / blockUs);
+}
+
+double MeasureSnr(float ratioPpm)
+{
+    audio::AudioResampler resampler;
+    resampler.setRatio(ratioPpm);
+
+    const double frequency = 1000;
+    const double amplitude = 10000;
+    double step = 1 + ratioPpm / 1e6;
+
+    int64_t inputIndex = 0;
+    int64_t outputIndex = 0;
+    double signal = 0;
+    double noise = 0;
+
+    int16_t input[AUDIO_RESAMPLER_MAX_INPUT_SAMPLES];
+    int16_t output[BLOCK_SAMPLES];
+    for (int block = 0; block < 500; block++)
+    {
+        int numInput = resampler.getInputSamplesNeeded(BLOCK_SAMPLES);
+        for (int index = 0; index < numInput; index++, inputIndex++)
+        {
+            input[index] = lrint(amplitude * sin(2 * M_PI * frequency * inputIndex / SAMPLE_RATE));
+        }
+
+        resampler.process(input, output, BLOCK_SAMPLES);
+
+        for (int index = 0; index < BLOCK_SAMPLES; index++, outputIndex++)
+        {
+            // Output is delayed by three input samples.
+            double expected = amplitude * sin(2 * M_PI * frequency * (outputIndex * step - 3) / SAMPLE_RATE);
+            if (block > 0)
+            {
+                signal += expected * expected;
+                noise += (output[index] - expected) * (output[index] - expected);
+            }
+        }
+    }
+
+    return 10 * log10(signal / noise);
+}
+
+// A sender whose clock is off by driftPpm sends 20ms packets with random 
+// network jitter; we play out one 20ms block at a time, compensating for drift
+// based on how much is buffered.
+bool Simulate(float driftPpm)
+{
+    audio::AudioDriftCompensator compensator("simulation", SAMPLE_RATE);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> jitterUs(0, 15000);
+
+    const int64_t durationUs = (int64_t)SIMULATION_HOURS * 3600 * 1000000;
+    const double sendIntervalUs = 20000.0 / (1 + driftPpm / 1e6);
+
+    int64_t numSent = 0;
+    int64_t fill = 0;
+    int64_t minFill = INT64_MAX;
+    int64_t maxFill = INT64_MIN;
+    int numUnderruns = 0;
+
+    // Average fill level in the first and last hours, to check for creep.
+    double firstHourFill = 0;
+    double lastHourFill = 0;
+    int numFirstHourBlocks = 0;
+    int numLastHourBlocks = 0;
+
+    int16_t input[AUDIO_RESAMPLER_MAX_INPUT_SAMPLES] = { 0 };
+    int16_t output[BLOCK_SAMPLES];
+
+    // Start with three packets buffered, like a jitter buffer would.
+    int64_t nextArrivalUs = 0;
+    for (int64_t nowUs = 60000; nowUs < durationUs; nowUs += 20000)
+    {
+        while (nextArrivalUs <= nowUs)
+        {
+            fill += BLOCK_SAMPLES;
+            numSent++;
+            nextArrivalUs = (int64_t)(numSent * sendIntervalUs) + jitterUs(rng);
+        }
+
+        compensator.update(fill, BLOCK_SAMPLES);
+
+        int numNeeded = compensator.getInputSamplesNeeded(BLOCK_SAMPLES);
+        if (fill < numNeeded)
+        {
+            numUnderruns++;
+            continue;
+        }
+
+        compensator.process(input, output, BLOCK_SAMPLES);
+        fill -= numNeeded;
+
+        // Ignore the first few minutes while the estimate converges.
+        if (nowUs > 5 * 60 * 1000000LL)
+        {
+            minFill = std::min(minFill, fill);
+            maxFill = std::max(maxFill, fill);
+
+            if (nowUs < 65 * 60 * 1000000LL)
+            {
+                firstHourFill += fill;
+                numFirstHourBlocks++;
+            }
+            else if (nowUs >= durationUs - 60 * 60 * 1000000LL)
+            {
+                lastHourFill += fill;
+                numLastHourBlocks++;
+            }
+        }
+    }
+
+    audio::AudioDriftCompensator::Statistics stats;
+    compensator.getStatistics(&stats, false);
+
+    double fillRangeMs = (maxFill - minFill) * 1000.0 / SAMPLE_RATE;
+    double creepMs = (lastHourFill / numLastHourBlocks - firstHourFill / numFirstHourBlocks) * 1000.0 / SAMPLE_RATE;
+    printf(
+        "drift %+6.1f ppm: estimated %+7.2f ppm, fill %.1f-%.1f ms (target %.1f ms), creep %+.2f ms, %d underruns, %" PRIu32 " resets\n",
+        driftPpm, stats.driftPpm, minFill * 1000.0 / SAMPLE_RATE, maxFill * 1000.0 / SAMPLE_RATE,
+        stats.targetUs / 1000.0, creepMs, numUnderruns, stats.numResets);
+
+    // The estimate wanders a bit with the jitter, which is harmless.
+    bool ok = true;
+    if (fabs(stats.driftPpm - driftPpm) > 20)
+    {
+        printf("FAIL: drift estimate off by more than 20ppm\n");
+        ok = false;
+    }
+    if (fillRangeMs > 45 || fabs(creepMs) > 2)
+    {
+        printf("FAIL: buffer level not steady\n");
+        ok = false;
+    }
+    if (numUnderruns > 0 || stats.numResets > 0)
+    {
+        printf("FAIL: buffer ran dry or was reset\n");
+        ok = false;
+    }
+
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Benchmark(BLOCK_SAMPLES);
+    Benchmark(VITA_BLOCK_SAMPLES);
+
+    for (float ratioPpm : { 0.0f, 100.0f, -300.0f })
+    {
+        printf("1 kHz tone at %+.0f ppm: SNR %.1f dB\n", ratioPpm, MeasureSnr(ratioPpm));
+    }
+
+    bool ok = true;
+    for (float driftPpm : { -300.0f, -100.0f, -20.0f, 0.0f, 20.0f, 100.0f, 300.0f })
+    {
+        ok &= Simulate(driftPpm);
+    }
+
+    printf(ok ? "All drift compensation checks passed.\n" : "Some drift compensation checks FAILED.\n");
+    return ok ? 0 : 1;
+}
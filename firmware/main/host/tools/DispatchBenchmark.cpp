@@ -0,0 +1,283 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures how quickly DVTask dispatches messages to their handlers. Posts
+// NUM_MESSAGES messages, round-robin across NUM_MESSAGE_TYPES message types,
+// to a task that registers HANDLERS_PER_TYPE handlers for each type and
+// reports messages and handler invocations per second.
+//
+// The lookup that dispatch used before the dense per-message-index table
+// (an std::multimap keyed on event base and ID, searched with equal_range()
+// for every message and called through a type-erased function pointer plus
+// a virtual call) no longer exists in DVTask, so it's reproduced here with
+// the same handler set and timed against the dense table in isolation.
+//
+// Fails if any message isn't delivered to every handler.
+//
+// Usage:
+//
+//     ezdv_dispatch_benchmark
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "task/DVTask.h"
+#include "task/DVTaskMessage.h"
+
+#define NUM_MESSAGES (50000)
+#define NUM_LOOKUPS (10000000)
+#define NUM_MESSAGE_TYPES (8)
+#define HANDLERS_PER_TYPE (2)
+#define BATCH_SIZE (32) /* well below the task's queue size */
+#define QUEUE_SIZE (64)
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(BENCHMARK_MESSAGE);
+    DV_EVENT_DEFINE_BASE(BENCHMARK_MESSAGE);
+}
+
+using namespace ezdv;
+
+namespace
+{
+
+template<uint32_t ID>
+class BenchmarkMessage : public task::DVTaskMessageBase<ID, BenchmarkMessage<ID>>
+{
+public:
+    BenchmarkMessage()
+        : task::DVTaskMessageBase<ID, BenchmarkMessage<ID>>(BENCHMARK_MESSAGE)
+        {}
+    virtual ~BenchmarkMessage() = default;
+};
+
+std::atomic<uint32_t> NumHandled_(0);
+
+class HandlerTask : public task::DVTask
+{
+public:
+    HandlerTask()
+        : DVTask("Handler", 10, 4096, tskNO_AFFINITY, QUEUE_SIZE)
+    {
+        registerHandlers_<0>();
+    }
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    template<uint32_t ID>
+    void registerHandlers_()
+    {
+        for (int index = 0; index < HANDLERS_PER_TYPE; index++)
+        {
+            registerMessageHandler(this, &HandlerTask::onBenchmarkMessage_<ID>);
+        }
+
+        if constexpr (ID + 1 < NUM_MESSAGE_TYPES)
+        {
+            registerHandlers_<ID + 1>();
+        }
+    }
+
+    template<uint32_t ID>
+    void onBenchmarkMessage_(DVTask* origin, BenchmarkMessage<ID>* message)
+    {
+        NumHandled_.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+template<uint32_t ID>
+void PostMessage(HandlerTask& task, int index)
+{
+    if (index == ID)
+    {
+        BenchmarkMessage<ID> message;
+        task.post(&message);
+    }
+    else if constexpr (ID + 1 < NUM_MESSAGE_TYPES)
+    {
+        PostMessage<ID + 1>(task, index);
+    }
+}
+
+/// Returns false if any messages went missing.
+bool RunTask()
+{
+    HandlerTask task;
+    task.start();
+    while (!task.isAwake())
+    {
+        std::this_thread::yield();
+    }
+
+    uint32_t expected = NumHandled_.load(std::memory_order_acquire);
+    auto startTime = std::chrono::steady_clock::now();
+    for (int index = 0; index < NUM_MESSAGES; index++)
+    {
+        PostMessage<0>(task, index % NUM_MESSAGE_TYPES);
+        expected += HANDLERS_PER_TYPE;
+
+        // Let the task catch up every so often so that nothing is dropped
+        // due to a full queue.
+        if ((index % BATCH_SIZE) == BATCH_SIZE - 1 || index == NUM_MESSAGES - 1)
+        {
+            auto waitStart = std::chrono::steady_clock::now();
+            while (NumHandled_.load(std::memory_order_acquire) != expected &&
+                   std::chrono::steady_clock::now() - waitStart < std::chrono::seconds(1))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    printf(
+        "DVTask: %d message types x %d handlers, %.0f messages/s, %.0f dispatches/s\n",
+        NUM_MESSAGE_TYPES, HANDLERS_PER_TYPE, NUM_MESSAGES / seconds, 
+        NUM_MESSAGES * HANDLERS_PER_TYPE / seconds);
+
+    bool ok = NumHandled_.load(std::memory_order_acquire) == expected;
+    if (!ok)
+    {
+        printf("FAIL: not every message was dispatched\n");
+    }
+
+    task.sleep();
+    while (task.isAwake())
+    {
+        std::this_thread::yield();
+    }
+
+    return ok;
+}
+
+// Handler storage as registered by the old dispatch path: a type-erased
+// function pointer taking void* arguments, which then made a virtual call
+// into the typed handler.
+struct OldStorage
+{
+    virtual ~OldStorage() = default;
+    virtual void call(void* data) = 0;
+};
+
+struct OldStorageImpl : public OldStorage
+{
+    virtual void call(void* data) override
+    {
+        (*(uint32_t*)data)++;
+    }
+};
+
+typedef void (*OldHandlerFn)(void*, DVEventBaseType, int32_t, void*);
+
+void OldHandler(void* arg, DVEventBaseType base, int32_t id, void* data)
+{
+    ((OldStorage*)arg)->call(data);
+}
+
+// Dense table equivalent to DVTask's current one.
+struct NewStorage
+{
+    uint32_t* counter;
+};
+
+typedef void (*NewHandlerFn)(NewStorage*, void*);
+
+void NewHandler(NewStorage* storage, void* data)
+{
+    (*storage->counter)++;
+}
+
+void RunLookups()
+{
+    typedef std::multimap<std::pair<DVEventBaseType, int32_t>, std::pair<OldHandlerFn, OldStorage*>> EventMap;
+    EventMap oldMap;
+    std::vector<OldStorageImpl> oldStorage(NUM_MESSAGE_TYPES * HANDLERS_PER_TYPE);
+
+    uint32_t newCounter = 0;
+    std::vector<std::vector<std::pair<NewHandlerFn, NewStorage*>>> newTable(NUM_MESSAGE_TYPES);
+    std::vector<NewStorage> newStorage(NUM_MESSAGE_TYPES * HANDLERS_PER_TYPE, NewStorage { &newCounter });
+
+    for (int id = 0; id < NUM_MESSAGE_TYPES; id++)
+    {
+        for (int handler = 0; handler < HANDLERS_PER_TYPE; handler++)
+        {
+            int storageIndex = id * HANDLERS_PER_TYPE + handler;
+            oldMap.insert(std::make_pair(
+                std::make_pair(BENCHMARK_MESSAGE, id), 
+                std::make_pair(&OldHandler, &oldStorage[storageIndex])));
+            newTable[id].push_back(std::make_pair(&NewHandler, &newStorage[storageIndex]));
+        }
+    }
+
+    uint32_t oldCounter = 0;
+    auto startTime = std::chrono::steady_clock::now();
+    for (int index = 0; index < NUM_LOOKUPS; index++)
+    {
+        int32_t id = index % NUM_MESSAGE_TYPES;
+        auto range = oldMap.equal_range(std::make_pair(BENCHMARK_MESSAGE, id));
+        for (auto iter = range.first; iter != range.second; iter++)
+        {
+            (*iter->second.first)(iter->second.second, BENCHMARK_MESSAGE, id, &oldCounter);
+        }
+    }
+    auto oldTime = std::chrono::steady_clock::now() - startTime;
+
+    startTime = std::chrono::steady_clock::now();
+    for (int index = 0; index < NUM_LOOKUPS; index++)
+    {
+        uint32_t messageIndex = index % NUM_MESSAGE_TYPES;
+        auto& handlers = newTable[messageIndex];
+        for (size_t handlerIndex = 0; handlerIndex < handlers.size(); handlerIndex++)
+        {
+            (*handlers[handlerIndex].first)(handlers[handlerIndex].second, nullptr);
+        }
+    }
+    auto newTime = std::chrono::steady_clock::now() - startTime;
+
+    double oldNs = std::chrono::duration<double, std::nano>(oldTime).count() / NUM_LOOKUPS;
+    double newNs = std::chrono::duration<double, std::nano>(newTime).count() / NUM_LOOKUPS;
+    printf(
+        "lookup + call only: multimap %.1f ns/message (%.0f dispatches/s), dense table %.1f ns/message (%.0f dispatches/s)\n",
+        oldNs, HANDLERS_PER_TYPE * 1e9 / oldNs, newNs, HANDLERS_PER_TYPE * 1e9 / newNs);
+
+    // Keep the counters live so the loops aren't optimized away.
+    if (oldCounter != newCounter)
+    {
+        printf("(handler counts differ: %" PRIu32 " vs %" PRIu32 ")\n", oldCounter, newCounter);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    task::DVTask::Initialize();
+
+    RunLookups();
+    return RunTask() ? 0 : 1;
+}
@@ -0,0 +1,439 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Decodes recorded radio audio offline using the same receive path as
+// FreeDVTask and FreeDVSpeechTask: modems set up by OpenFreeDV(), squelch,
+// reliable_text callsign decoding and (optionally) Scan mode detection. Files
+// are decoded in parallel, one per thread, as fast as possible. For each file
+// it reports:
+//
+// * The mode used (or detected, in scan mode).
+// * How long it took to sync, and the fraction of frames in sync.
+// * Average SNR while in sync.
+// * Callsigns decoded from reliable_text, with the SNR at the time.
+// * Real-time factor (seconds of audio decoded per second spent decoding).
+//
+// Input files must be 8000 Hz, 16-bit mono WAV files. Decoded speech can
+// optionally be written out as raw 16-bit 8000 Hz audio (same as the other
+// host tools) for listening tests.
+//
+// Usage:
+//
+//     ezdv_freedv_decode [-m 700D|700E|1600|scan] [-j threads] [-o output dir] <WAV files or directories...>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "audio/FreeDVConfig.h"
+#include "audio/FreeDVModeScanner.h"
+#include "audio/FreeDVSpeechFrame.h"
+#include "audio/WAVFileReader.h"
+
+#include "reliable_text.h"
+
+#define SAMPLE_RATE (8000)
+#define BLOCK_SAMPLES (160) /* 20ms, same as TLV320 */
+
+using namespace ezdv;
+
+namespace
+{
+
+struct ReceivedCallsign
+{
+    std::string callsign;
+    float snr;
+    float timeSeconds;
+};
+
+struct DecodeResult
+{
+    std::string path;
+    std::string error; // empty if decoded successfully
+
+    audio::FreeDVMode mode;
+    double audioSeconds;
+    double decodeSeconds;
+    double syncSeconds; // negative if never in sync
+    uint32_t numFrames;
+    uint32_t numSyncedFrames;
+    double snrSum; // over synced frames
+    std::vector<ReceivedCallsign> callsigns;
+};
+
+struct DecodeState
+{
+    struct freedv* dv;
+    DecodeResult* result;
+    uint32_t sampleIndex;
+};
+
+const char* ModeName(audio::FreeDVMode mode)
+{
+    switch (mode)
+    {
+        case audio::FREEDV_700D:
+            return "700D";
+        case audio::FREEDV_700E:
+            return "700E";
+        case audio::FREEDV_1600:
+            return "1600";
+        case audio::FREEDV_SCAN:
+            return "scan";
+        default:
+            return "none";
+    }
+}
+
+void OnReliableTextRx(reliable_text_t rt, const char* txt_ptr, int length, void* state)
+{
+    DecodeState* decodeState = (DecodeState*)state;
+
+    int sync = 0;
+    float snr = 0;
+    freedv_get_modem_stats(decodeState->dv, &sync, &snr);
+
+    ReceivedCallsign callsign;
+    callsign.callsign = std::string(txt_ptr, length);
+    callsign.snr = snr;
+    callsign.timeSeconds = (float)decodeState->sampleIndex / SAMPLE_RATE;
+    decodeState->result->callsigns.push_back(callsign);
+
+    reliable_text_reset(rt);
+}
+
+bool ReadWAVFile(const std::string& path, std::vector<short>& samples, std::string& error)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        error = "could not open file";
+        return false;
+    }
+
+    audio::WAVFileReader reader(fp);
+    if (reader.sample_rate() != SAMPLE_RATE || reader.num_channels() != 1)
+    {
+        error = "not an 8000 Hz mono WAV file";
+        fclose(fp);
+        return false;
+    }
+
+    short block[BLOCK_SAMPLES];
+    int numRead = 0;
+    while ((numRead = reader.read(block, BLOCK_SAMPLES)) > 0)
+    {
+        samples.insert(samples.end(), block, block + numRead);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+void DecodeFile(audio::FreeDVMode requestedMode, const char* outputDir, DecodeResult* result)
+{
+    result->mode = audio::ANALOG;
+    result->audioSeconds = 0;
+    result->decodeSeconds = 0;
+    result->syncSeconds = -1;
+    result->numFrames = 0;
+    result->numSyncedFrames = 0;
+    result->snrSum = 0;
+
+    std::vector<short> samples;
+    if (!ReadWAVFile(result->path, samples, result->error))
+    {
+        return;
+    }
+    result->audioSeconds = (double)samples.size() / SAMPLE_RATE;
+
+    std::vector<short> speech;
+    auto startTime = std::chrono::steady_clock::now();
+
+    DecodeState state;
+    state.dv = nullptr;
+    state.result = result;
+    state.sampleIndex = 0;
+
+    if (requestedMode == audio::FREEDV_SCAN)
+    {
+        // Same as FreeDVTask, except that both workers run on this thread.
+        audio::FreeDVModeScanner scanner;
+        scanner.start();
+        while (state.sampleIndex + BLOCK_SAMPLES <= samples.size() && scanner.getLockedMode() == audio::ANALOG)
+        {
+            scanner.write(&samples[state.sampleIndex], BLOCK_SAMPLES);
+            for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+            {
+                scanner.process(worker);
+            }
+            state.sampleIndex += BLOCK_SAMPLES;
+        }
+
+        result->mode = scanner.getLockedMode();
+        state.dv = scanner.takeLockedModem();
+        scanner.stop();
+
+        if (state.dv != nullptr)
+        {
+            result->syncSeconds = (double)state.sampleIndex / SAMPLE_RATE;
+        }
+
+        // Muted while scanning.
+        speech.resize(state.sampleIndex, 0);
+    }
+    else
+    {
+        result->mode = requestedMode;
+        state.dv = audio::OpenFreeDV(requestedMode);
+    }
+
+    if (state.dv != nullptr)
+    {
+        bool squelchEnabled = false;
+        float squelchThresholdDb = 0;
+        audio::GetFreeDVSquelch(result->mode, &squelchEnabled, &squelchThresholdDb);
+
+        reliable_text_t rt = reliable_text_create();
+        assert(rt != nullptr);
+        reliable_text_use_with_freedv(rt, state.dv, OnReliableTextRx, &state);
+
+        struct CODEC2* codec2 = freedv_get_codec2(state.dv);
+        std::unique_ptr<audio::FreeDVSpeechFrame> frame(new audio::FreeDVSpeechFrame());
+        std::vector<short> frameSpeech(FREEDV_SPEECH_FRAME_MAX_SAMPLES);
+
+        uint32_t numInputSamples = freedv_nin(state.dv);
+        while (state.sampleIndex + numInputSamples <= samples.size())
+        {
+            bool hasFrame = audio::DemodulateFreeDVFrame(
+                state.dv, squelchEnabled, squelchThresholdDb, &samples[state.sampleIndex], frame.get());
+            state.sampleIndex += numInputSamples;
+            result->numFrames++;
+
+            if (freedv_get_rx_status(state.dv) & FREEDV_RX_SYNC)
+            {
+                int sync = 0;
+                float snr = 0;
+                freedv_get_modem_stats(state.dv, &sync, &snr);
+
+                result->numSyncedFrames++;
+                result->snrSum += snr;
+                if (result->syncSeconds < 0)
+                {
+                    result->syncSeconds = (double)state.sampleIndex / SAMPLE_RATE;
+                }
+            }
+
+            if (hasFrame)
+            {
+                audio::DecodeFreeDVSpeechFrame(codec2, frame.get(), frameSpeech.data());
+                speech.insert(speech.end(), frameSpeech.begin(), frameSpeech.begin() + frame->numSamples);
+            }
+
+            numInputSamples = freedv_nin(state.dv);
+        }
+
+        reliable_text_unlink_from_freedv(rt);
+        reliable_text_destroy(rt);
+        freedv_close(state.dv);
+    }
+
+    auto endTime = std::chrono::steady_clock::now();
+    result->decodeSeconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    if (outputDir != nullptr)
+    {
+        auto outputPath = std::filesystem::path(outputDir) / std::filesystem::path(result->path).stem();
+        outputPath += ".raw";
+
+        FILE* fp = fopen(outputPath.c_str(), "wb");
+        if (fp == nullptr)
+        {
+            result->error = "could not write " + outputPath.string();
+            return;
+        }
+        fwrite(speech.data(), sizeof(short), speech.size(), fp);
+        fclose(fp);
+    }
+}
+
+bool IsWAVFile(const std::filesystem::path& path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".wav";
+}
+
+void Usage(const char* name)
+{
+    fprintf(
+        stderr, 
+        "Usage: %s [-m 700D|700E|1600|scan] [-j threads] [-o output dir] <WAV files or directories...>\n", 
+        name);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    audio::FreeDVMode mode = audio::FREEDV_SCAN;
+    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    const char* outputDir = nullptr;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "m:j:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                if (!strcasecmp(optarg, "700D")) mode = audio::FREEDV_700D;
+                else if (!strcasecmp(optarg, "700E")) mode = audio::FREEDV_700E;
+                else if (!strcasecmp(optarg, "1600")) mode = audio::FREEDV_1600;
+                else if (!strcasecmp(optarg, "scan")) mode = audio::FREEDV_SCAN;
+                else
+                {
+                    Usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'j':
+                numThreads = std::max(1, atoi(optarg));
+                break;
+            case 'o':
+                outputDir = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+                return 2;
+        }
+    }
+
+    std::vector<DecodeResult> results;
+    for (int index = optind; index < argc; index++)
+    {
+        std::filesystem::path path(argv[index]);
+        if (std::filesystem::is_directory(path))
+        {
+            std::vector<std::string> files;
+            for (auto& entry : std::filesystem::directory_iterator(path))
+            {
+                if (entry.is_regular_file() && IsWAVFile(entry.path()))
+                {
+                    files.push_back(entry.path().string());
+                }
+            }
+
+            std::sort(files.begin(), files.end());
+            for (auto& file : files)
+            {
+                results.push_back(DecodeResult());
+                results.back().path = file;
+            }
+        }
+        else
+        {
+            results.push_back(DecodeResult());
+            results.back().path = path.string();
+        }
+    }
+
+    if (results.empty())
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    // Each thread takes the next file that hasn't been started yet.
+    std::atomic<size_t> nextFile(0);
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned int thread = 0; thread < std::min<size_t>(numThreads, results.size()); thread++)
+    {
+        threads.emplace_back([&]() {
+            size_t index = 0;
+            while ((index = nextFile.fetch_add(1)) < results.size())
+            {
+                DecodeFile(mode, outputDir, &results[index]);
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    bool failed = false;
+    double totalAudioSeconds = 0;
+    for (auto& result : results)
+    {
+        if (!result.error.empty())
+        {
+            printf("%s: ERROR: %s\n", result.path.c_str(), result.error.c_str());
+            failed = true;
+            continue;
+        }
+
+        totalAudioSeconds += result.audioSeconds;
+
+        printf(
+            "%s: mode %s, %.1f s of audio, ", 
+            result.path.c_str(), ModeName(result.mode), result.audioSeconds);
+        if (result.syncSeconds >= 0)
+        {
+            printf("sync at %.2f s, ", result.syncSeconds);
+        }
+        else
+        {
+            printf("never in sync, ");
+        }
+        printf(
+            "%" PRIu32 "/%" PRIu32 " frames in sync, avg SNR %.1f dB, real-time factor %.1fx\n",
+            result.numSyncedFrames, result.numFrames,
+            result.numSyncedFrames > 0 ? result.snrSum / result.numSyncedFrames : 0,
+            result.decodeSeconds > 0 ? result.audioSeconds / result.decodeSeconds : 0);
+
+        for (auto& callsign : result.callsigns)
+        {
+            printf(
+                "    callsign %s at %.2f s (SNR %.1f dB)\n", 
+                callsign.callsign.c_str(), callsign.timeSeconds, callsign.snr);
+        }
+    }
+
+    double wallSeconds = std::chrono::duration<double>(endTime - startTime).count();
+    printf(
+        "%zu files, %.1f s of audio in %.1f s using %zu threads (%.1fx real time)\n",
+        results.size(), totalAudioSeconds, wallSeconds, threads.size(),
+        wallSeconds > 0 ? totalAudioSeconds / wallSeconds : 0);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks FreeDVModeScanner against synthetic signals and measures how much
+// CPU each of its demodulators uses:
+//
+// * For each supported mode, a modulated signal (after a bit of noise) with
+//   additive white noise at the given SNR. The scan must lock onto the right
+//   mode within a few seconds.
+// * Noise by itself. The scan must not lock onto anything.
+// * CPU time for each candidate and worker as a percentage of real time on
+//   this machine, i.e. how much of a core each needs while scanning.
+//
+// Usage:
+//
+//     ezdv_freedv_scan_benchmark [SNR in dB, default 10]
+
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "audio/FreeDVConfig.h"
+#include "audio/FreeDVModeScanner.h"
+
+#define SAMPLE_RATE (8000)
+#define BLOCK_SAMPLES (160) /* 20ms, same as TLV320 */
+#define LEADING_NOISE_SECONDS (1)
+#define SIGNAL_SECONDS (10)
+#define NOISE_ONLY_SECONDS (60)
+#define MAX_LOCK_SECONDS (5)
+#define SIGNAL_RMS (4000)
+
+using namespace ezdv;
+
+namespace
+{
+
+const char* ModeName(audio::FreeDVMode mode)
+{
+    switch (mode)
+    {
+        case audio::FREEDV_700D:
+            return "700D";
+        case audio::FREEDV_700E:
+            return "700E";
+        case audio::FREEDV_1600:
+            return "1600";
+        default:
+            return "none";
+    }
+}
+
+std::vector<short> Modulate(audio::FreeDVMode mode, int numSamples)
+{
+    struct freedv* dv = audio::OpenFreeDV(mode);
+    int numSpeechSamples = freedv_get_n_speech_samples(dv);
+    int numModemSamples = freedv_get_n_nom_modem_samples(dv);
+
+    // Something vaguely voice-like; the content doesn't matter here.
+    std::vector<short> speech(numSpeechSamples);
+    std::vector<short> modem(numModemSamples);
+    std::vector<short> output;
+    int speechIndex = 0;
+    while ((int)output.size() < numSamples)
+    {
+        for (auto& sample : speech)
+        {
+            float value = 0;
+            for (int harmonic = 1; harmonic <= 10; harmonic++)
+            {
+                value += sin(2 * M_PI * 120 * harmonic * speechIndex / SAMPLE_RATE) / harmonic;
+            }
+            sample = 3000 * value;
+            speechIndex++;
+        }
+
+        freedv_tx(dv, modem.data(), speech.data());
+        output.insert(output.end(), modem.begin(), modem.end());
+    }
+    output.resize(numSamples);
+
+    freedv_close(dv);
+
+    // Normalize so that the SNR below means the same thing for every mode.
+    double power = 0;
+    for (auto sample : output)
+    {
+        power += (double)sample * sample;
+    }
+    double gain = SIGNAL_RMS / sqrt(power / output.size());
+    for (auto& sample : output)
+    {
+        sample = sample * gain;
+    }
+
+    return output;
+}
+
+void AddNoise(std::vector<short>& samples, float snrDb, std::mt19937& rng)
+{
+    std::normal_distribution<float> noise(0, SIGNAL_RMS / pow(10, snrDb / 20));
+    for (auto& sample : samples)
+    {
+        float value = sample + noise(rng);
+        sample = value > 32767 ? 32767 : (value < -32768 ? -32768 : value);
+    }
+}
+
+/// Runs a scan over the given audio, returning the detected mode (or ANALOG)
+/// and the number of samples it took.
+audio::FreeDVMode RunScan(
+    audio::FreeDVModeScanner& scanner, const std::vector<short>& input, uint32_t* samplesToLock, 
+    double* workerUs)
+{
+    scanner.start();
+
+    audio::FreeDVMode lockedMode = audio::ANALOG;
+    uint32_t index = 0;
+    for (; index + BLOCK_SAMPLES <= input.size() && lockedMode == audio::ANALOG; index += BLOCK_SAMPLES)
+    {
+        scanner.write(&input[index], BLOCK_SAMPLES);
+
+        // On ezDV the two workers run at the same time on different cores.
+        // Here they run one after the other so each can be timed separately.
+        for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            scanner.process(worker);
+            auto end = std::chrono::steady_clock::now();
+            workerUs[worker] += std::chrono::duration<double, std::micro>(end - start).count();
+        }
+
+        lockedMode = scanner.getLockedMode();
+    }
+
+    *samplesToLock = index;
+
+    struct freedv* dv = scanner.takeLockedModem();
+    if (dv != nullptr)
+    {
+        freedv_close(dv);
+    }
+    scanner.stop();
+
+    return lockedMode;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    float snrDb = argc > 1 ? atof(argv[1]) : 10;
+    bool failed = false;
+
+    std::mt19937 rng(1234);
+    audio::FreeDVModeScanner scanner;
+    double workerUs[FREEDV_SCAN_NUM_WORKERS] = { 0 };
+    uint32_t totalSamples = 0;
+
+    printf("SNR: %.1f dB\n", snrDb);
+
+    const audio::FreeDVMode modes[] = { audio::FREEDV_700D, audio::FREEDV_700E, audio::FREEDV_1600 };
+    for (auto mode : modes)
+    {
+        std::vector<short> input(LEADING_NOISE_SECONDS * SAMPLE_RATE, 0);
+        auto signal = Modulate(mode, SIGNAL_SECONDS * SAMPLE_RATE);
+        input.insert(input.end(), signal.begin(), signal.end());
+        AddNoise(input, snrDb, rng);
+
+        uint32_t samplesToLock = 0;
+        auto lockedMode = RunScan(scanner, input, &samplesToLock, workerUs);
+        totalSamples += samplesToLock;
+
+        float lockSeconds = (float)((int)samplesToLock - LEADING_NOISE_SECONDS * SAMPLE_RATE) / SAMPLE_RATE;
+        printf("%s: detected %s after %.2f s of signal\n", ModeName(mode), ModeName(lockedMode), lockSeconds);
+
+        if (lockedMode != mode)
+        {
+            printf("FAIL: %s was detected as %s\n", ModeName(mode), ModeName(lockedMode));
+            failed = true;
+        }
+        else if (lockSeconds > MAX_LOCK_SECONDS)
+        {
+            printf("FAIL: %s took longer than %d s to detect\n", ModeName(mode), MAX_LOCK_SECONDS);
+            failed = true;
+        }
+    }
+
+    {
+        std::vector<short> input(NOISE_ONLY_SECONDS * SAMPLE_RATE, 0);
+        AddNoise(input, snrDb, rng);
+
+        uint32_t samplesToLock = 0;
+        auto lockedMode = RunScan(scanner, input, &samplesToLock, workerUs);
+        totalSamples += samplesToLock;
+
+        printf("noise: detected %s after %.2f s\n", ModeName(lockedMode), (float)samplesToLock / SAMPLE_RATE);
+        if (lockedMode != audio::ANALOG)
+        {
+            printf("FAIL: noise was detected as %s\n", ModeName(lockedMode));
+            failed = true;
+        }
+    }
+
+    // CPU use as a fraction of the audio each candidate actually processed.
+    std::vector<audio::FreeDVModeScanner::CandidateStatistics> stats;
+    scanner.getStatistics(stats, false);
+    for (auto& candidate : stats)
+    {
+        double audioUs = (double)candidate.numSamples * 1000000 / SAMPLE_RATE;
+        printf(
+            "candidate %s (worker %d): %" PRIu32 " frames, demod avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us, %.2f%% of real time\n",
+            ModeName(candidate.mode), candidate.worker, candidate.numFrames, candidate.demodTime.getAverageUs(),
+            candidate.demodTime.getPercentileUs(99), candidate.demodTime.getMaxUs(),
+            audioUs > 0 ? 100.0 * candidate.demodTime.getTotalUs() / audioUs : 0);
+    }
+
+    double totalAudioUs = (double)totalSamples * 1000000 / SAMPLE_RATE;
+    for (int worker = 0; worker < FREEDV_SCAN_NUM_WORKERS; worker++)
+    {
+        printf("worker %d: %.2f%% of real time\n", worker, 100.0 * workerUs[worker] / totalAudioUs);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Feeds AudioJitterBuffer synthetic packet traces (network jitter, Wi-Fi
+// stalls, reordering, loss and sender restarts) and checks that it behaves
+// as expected for each. Also replays recorded traces, one packet per line:
+//
+//     <arrival time in ms> <sequence number> [number of samples]
+//
+// Usage:
+//
+//     ezdv_jitter_buffer [trace file]
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "audio/AudioJitterBuffer.h"
+
+#define SAMPLE_RATE (8000)
+#define PACKET_SAMPLES (160)
+#define PACKET_US (20000)
+#define MIN_DEPTH_MS (40)
+#define MAX_DEPTH_MS (300)
+#define TRACE_DURATION_US (60 * 1000 * 1000)
+
+using namespace ezdv;
+
+namespace
+{
+
+struct Packet
+{
+    int64_t arrivalTimeUs;
+    uint16_t seq;
+    int numSamples;
+};
+
+struct Result
+{
+    audio::AudioJitterBuffer::Statistics stats;
+    uint32_t numBlocksPlayed;
+    uint32_t numSent;
+    task::DVLatencyHistogram residence;
+};
+
+Result Run(const std::vector<Packet>& packets)
+{
+    audio::AudioJitterBuffer buffer("test", SAMPLE_RATE, MIN_DEPTH_MS, MAX_DEPTH_MS);
+    Result result;
+    buffer.getStatistics(&result.stats, false);
+    result.numBlocksPlayed = 0;
+    result.numSent = packets.size();
+    result.residence.reset();
+
+    int64_t endTimeUs = packets.empty() ? 0 : packets.back().arrivalTimeUs + 1000000;
+    int16_t audio[AUDIO_JITTER_BUFFER_MAX_PACKET_SAMPLES] = { 0 };
+    int16_t block[PACKET_SAMPLES];
+
+    size_t packetIndex = 0;
+    for (int64_t playoutTimeUs = 0; playoutTimeUs < endTimeUs; playoutTimeUs += PACKET_US)
+    {
+        while (packetIndex < packets.size() && packets[packetIndex].arrivalTimeUs <= playoutTimeUs)
+        {
+            auto& packet = packets[packetIndex++];
+            buffer.push(packet.seq, audio, packet.numSamples, packet.arrivalTimeUs);
+
+            if (packetIndex == packets.size())
+            {
+                // Leave out the underruns at the end of the trace.
+                buffer.getStatistics(&result.stats, false);
+            }
+        }
+
+        int64_t arrivalTimeUs = 0;
+        if (buffer.pop(block, PACKET_SAMPLES, &arrivalTimeUs))
+        {
+            result.numBlocksPlayed++;
+            if (arrivalTimeUs >= 0)
+            {
+                result.residence.add(playoutTimeUs - arrivalTimeUs);
+            }
+        }
+    }
+
+    return result;
+}
+
+// Packets sent every 20ms starting at the given sequence number, with 
+// the given function adding delay (or returning < 0 to lose the packet).
+std::vector<Packet> Generate(uint16_t firstSeq, std::function<int64_t(int index, int64_t sendTimeUs)> delayUs)
+{
+    std::vector<Packet> packets;
+    for (int index = 0; (int64_t)index * PACKET_US < TRACE_DURATION_US; index++)
+    {
+        int64_t sendTimeUs = (int64_t)index * PACKET_US + PACKET_US;
+        int64_t delay = delayUs(index, sendTimeUs);
+        if (delay >= 0)
+        {
+            packets.push_back({ sendTimeUs + delay, (uint16_t)(firstSeq + index), PACKET_SAMPLES });
+        }
+    }
+
+    std::stable_sort(packets.begin(), packets.end(), [](const Packet& a, const Packet& b) {
+        return a.arrivalTimeUs < b.arrivalTimeUs;
+    });
+    return packets;
+}
+
+void Print(const char* name, const Result& result)
+{
+    auto& stats = result.stats;
+    printf(
+        "%s: sent %" PRIu32 ", received %" PRIu32 ", played %" PRIu32 ", reordered %" PRIu32 ", late %" PRIu32
+        ", duplicate %" PRIu32 ", concealed %" PRIu32 ", underruns %" PRIu32 ", discarded %" PRIu32 ", resyncs %" PRIu32 "\n",
+        name, result.numSent, stats.numReceived, stats.numPlayed, stats.numReordered, stats.numLate,
+        stats.numDuplicate, stats.numConcealed, stats.numUnderruns, stats.numDiscarded, stats.numResyncs);
+    printf(
+        "    jitter %" PRIu32 " us, peak %" PRIu32 " us, target %" PRIu32 " us, depth avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32
+        " us, residence avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us\n",
+        stats.jitterUs, stats.peakJitterUs, stats.targetDepthUs,
+        stats.depth.getAverageUs(), stats.depth.getPercentileUs(99), stats.depth.getMaxUs(),
+        result.residence.getAverageUs(), result.residence.getPercentileUs(99), result.residence.getMaxUs());
+}
+
+bool Check(const char* name, bool condition, const char* description)
+{
+    if (!condition)
+    {
+        printf("FAIL: %s: %s\n", name, description);
+    }
+    return condition;
+}
+
+bool RunTrace(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    std::vector<Packet> packets;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != nullptr)
+    {
+        double arrivalTimeMs = 0;
+        unsigned seq = 0;
+        int numSamples = PACKET_SAMPLES;
+        if (line[0] == '#' || sscanf(line, "%lf %u %d", &arrivalTimeMs, &seq, &numSamples) < 2)
+        {
+            continue;
+        }
+
+        packets.push_back({ (int64_t)(arrivalTimeMs * 1000), (uint16_t)seq, numSamples });
+    }
+    fclose(fp);
+
+    std::stable_sort(packets.begin(), packets.end(), [](const Packet& a, const Packet& b) {
+        return a.arrivalTimeUs < b.arrivalTimeUs;
+    });
+
+    Print(path, Run(packets));
+    return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        return RunTrace(argv[1]) ? 0 : 2;
+    }
+
+    std::mt19937 rng(1234);
+    bool ok = true;
+
+    {
+        // Steady network: should sit at the minimum depth and never conceal.
+        std::uniform_int_distribution<int> jitter(0, 1000);
+        auto result = Run(Generate(0, [&](int, int64_t) { return 5000 + jitter(rng); }));
+        Print("clean", result);
+        ok &= Check("clean", result.stats.numConcealed == 0 && result.stats.numUnderruns == 0, "audio was concealed");
+        ok &= Check("clean", result.stats.targetDepthUs == MIN_DEPTH_MS * 1000, "target depth above minimum");
+    }
+
+    {
+        // Typical Wi-Fi jitter. The target should grow to cover it.
+        std::normal_distribution<double> jitter(0, 15000);
+        auto result = Run(Generate(0, [&](int, int64_t) { return 5000 + std::max(0.0, jitter(rng)); }));
+        Print("gaussian", result);
+        ok &= Check("gaussian", result.stats.targetDepthUs > MIN_DEPTH_MS * 1000, "target depth did not adapt");
+        ok &= Check("gaussian", result.stats.numUnderruns + result.stats.numConcealed < result.numSent / 100, "more than 1% concealed");
+    }
+
+    {
+        // Wi-Fi power save/scanning: every 3 seconds, nothing arrives for
+        // 150ms and then everything that was held up arrives at once.
+        auto result = Run(Generate(0, [&](int, int64_t sendTimeUs) {
+            int64_t phaseUs = sendTimeUs % 3000000;
+            return phaseUs < 150000 ? 150000 - phaseUs + 5000 : 5000;
+        }));
+        Print("bursts", result);
+        ok &= Check("bursts", result.stats.targetDepthUs >= 150000, "target depth did not cover stalls");
+        ok &= Check("bursts", result.stats.numDiscarded == 0, "packets discarded on bursts");
+        ok &= Check("bursts", result.stats.numUnderruns + result.stats.numConcealed < result.numSent / 50, "more than 2% concealed");
+    }
+
+    {
+        // Adjacent packets swapped 5% of the time. Nothing should be lost.
+        std::uniform_real_distribution<double> chance(0, 1);
+        auto result = Run(Generate(0, [&](int, int64_t) { return chance(rng) < 0.05 ? 5000 + 25000 : 5000; }));
+        Print("reorder", result);
+        ok &= Check("reorder", result.stats.numReordered > 0, "reordering not detected");
+        ok &= Check("reorder", result.stats.numLate == 0 && result.stats.numConcealed == 0, "reordered packets lost");
+    }
+
+    {
+        // 3% random loss: every lost packet should be concealed, not skipped.
+        std::uniform_real_distribution<double> chance(0, 1);
+        uint32_t numLost = 0;
+        auto result = Run(Generate(0, [&](int, int64_t) {
+            if (chance(rng) < 0.03)
+            {
+                numLost++;
+                return (int64_t)-1;
+            }
+            return (int64_t)5000;
+        }));
+        Print("loss", result);
+        ok &= Check("loss", result.stats.numConcealed == numLost, "lost packets not concealed");
+    }
+
+    {
+        // Sequence numbers wrap partway through, then the sender restarts
+        // with an unrelated sequence number.
+        auto packets = Generate(65000, [](int, int64_t) { return 5000; });
+        for (size_t index = packets.size() / 2; index < packets.size(); index++)
+        {
+            packets[index].seq += 20000;
+        }
+        auto result = Run(packets);
+        Print("restart", result);
+        ok &= Check("restart", result.stats.numResyncs == 1, "expected exactly one resync");
+        ok &= Check("restart", result.stats.numConcealed == 0 && result.stats.numLate == 0, "audio lost across wrap/restart");
+    }
+
+    printf(ok ? "All jitter buffer checks passed.\n" : "Some jitter buffer checks FAILED.\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the cost of publish() with a single shared message copy against
+// the old approach of one copy per subscriber (emulated here with sendTo()
+// to each subscribing task). For several subscriber counts, reports per
+// published message:
+//
+// * Queued message copies and bytes copied (DVTask counters).
+// * Message allocations (pool and heap).
+// * Time spent in the publishing task per message (publish() or the sendTo()
+//   calls), and wall-clock time per message including handling by every
+//   subscriber.
+//
+// Fails if publish() makes more than one copy per message or if any
+// message isn't delivered.
+//
+// Usage:
+//
+//     ezdv_publish_benchmark
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "task/DVTask.h"
+#include "task/DVTaskMessage.h"
+
+#define NUM_MESSAGES (20000)
+#define BATCH_SIZE (16) /* well below the subscribers' queue size */
+#define QUEUE_SIZE (64)
+#define PAYLOAD_BYTES (64)
+
+extern "C"
+{
+    DV_EVENT_DECLARE_BASE(BENCHMARK_MESSAGE);
+    DV_EVENT_DEFINE_BASE(BENCHMARK_MESSAGE);
+}
+
+using namespace ezdv;
+
+namespace
+{
+
+class BenchmarkMessage : public task::DVTaskMessageBase<1, BenchmarkMessage>
+{
+public:
+    BenchmarkMessage()
+        : task::DVTaskMessageBase<1, BenchmarkMessage>(BENCHMARK_MESSAGE)
+        {}
+    virtual ~BenchmarkMessage() = default;
+
+    char payload[PAYLOAD_BYTES];
+};
+
+std::atomic<uint32_t> NumHandled_(0);
+
+class SubscriberTask : public task::DVTask
+{
+public:
+    SubscriberTask()
+        : DVTask("Subscriber", 10, 4096, tskNO_AFFINITY, QUEUE_SIZE)
+    {
+        registerMessageHandler(this, &SubscriberTask::onBenchmarkMessage_);
+    }
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    void onBenchmarkMessage_(DVTask* origin, BenchmarkMessage* message)
+    {
+        NumHandled_.fetch_add(1, std::memory_order_release);
+    }
+};
+
+class PublisherTask : public task::DVTask
+{
+public:
+    PublisherTask()
+        : DVTask("Publisher", 10, 4096, tskNO_AFFINITY, QUEUE_SIZE)
+    {
+        // empty
+    }
+
+    using DVTask::publish;
+    using DVTask::sendTo;
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+};
+
+struct Counters
+{
+    uint32_t numCopies;
+    uint32_t numBytesCopied;
+    uint32_t numAllocations;
+};
+
+void GetCounters(Counters* counters)
+{
+    counters->numCopies = task::DVTask::GetNumMessageCopies();
+    counters->numBytesCopied = task::DVTask::GetNumMessageBytesCopied();
+    counters->numAllocations = task::DVTask::GetNumHeapMessageAllocations();
+    for (int index = 0; index < task::DVTask::GetNumMessagePools(); index++)
+    {
+        task::DVMessagePool::Statistics stats;
+        task::DVTask::GetMessagePoolStatistics(index, &stats);
+        counters->numAllocations += stats.numAllocations;
+    }
+}
+
+/// Returns false if any messages went missing.
+bool Run(PublisherTask& publisher, std::vector<std::unique_ptr<SubscriberTask>>& subscribers, bool shared)
+{
+    BenchmarkMessage message;
+    Counters before;
+    GetCounters(&before);
+
+    uint32_t expected = NumHandled_.load(std::memory_order_acquire);
+    std::chrono::steady_clock::duration publishTime(0);
+    auto startTime = std::chrono::steady_clock::now();
+    for (int index = 0; index < NUM_MESSAGES; index++)
+    {
+        auto publishStart = std::chrono::steady_clock::now();
+        if (shared)
+        {
+            publisher.publish(&message);
+        }
+        else
+        {
+            for (auto& subscriber : subscribers)
+            {
+                publisher.sendTo(subscriber.get(), &message);
+            }
+        }
+        publishTime += std::chrono::steady_clock::now() - publishStart;
+        expected += subscribers.size();
+
+        // Let the subscribers catch up every so often so that nothing
+        // is dropped due to full queues.
+        if ((index % BATCH_SIZE) == BATCH_SIZE - 1 || index == NUM_MESSAGES - 1)
+        {
+            auto waitStart = std::chrono::steady_clock::now();
+            while (NumHandled_.load(std::memory_order_acquire) != expected &&
+                   std::chrono::steady_clock::now() - waitStart < std::chrono::seconds(1))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    Counters after;
+    GetCounters(&after);
+
+    double nsInPublish = std::chrono::duration<double, std::nano>(publishTime).count() / NUM_MESSAGES;
+    double nsPerPublish = std::chrono::duration<double, std::nano>(endTime - startTime).count() / NUM_MESSAGES;
+    printf(
+        "%zu subscribers, %-14s: %.2f copies, %.1f bytes copied, %.2f allocations, %.0f ns in publisher, %.0f ns end to end\n",
+        subscribers.size(), shared ? "shared" : "per-subscriber",
+        (double)(after.numCopies - before.numCopies) / NUM_MESSAGES,
+        (double)(after.numBytesCopied - before.numBytesCopied) / NUM_MESSAGES,
+        (double)(after.numAllocations - before.numAllocations) / NUM_MESSAGES,
+        nsInPublish, nsPerPublish);
+
+    bool ok = NumHandled_.load(std::memory_order_acquire) == expected;
+    if (!ok)
+    {
+        printf("FAIL: not every message was delivered\n");
+    }
+    if (shared && after.numCopies - before.numCopies != NUM_MESSAGES)
+    {
+        printf("FAIL: publish() made more than one copy per message\n");
+        ok = false;
+    }
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    task::DVTask::Initialize();
+
+    bool failed = false;
+    PublisherTask publisher;
+
+    const size_t subscriberCounts[] = { 1, 2, 4, 8 };
+    for (auto numSubscribers : subscriberCounts)
+    {
+        std::vector<std::unique_ptr<SubscriberTask>> subscribers;
+        for (size_t index = 0; index < numSubscribers; index++)
+        {
+            subscribers.emplace_back(new SubscriberTask());
+            subscribers.back()->start();
+        }
+
+        for (auto& subscriber : subscribers)
+        {
+            while (!subscriber->isAwake())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        failed |= !Run(publisher, subscribers, false);
+        failed |= !Run(publisher, subscribers, true);
+
+        for (auto& subscriber : subscribers)
+        {
+            subscriber->sleep();
+        }
+        for (auto& subscriber : subscribers)
+        {
+            while (subscriber->isAwake())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,424 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Replays a script of PTT and RX/TX events against the FreeDV audio path in
+// simulated time (see host_simulation.h), then prints each task's overflow
+// and queue wait statistics and each timer wheel's deadline statistics.
+// The graph is the one Application sets up with TLV320 (analog mode only),
+// with silent file endpoints standing in for the codec.
+//
+// The scenario is run twice, each time in a fresh process so that nothing
+// carries over between runs. Simulation is deterministic, so the tool fails
+// if the two runs print anything different.
+//
+// Script actions (see host/tools/scripts/ptt_session.txt):
+//
+// * ptt on|off: sets FreeDVTask's PTT state directly.
+// * tx: requests TX the same way as the PTT button (RequestTxMessage).
+// * rx: requests RX (RequestRxMessage) and waits for TX to finish, the same
+//   way UserInterfaceTask does.
+//
+// Usage:
+//
+//     ezdv_simulation [-v] [script]
+//
+// -v shows log output from the runs. Without a script, the checked-in
+// session is used.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "host_simulation.h"
+#include "audio/AudioGraph.h"
+#include "audio/AudioLatency.h"
+#include "audio/AudioMixer.h"
+#include "audio/FreeDVMessage.h"
+#include "audio/FreeDVScanTask.h"
+#include "audio/FreeDVSpeechTask.h"
+#include "audio/FreeDVTask.h"
+#include "audio/VoiceKeyerMessage.h"
+#include "host/HostAudioFile.h"
+#include "task/DVTimerWheel.h"
+
+#define SILENCE_PATH "/dev/zero"
+#define DISCARD_PATH "/dev/null"
+#define DRAIN_TIME_US (1000 * 1000)
+
+using namespace ezdv;
+
+namespace
+{
+
+/// @brief Stands in for UserInterfaceTask's handling of TX/RX requests,
+///        which isn't part of the host build.
+class PttController : public task::DVTask
+{
+public:
+    PttController()
+        : DVTask("PttController", 10, 4096, tskNO_AFFINITY, 64)
+    {
+        registerMessageHandler(this, &PttController::onRequestTx_);
+        registerMessageHandler(this, &PttController::onRequestRx_);
+    }
+
+protected:
+    virtual void onTaskStart_() override { }
+    virtual void onTaskSleep_() override { }
+
+private:
+    void onRequestTx_(DVTask* origin, audio::RequestTxMessage* message)
+    {
+        audio::FreeDVSetPTTStateMessage pttStateMessage(true);
+        publish(&pttStateMessage);
+    }
+
+    void onRequestRx_(DVTask* origin, audio::RequestRxMessage* message)
+    {
+        audio::FreeDVSetPTTStateMessage pttStateMessage(false);
+        publish(&pttStateMessage);
+
+        auto result = waitFor<audio::TransmitCompleteMessage>(pdMS_TO_TICKS(1000), nullptr);
+        delete result;
+    }
+};
+
+struct Scenario
+{
+    audio::FreeDVTask* freedv;
+    PttController* controller;
+    int numBadEvents;
+};
+
+void OnPtt_(int argc, const char** argv, void* arg)
+{
+    Scenario* scenario = (Scenario*)arg;
+    if (argc != 2 || (strcmp(argv[1], "on") && strcmp(argv[1], "off")))
+    {
+        fprintf(stderr, "usage: ptt on|off\n");
+        scenario->numBadEvents++;
+        return;
+    }
+
+    audio::FreeDVSetPTTStateMessage message(!strcmp(argv[1], "on"));
+    scenario->freedv->post(&message);
+}
+
+void OnTx_(int argc, const char** argv, void* arg)
+{
+    Scenario* scenario = (Scenario*)arg;
+    audio::RequestTxMessage message;
+    scenario->controller->post(&message);
+}
+
+void OnRx_(int argc, const char** argv, void* arg)
+{
+    Scenario* scenario = (Scenario*)arg;
+    audio::RequestRxMessage message;
+    scenario->controller->post(&message);
+}
+
+void PrintHistogram_(FILE* out, const task::DVLatencyHistogram& histogram)
+{
+    fprintf(
+        out, "%" PRIu32 " avg/p99/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 " us",
+        histogram.getCount(), histogram.getAverageUs(), histogram.getPercentileUs(99), histogram.getMaxUs());
+}
+
+/// @brief Prints everything that should come out the same on every run.
+///        Tasks and message types are sorted by name since neither creation
+///        nor first use order is guaranteed.
+void PrintStatistics_(FILE* out, int numEvents)
+{
+    HostSimulationStatistics_t simStats;
+    HostSimulationGetStatistics(&simStats);
+    fprintf(
+        out, "simulation: %d events, %" PRId64 " us, %" PRIu64 " context switches, %" PRIu64 " time advances\n",
+        numEvents, simStats.virtualTimeUs, simStats.numContextSwitches, simStats.numTimeAdvances);
+
+    std::vector<task::DVTask*> tasks;
+    task::DVTask::GetAllTasks(tasks);
+    std::sort(tasks.begin(), tasks.end(), [](task::DVTask* a, task::DVTask* b) {
+        return strcmp(a->getName(), b->getName()) < 0;
+    });
+
+    for (auto task : tasks)
+    {
+        task::DVTask::TaskStatistics taskStats;
+        task->getTaskStatistics(&taskStats);
+
+        task::DVTask::OverflowStatistics overflowStats;
+        task->getOverflowStatistics(&overflowStats);
+
+        fprintf(
+            out, "task %s: %" PRIu32 " handled, %" PRIu32 " ticks, peak queue %" PRIu32 "/%" PRIu32 ", "
+            "%" PRIu32 " blocked, %" PRIu32 " block timeouts, %" PRIu32 " dropped newest, "
+            "%" PRIu32 " dropped oldest, %" PRIu32 " coalesced\n",
+            task->getName(), taskStats.numMessagesHandled, taskStats.numTicks, taskStats.peakQueueDepth,
+            taskStats.queueCapacity, overflowStats.numBlocked, overflowStats.numBlockTimeouts,
+            overflowStats.numDroppedNewest, overflowStats.numDroppedOldest, overflowStats.numCoalesced);
+
+        std::vector<task::DVTask::MessageStatistics> messageStats;
+        task->getMessageStatistics(messageStats);
+        std::sort(messageStats.begin(), messageStats.end(), [](const auto& a, const auto& b) {
+            int result = strcmp(a.eventBase, b.eventBase);
+            return result < 0 || (result == 0 && a.eventId < b.eventId);
+        });
+
+        for (auto& stats : messageStats)
+        {
+            fprintf(out, "  %s:%" PRId32 " queue wait ", stats.eventBase, stats.eventId);
+            PrintHistogram_(out, stats.queueWait);
+            fprintf(out, "\n");
+        }
+    }
+
+    for (int index = 0; index < portNUM_PROCESSORS; index++)
+    {
+        task::DVTimerWheel::Statistics wheelStats;
+        task::DVTimerWheel::Get(index)->getStatistics(&wheelStats);
+
+        fprintf(
+            out, "timer wheel %d: %" PRIu32 " timers, %" PRIu32 " expirations, %" PRIu32 " messages, "
+            "%" PRIu32 " dropped, %" PRIu32 " missed, drift ",
+            index, wheelStats.numTimers, wheelStats.numExpirations, wheelStats.numMessages,
+            wheelStats.numDroppedMessages, wheelStats.numMissedExpirations);
+        PrintHistogram_(out, wheelStats.drift);
+        fprintf(out, "\n");
+    }
+
+    std::vector<audio::AudioLatencyStatistics::Path> paths;
+    audio::AudioLatencyStatistics::GetPaths(paths, false);
+    std::sort(paths.begin(), paths.end(), [](const auto& a, const auto& b) {
+        int result = strcmp(a.origin, b.origin);
+        return result < 0 || (result == 0 && strcmp(a.destination, b.destination) < 0);
+    });
+
+    for (auto& path : paths)
+    {
+        fprintf(out, "latency %s -> %s: ", path.origin, path.destination);
+        PrintHistogram_(out, path.latency);
+        fprintf(out, "\n");
+    }
+}
+
+/// @brief Ends a run without tearing down the tasks, since the process is
+///        about to go away anyway.
+void ExitRun_(FILE* out, int result)
+{
+    fclose(out);
+    fflush(stdout);
+    _exit(result);
+}
+
+/// @brief Runs the script once, prints the resulting statistics and exits
+///        with the status for the run.
+void RunScenario_(const char* scriptPath, FILE* out)
+{
+    HostSimulationEnable();
+    task::DVTask::Initialize();
+
+    host::HostAudioFileSource mic("Mic", SILENCE_PATH);
+    host::HostAudioFileSource radioIn("Radio RX", SILENCE_PATH);
+    audio::AudioMixer mixer;
+    audio::FreeDVSpeechTask speechTask;
+    audio::FreeDVScanTask scanTask;
+    audio::FreeDVTask freedv(&speechTask, &scanTask);
+    host::HostAudioFileSink radioOut("Radio TX", DISCARD_PATH);
+    host::HostAudioFileSink headset("Headset", DISCARD_PATH);
+    PttController controller;
+
+    auto graph = audio::AudioGraph::GetInstance();
+    graph->addNode("Mic", &mic);
+    graph->addNode("RadioRX", &radioIn);
+    graph->addNode("Mixer", &mixer);
+    graph->addNode("FreeDV", &freedv);
+    graph->addNode("FreeDVSpeech", &speechTask);
+    graph->addNode("RadioTX", &radioOut);
+    graph->addNode("Headset", &headset);
+
+    {
+        // Same channels as Application uses with TLV320.
+        audio::AudioGraph::Patch patch;
+        patch.connect(&mic, audio::AudioInput::LEFT_CHANNEL, &freedv, audio::AudioInput::USER_CHANNEL);
+        patch.connect(&radioIn, audio::AudioInput::LEFT_CHANNEL, &freedv, audio::AudioInput::RADIO_CHANNEL);
+        patch.connect(&freedv, audio::AudioInput::RADIO_CHANNEL, &radioOut, audio::AudioInput::LEFT_CHANNEL);
+        patch.connect(&speechTask, audio::AudioInput::USER_CHANNEL, &mixer, audio::AudioInput::LEFT_CHANNEL);
+        patch.connect(&mixer, audio::AudioInput::LEFT_CHANNEL, &headset, audio::AudioInput::LEFT_CHANNEL);
+
+        if (!patch.commit())
+        {
+            ExitRun_(out, 2);
+        }
+    }
+
+    radioOut.start();
+    headset.start();
+    mixer.start();
+    speechTask.start();
+    freedv.start();
+    controller.start();
+    mic.start();
+    radioIn.start();
+
+    Scenario scenario = { &freedv, &controller, 0 };
+    HostSimulationRegisterAction("ptt", &OnPtt_, &scenario);
+    HostSimulationRegisterAction("tx", &OnTx_, &scenario);
+    HostSimulationRegisterAction("rx", &OnRx_, &scenario);
+
+    int numEvents = HostSimulationRunScript(scriptPath);
+    if (numEvents < 0 || scenario.numBadEvents > 0)
+    {
+        ExitRun_(out, 2);
+    }
+
+    HostSimulationRunFor(DRAIN_TIME_US);
+    PrintStatistics_(out, numEvents);
+
+    ExitRun_(out, 0);
+}
+
+/// @brief Runs the scenario in a child process and collects what it printed.
+/// @return Whether the run completed successfully.
+bool RunInChild_(const char* scriptPath, bool verbose, std::string& output)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return false;
+    }
+    else if (pid == 0)
+    {
+        close(fds[0]);
+        if (!verbose && freopen(DISCARD_PATH, "w", stdout) == nullptr)
+        {
+            _exit(2);
+        }
+
+        FILE* out = fdopen(fds[1], "w");
+        if (out == nullptr)
+        {
+            _exit(2);
+        }
+
+        RunScenario_(scriptPath, out);
+    }
+
+    close(fds[1]);
+
+    char buf[4096];
+    ssize_t numRead;
+    while ((numRead = read(fds[0], buf, sizeof(buf))) > 0)
+    {
+        output.append(buf, numRead);
+    }
+    close(fds[0]);
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "Simulation run failed, use -v for details\n");
+        return false;
+    }
+
+    return true;
+}
+
+/// @brief Returns the given line of text (0-based), or an empty string if there aren't that many.
+std::string GetLine_(const std::string& text, int lineNumber)
+{
+    size_t begin = 0;
+    for (int index = 0; index < lineNumber && begin != std::string::npos; index++)
+    {
+        begin = text.find('\n', begin);
+        if (begin != std::string::npos)
+        {
+            begin++;
+        }
+    }
+
+    if (begin == std::string::npos || begin >= text.size())
+    {
+        return "";
+    }
+
+    return text.substr(begin, text.find('\n', begin) - begin);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bool verbose = false;
+    if (argc > 1 && !strcmp(argv[1], "-v"))
+    {
+        verbose = true;
+        argv++;
+        argc--;
+    }
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: %s [-v] [script]\n", argv[0]);
+        return 2;
+    }
+
+    const char* scriptPath = argc > 1 ? argv[1] : EZDV_SIMULATION_DEFAULT_SCRIPT;
+
+    std::string firstRun;
+    std::string secondRun;
+    if (!RunInChild_(scriptPath, verbose, firstRun) || !RunInChild_(scriptPath, verbose, secondRun))
+    {
+        return 2;
+    }
+
+    printf("%s", firstRun.c_str());
+
+    if (firstRun != secondRun)
+    {
+        for (int lineNumber = 0; ; lineNumber++)
+        {
+            std::string firstLine = GetLine_(firstRun, lineNumber);
+            std::string secondLine = GetLine_(secondRun, lineNumber);
+            if (firstLine != secondLine)
+            {
+                printf("FAIL: runs differ at line %d:\n  first:  %s\n  second: %s\n",
+                    lineNumber + 1, firstLine.c_str(), secondLine.c_str());
+                break;
+            }
+        }
+
+        return 1;
+    }
+
+    printf("Both runs produced identical statistics.\n");
+    return 0;
+}
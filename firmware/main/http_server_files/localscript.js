@@ -501,6 +501,11 @@ function wsConnect()
               $("#mode1600").addClass("btn-primary");
               $("#mode1600").removeClass("btn-secondary");
           }
+          else if (json.currentMode == 4)
+          {
+              $("#modeScan").addClass("btn-primary");
+              $("#modeScan").removeClass("btn-secondary");
+          }
       }
       else if (json.type == "voiceKeyerRunning")
       {
@@ -738,6 +743,10 @@ $("#mode1600").click(function() {
     setFreeDVMode(3);
 });
 
+$("#modeScan").click(function() {
+    setFreeDVMode(4);
+});
+
 $("#startVoiceKeyer").click(function() {
     var running = $("#startVoiceKeyer").hasClass("btn-secondary");
 
@@ -81,9 +81,8 @@ void FreeDVReporterTask::onTaskStart_()
     storage::RequestReportingSettingsMessage reportingRequest;
     publish(&reportingRequest);
 
-    // Request current FreeDV mode
-    audio::RequestGetFreeDVModeMessage modeRequest;
-    publish(&modeRequest);
+    // Pick up current FreeDV mode; later changes arrive via SetFreeDVModeMessage.
+    freeDVMode_ = audio::FreeDVModeTopic.get();
 }
 
 void FreeDVReporterTask::onTaskSleep_()
@@ -281,7 +280,8 @@ static const char* FreeDVModeString_[] = {
     "ANALOG",
     "700D",
     "700E",
-    "1600"
+    "1600",
+    "SCAN"
 };
 
 const char* FreeDVReporterTask::freeDVModeAsString_()
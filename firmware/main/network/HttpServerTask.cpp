@@ -790,33 +790,22 @@ void HttpServerTask::onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsoc
     }
 
     {
-        audio::RequestGetFreeDVModeMessage request;
-        publish(&request);
-        
-        auto response = waitFor<audio::SetFreeDVModeMessage>(pdMS_TO_TICKS(1000), NULL);
-        if (response)
+        // Current mode is available without a round trip to FreeDVTask.
+        cJSON *root = cJSON_CreateObject();
+        if (root != nullptr)
         {
-            cJSON *root = cJSON_CreateObject();
-            if (root != nullptr)
-            {
-                cJSON_AddStringToObject(root, "type", JSON_CURRENT_MODE_TYPE);
-                cJSON_AddNumberToObject(root, "currentMode", (int)response->mode);
-        
-                // Note: below is responsible for cleanup.
-                WebSocketList sockets;
-                sockets[message->fd] = false;
-                sendJSONMessage_(root, sockets);
-                delete response;
-            }
-            else
-            {
-                // HTTP isn't 100% critical but we really should see what's leaking memory.
-                ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for FreeDV mode info!");
-            }
+            cJSON_AddStringToObject(root, "type", JSON_CURRENT_MODE_TYPE);
+            cJSON_AddNumberToObject(root, "currentMode", (int)audio::FreeDVModeTopic.get());
+    
+            // Note: below is responsible for cleanup.
+            WebSocketList sockets;
+            sockets[message->fd] = false;
+            sendJSONMessage_(root, sockets);
         }
         else
         {
-            ESP_LOGE(CURRENT_LOG_TAG, "Timed out waiting for current FreeDV mode info");
+            // HTTP isn't 100% critical but we really should see what's leaking memory.
+            ESP_LOGE(CURRENT_LOG_TAG, "Could not create JSON object for FreeDV mode info!");
         }
     }
 
@@ -827,11 +816,11 @@ void HttpServerTask::onHttpWebsocketConnectedMessage_(DVTask* origin, HttpWebsoc
         // This is asynchronous, so we don't need to handle here.
     }
 
+    if (driver::BatteryStateTopic.hasValue())
     {
-        driver::RequestBatteryStateMessage request;
-        publish(&request);
-
-        // This is asynchronous, so we don't need to handle here.
+        WebSocketList sockets;
+        sockets[message->fd] = false;
+        sendBatteryState_(driver::BatteryStateTopic.get(), sockets);
     }
 }
 
@@ -859,17 +848,23 @@ void HttpServerTask::onHttpWebsocketDisconnectedMessage_(DVTask* origin, HttpWeb
 }
 
 void HttpServerTask::onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message)
+{
+    driver::BatteryState state = { message->voltage, message->soc, message->socChangeRate, message->usbPowerEnabled };
+    sendBatteryState_(state, activeWebSockets_);
+}
+
+void HttpServerTask::sendBatteryState_(const driver::BatteryState& state, WebSocketList& socketList)
 {
     cJSON *root = cJSON_CreateObject();
     if (root != nullptr)
     {
         cJSON_AddStringToObject(root, "type", JSON_BATTERY_STATUS_TYPE);
-        cJSON_AddNumberToObject(root, "voltage", message->voltage);
-        cJSON_AddNumberToObject(root, "stateOfCharge", message->soc);
-        cJSON_AddNumberToObject(root, "stateOfChargeChange", message->socChangeRate);
+        cJSON_AddNumberToObject(root, "voltage", state.voltage);
+        cJSON_AddNumberToObject(root, "stateOfCharge", state.soc);
+        cJSON_AddNumberToObject(root, "stateOfChargeChange", state.socChangeRate);
         
         // Note: below is responsible for cleanup.
-        sendJSONMessage_(root, activeWebSockets_);
+        sendJSONMessage_(root, socketList);
     }
     else
     {
@@ -1473,7 +1468,7 @@ void HttpServerTask::onSetModeMessage_(DVTask* origin, SetModeMessage* message)
     if (modeJSON != nullptr)
     {
         mode = (int)cJSON_GetNumberValue(modeJSON);
-        settingsValid &= mode >= 0 && mode <= 3;
+        settingsValid &= mode >= 0 && mode < audio::MAX_FREEDV_MODES;
     }
     else
     {
@@ -174,6 +174,7 @@ private:
     void onHttpServeStaticFileMessage_(DVTask* origin, HttpServeStaticFileMessage* message);
     
     void sendJSONMessage_(cJSON* message, WebSocketList& socketList);
+    void sendBatteryState_(const driver::BatteryState& state, WebSocketList& socketList);
     
     static esp_err_t ServeWebsocketPage_(httpd_req_t *req);
     static esp_err_t ServeStaticPage_(httpd_req_t *req);
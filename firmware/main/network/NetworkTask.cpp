@@ -39,6 +39,7 @@
 #include "NetworkTask.h"
 #include "HttpServerTask.h"
 #include "NetworkMessage.h"
+#include "audio/AudioGraph.h"
 
 #include "interfaces/EthernetInterface.h"
 #include "interfaces/WirelessInterface.h"
@@ -140,6 +141,7 @@ void NetworkTask::onTaskSleep_()
     if (icomAudioTask_ != nullptr)
     {
         sleep(icomAudioTask_, pdMS_TO_TICKS(1000));
+        audio::AudioGraph::GetInstance()->removeNode(icomAudioTask_);
         delete icomAudioTask_;
         icomAudioTask_ = nullptr;
     }
@@ -161,6 +163,7 @@ void NetworkTask::onTaskSleep_()
     if (flexVitaTask_ != nullptr)
     {
         sleep(flexVitaTask_, pdMS_TO_TICKS(1000));
+        audio::AudioGraph::GetInstance()->removeNode(flexVitaTask_);
         delete flexVitaTask_;
         flexVitaTask_ = nullptr;
     }
@@ -256,6 +259,7 @@ void NetworkTask::onNetworkConnected_(bool client, char* ip, uint8_t* macAddress
     if (flexVitaTask_ == nullptr)
     {
         flexVitaTask_ = new flex::FlexVitaTask();
+        audio::AudioGraph::GetInstance()->addNode("FlexVita", flexVitaTask_);
         start(flexVitaTask_, pdMS_TO_TICKS(1000));
     }
     
@@ -298,6 +302,7 @@ void NetworkTask::onNetworkConnected_(bool client, char* ip, uint8_t* macAddress
 
                             icomControlTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::CONTROL_SOCKET);
                             icomAudioTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::AUDIO_SOCKET);
+                            audio::AudioGraph::GetInstance()->addNode("IcomAudio", icomAudioTask_);
                             icomCIVTask_ = new icom::IcomSocketTask(icom::IcomSocketTask::CIV_SOCKET);
 
                             // Wait a bit, then start the connection.
@@ -366,6 +371,7 @@ void NetworkTask::onNetworkDisconnected_()
     if (icomAudioTask_ != nullptr)
     {
         sleep(icomAudioTask_, pdMS_TO_TICKS(1000));
+        audio::AudioGraph::GetInstance()->removeNode(icomAudioTask_);
         delete icomAudioTask_;
         icomAudioTask_ = nullptr;
     }
@@ -387,6 +393,7 @@ void NetworkTask::onNetworkDisconnected_()
     if (flexVitaTask_ != nullptr)
     {
         sleep(flexVitaTask_, pdMS_TO_TICKS(1000));
+        audio::AudioGraph::GetInstance()->removeNode(flexVitaTask_);
         delete flexVitaTask_;
         flexVitaTask_ = nullptr;
     }
@@ -400,58 +407,50 @@ void NetworkTask::onNetworkDisconnected_()
 
 void NetworkTask::onRadioStateChange_(DVTask* origin, RadioConnectionStatusMessage* message)
 {
+    audio::AudioGraph::Patch patch;
+
     if (message->state)
     {
         ESP_LOGI(CURRENT_LOG_TAG, "rerouting audio pipes to network");
         
-        tlv320Handler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
-            nullptr
-        );
+        patch.disconnect(tlv320Handler_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
         
         if (radioType_ == 0)
         {
-            icomAudioTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-                freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
+            patch.connect(
+                icomAudioTask_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
+                freedvHandler_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
         
-            freedvHandler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-                icomAudioTask_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-            );
+            patch.connect(
+                freedvHandler_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
+                icomAudioTask_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
         }
         else if (radioType_ == 1)
         {
             // Flex 100% goes through SmartSDR, so disable TLV320 user port handling
-            tlv320Handler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                nullptr
-            );
+            patch.disconnect(tlv320Handler_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
             
             // Make sure voice keyer can restore Flex mic device once done.
             vkTask_->setMicDeviceTask(flexVitaTask_);
             
-            flexVitaTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
+            patch.connect(
+                flexVitaTask_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
+                freedvHandler_, audio::AudioInput::ChannelLabel::USER_CHANNEL);
                 
-            flexVitaTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
-                freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
+            patch.connect(
+                flexVitaTask_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL,
+                freedvHandler_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
                 
-            freedvHandler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-                flexVitaTask_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-            );
+            patch.connect(
+                freedvHandler_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
+                flexVitaTask_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
                 
-            audioMixerHandler_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-                flexVitaTask_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-            );
+            patch.connect(
+                audioMixerHandler_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
+                flexVitaTask_, audio::AudioInput::ChannelLabel::USER_CHANNEL);
         }
+
+        patch.commit();
     }
     else
     {
@@ -460,33 +459,25 @@ void NetworkTask::onRadioStateChange_(DVTask* origin, RadioConnectionStatusMessa
         // Make sure voice keyer can restore TLV320 mic device once done.
         vkTask_->setMicDeviceTask(tlv320Handler_);
         
-        tlv320Handler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-            freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::LEFT_CHANNEL)
-        );
+        // Connecting TLV320 back up to FreeDV also disconnects whichever
+        // radio was feeding it.
+        patch.connect(
+            tlv320Handler_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
+            freedvHandler_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL);
             
-        tlv320Handler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::RIGHT_CHANNEL, 
-            freedvHandler_->getAudioInput(audio::AudioInput::ChannelLabel::RIGHT_CHANNEL)
-        );
-        
-        if (icomAudioTask_ != nullptr)
-        {
-            icomAudioTask_->setAudioOutput(
-                audio::AudioInput::ChannelLabel::LEFT_CHANNEL, 
-                nullptr
-            );
-        }
+        patch.connect(
+            tlv320Handler_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL, 
+            freedvHandler_, audio::AudioInput::ChannelLabel::RIGHT_CHANNEL);
 
-        freedvHandler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
-            tlv320Handler_->getAudioInput(audio::AudioInput::ChannelLabel::RADIO_CHANNEL)
-        );
+        patch.connect(
+            freedvHandler_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL, 
+            tlv320Handler_, audio::AudioInput::ChannelLabel::RADIO_CHANNEL);
             
-        audioMixerHandler_->setAudioOutput(
-            audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
-            tlv320Handler_->getAudioInput(audio::AudioInput::ChannelLabel::USER_CHANNEL)
-        );
+        patch.connect(
+            audioMixerHandler_, audio::AudioInput::ChannelLabel::LEFT_CHANNEL,
+            tlv320Handler_, audio::AudioInput::ChannelLabel::USER_CHANNEL);
+
+        patch.commit();
             
         if (radioType_ == 0)
         {
@@ -100,12 +100,7 @@ void PskReporterTask::onTaskStart_()
 {
     // Request current reporting settings
     storage::RequestReportingSettingsMessage reportingRequest;
-    publish(&reportingRequest);
-
-    // Request current FreeDV mode
-    audio::RequestGetFreeDVModeMessage modeRequest;
-    publish(&modeRequest);
-}
+    publish(&reportingRequest);}
 
 void PskReporterTask::onTaskSleep_()
 {
@@ -42,11 +42,11 @@ enum ReportingMessageTypes
 
 // These don't require arguments.
 template<uint32_t MSG_ID>
-class ReportingZeroArgMessageCommon : public DVTaskMessageBase<MSG_ID, ReportingZeroArgMessageCommon<MSG_ID>>
+class ReportingZeroArgMessageCommon : public DVTaskMessageBase<MSG_ID, ReportingZeroArgMessageCommon<MSG_ID>, PRIORITY_BACKGROUND>
 {
 public:
     ReportingZeroArgMessageCommon()
-        : DVTaskMessageBase<MSG_ID, ReportingZeroArgMessageCommon<MSG_ID>>(REPORTING_MESSAGE)
+        : DVTaskMessageBase<MSG_ID, ReportingZeroArgMessageCommon<MSG_ID>, PRIORITY_BACKGROUND>(REPORTING_MESSAGE)
         {}
     virtual ~ReportingZeroArgMessageCommon() = default;
 };
@@ -54,11 +54,11 @@ public:
 using EnableReportingMessage = ReportingZeroArgMessageCommon<ENABLE_REPORTING>;
 using DisableReportingMessage = ReportingZeroArgMessageCommon<DISABLE_REPORTING>;
 
-class ReportFrequencyChangeMessage : public DVTaskMessageBase<REPORT_FREQUENCY_CHANGE, ReportFrequencyChangeMessage>
+class ReportFrequencyChangeMessage : public DVTaskMessageBase<REPORT_FREQUENCY_CHANGE, ReportFrequencyChangeMessage, PRIORITY_BACKGROUND>
 {
 public:
     ReportFrequencyChangeMessage(uint64_t frequencyHzProvided = 0)
-        : DVTaskMessageBase<REPORT_FREQUENCY_CHANGE, ReportFrequencyChangeMessage>(REPORTING_MESSAGE)
+        : DVTaskMessageBase<REPORT_FREQUENCY_CHANGE, ReportFrequencyChangeMessage, PRIORITY_BACKGROUND>(REPORTING_MESSAGE)
         , frequencyHz(frequencyHzProvided)
         {}
 
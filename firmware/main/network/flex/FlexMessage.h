@@ -104,11 +104,11 @@ public:
 };
 
 template<uint32_t MSG_ID>
-class VitaMessageCommon : public DVTaskMessageBase<MSG_ID,  VitaMessageCommon<MSG_ID> >
+class VitaMessageCommon : public DVTaskMessageBase<MSG_ID,  VitaMessageCommon<MSG_ID>, PRIORITY_REALTIME, OVERFLOW_DROP_OLDEST>
 {
 public:
     VitaMessageCommon(vita_packet* packetProvided = nullptr, int lengthProvided = 0)
-        : DVTaskMessageBase<MSG_ID,  VitaMessageCommon<MSG_ID> >(FLEX_MESSAGE)
+        : DVTaskMessageBase<MSG_ID,  VitaMessageCommon<MSG_ID>, PRIORITY_REALTIME, OVERFLOW_DROP_OLDEST>(FLEX_MESSAGE)
         , packet(packetProvided)
         , length(lengthProvided)
     {
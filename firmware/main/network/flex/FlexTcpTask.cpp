@@ -63,6 +63,7 @@ FlexTcpTask::FlexTcpTask()
     filterWidths_.push_back(FilterPair_(750, 2250)); // 700D - 1K width + a bit extra
     filterWidths_.push_back(FilterPair_(500, 2500)); // 700E - 1.5K width + a bit extra
     filterWidths_.push_back(FilterPair_(687, 2313)); // 1600 - 1.125K width + a bit extra
+    filterWidths_.push_back(FilterPair_(500, 2500)); // SCAN - widest of the above
     
     // Default to ANA unless we get something better.
     currentWidth_ = filterWidths_[0];
@@ -256,10 +257,10 @@ void FlexTcpTask::checkConnection_(DVTimer*)
             ezdv::network::RadioConnectionStatusMessage response(true);
             publish(&response);
 
-            // Get current FreeDV mode to ensure filters are set properly on
+            // Use current FreeDV mode to ensure filters are set properly on
             // SmartSDR connection.
-            audio::RequestGetFreeDVModeMessage requestGetFreeDVMode;
-            publish(&requestGetFreeDVMode);
+            currentWidth_ = filterWidths_[audio::FreeDVModeTopic.get()];
+            setFilter_(currentWidth_.first, currentWidth_.second);
             
             // Start ping timer
             pingTimer_.start();
@@ -16,6 +16,7 @@
  */
 
 #include <cmath>
+#include <cstring>
 #include <unistd.h>
 
 #include "FlexVitaTask.h"
@@ -25,7 +26,6 @@
 #include "esp_timer.h"
 #include "esp_dsp.h"
 
-#include "codec2_fifo.h"
 #include "codec2_fdmdv.h"
 
 #include "SampleRateConverter.h"
@@ -38,7 +38,8 @@
 #define MAX_VITA_PACKETS_TO_SEND (10)
 #define US_OF_AUDIO_PER_VITA_PACKET (5250)
 #define VITA_IO_TIME_INTERVAL_US (US_OF_AUDIO_PER_VITA_PACKET * MIN_VITA_PACKETS_TO_SEND) /* Time interval between subsequent sends or receives */
-#define MAX_JITTER_US (500) /* Corresponds to +/- the maximum amount VITA_IO_TIME_INTERVAL_US should vary by. */
+#define MAX_JITTER_US (500) /* Corresponds to the maximum amount the packet write handler should run behind its deadline. */
+#define RX_DRIFT_BUFFER_SAMPLES (MAX_VITA_SAMPLES * 3) /* Room for one block plus what drift compensation might leave over */
 
 #define CURRENT_LOG_TAG "FlexVitaTask"
 
@@ -67,9 +68,13 @@ FlexVitaTask::FlexVitaTask()
     , audioEnabled_(false)
     , isTransmitting_(false)
     , inputCtr_(0)
-    , lastVitaGenerationTime_(0)
     , minPacketsRequired_(0)
-    , timeBeyondExpectedUs_(0)
+    , radioLatencyTagger_("Flex RX")
+    , micLatencyTagger_("Flex mic")
+    , radioRxDriftCompensator_("Flex RX", 8000)
+    , micRxDriftCompensator_("Flex mic", 8000)
+    , radioTxDriftCompensator_("Flex TX", 8000)
+    , userTxDriftCompensator_("Flex headset", 8000)
 {
     registerMessageHandler(this, &FlexVitaTask::onFlexConnectRadioMessage_);
     registerMessageHandler(this, &FlexVitaTask::onReceiveVitaMessage_);
@@ -88,6 +93,13 @@ FlexVitaTask::FlexVitaTask()
     upsamplerOutBuf_ = (float*)heap_caps_calloc((MAX_VITA_SAMPLES * FDMDV_OS_24), sizeof(float), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
     assert(upsamplerOutBuf_ != nullptr);
 
+    for (int channel = 0; channel < 2; channel++)
+    {
+        rxDriftInBuf_[channel] = (short*)heap_caps_calloc(RX_DRIFT_BUFFER_SAMPLES, sizeof(short), MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+        assert(rxDriftInBuf_[channel] != nullptr);
+        rxDriftInCtr_[channel] = 0;
+    }
+
     packetArray_ = (vita_packet*)heap_caps_calloc(MAX_VITA_PACKETS, sizeof(vita_packet), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
     assert(packetArray_ != nullptr);
     packetIndex_ = 0;
@@ -101,6 +113,8 @@ FlexVitaTask::~FlexVitaTask()
     heap_caps_free(upsamplerInBuf_);
     heap_caps_free(downsamplerOutBuf_);
     heap_caps_free(upsamplerOutBuf_);
+    heap_caps_free(rxDriftInBuf_[0]);
+    heap_caps_free(rxDriftInBuf_[1]);
     heap_caps_free(packetArray_);
 }
 
@@ -120,77 +134,53 @@ void FlexVitaTask::onTaskTick_()
     // empty
 }
 
-void FlexVitaTask::generateVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId)
+void FlexVitaTask::generateVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId, DVTimer* timer)
 {
     auto fifo = getAudioInput(channel);
 
-    auto currentTimeInMicroseconds = esp_timer_get_time();
-    auto timeSinceLastPacketSend = currentTimeInMicroseconds - lastVitaGenerationTime_;
-    lastVitaGenerationTime_ = currentTimeInMicroseconds;
-
-    // If we're starved of audio, don't even bother going through the rest of the logic right now
-    // and reset state back to the point right when we started.
-    /*if (codec2_fifo_used(fifo) < MAX_VITA_SAMPLES_TO_RESAMPLE * minPacketsRequired_)
-    {
-        if (isTransmitting_) ESP_LOGW(CURRENT_LOG_TAG, "Not enough audio samples to process/send packets (minimum packets needed: %d)!", minPacketsRequired_);
-        minPacketsRequired_ = 0;
-        timeBeyondExpectedUs_ = 0;
-        return;
-    }*/
-
-    if (isTransmitting_ && (
-        timeSinceLastPacketSend >= (VITA_IO_TIME_INTERVAL_US + MAX_JITTER_US) ||
-        timeSinceLastPacketSend <= (VITA_IO_TIME_INTERVAL_US - MAX_JITTER_US)))
+    // The write timer's deadlines are exact multiples of VITA_IO_TIME_INTERVAL_US,
+    // so lateness here is purely due to how long it took to get into this method.
+    auto timeBeyondDeadlineUs = esp_timer_get_time() - (int64_t)timer->getDeadlineUs();
+    if (isTransmitting_ && timeBeyondDeadlineUs >= MAX_JITTER_US)
     {
         ESP_LOGW(
             CURRENT_LOG_TAG, 
-            "Packet TX jitter is a bit high (time = %" PRIu64 ", expected: %d-%d)", 
-            timeSinceLastPacketSend,
-            VITA_IO_TIME_INTERVAL_US - MAX_JITTER_US,
-            VITA_IO_TIME_INTERVAL_US + MAX_JITTER_US);
+            "Packet TX jitter is a bit high (%" PRId64 " us after deadline, expected < %d us)", 
+            timeBeyondDeadlineUs,
+            MAX_JITTER_US);
     }
 
-    // Determine the number of extra packets we need to send this go-around.
-    // This is since it can take a bit longer than the timer interval to 
-    // actually enter this method (depending on what else is going on in the
-    // system at the time).
-    int addedExtra = 0;
-    auto packetsToSend = MIN_VITA_PACKETS_TO_SEND * timeSinceLastPacketSend / VITA_IO_TIME_INTERVAL_US;
-    if (packetsToSend == 0 && minPacketsRequired_ == 0)
-    {
-        // We're executing too quickly (or there are a bunch of events piled up that
-        // need to be worked through). We'll wait until the next time we're actually
-        // supposed to execute.
-        ESP_LOGW(CURRENT_LOG_TAG, "Executing send handler too quickly!");
-        return;
-    }
-    else
+    // Each period covers exactly MIN_VITA_PACKETS_TO_SEND packets worth of audio.
+    // If the timer had to skip periods because we were running behind, we also
+    // need to make up for those. Anything we can't send now (i.e. because there
+    // isn't enough audio yet) carries over to the next period, within reason.
+    minPacketsRequired_ += MIN_VITA_PACKETS_TO_SEND * timer->getPeriodsDue();
+    if (minPacketsRequired_ > MAX_VITA_PACKETS_TO_SEND)
     {
-        //ESP_LOGI(CURRENT_LOG_TAG, "In the previous interval, %" PRIu64 " packets should have gone out (time since last send = %" PRIu64 ")", packetsToSend, timeSinceLastPacketSend);
-        minPacketsRequired_ += packetsToSend;
-        timeBeyondExpectedUs_ += timeSinceLastPacketSend % VITA_IO_TIME_INTERVAL_US;
+        minPacketsRequired_ = MAX_VITA_PACKETS_TO_SEND;
     }
 
-    while (timeBeyondExpectedUs_ >= (US_OF_AUDIO_PER_VITA_PACKET >> 1))
-    {
-        addedExtra = 1;
-        minPacketsRequired_++;
-        timeBeyondExpectedUs_ -= US_OF_AUDIO_PER_VITA_PACKET;
-    }
-
-    if (minPacketsRequired_ <= 0)
-    {
-        minPacketsRequired_ = 0;
-        timeBeyondExpectedUs_ = 0;
-    }
+    // The radio consumes audio at its own rate, but we send it at ours, so
+    // what matters here is how fast audio is arriving in the FIFO compared
+    // to the write timer.
+    auto& driftCompensator = channel == audio::AudioInput::RADIO_CHANNEL ? radioTxDriftCompensator_ : userTxDriftCompensator_;
+    driftCompensator.update(fifo->getUsed(), MIN_VITA_PACKETS_TO_SEND * MAX_VITA_SAMPLES * timer->getPeriodsDue());
 
     //ESP_LOGI(CURRENT_LOG_TAG, "Packets to be sent this time: %d", minPacketsRequired_);
     int ctr = MAX_VITA_PACKETS_TO_SEND;
-    while(minPacketsRequired_ > 0 && ctr > 0 && codec2_fifo_read(fifo, &upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES) == 0)
+    while(minPacketsRequired_ > 0 && ctr > 0 && 
+          fifo->getUsed() >= driftCompensator.getInputSamplesNeeded(MAX_VITA_SAMPLES))
     {
         minPacketsRequired_--;
         ctr--;
 
+        int numInputSamples = driftCompensator.getInputSamplesNeeded(MAX_VITA_SAMPLES);
+        short* inputAudio = fifo->acquireRead(numInputSamples);
+        driftCompensator.process(inputAudio, &upsamplerInBuf_[FDMDV_OS_TAPS_24_8K], MAX_VITA_SAMPLES);
+        fifo->commitRead(numInputSamples);
+
+        audio::RecordAudioLatency(fifo, channel == audio::AudioInput::RADIO_CHANNEL ? "Flex TX" : "Flex headset");
+
         if (!audioEnabled_ || !canPostMessage())
         {
             // Skip sending audio to SmartSDR if the user isn't using us yet
@@ -296,8 +286,6 @@ void FlexVitaTask::generateVitaPackets_(audio::AudioInput::ChannelLabel channel,
         SendVitaMessage message(packet, packet_len);
         post(&message);
     }
-
-    minPacketsRequired_ -= addedExtra;
 }
 
 void FlexVitaTask::openSocket_()
@@ -342,8 +330,6 @@ void FlexVitaTask::openSocket_()
 #endif // 0
 
     minPacketsRequired_ = MIN_VITA_PACKETS_TO_SEND;
-    timeBeyondExpectedUs_ = 0;
-    lastVitaGenerationTime_ = esp_timer_get_time();
 
     packetReadTimer_.start();
     packetWriteTimer_.start();
@@ -367,6 +353,8 @@ void FlexVitaTask::disconnect_()
         timeFracSeq_ = 0;
         inputCtr_ = 0;
         packetIndex_ = 0;
+        rxDriftInCtr_[0] = 0;
+        rxDriftInCtr_[1] = 0;
     }
 }
 
@@ -398,12 +386,12 @@ void FlexVitaTask::readPendingPackets_(DVTimer*)
     }
 }
 
-void FlexVitaTask::sendAudioOut_(DVTimer*)
+void FlexVitaTask::sendAudioOut_(DVTimer* timer)
 {
     // Generate packets for both RX and TX.
     if (rxStreamId_ && !isTransmitting_)
     {
-        generateVitaPackets_(audio::AudioInput::USER_CHANNEL, rxStreamId_);
+        generateVitaPackets_(audio::AudioInput::USER_CHANNEL, rxStreamId_, timer);
     }
     else if (rxStreamId_)
     {
@@ -411,16 +399,12 @@ void FlexVitaTask::sendAudioOut_(DVTimer*)
         // don't end up with audio packets going to the wrong place
         // (i.e. UI beeps being transmitted along with the FreeDV signal).
         auto fifo = getAudioInput(audio::AudioInput::USER_CHANNEL);
-        short tmpBuf[MAX_VITA_SAMPLES];
-        while(codec2_fifo_read(fifo, tmpBuf, MAX_VITA_SAMPLES) == 0)
-        {
-            // empty
-        }
+        fifo->discard();
     }
     
     if (txStreamId_ && isTransmitting_)
     {
-        generateVitaPackets_(audio::AudioInput::RADIO_CHANNEL, txStreamId_);
+        generateVitaPackets_(audio::AudioInput::RADIO_CHANNEL, txStreamId_, timer);
     }
     else if (txStreamId_)
     {
@@ -428,11 +412,7 @@ void FlexVitaTask::sendAudioOut_(DVTimer*)
         // don't end up with audio packets going to the wrong place
         // (i.e. UI beeps being transmitted along with the FreeDV signal).
         auto fifo = getAudioInput(audio::AudioInput::RADIO_CHANNEL);
-        short tmpBuf[MAX_VITA_SAMPLES];
-        while(codec2_fifo_read(fifo, tmpBuf, MAX_VITA_SAMPLES) == 0)
-        {
-            // empty
-        }
+        fifo->discard();
     }
 }
 
@@ -505,6 +485,7 @@ void FlexVitaTask::onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* mes
             unsigned int half_num_samples = num_samples >> 1;
 
             int i = 0;
+            latchAudioOutputs();
             auto fifo = getAudioOutput(channel);
             while (fifo != nullptr && i < half_num_samples)
             {
@@ -516,10 +497,7 @@ void FlexVitaTask::onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* mes
                 {
                     inputCtr_ = 0;
                     fdmdv_24_to_8(downsamplerOutBuf_, &downsamplerInBuf_[FDMDV_OS_TAPS_24K], MAX_VITA_SAMPLES);
-            
-                    // Queue on respective FIFO.
-                    // Note: may be null during voice keyer operation
-                    codec2_fifo_write(fifo, downsamplerOutBuf_, MAX_VITA_SAMPLES);
+                    writeRxAudio_(channel, fifo);
                 }
             }            
             break;
@@ -582,6 +560,37 @@ void FlexVitaTask::onEnableReportingMessage_(DVTask* origin, EnableReportingMess
     audioEnabled_ = true;
 }
 
+void FlexVitaTask::writeRxAudio_(audio::AudioInput::ChannelLabel channel, audio::AudioRingBuffer* fifo)
+{
+    auto& driftCompensator = channel == audio::AudioInput::RADIO_CHANNEL ? radioRxDriftCompensator_ : micRxDriftCompensator_;
+    auto& tagger = channel == audio::AudioInput::RADIO_CHANNEL ? radioLatencyTagger_ : micLatencyTagger_;
+    short* inBuf = rxDriftInBuf_[channel];
+    int& inCtr = rxDriftInCtr_[channel];
+
+    memcpy(&inBuf[inCtr], downsamplerOutBuf_, MAX_VITA_SAMPLES * sizeof(short));
+    inCtr += MAX_VITA_SAMPLES;
+
+    // Nothing downstream buffers audio on the radio's clock, so compare
+    // what we've output against our own clock instead.
+    short outBuf[MAX_VITA_SAMPLES];
+    int numInputSamples = driftCompensator.getInputSamplesNeeded(MAX_VITA_SAMPLES);
+    while (inCtr >= numInputSamples)
+    {
+        driftCompensator.process(inBuf, outBuf, MAX_VITA_SAMPLES);
+        inCtr -= numInputSamples;
+        memmove(inBuf, &inBuf[numInputSamples], inCtr * sizeof(short));
+
+        // Queue on respective FIFO.
+        // Note: may be null during voice keyer operation
+        auto now = esp_timer_get_time();
+        tagger.tag(fifo, now);
+        fifo->write(outBuf, MAX_VITA_SAMPLES);
+
+        driftCompensator.updateFromLocalClock(MAX_VITA_SAMPLES, now);
+        numInputSamples = driftCompensator.getInputSamplesNeeded(MAX_VITA_SAMPLES);
+    }
+}
+
 void FlexVitaTask::onDisableReportingMessage_(DVTask* origin, DisableReportingMessage* message)
 {
     audioEnabled_ = false;
@@ -591,11 +600,11 @@ void FlexVitaTask::onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage*
 {
     isTransmitting_ = true;
 
-    // Reset packet timing parameters so we can redetermine how quickly we need to be
-    // sending packets.
+    // Reset packet backlog and restart the write timer so its deadlines are
+    // anchored to the start of this transmission.
     minPacketsRequired_ = MIN_VITA_PACKETS_TO_SEND;
-    timeBeyondExpectedUs_ = 0;
-    lastVitaGenerationTime_ = esp_timer_get_time();
+    radioTxDriftCompensator_.reset();
+    userTxDriftCompensator_.reset();
     packetWriteTimer_.stop();
     packetWriteTimer_.start();
 }
@@ -604,11 +613,11 @@ void FlexVitaTask::onRequestRxMessage_(DVTask* origin, audio::TransmitCompleteMe
 {
     isTransmitting_ = false;
 
-    // Reset packet timing parameters so we can redetermine how quickly we need to be
-    // sending packets.
+    // Reset packet backlog and restart the write timer so its deadlines are
+    // anchored to the start of this transmission.
     minPacketsRequired_ = MIN_VITA_PACKETS_TO_SEND;
-    timeBeyondExpectedUs_ = 0;
-    lastVitaGenerationTime_ = esp_timer_get_time();
+    radioTxDriftCompensator_.reset();
+    userTxDriftCompensator_.reset();
     packetWriteTimer_.stop();
     packetWriteTimer_.start();
 }
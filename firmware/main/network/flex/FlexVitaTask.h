@@ -22,7 +22,9 @@
 #include <ctime>
 #include <sys/socket.h>
 
+#include "audio/AudioDriftCompensator.h"
 #include "audio/AudioInput.h"
+#include "audio/AudioLatency.h"
 #include "audio/FreeDVMessage.h"
 #include "audio/VoiceKeyerMessage.h"
 #include "network/NetworkMessage.h"
@@ -73,15 +75,24 @@ private:
     bool audioEnabled_;
     bool isTransmitting_;
     int inputCtr_;
-    int64_t lastVitaGenerationTime_;
     int minPacketsRequired_;
-    int64_t timeBeyondExpectedUs_;
+    audio::AudioLatencyTagger radioLatencyTagger_;
+    audio::AudioLatencyTagger micLatencyTagger_;
+
+    // Compensates for the difference between the radio's sample clock
+    // and ours, in each direction.
+    audio::AudioDriftCompensator radioRxDriftCompensator_;
+    audio::AudioDriftCompensator micRxDriftCompensator_;
+    audio::AudioDriftCompensator radioTxDriftCompensator_;
+    audio::AudioDriftCompensator userTxDriftCompensator_;
 
     // Resampler buffers
     short* downsamplerInBuf_;
     short* downsamplerOutBuf_;
     short* upsamplerInBuf_;
     float* upsamplerOutBuf_;
+    short* rxDriftInBuf_[2]; // 8K RX audio waiting for drift compensation, per channel
+    int rxDriftInCtr_[2];
 
     // vita packet cache -- preallocate on startup
     // to reduce the amount of latency when sending packets 
@@ -95,7 +106,8 @@ private:
     void readPendingPackets_(DVTimer*);
     void sendAudioOut_(DVTimer*);
     
-    void generateVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId);
+    void generateVitaPackets_(audio::AudioInput::ChannelLabel channel, uint32_t streamId, DVTimer* timer);
+    void writeRxAudio_(audio::AudioInput::ChannelLabel channel, audio::AudioRingBuffer* fifo);
     
     void onFlexConnectRadioMessage_(DVTask* origin, FlexConnectRadioMessage* message);
     void onReceiveVitaMessage_(DVTask* origin, ReceiveVitaMessage* message);
@@ -16,6 +16,7 @@
  */
 
 #include "esp_dsp.h"
+#include "esp_timer.h"
 
 #include <cstring>
 #include <cmath>
@@ -212,6 +213,13 @@ static short FIXED_POINT_AMPLIFICATION_FACTORS[] = {
 
 #define MIN_AMPLIFICATION_DB (-127) /* -63.5dB minimum amplification by TLV320 */
 #define UNITY_AMPLIFICATION_VAL (2048) /* 1.0 */
+#define ICOM_SAMPLES_PER_PACKET (160) /* 20ms @ 8000 Hz */
+#define ICOM_SAMPLE_RATE (8000)
+
+// Bounds for the RX jitter buffer's playout delay. The actual delay
+// adapts to the jitter seen on the network.
+#define ICOM_MIN_JITTER_BUFFER_MS (40)
+#define ICOM_MAX_JITTER_BUFFER_MS (300)
 
 namespace ezdv
 {
@@ -225,12 +233,20 @@ namespace icom
 AudioState::AudioState(IcomStateMachine* parent)
     : TrackedPacketState(parent)
     , audioOutTimer_(parent_->getTask(), this, &AudioState::onAudioOutTimer_, MS_TO_US(20), "IcomAudioOutTimer")
+    , audioInTimer_(parent_->getTask(), this, &AudioState::onAudioInTimer_, MS_TO_US(20), "IcomAudioInTimer")
     , audioWatchdogTimer_(parent_->getTask(), this, &AudioState::onAudioWatchdog_, MS_TO_US(WATCHDOG_PERIOD), "IcomAudioWatchdogTimer")
     , audioSequenceNumber_(0)
     , completingTransmit_(false)
+    , isActive_(false)
+    , audioOutTimerRunning_(false)
+    , rxJitterBuffer_("Icom RX", ICOM_SAMPLE_RATE, ICOM_MIN_JITTER_BUFFER_MS, ICOM_MAX_JITTER_BUFFER_MS)
+    , rxDriftCompensator_("Icom RX", ICOM_SAMPLE_RATE)
+    , txDriftCompensator_("Icom TX", ICOM_SAMPLE_RATE)
+    , rxLatencyTagger_("Icom RX")
 {
     parent->getTask()->registerMessageHandler(this, &AudioState::onRightChannelVolumeMessage_);
     parent->getTask()->registerMessageHandler(this, &AudioState::onTransmitCompleteMessage_);
+    parent->getTask()->registerMessageHandler(this, &AudioState::onAudioDataAvailable_);
 
     for (int index = 0; index < 160; index++)
     {
@@ -245,11 +261,18 @@ void AudioState::onEnterState()
     // Reset sequence number
     audioSequenceNumber_ = 0;
 
-    // Start audio output timer
-    audioOutTimer_.start();
+    // Audio output is started once there's audio to send.
+    isActive_ = true;
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    task->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL)->setConsumerNotification(task, ICOM_SAMPLES_PER_PACKET);
     
     // Start watchdog
     audioWatchdogTimer_.start();
+
+    // RX audio is played out of the jitter buffer at a steady rate.
+    rxJitterBuffer_.reset();
+    rxDriftCompensator_.reset();
+    audioInTimer_.start();
     
     // Grab current volumes to make sure we properly recover TX ALC.
     storage::RequestVolumeSettingsMessage requestMessage;
@@ -258,7 +281,13 @@ void AudioState::onEnterState()
 
 void AudioState::onExitState()
 {
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    task->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL)->setConsumerNotification(nullptr);
+    isActive_ = false;
+
     audioOutTimer_.stop();
+    audioOutTimerRunning_ = false;
+    audioInTimer_.stop();
     audioWatchdogTimer_.stop();
 
     TrackedPacketState::onExitState();
@@ -280,13 +309,8 @@ void AudioState::onReceivePacket(IcomPacket& packet)
         audioWatchdogTimer_.stop();
         audioWatchdogTimer_.start();
         
-        auto task = (IcomSocketTask*)(parent_->getTask());
-        auto outputFifo = task->getAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL);
-        if (outputFifo != nullptr)
-        {
-            int totalSize = (packet.getSendLength() - 0x18) / sizeof(short);
-            codec2_fifo_write(outputFifo, audioData, totalSize); 
-        }
+        int totalSize = (packet.getSendLength() - 0x18) / sizeof(short);
+        rxJitterBuffer_.push(audioSeqId, audioData, totalSize, esp_timer_get_time());
     }
 
     // Call into parent to perform missing packet handling.
@@ -299,42 +323,87 @@ void AudioState::onAudioWatchdog_(DVTimer*)
     parent_->transitionState(IcomProtocolState::ARE_YOU_THERE);
 }
 
-void AudioState::onAudioOutTimer_(DVTimer*)
+void AudioState::onAudioDataAvailable_(DVTask* origin, ezdv::audio::AudioDataAvailableMessage* message)
+{
+    if (isActive_ && !audioOutTimerRunning_)
+    {
+        startAudioOut_();
+    }
+}
+
+void AudioState::onAudioInTimer_(DVTimer* timer)
 {
     auto task = (IcomSocketTask*)(parent_->getTask());
-    auto inputFifo = task->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL);
-    if (inputFifo == nullptr)
+    task->latchAudioOutputs();
+    auto outputFifo = task->getAudioOutput(ezdv::audio::AudioInput::LEFT_CHANNEL);
+
+    // Keep playing out at the same average rate even if the timer was late.
+    for (uint32_t period = 0; period < timer->getPeriodsDue(); period++)
     {
-        ESP_LOGE(parent_->getName().c_str(), "input fifo is null for some reason!");
-        return;
+        // The radio's sample clock and ours drift apart over time, which 
+        // shows up as the jitter buffer slowly filling or draining. Resample
+        // to keep it at its target depth (plus half a packet, since it's
+        // measured just before a packet is played).
+        short tempAudioIn[ICOM_SAMPLES_PER_PACKET * 2];
+        short tempAudioOut[ICOM_SAMPLES_PER_PACKET];
+        int64_t arrivalTimeUs = 0;
+        int numInputSamples = rxDriftCompensator_.getInputSamplesNeeded(ICOM_SAMPLES_PER_PACKET);
+        int32_t depthSamples = (int64_t)rxJitterBuffer_.getDepthUs() * ICOM_SAMPLE_RATE / 1000000;
+        int32_t targetSamples = (int64_t)rxJitterBuffer_.getTargetDepthUs() * ICOM_SAMPLE_RATE / 1000000;
+        if (!rxJitterBuffer_.pop(tempAudioIn, numInputSamples, &arrivalTimeUs))
+        {
+            // Still buffering, so there's nothing to measure.
+            rxDriftCompensator_.reset();
+            break;
+        }
+
+        rxDriftCompensator_.process(tempAudioIn, tempAudioOut, ICOM_SAMPLES_PER_PACKET);
+        rxDriftCompensator_.setTargetFill(targetSamples + ICOM_SAMPLES_PER_PACKET / 2);
+        rxDriftCompensator_.update(depthSamples, ICOM_SAMPLES_PER_PACKET);
+
+        if (outputFifo != nullptr)
+        {
+            if (arrivalTimeUs >= 0)
+            {
+                rxLatencyTagger_.tag(outputFifo, arrivalTimeUs);
+            }
+            outputFifo->write(tempAudioOut, ICOM_SAMPLES_PER_PACKET);
+        }
     }
-    
-    // Get input audio and write to socket
-    uint16_t samplesToRead = 160; // 320 bytes
-    short tempAudioOut[samplesToRead];
-    //memset(tempAudioOut, 0, samplesToRead * sizeof(short));
+}
 
-    if (codec2_fifo_used(inputFifo) >= samplesToRead)
+void AudioState::onAudioOutTimer_(DVTimer*)
+{
+    if (!sendAudioPacket_())
     {
-        codec2_fifo_read(inputFifo, tempAudioOut, samplesToRead);
-
-        // Adjust output based on configured volume.
-        // Note that since audioMultiplier_ is a Q5.11 fixed point number,
-        // the result pre-shift is a Q6.27 fixed point number. Shifting
-        // by 11 should cancel this out and result in the proper precision
-        // again.
-        dsps_mul_s16(tempAudioOut, audioMultiplier_, tempAudioOut, samplesToRead, 1, 1, 1, 11);
-    
-        auto packet = IcomPacket::CreateAudioPacket(
-            audioSequenceNumber_++,
-            parent_->getOurIdentifier(), 
-            parent_->getTheirIdentifier(), 
-            tempAudioOut, 
-            samplesToRead);
-
-        sendTracked_(packet);
+        // Out of audio; wait for more before starting up again.
+        audioOutTimer_.stop();
+        audioOutTimerRunning_ = false;
+        checkTransmitComplete_();
     }
-    else if (completingTransmit_)
+}
+
+void AudioState::startAudioOut_()
+{
+    // Audio may have stopped for a while, so measure drift from scratch.
+    txDriftCompensator_.reset();
+
+    // Send the first packet as soon as it's ready and let the timer
+    // pace the rest so that we don't send faster than real time.
+    if (sendAudioPacket_())
+    {
+        audioOutTimer_.start();
+        audioOutTimerRunning_ = true;
+    }
+    else
+    {
+        checkTransmitComplete_();
+    }
+}
+
+void AudioState::checkTransmitComplete_()
+{
+    if (completingTransmit_)
     {
         completingTransmit_ = false;
         
@@ -343,6 +412,53 @@ void AudioState::onAudioOutTimer_(DVTimer*)
     }
 }
 
+bool AudioState::sendAudioPacket_()
+{
+    auto task = (IcomSocketTask*)(parent_->getTask());
+    auto inputFifo = task->getAudioInput(ezdv::audio::AudioInput::LEFT_CHANNEL);
+    if (inputFifo == nullptr)
+    {
+        ESP_LOGE(parent_->getName().c_str(), "input fifo is null for some reason!");
+        return false;
+    }
+    
+    // Get input audio and write to socket. Audio arrives on the TLV320/FreeDV
+    // clock but is sent on our timer, so resample to keep the FIFO level steady.
+    uint16_t samplesToSend = ICOM_SAMPLES_PER_PACKET; // 320 bytes
+    short tempAudioResampled[samplesToSend];
+    short tempAudioOut[samplesToSend];
+    //memset(tempAudioOut, 0, samplesToSend * sizeof(short));
+
+    txDriftCompensator_.update(inputFifo->getUsed(), samplesToSend);
+    int samplesToRead = txDriftCompensator_.getInputSamplesNeeded(samplesToSend);
+    if (inputFifo->getUsed() < samplesToRead)
+    {
+        return false;
+    }
+
+    short* inputAudio = inputFifo->acquireRead(samplesToRead);
+    txDriftCompensator_.process(inputAudio, tempAudioResampled, samplesToSend);
+    inputFifo->commitRead(samplesToRead);
+
+    // Adjust output based on configured volume.
+    // Note that since audioMultiplier_ is a Q5.11 fixed point number,
+    // the result pre-shift is a Q6.27 fixed point number. Shifting
+    // by 11 should cancel this out and result in the proper precision
+    // again.
+    dsps_mul_s16(tempAudioResampled, audioMultiplier_, tempAudioOut, samplesToSend, 1, 1, 1, 11);
+    ezdv::audio::RecordAudioLatency(inputFifo, "Icom TX");
+
+    auto packet = IcomPacket::CreateAudioPacket(
+        audioSequenceNumber_++,
+        parent_->getOurIdentifier(), 
+        parent_->getTheirIdentifier(), 
+        tempAudioOut, 
+        samplesToSend);
+
+    sendTracked_(packet);
+    return true;
+}
+
 void AudioState::onRightChannelVolumeMessage_(DVTask* origin, storage::RightChannelVolumeMessage* message)
 {
     short calcResult = FIXED_POINT_AMPLIFICATION_FACTORS[message->volume - MIN_AMPLIFICATION_DB];
@@ -358,6 +474,13 @@ void AudioState::onTransmitCompleteMessage_(DVTask* origin, ezdv::audio::Transmi
     // Set completingTransmit_ to true. This will let us know to send the CI-V command to stop
     // TX as soon as there's nothing left in the TX buffer.
     completingTransmit_ = true;
+
+    if (isActive_ && !audioOutTimerRunning_)
+    {
+        // Nothing's being sent right now, so check immediately instead of
+        // waiting for the timer.
+        startAudioOut_();
+    }
 }
 
 }
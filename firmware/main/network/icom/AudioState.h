@@ -20,6 +20,10 @@
 
 #include "task/DVTimer.h"
 #include "TrackedPacketState.h"
+#include "audio/AudioDriftCompensator.h"
+#include "audio/AudioJitterBuffer.h"
+#include "audio/AudioLatency.h"
+#include "audio/AudioMessage.h"
 #include "audio/FreeDVMessage.h"
 #include "storage/SettingsMessage.h"
 
@@ -49,12 +53,28 @@ public:
 
 private:
     DVTimer audioOutTimer_;
+    DVTimer audioInTimer_;
     DVTimer audioWatchdogTimer_;
     uint16_t audioSequenceNumber_;
     bool completingTransmit_;
+    bool isActive_;
+    bool audioOutTimerRunning_;
+    ezdv::audio::AudioJitterBuffer rxJitterBuffer_;
+    ezdv::audio::AudioDriftCompensator rxDriftCompensator_;
+    ezdv::audio::AudioDriftCompensator txDriftCompensator_;
+    ezdv::audio::AudioLatencyTagger rxLatencyTagger_;
     short audioMultiplier_[160]; // Q5.11 fixed point
 
     void onAudioOutTimer_(DVTimer*);
+    void onAudioInTimer_(DVTimer* timer);
+    void onAudioDataAvailable_(DVTask* origin, ezdv::audio::AudioDataAvailableMessage* message);
+
+    void startAudioOut_();
+    void checkTransmitComplete_();
+
+    /// @brief Sends one packet's worth of TX audio to the radio, if available.
+    /// @return true if there was enough audio to send.
+    bool sendAudioPacket_();
     void onAudioWatchdog_(DVTimer*);
     
     void onRightChannelVolumeMessage_(DVTask* origin, storage::RightChannelVolumeMessage* message);
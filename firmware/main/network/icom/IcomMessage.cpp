@@ -16,8 +16,34 @@
  */
 
 #include "IcomMessage.h"
+#include "IcomPacket.h"
 
 extern "C"
 {
     DV_EVENT_DEFINE_BASE(ICOM_MESSAGE);
-}
\ No newline at end of file
+}
+
+namespace ezdv
+{
+
+namespace network
+{
+
+namespace icom
+{
+
+void SendPacketMessage::onDropped()
+{
+    delete packet;
+}
+
+void ReceivePacketMessage::onDropped()
+{
+    delete packet;
+}
+
+}
+
+}
+
+}
@@ -126,29 +126,33 @@ public:
     virtual ~DisconnectedRadioMessage() = default;
 };
 
-class SendPacketMessage : public DVTaskMessageBase<SEND_PACKET, SendPacketMessage>
+class SendPacketMessage : public DVTaskMessageBase<SEND_PACKET, SendPacketMessage, PRIORITY_REALTIME, OVERFLOW_DROP_OLDEST>
 {
 public:
     SendPacketMessage(IcomPacket* packetProvided = nullptr)
-        : DVTaskMessageBase<SEND_PACKET, SendPacketMessage>(ICOM_MESSAGE)
+        : DVTaskMessageBase<SEND_PACKET, SendPacketMessage, PRIORITY_REALTIME, OVERFLOW_DROP_OLDEST>(ICOM_MESSAGE)
         , packet(packetProvided)
         , sendTime(esp_timer_get_time())
         {}
     virtual ~SendPacketMessage() = default;
 
+    virtual void onDropped() override;
+
     IcomPacket* packet;
     int64_t sendTime;
 };
 
-class ReceivePacketMessage : public DVTaskMessageBase<RECEIVE_PACKET, ReceivePacketMessage>
+class ReceivePacketMessage : public DVTaskMessageBase<RECEIVE_PACKET, ReceivePacketMessage, PRIORITY_REALTIME, OVERFLOW_DROP_OLDEST>
 {
 public:
     ReceivePacketMessage(IcomPacket* packetProvided = nullptr)
-        : DVTaskMessageBase<RECEIVE_PACKET, ReceivePacketMessage>(ICOM_MESSAGE)
+        : DVTaskMessageBase<RECEIVE_PACKET, ReceivePacketMessage, PRIORITY_REALTIME, OVERFLOW_DROP_OLDEST>(ICOM_MESSAGE)
         , packet(packetProvided)
         {}
     virtual ~ReceivePacketMessage() = default;
 
+    virtual void onDropped() override;
+
     IcomPacket* packet;
 };
 
@@ -575,9 +575,12 @@ bool IcomPacket::isAudioPacket(uint16_t& seq, short** dataStart)
     auto typedPacket = getConstTypedPacket<control_packet>();
     if (typedPacket->type != 0x01 && typedPacket->len >= 0x20)
     {
-        // TBD -- we might need to do some reordering by virtue of how UDP works.
+        // Use the audio sequence number rather than the tracked packet one
+        // so that the jitter buffer sees a gapless count of audio packets.
+        // This is sent big endian (see CreateAudioPacket()).
         result = true;
-        seq = ToLittleEndian(typedPacket->seq);
+        auto data = getData();
+        seq = (data[0x12] << 8) | data[0x13];
         *dataStart = (short*)(getData() + 0x18);
     }
     
@@ -71,11 +71,11 @@ enum SettingsMessageTypes
 };
 
 template<uint32_t TYPE_ID>
-class VolumeMessageCommon : public DVTaskMessageBase<TYPE_ID, VolumeMessageCommon<TYPE_ID>>
+class VolumeMessageCommon : public DVTaskMessageBase<TYPE_ID, VolumeMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     VolumeMessageCommon(int8_t volProvided = 0)
-        : DVTaskMessageBase<TYPE_ID, VolumeMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
+        : DVTaskMessageBase<TYPE_ID, VolumeMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE) 
         , volume(volProvided) { }
     virtual ~VolumeMessageCommon() = default;
 
@@ -86,7 +86,7 @@ enum WifiMode { ACCESS_POINT, CLIENT };
 enum WifiSecurityMode { NONE, WEP, WPA, WPA2, WPA_AND_WPA2, /*WPA3, WPA2_AND_WPA3*/ };
 
 template<uint32_t TYPE_ID>
-class WifiSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, WifiSettingsMessageCommon<TYPE_ID>>
+class WifiSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, WifiSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     enum { MAX_STR_SIZE = 32 };
@@ -99,7 +99,7 @@ public:
         const char* ssidProvided = "", 
         const char* passwordProvided = "",
         const char* hostnameProvided = "")
-        : DVTaskMessageBase<TYPE_ID, WifiSettingsMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
+        : DVTaskMessageBase<TYPE_ID, WifiSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE) 
         , enabled(enabledProvided)
         , mode(modeProvided)
         , security(securityProvided)
@@ -135,7 +135,7 @@ public:
 };
 
 template<uint32_t TYPE_ID>
-class RadioSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, RadioSettingsMessageCommon<TYPE_ID>>
+class RadioSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, RadioSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     enum { MAX_STR_SIZE = 32 };
@@ -149,7 +149,7 @@ public:
         int portProvided = 0, 
         const char* usernameProvided = "", 
         const char* passwordProvided = "")
-        : DVTaskMessageBase<TYPE_ID, RadioSettingsMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
+        : DVTaskMessageBase<TYPE_ID, RadioSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE) 
         , headsetPtt(headsetPttProvided)
         , timeOutTimer(timeOutTimerProvided)
         , enabled(enabledProvided)
@@ -198,14 +198,14 @@ using RadioSettingsMessage = RadioSettingsMessageCommon<RADIO_SETTINGS>;
 using SetRadioSettingsMessage = RadioSettingsMessageCommon<SET_RADIO_SETTINGS>;
 
 template<uint32_t TYPE_ID>
-class VoiceKeyerSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, VoiceKeyerSettingsMessageCommon<TYPE_ID>>
+class VoiceKeyerSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, VoiceKeyerSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     VoiceKeyerSettingsMessageCommon(
         bool enabledProvided = false, 
         int timesToTransmitProvided = 0,
         int secondsToWaitProvided = 0)
-        : DVTaskMessageBase<TYPE_ID, VoiceKeyerSettingsMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
+        : DVTaskMessageBase<TYPE_ID, VoiceKeyerSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE) 
         , enabled(enabledProvided)
         , timesToTransmit(timesToTransmitProvided)
         , secondsToWait(secondsToWaitProvided)
@@ -224,7 +224,7 @@ using VoiceKeyerSettingsMessage = VoiceKeyerSettingsMessageCommon<VOICE_KEYER_SE
 using SetVoiceKeyerSettingsMessage = VoiceKeyerSettingsMessageCommon<SET_VOICE_KEYER_SETTINGS>;
 
 template<uint32_t TYPE_ID>
-class ReportingSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, ReportingSettingsMessageCommon<TYPE_ID>>
+class ReportingSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, ReportingSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     enum { 
@@ -238,7 +238,7 @@ public:
         bool forceReportingProvided = false, 
         uint64_t freqHzProvided = 0,
         const char* msgProvided = "")
-        : DVTaskMessageBase<TYPE_ID, ReportingSettingsMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE)
+        : DVTaskMessageBase<TYPE_ID, ReportingSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE)
         , forceReporting(forceReportingProvided)
         , freqHz(freqHzProvided)
     { 
@@ -274,11 +274,11 @@ using ReportingSettingsMessage = ReportingSettingsMessageCommon<REPORTING_SETTIN
 using SetReportingSettingsMessage = ReportingSettingsMessageCommon<SET_REPORTING_SETTINGS>;
 
 template<uint32_t TYPE_ID>
-class LedBrightnessMessageCommon : public DVTaskMessageBase<TYPE_ID, LedBrightnessMessageCommon<TYPE_ID>>
+class LedBrightnessMessageCommon : public DVTaskMessageBase<TYPE_ID, LedBrightnessMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     LedBrightnessMessageCommon(int dutyCycleProvided = 0)
-        : DVTaskMessageBase<TYPE_ID, LedBrightnessMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
+        : DVTaskMessageBase<TYPE_ID, LedBrightnessMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE) 
         , dutyCycle(dutyCycleProvided) { }
     virtual ~LedBrightnessMessageCommon() = default;
 
@@ -289,11 +289,11 @@ using LedBrightnessSettingsMessage = LedBrightnessMessageCommon<LED_BRIGHTNESS_S
 using SetLedBrightnessSettingsMessage = LedBrightnessMessageCommon<SET_LED_BRIGHTNESS_SETTINGS>;
 
 template<uint32_t TYPE_ID>
-class RequesSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, RequesSettingsMessageCommon<TYPE_ID>>
+class RequesSettingsMessageCommon : public DVTaskMessageBase<TYPE_ID, RequesSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>
 {
 public:
     RequesSettingsMessageCommon()
-        : DVTaskMessageBase<TYPE_ID, RequesSettingsMessageCommon<TYPE_ID>>(SETTINGS_MESSAGE) 
+        : DVTaskMessageBase<TYPE_ID, RequesSettingsMessageCommon<TYPE_ID>, PRIORITY_BACKGROUND>(SETTINGS_MESSAGE) 
     { }
     virtual ~RequesSettingsMessageCommon() = default;
 };
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "DVLatencyHistogram.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+DVLatencyHistogram::DVLatencyHistogram()
+{
+    reset();
+}
+
+void DVLatencyHistogram::reset()
+{
+    memset(buckets_, 0, sizeof(buckets_));
+    count_ = 0;
+    totalUs_ = 0;
+    maxUs_ = 0;
+}
+
+uint32_t DVLatencyHistogram::getAverageUs() const
+{
+    if (count_ == 0)
+    {
+        return 0;
+    }
+
+    return totalUs_ / count_;
+}
+
+uint32_t DVLatencyHistogram::getPercentileUs(int percentile) const
+{
+    if (count_ == 0)
+    {
+        return 0;
+    }
+
+    // Number of samples at or below the requested percentile, rounded up.
+    uint32_t target = ((uint64_t)count_ * percentile + 99) / 100;
+    if (target == 0)
+    {
+        target = 1;
+    }
+
+    uint32_t cumulative = 0;
+    for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        cumulative += buckets_[bucket];
+        if (cumulative >= target)
+        {
+            // The maximum is a tighter bound for the last occupied bucket.
+            uint32_t upperBound = GetBucketUpperBoundUs(bucket);
+            return upperBound < maxUs_ ? upperBound : maxUs_;
+        }
+    }
+
+    return maxUs_;
+}
+
+uint32_t DVLatencyHistogram::GetBucketUpperBoundUs(int bucket)
+{
+    if (bucket == 0)
+    {
+        return 0;
+    }
+    else if (bucket >= NUM_BUCKETS - 1)
+    {
+        return UINT32_MAX;
+    }
+
+    return (1UL << bucket) - 1;
+}
+
+}
+
+}
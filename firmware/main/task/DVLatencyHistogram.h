@@ -0,0 +1,92 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_LATENCY_HISTOGRAM_H
+#define DV_LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+
+namespace ezdv
+{
+
+namespace task
+{
+
+/// @brief Histogram of durations using power of two buckets.
+///
+/// Bucket 0 holds zero length samples and bucket N (N > 0) holds samples
+/// in the range [2^(N-1), 2^N) microseconds. The last bucket also holds
+/// everything longer than that.
+class DVLatencyHistogram
+{
+public:
+    static constexpr int NUM_BUCKETS = 20; // last bucket starts at ~262ms
+
+    DVLatencyHistogram();
+
+    /// @brief Adds a sample to the histogram.
+    /// @param durationUs The duration in microseconds.
+    void add(uint32_t durationUs);
+
+    /// @brief Clears all samples.
+    void reset();
+
+    uint32_t getCount() const { return count_; }
+    uint64_t getTotalUs() const { return totalUs_; }
+    uint32_t getMaxUs() const { return maxUs_; }
+    uint32_t getBucketCount(int bucket) const { return buckets_[bucket]; }
+
+    /// @brief Returns the average duration in microseconds.
+    uint32_t getAverageUs() const;
+
+    /// @brief Estimates the given percentile.
+    /// @param percentile The percentile to estimate (0-100).
+    /// @return The upper bound (in microseconds) of the bucket containing the percentile.
+    uint32_t getPercentileUs(int percentile) const;
+
+    /// @brief Returns the largest duration (in microseconds) held by the given bucket.
+    static uint32_t GetBucketUpperBoundUs(int bucket);
+
+private:
+    uint32_t buckets_[NUM_BUCKETS];
+    uint32_t count_;
+    uint64_t totalUs_;
+    uint32_t maxUs_;
+};
+
+inline void DVLatencyHistogram::add(uint32_t durationUs)
+{
+    int bucket = durationUs == 0 ? 0 : 32 - __builtin_clz(durationUs);
+    if (bucket >= NUM_BUCKETS)
+    {
+        bucket = NUM_BUCKETS - 1;
+    }
+
+    buckets_[bucket]++;
+    count_++;
+    totalUs_ += durationUs;
+    if (durationUs > maxUs_)
+    {
+        maxUs_ = durationUs;
+    }
+}
+
+}
+
+}
+
+#endif // DV_LATENCY_HISTOGRAM_H
@@ -0,0 +1,120 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+
+#include "esp_heap_caps.h"
+#include "DVMessagePool.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+DVMessagePool::DVMessagePool(uint32_t blockSize, uint32_t numBlocks)
+    : freeList_(nullptr)
+    , numBlocks_(numBlocks)
+    , numInUse_(0)
+    , highWaterMark_(0)
+    , numAllocations_(0)
+    , numExhausted_(0)
+{
+    assert(numBlocks > 0);
+
+    // Keep every block 8 byte aligned so that messages containing
+    // 64-bit fields can be safely copied in.
+    blockSize_ = (blockSize + 7) & ~7;
+    assert(blockSize_ >= sizeof(FreeBlock));
+
+    poolStart_ = (char*)heap_caps_aligned_alloc(8, blockSize_ * numBlocks_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(poolStart_ != nullptr);
+    poolEnd_ = poolStart_ + blockSize_ * numBlocks_;
+
+    // Thread all blocks onto the free list.
+    for (int index = numBlocks_ - 1; index >= 0; index--)
+    {
+        FreeBlock* block = (FreeBlock*)(poolStart_ + index * blockSize_);
+        block->next = freeList_;
+        freeList_ = block;
+    }
+
+    spinlock_initialize(&lock_);
+}
+
+DVMessagePool::~DVMessagePool()
+{
+    assert(numInUse_ == 0);
+    heap_caps_free(poolStart_);
+}
+
+void* DVMessagePool::allocate()
+{
+    FreeBlock* block = nullptr;
+
+    portENTER_CRITICAL_SAFE(&lock_);
+    if (freeList_ != nullptr)
+    {
+        block = freeList_;
+        freeList_ = block->next;
+
+        numAllocations_++;
+        numInUse_++;
+        if (numInUse_ > highWaterMark_)
+        {
+            highWaterMark_ = numInUse_;
+        }
+    }
+    else
+    {
+        numExhausted_++;
+    }
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return block;
+}
+
+void DVMessagePool::free(void* ptr)
+{
+    assert(owns(ptr));
+
+    FreeBlock* block = (FreeBlock*)ptr;
+
+    portENTER_CRITICAL_SAFE(&lock_);
+    block->next = freeList_;
+    freeList_ = block;
+    numInUse_--;
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+void DVMessagePool::getStatistics(Statistics* stats)
+{
+    assert(stats != nullptr);
+
+    portENTER_CRITICAL_SAFE(&lock_);
+    stats->blockSize = blockSize_;
+    stats->numBlocks = numBlocks_;
+    stats->numInUse = numInUse_;
+    stats->highWaterMark = highWaterMark_;
+    stats->numAllocations = numAllocations_;
+    stats->numExhausted = numExhausted_;
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+}
+
+}
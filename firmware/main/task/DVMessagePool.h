@@ -0,0 +1,101 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_MESSAGE_POOL_H
+#define DV_MESSAGE_POOL_H
+
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+/// @brief Fixed-size block allocator used for queued task messages.
+///
+/// Blocks are carved out of a single internal RAM allocation at construction
+/// time so that allocation and deallocation never touch the general purpose
+/// heap. Safe to use from both tasks and ISRs.
+class DVMessagePool
+{
+public:
+    struct Statistics
+    {
+        uint32_t blockSize;
+        uint32_t numBlocks;
+        uint32_t numInUse;
+        uint32_t highWaterMark;
+        uint32_t numAllocations;
+        uint32_t numExhausted;
+    };
+
+    /// @brief Creates a new pool.
+    /// @param blockSize The size of each block in bytes.
+    /// @param numBlocks The number of blocks in the pool.
+    DVMessagePool(uint32_t blockSize, uint32_t numBlocks);
+    virtual ~DVMessagePool();
+
+    /// @brief Retrieves a block from the pool.
+    /// @return The block, or nullptr if the pool is exhausted.
+    void* allocate();
+
+    /// @brief Returns a block to the pool.
+    /// @param ptr The block to return. Must be owned by this pool.
+    void free(void* ptr);
+
+    /// @brief Determines whether the given pointer was allocated by this pool.
+    bool owns(void* ptr) const;
+
+    uint32_t getBlockSize() const { return blockSize_; }
+
+    /// @brief Retrieves the current usage statistics for the pool.
+    void getStatistics(Statistics* stats);
+
+private:
+    // Overlays the first bytes of each unused block.
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    char* poolStart_;
+    char* poolEnd_;
+    FreeBlock* freeList_;
+
+    uint32_t blockSize_;
+    uint32_t numBlocks_;
+    uint32_t numInUse_;
+    uint32_t highWaterMark_;
+    uint32_t numAllocations_;
+    uint32_t numExhausted_;
+
+    portMUX_TYPE lock_;
+};
+
+inline bool DVMessagePool::owns(void* ptr) const
+{
+    return (char*)ptr >= poolStart_ && (char*)ptr < poolEnd_;
+}
+
+}
+
+}
+
+#endif // DV_MESSAGE_POOL_H
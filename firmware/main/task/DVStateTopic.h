@@ -0,0 +1,153 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_STATE_TOPIC_H
+#define DV_STATE_TOPIC_H
+
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+
+#include "freertos/FreeRTOS.h"
+
+#include "DVTask.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+/// @brief Holds the latest value of a piece of shared state (sync, mode, battery, etc.).
+///
+/// The producer calls publish() whenever it recomputes the state; subscribers
+/// only receive a message when the value actually changes. Any task can also
+/// read the current value with get() instead of doing a request/response
+/// round trip through the owning task.
+template<typename ValueType>
+class DVStateTopic
+{
+    static_assert(std::is_trivially_copyable<ValueType>::value, "Topic values are copied under a spinlock");
+
+public:
+    DVStateTopic(ValueType initialValue = ValueType());
+
+    /// @brief Retrieves a copy of the current value.
+    ValueType get() const;
+
+    /// @brief Returns whether a value has been set since startup.
+    bool hasValue() const;
+
+    /// @brief Returns a counter that increments every time the value changes.
+    uint32_t getVersion() const;
+
+    /// @brief Updates the current value without notifying anyone.
+    /// @return true if the value changed.
+    bool set(ValueType value);
+
+    /// @brief Updates the current value and, if it changed, publishes the given message.
+    /// @param publisher The task that owns this state.
+    /// @param value The new value.
+    /// @param message The message to publish to subscribers on change.
+    /// @return true if the value changed.
+    bool publish(DVTask* publisher, ValueType value, DVTaskMessage* message);
+
+private:
+    ValueType value_;
+    uint32_t version_;
+    bool hasValue_;
+    mutable portMUX_TYPE lock_;
+};
+
+template<typename ValueType>
+DVStateTopic<ValueType>::DVStateTopic(ValueType initialValue)
+    : value_(initialValue)
+    , version_(0)
+    , hasValue_(false)
+{
+    spinlock_initialize(&lock_);
+}
+
+template<typename ValueType>
+ValueType DVStateTopic<ValueType>::get() const
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    ValueType value = value_;
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return value;
+}
+
+template<typename ValueType>
+bool DVStateTopic<ValueType>::hasValue() const
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    bool result = hasValue_;
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return result;
+}
+
+template<typename ValueType>
+uint32_t DVStateTopic<ValueType>::getVersion() const
+{
+    portENTER_CRITICAL_SAFE(&lock_);
+    uint32_t result = version_;
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return result;
+}
+
+template<typename ValueType>
+bool DVStateTopic<ValueType>::set(ValueType value)
+{
+    bool changed = false;
+
+    portENTER_CRITICAL_SAFE(&lock_);
+    if (!hasValue_ || !(value_ == value))
+    {
+        value_ = value;
+        hasValue_ = true;
+        version_++;
+        changed = true;
+    }
+    portEXIT_CRITICAL_SAFE(&lock_);
+
+    return changed;
+}
+
+template<typename ValueType>
+bool DVStateTopic<ValueType>::publish(DVTask* publisher, ValueType value, DVTaskMessage* message)
+{
+    assert(publisher != nullptr);
+    assert(message != nullptr);
+
+    // Note: publishing happens outside the lock as it may block.
+    bool changed = set(value);
+    if (changed)
+    {
+        publisher->publish(message);
+    }
+
+    return changed;
+}
+
+}
+
+}
+
+#endif // DV_STATE_TOPIC_H
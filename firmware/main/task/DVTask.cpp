@@ -18,12 +18,37 @@
 #include <cstdlib>
 #include <cstring>
 #include <inttypes.h>
+#include <new>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "DVTask.h"
+#include "DVTimerWheel.h"
 
 #define CURRENT_LOG_TAG ("DVTask")
 
+// Number of times a lower priority queue can be passed over in favor of
+// higher priority messages before it's allowed to deliver one.
+#define MAX_TASK_QUEUE_SKIPS (16)
+
+// Maximum amount of time OVERFLOW_BLOCK messages wait for queue space.
+#define MESSAGE_BLOCK_TIMEOUT_MS (100)
+
+// How often each task checks its stack high water mark. Checking scans 
+// the unused part of the stack, so this isn't done on every message. The
+// high water mark is permanent, so nothing is missed between checks.
+#define STACK_SAMPLE_INTERVAL_MS (1000)
+
+// Coalesced messages are queued as (slot index << 1) | 1. Real entries
+// are always at least 8 byte aligned so can't be confused with these.
+#define IS_COALESCE_TOKEN(entry) (((uintptr_t)(entry) & 1) != 0)
+#define COALESCE_TOKEN(slotIndex) ((MessageEntry*)(((uintptr_t)(slotIndex) << 1) | 1))
+#define COALESCE_TOKEN_SLOT(entry) ((uintptr_t)(entry) >> 1)
+
+// Only real entries posted with OVERFLOW_DROP_OLDEST can be removed from a
+// full queue to make room for newer messages.
+#define IS_DROPPABLE(entry) (!IS_COALESCE_TOKEN(entry) && (entry)->overflowPolicy == OVERFLOW_DROP_OLDEST)
+
 namespace ezdv
 {
 
@@ -32,23 +57,114 @@ namespace task
 
 DVTask::PublishMap DVTask::SubscriberTasksByMessageType_;
 SemaphoreHandle_t DVTask::SubscriberTasksByMessageTypeSemaphore_;
+DVTask::SubscriberIndex* DVTask::CurrentSubscriberIndex_;
+portMUX_TYPE DVTask::CurrentSubscriberIndexLock_ = portMUX_INITIALIZER_UNLOCKED;
+DVMessagePool* DVTask::MessagePools_[NUM_MESSAGE_POOLS];
+std::atomic<uint32_t> DVTask::NumHeapMessageAllocations_;
+std::atomic<uint32_t> DVTask::NumMessageCopies_;
+std::atomic<uint32_t> DVTask::NumMessageBytesCopied_;
+std::atomic<uint32_t> DVTask::NumPublishDeliveries_;
+std::vector<DVTask*> DVTask::AllTasks_;
+SemaphoreHandle_t DVTask::AllTasksSemaphore_;
 
 void DVTask::Initialize()
 {
-    SubscriberTasksByMessageTypeSemaphore_ = xSemaphoreCreateBinary();
+    SubscriberTasksByMessageTypeSemaphore_ = xSemaphoreCreateMutex();
     assert(SubscriberTasksByMessageTypeSemaphore_ != nullptr);
+
+    AllTasksSemaphore_ = xSemaphoreCreateMutex();
+    assert(AllTasksSemaphore_ != nullptr);
+
+    CurrentSubscriberIndex_ = new SubscriberIndex(SubscriberTasksByMessageType_);
+    assert(CurrentSubscriberIndex_ != nullptr);
+
+    // Pools must be in ascending block size order.
+    MessagePools_[0] = new DVMessagePool(SMALL_MESSAGE_POOL_BLOCK_SIZE, SMALL_MESSAGE_POOL_NUM_BLOCKS);
+    MessagePools_[1] = new DVMessagePool(MEDIUM_MESSAGE_POOL_BLOCK_SIZE, MEDIUM_MESSAGE_POOL_NUM_BLOCKS);
+    MessagePools_[2] = new DVMessagePool(LARGE_MESSAGE_POOL_BLOCK_SIZE, LARGE_MESSAGE_POOL_NUM_BLOCKS);
+
+    for (int index = 0; index < NUM_MESSAGE_POOLS; index++)
+    {
+        assert(MessagePools_[index] != nullptr);
+    }
+
+    DVTimerWheel::Initialize();
+}
+
+int DVTask::GetNumMessagePools()
+{
+    return NUM_MESSAGE_POOLS;
+}
+
+void DVTask::GetMessagePoolStatistics(int index, DVMessagePool::Statistics* stats)
+{
+    assert(index >= 0 && index < NUM_MESSAGE_POOLS);
+    MessagePools_[index]->getStatistics(stats);
+}
+
+void DVTask::GetAllTasks(std::vector<DVTask*>& tasks)
+{
+    auto rv = xSemaphoreTake(AllTasksSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+
+    tasks = AllTasks_;
+
+    xSemaphoreGive(AllTasksSemaphore_);
 }
 
 DVTask::DVTask(const char* taskName, UBaseType_t taskPriority, uint32_t taskStackSize, BaseType_t pinnedCoreId, int32_t taskQueueSize, TickType_t taskTick)
     : taskName_(taskName)
     , taskObject_(nullptr)
+    , dispatchDepth_(0)
+    , dispatchTableDirty_(false)
     , taskQueueSize_(taskQueueSize)
     , taskStackSize_(taskStackSize)
     , taskPriority_(taskPriority)
     , pinnedCoreId_(pinnedCoreId)
-    , taskQueue_(nullptr)
+    , taskQueueSemaphore_(nullptr)
+    , numBlocked_(0)
+    , numBlockTimeouts_(0)
+    , numDroppedNewest_(0)
+    , numDroppedOldest_(0)
+    , numCoalesced_(0)
     , taskTick_(taskTick)
+    , busyTimeUs_(0)
+    , numMessagesHandled_(0)
+    , numTicks_(0)
+    , minStackFree_(UINT32_MAX)
+    , peakQueueDepth_(0)
+    , numCoreMigrations_(0)
+    , lastCoreId_(-1)
+    , busyDepth_(0)
+    , busyStartUs_(0)
+    , nestedWaitUs_(0)
+    , lastStackSampleTick_(0)
 {
+    for (int index = 0; index < NUM_COALESCE_SLOTS; index++)
+    {
+        coalesceSlots_[index].messageIndex = UINT32_MAX;
+        coalesceSlots_[index].entry = nullptr;
+    }
+
+    coalesceSemaphore_ = xSemaphoreCreateMutex();
+    assert(coalesceSemaphore_ != nullptr);
+
+    for (int priority = 0; priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        taskQueues_[priority] = nullptr;
+        taskQueueSkips_[priority] = 0;
+    }
+
+    messageStatsSemaphore_ = xSemaphoreCreateMutex();
+    assert(messageStatsSemaphore_ != nullptr);
+    spinlock_initialize(&messageStatsLock_);
+    spinlock_initialize(&telemetryLock_);
+
+    auto rv = xSemaphoreTake(AllTasksSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+    AllTasks_.push_back(this);
+    xSemaphoreGive(AllTasksSemaphore_);
+
     // Register task start/wake/sleep handlers.
     registerMessageHandler(this, &DVTask::onTaskStart_);
     registerMessageHandler(this, &DVTask::onTaskSleep_);
@@ -59,11 +175,30 @@ DVTask::~DVTask()
 {
     assert(taskObject_ == nullptr);
 
-    while (eventRegistrationMap_.size() > 0)
+    DVTimerWheel::RemoveOwner(this);
+
+    for (auto& handlers : dispatchTable_)
     {
-        auto iter = eventRegistrationMap_.begin();
-        unregisterMessageHandler(iter->second.second);
+        while (handlers.size() > 0)
+        {
+            unregisterMessageHandler(handlers.front().storage);
+        }
     }
+
+    auto rv = xSemaphoreTake(AllTasksSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+    for (auto iter = AllTasks_.begin(); iter != AllTasks_.end(); iter++)
+    {
+        if (*iter == this)
+        {
+            AllTasks_.erase(iter);
+            break;
+        }
+    }
+    xSemaphoreGive(AllTasksSemaphore_);
+
+    vSemaphoreDelete(messageStatsSemaphore_);
+    vSemaphoreDelete(coalesceSemaphore_);
 }
 
 void DVTask::start()
@@ -125,42 +260,187 @@ void DVTask::unregisterMessageHandler(MessageHandlerHandle handler)
 {
     FnPtrStorage* handlerPtr = (FnPtrStorage*)handler;
     
+    uint32_t messageIndex = handlerPtr->messageIndex;
+    
     // Unregister task specific handler.
-    auto iter = eventRegistrationMap_.begin();
-    EventIdentifierPair key;
-    for (; iter != eventRegistrationMap_.end(); iter++)
+    auto& handlers = dispatchTable_[messageIndex];
+    bool found = false;
+    for (auto iter = handlers.begin(); iter != handlers.end(); iter++)
     {
-        if (iter->second.second == handlerPtr)
+        if (iter->storage == handlerPtr)
         {
-            key = iter->first;
-            eventRegistrationMap_.erase(iter);
+            if (dispatchDepth_ > 0)
+            {
+                // We're in the middle of handling a message (e.g. this 
+                // is being called from waitFor()), so we can't safely
+                // remove the entry yet.
+                iter->fn = nullptr;
+                iter->storage = nullptr;
+                dispatchTableDirty_ = true;
+            }
+            else
+            {
+                handlers.erase(iter);
+            }
+
             delete handlerPtr;
+            found = true;
             break;
         }
     }
     
     // Unregister for use by publish.
-    xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    if (eventRegistrationMap_.count(key) == 0)
+    if (found)
+    {
+        unsubscribe_(messageIndex);
+    }
+}
+
+void DVTask::compactDispatchTable_()
+{
+    for (auto& handlers : dispatchTable_)
     {
-        auto iter = SubscriberTasksByMessageType_.equal_range(key);
-        for (auto i = iter.first; i != iter.second; i++)
+        auto iter = handlers.begin();
+        while (iter != handlers.end())
         {
-            if (i->second == this)
+            if (iter->fn == nullptr)
             {
-                SubscriberTasksByMessageType_.erase(i);
-                break;
+                iter = handlers.erase(iter);
+            }
+            else
+            {
+                iter++;
+            }
+        }
+    }
+
+    dispatchTableDirty_ = false;
+}
+
+void DVTask::subscribe_(uint32_t messageIndex)
+{
+    auto rv = xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+
+    // Tasks with multiple handlers for the same message only need
+    // to be sent one copy, so we keep count of the number of handlers 
+    // instead of adding duplicate entries.
+    auto& subscribers = SubscriberTasksByMessageType_[messageIndex];
+    if (subscribers[this]++ == 0)
+    {
+        UpdateSubscriberIndex_();
+    }
+    
+    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
+}
+
+void DVTask::unsubscribe_(uint32_t messageIndex)
+{
+    auto rv = xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+
+    auto iter = SubscriberTasksByMessageType_.find(messageIndex);
+    if (iter != SubscriberTasksByMessageType_.end())
+    {
+        auto taskIter = iter->second.find(this);
+        if (taskIter != iter->second.end() && --taskIter->second == 0)
+        {
+            iter->second.erase(taskIter);
+            if (iter->second.size() == 0)
+            {
+                SubscriberTasksByMessageType_.erase(iter);
             }
+
+            UpdateSubscriberIndex_();
         }
     }
+
     xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
 }
 
+DVTask::SubscriberIndex::SubscriberIndex(const PublishMap& subscribers)
+    : refCount(1)
+{
+    // PublishMap is sorted by message index, so the last entry 
+    // determines how big the table needs to be.
+    if (subscribers.size() > 0)
+    {
+        entries_.resize(subscribers.rbegin()->first + 1, Entry { 0, 0 });
+    }
+
+    for (auto& subscriberPair : subscribers)
+    {
+        Entry& entry = entries_[subscriberPair.first];
+        entry.firstTask = tasks_.size();
+        entry.numTasks = subscriberPair.second.size();
+
+        for (auto& taskPair : subscriberPair.second)
+        {
+            tasks_.push_back(taskPair.first);
+        }
+    }
+}
+
+DVTask* const* DVTask::SubscriberIndex::find(uint32_t messageIndex, uint32_t* numTasks) const
+{
+    // Message types that nobody has registered for may be past the end
+    // of the table.
+    if (messageIndex >= entries_.size() || entries_[messageIndex].numTasks == 0)
+    {
+        *numTasks = 0;
+        return nullptr;
+    }
+
+    const Entry& entry = entries_[messageIndex];
+    *numTasks = entry.numTasks;
+    return &tasks_[entry.firstTask];
+}
+
+void DVTask::UpdateSubscriberIndex_()
+{
+    // Note: must be called while holding SubscriberTasksByMessageTypeSemaphore_.
+    SubscriberIndex* newIndex = new SubscriberIndex(SubscriberTasksByMessageType_);
+    assert(newIndex != nullptr);
+
+    portENTER_CRITICAL(&CurrentSubscriberIndexLock_);
+    SubscriberIndex* oldIndex = CurrentSubscriberIndex_;
+    CurrentSubscriberIndex_ = newIndex;
+    portEXIT_CRITICAL(&CurrentSubscriberIndexLock_);
+
+    // Frees the old index once any in-progress publishes are done with it.
+    ReleaseSubscriberIndex_(oldIndex);
+}
+
+DVTask::SubscriberIndex* DVTask::AcquireSubscriberIndex_()
+{
+    portENTER_CRITICAL(&CurrentSubscriberIndexLock_);
+    SubscriberIndex* index = CurrentSubscriberIndex_;
+    index->refCount++;
+    portEXIT_CRITICAL(&CurrentSubscriberIndexLock_);
+
+    return index;
+}
+
+void DVTask::ReleaseSubscriberIndex_(SubscriberIndex* index)
+{
+    if (index->refCount.fetch_sub(1) == 1)
+    {
+        delete index;
+    }
+}
+
 void DVTask::startTask_()
 {
-    // Create task event queue
-    taskQueue_ = xQueueCreate(taskQueueSize_, sizeof(MessageEntry*));
-    assert(taskQueue_ != nullptr);
+    // Create task event queues
+    for (int priority = 0; priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        taskQueues_[priority] = xQueueCreate(taskQueueSize_, sizeof(MessageEntry*));
+        assert(taskQueues_[priority] != nullptr);
+        taskQueueSkips_[priority] = 0;
+    }
+
+    taskQueueSemaphore_ = xSemaphoreCreateCounting(taskQueueSize_ * NUM_MESSAGE_PRIORITIES, 0);
+    assert(taskQueueSemaphore_ != nullptr);
 
     auto returnValue = 
         xTaskCreatePinnedToCore((TaskFunction_t)&ThreadEntry_, taskName_, taskStackSize_, this, taskPriority_, &taskObject_, pinnedCoreId_);
@@ -172,29 +452,83 @@ void DVTask::onTaskTick_()
     // optional, default doesn't do anything
 }
 
-DVTask::MessageEntry* DVTask::createMessageEntry_(DVTask* origin, DVTaskMessage* message)
+DVTask::MessageEntry* DVTask::createMessageEntry_(DVTask* origin, DVTaskMessage* message, uint32_t refCount)
 {
     // Create object that's big enough to hold the passed-in message.
-    uint32_t size = message->getSize() + sizeof(MessageEntry);
-    char* messageEntryBuf = new char[size];
+    // The smallest pool that can fit it is preferred, falling back to
+    // larger pools and finally the heap if those are exhausted.
+    uint32_t size = GetQueuedMessageSize(message->getSize());
+    char* messageEntryBuf = nullptr;
+    for (int index = 0; index < NUM_MESSAGE_POOLS && messageEntryBuf == nullptr; index++)
+    {
+        if (MessagePools_[index]->getBlockSize() >= size)
+        {
+            messageEntryBuf = (char*)MessagePools_[index]->allocate();
+        }
+    }
+
+    if (messageEntryBuf == nullptr)
+    {
+        messageEntryBuf = new char[size];
+        NumHeapMessageAllocations_++;
+    }
     assert(messageEntryBuf != nullptr);
 
     // Copy the message over to the object.
-    MessageEntry* entry = (MessageEntry*)messageEntryBuf;
+    MessageEntry* entry = new (messageEntryBuf) MessageEntry;
     memcpy(&entry->messageStart, message, message->getSize());
 
     // Fill in remaining data fields.
     entry->eventBase = message->getEventBase();
     entry->eventId = message->getEventType();
+    entry->messageIndex = message->getMessageIndex();
+    entry->priority = message->getPriority();
+    entry->overflowPolicy = message->getOverflowPolicy();
     entry->size = size;
     entry->origin = origin;
+    entry->refCount = refCount;
+    entry->enqueueTimeUs = esp_timer_get_time();
+
+    NumMessageCopies_++;
+    NumMessageBytesCopied_ += message->getSize();
 
     return entry;
 }
 
+void DVTask::ReleaseMessageEntry_(MessageEntry* entry)
+{
+    if (entry->refCount.fetch_sub(1) > 1)
+    {
+        // Still waiting for other tasks to handle this message.
+        return;
+    }
+
+    entry->~MessageEntry();
+
+    for (int index = 0; index < NUM_MESSAGE_POOLS; index++)
+    {
+        if (MessagePools_[index]->owns(entry))
+        {
+            MessagePools_[index]->free(entry);
+            return;
+        }
+    }
+
+    char* entryPtr = (char*)entry;
+    delete[] entryPtr;
+}
+
 bool DVTask::canPostMessage()
 {
-    return uxQueueSpacesAvailable(taskQueue_) > 0;
+    for (int priority = 0; priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        if (uxQueueSpacesAvailable(taskQueues_[priority]) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 void DVTask::post(DVTaskMessage* message)
@@ -205,12 +539,22 @@ void DVTask::post(DVTaskMessage* message)
 
 void DVTask::postISR(DVTaskMessage* message)
 {
-    if (taskQueue_ && isAwake())
+    if (taskQueueSemaphore_ && isAwake())
     {
         MessageEntry* entry = createMessageEntry_(nullptr, message);
         BaseType_t taskUnblocked = pdFALSE;
 
-        xQueueSendToBackFromISR(taskQueue_, &entry, &taskUnblocked);
+        // We can't block or take mutexes here, so all messages 
+        // posted from ISRs are treated as OVERFLOW_DROP_NEWEST.
+        if (xQueueSendToBackFromISR(taskQueues_[entry->priority], &entry, &taskUnblocked) == pdTRUE)
+        {
+            xSemaphoreGiveFromISR(taskQueueSemaphore_, &taskUnblocked);
+        }
+        else
+        {
+            numDroppedNewest_++;
+            ReleaseMessageEntry_(entry);
+        }
 
         if (taskUnblocked != pdFALSE)
         {
@@ -219,19 +563,27 @@ void DVTask::postISR(DVTaskMessage* message)
     }
 }
 
-void DVTask::postTimer(DVTaskMessage* message)
+bool DVTask::postTimer(DVTaskMessage* message)
 {
-    if (taskQueue_ && isAwake())
+    // Timers are all handled from the same context, so one task being
+    // slow mustn't hold up the others.
+    assert(message->getOverflowPolicy() == OVERFLOW_DROP_NEWEST);
+
+    if (taskQueueSemaphore_ && isAwake())
     {
+        // Timers always jump to the front of their queue.
         MessageEntry* entry = createMessageEntry_(nullptr, message);
-        auto rv = xQueueSendToFront(taskQueue_, &entry, pdMS_TO_TICKS(100));
-        if (rv == errQUEUE_FULL)
+        if (sendToQueue_(taskQueues_[entry->priority], entry, 0, true))
         {
-            ESP_LOGE(CURRENT_LOG_TAG, "Task %s has a full queue! (maximum: %ld)", taskName_, taskQueueSize_);
-            vTaskDelay(pdMS_TO_TICKS(100));
+            xSemaphoreGive(taskQueueSemaphore_);
+            return true;
         }
-        assert(rv != errQUEUE_FULL);
+
+        numDroppedNewest_++;
+        dropEntry_(entry);
     }
+
+    return false;
 }
 
 void DVTask::sendTo(DVTask* destination, DVTaskMessage* message)
@@ -242,36 +594,28 @@ void DVTask::sendTo(DVTask* destination, DVTaskMessage* message)
 
 void DVTask::publish(DVTaskMessage* message)
 {    
-    auto messagePair = std::make_pair(message->getEventBase(), message->getEventType());
+    // Grab the current subscriber snapshot. Holding a reference to it 
+    // (rather than a lock) means that other tasks can publish or 
+    // (un)subscribe while we're posting.
+    SubscriberIndex* index = AcquireSubscriberIndex_();
 
-    std::vector<DVTask*> tasksToPostTo;
+    uint32_t numTasks = 0;
+    DVTask* const* tasksToPostTo = index->find(message->getMessageIndex(), &numTasks);
 
-    // Get the list of tasks to post to first so we don't deadlock.
-    auto rv = xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    if (rv != pdTRUE)
+    // All subscribers share a single copy of the message, which is 
+    // freed once the last one is done with it.
+    if (numTasks > 0)
     {
-        ESP_LOGE(CURRENT_LOG_TAG, "Could not get task list in time for %s to publish", taskName_);
-        vTaskDelay(pdMS_TO_TICKS(100)); // flush debug output before crashing
-        assert(rv == pdTRUE);
-    }
-
-    for (auto& taskPair : SubscriberTasksByMessageType_)
-    {
-        if (messagePair == taskPair.first)
+        MessageEntry* entry = createMessageEntry_(this, message, numTasks);
+        for (uint32_t taskIndex = 0; taskIndex < numTasks; taskIndex++)
         {
-            tasksToPostTo.push_back(taskPair.second);
+            tasksToPostTo[taskIndex]->postHelper_(entry);
         }
-    }
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
 
-    // Now that we have the list of tasks, we can take our time
-    // posting the messages.
-    for (auto& task : tasksToPostTo)
-    {
-        MessageEntry* entry = createMessageEntry_(this, message);
-        task->postHelper_(entry);
+        NumPublishDeliveries_ += numTasks;
     }
 
+    ReleaseSubscriberIndex_(index);
 }
 
 void DVTask::onTaskStart_(DVTask* origin, TaskStartMessage* message)
@@ -294,68 +638,549 @@ void DVTask::onTaskSleep_(DVTask* origin, TaskSleepMessage* message)
 
     // Process all remaining messages in message queue in case
     // there are actions that need to be performed during shutdown.
-    MessageEntry* entry = nullptr;
-    while (taskQueue_ != nullptr && xQueuePeek(taskQueue_, &entry, 0) == pdTRUE)
+    while (taskQueueSemaphore_ != nullptr && hasQueuedMessages_())
     {
         singleMessagingLoop_(0);
     }
 
     taskObject_ = nullptr;
 
-    vQueueDelete(taskQueue_);
-    taskQueue_ = nullptr;
+    for (int priority = 0; priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        vQueueDelete(taskQueues_[priority]);
+        taskQueues_[priority] = nullptr;
+    }
+
+    vSemaphoreDelete(taskQueueSemaphore_);
+    taskQueueSemaphore_ = nullptr;
 
     TaskAsleepMessage result;
     publish(&result);
 
+    // vTaskDelete() never returns, so the dispatch of this message never
+    // completes. Reset dispatch state so that handlers unregistered while
+    // asleep (or on destruction) are removed immediately.
+    dispatchDepth_ = 0;
+    if (dispatchTableDirty_)
+    {
+        compactDispatchTable_();
+    }
+
     // Remove ourselves from FreeRTOS.
     vTaskDelete(nullptr);
 }
 
-void DVTask::postHelper_(MessageEntry* entry)
+void DVTask::postHelper_(MessageEntry* entry, bool toFront)
 {
-    if (taskQueue_ && isAwake())
+    if (taskQueueSemaphore_ && isAwake())
     {
-        auto rv = xQueueSendToBack(taskQueue_, &entry, pdMS_TO_TICKS(100));
-        if (rv == errQUEUE_FULL)
+        QueueHandle_t queue = taskQueues_[entry->priority];
+
+        switch (entry->overflowPolicy)
         {
-            ESP_LOGE(CURRENT_LOG_TAG, "Task %s has a full queue! (maximum: %ld)", taskName_, taskQueueSize_);
-            vTaskDelay(pdMS_TO_TICKS(100));
+            case OVERFLOW_DROP_NEWEST:
+                if (sendToQueue_(queue, entry, 0, toFront))
+                {
+                    xSemaphoreGive(taskQueueSemaphore_);
+                }
+                else
+                {
+                    numDroppedNewest_++;
+                    dropEntry_(entry);
+                }
+                break;
+            case OVERFLOW_DROP_OLDEST:
+                enqueueWithDropOldest_(queue, entry, toFront);
+                break;
+            case OVERFLOW_COALESCE_LATEST:
+                enqueueWithCoalesce_(queue, entry, toFront);
+                break;
+            case OVERFLOW_BLOCK:
+            default:
+                enqueueWithBlock_(queue, entry, toFront);
+                break;
         }
-        assert(rv != errQUEUE_FULL);
     }
     else
     {
         // Task isn't awake, no use keeping the entry around
-        char* entryPtr = (char*)entry;
-        delete[] entryPtr;
+        ReleaseMessageEntry_(entry);
     }
 }
 
-void DVTask::singleMessagingLoop_(int64_t ticksRemaining)
+bool DVTask::sendToQueue_(QueueHandle_t queue, MessageEntry* entry, TickType_t ticksToWait, bool toFront)
+{
+    if (toFront)
+    {
+        return xQueueSendToFront(queue, &entry, ticksToWait) == pdTRUE;
+    }
+    else
+    {
+        return xQueueSendToBack(queue, &entry, ticksToWait) == pdTRUE;
+    }
+}
+
+void DVTask::enqueueWithBlock_(QueueHandle_t queue, MessageEntry* entry, bool toFront)
+{
+    if (!sendToQueue_(queue, entry, 0, toFront))
+    {
+        numBlocked_++;
+
+        if (!sendToQueue_(queue, entry, pdMS_TO_TICKS(MESSAGE_BLOCK_TIMEOUT_MS), toFront))
+        {
+            numBlockTimeouts_++;
+            ESP_LOGE(
+                CURRENT_LOG_TAG, 
+                "Task %s has a full queue! (maximum: %" PRId32 "), dropping %s:%" PRId32, 
+                taskName_, taskQueueSize_, entry->eventBase, entry->eventId);
+            dropEntry_(entry);
+            return;
+        }
+    }
+
+    xSemaphoreGive(taskQueueSemaphore_);
+}
+
+void DVTask::enqueueWithDropOldest_(QueueHandle_t queue, MessageEntry* entry, bool toFront)
 {
+    if (sendToQueue_(queue, entry, 0, toFront))
+    {
+        xSemaphoreGive(taskQueueSemaphore_);
+        return;
+    }
+
+    // Queue's full. If the oldest message doesn't allow itself to be
+    // dropped, drop ours instead without touching the queue.
+    MessageEntry* oldest = nullptr;
+    if (xQueuePeek(queue, &oldest, 0) == pdTRUE && !IS_DROPPABLE(oldest))
+    {
+        numDroppedNewest_++;
+        dropEntry_(entry);
+        return;
+    }
+
+    // Otherwise, reserve one of the queued messages first so that our
+    // task doesn't think there's a message available that we then remove.
+    if (xSemaphoreTake(taskQueueSemaphore_, 0) == pdTRUE)
+    {
+        MessageEntry* received = nullptr;
+        if (xQueueReceive(queue, &received, 0) != pdTRUE)
+        {
+            // Our task drained the queue in the meantime.
+            xSemaphoreGive(taskQueueSemaphore_);
+            if (sendToQueue_(queue, entry, 0, toFront))
+            {
+                xSemaphoreGive(taskQueueSemaphore_);
+                return;
+            }
+        }
+        else if (!IS_DROPPABLE(received))
+        {
+            // Our task handled the message we peeked at in the meantime,
+            // leaving one that can't be dropped at the front. Put it back 
+            // where it was and drop ours instead. Another task may have 
+            // taken the slot we just freed, in which case we wait for our
+            // task to make room as OVERFLOW_BLOCK would (but not if we *are*
+            // our task, since nothing else can make room).
+            TickType_t ticksToWait = isCurrentTask() ? 0 : pdMS_TO_TICKS(MESSAGE_BLOCK_TIMEOUT_MS);
+            if (xQueueSendToFront(queue, &received, ticksToWait) == pdTRUE)
+            {
+                xSemaphoreGive(taskQueueSemaphore_);
+            }
+            else
+            {
+                received = resolveQueuedEntry_(received);
+                numBlockTimeouts_++;
+                ESP_LOGE(
+                    CURRENT_LOG_TAG, 
+                    "Task %s has a full queue! (maximum: %" PRId32 "), dropping %s:%" PRId32, 
+                    taskName_, taskQueueSize_, received->eventBase, received->eventId);
+                dropEntry_(received);
+            }
+        }
+        else
+        {
+            numDroppedOldest_++;
+            dropEntry_(received);
+
+            if (sendToQueue_(queue, entry, 0, toFront))
+            {
+                xSemaphoreGive(taskQueueSemaphore_);
+                return;
+            }
+        }
+    }
+
+    numDroppedNewest_++;
+    dropEntry_(entry);
+}
+
+void DVTask::enqueueWithCoalesce_(QueueHandle_t queue, MessageEntry* entry, bool toFront)
+{
+    auto rv = xSemaphoreTake(coalesceSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    int slotIndex = -1;
+    for (int index = 0; index < NUM_COALESCE_SLOTS; index++)
+    {
+        if (coalesceSlots_[index].messageIndex == entry->messageIndex)
+        {
+            slotIndex = index;
+            break;
+        }
+        else if (coalesceSlots_[index].messageIndex == UINT32_MAX)
+        {
+            coalesceSlots_[index].messageIndex = entry->messageIndex;
+            slotIndex = index;
+            break;
+        }
+    }
+
+    if (slotIndex < 0)
+    {
+        // Too many coalesced message types for this task.
+        xSemaphoreGive(coalesceSemaphore_);
+        ESP_LOGW(CURRENT_LOG_TAG, "Task %s has no free coalesce slots for %s:%" PRId32, taskName_, entry->eventBase, entry->eventId);
+        enqueueWithBlock_(queue, entry, toFront);
+        return;
+    }
+
+    auto& slot = coalesceSlots_[slotIndex];
+    MessageEntry* replacedEntry = slot.entry;
+    if (replacedEntry != nullptr)
+    {
+        // A token is already queued; it'll pick up this entry instead.
+        slot.entry = entry;
+        xSemaphoreGive(coalesceSemaphore_);
+
+        numCoalesced_++;
+        dropEntry_(replacedEntry);
+    }
+    else if (sendToQueue_(queue, COALESCE_TOKEN(slotIndex), 0, toFront))
+    {
+        // Our task can't resolve the token until we release the mutex.
+        slot.entry = entry;
+        xSemaphoreGive(coalesceSemaphore_);
+        xSemaphoreGive(taskQueueSemaphore_);
+    }
+    else
+    {
+        xSemaphoreGive(coalesceSemaphore_);
+
+        numDroppedNewest_++;
+        dropEntry_(entry);
+    }
+}
+
+DVTask::MessageEntry* DVTask::resolveQueuedEntry_(MessageEntry* queuedEntry)
+{
+    if (!IS_COALESCE_TOKEN(queuedEntry))
+    {
+        return queuedEntry;
+    }
+
+    auto rv = xSemaphoreTake(coalesceSemaphore_, portMAX_DELAY);
+    assert(rv == pdTRUE);
+
+    auto& slot = coalesceSlots_[COALESCE_TOKEN_SLOT(queuedEntry)];
+    MessageEntry* entry = slot.entry;
+    slot.entry = nullptr;
+
+    xSemaphoreGive(coalesceSemaphore_);
+
+    assert(entry != nullptr);
+    return entry;
+}
+
+void DVTask::dropEntry_(MessageEntry* entry)
+{
+    DVTaskMessage* message = (DVTaskMessage*)&entry->messageStart;
+    message->onDropped();
+
+    ReleaseMessageEntry_(entry);
+}
+
+void DVTask::getOverflowStatistics(OverflowStatistics* stats) const
+{
+    assert(stats != nullptr);
+
+    stats->numBlocked = numBlocked_;
+    stats->numBlockTimeouts = numBlockTimeouts_;
+    stats->numDroppedNewest = numDroppedNewest_;
+    stats->numDroppedOldest = numDroppedOldest_;
+    stats->numCoalesced = numCoalesced_;
+}
+
+DVTask::MessageEntry* DVTask::receiveMessage_(int64_t ticksRemaining)
+{
+    // Wait for a message to be queued on any of our queues. Time spent
+    // blocked here while inside a handler (i.e. waitFor()) isn't busy time.
+    int64_t waitStartUs = busyDepth_ > 0 ? esp_timer_get_time() : 0;
+    bool received = xSemaphoreTake(taskQueueSemaphore_, ticksRemaining) == pdTRUE;
+    if (busyDepth_ > 0)
+    {
+        nestedWaitUs_ += esp_timer_get_time() - waitStartUs;
+    }
+
+    if (!received)
+    {
+        return nullptr;
+    }
+
+    // The queue depth only drops here, so checking it before each 
+    // dequeue catches every peak.
+    uint32_t queueDepth = uxSemaphoreGetCount(taskQueueSemaphore_) + 1;
+    if (queueDepth > peakQueueDepth_)
+    {
+        peakQueueDepth_ = queueDepth;
+    }
+
     MessageEntry* entry = nullptr;
+    int receivedPriority = -1;
+
+    // Give lower priority queues that have been passed over too
+    // many times a chance first (lowest priority first).
+    for (int priority = NUM_MESSAGE_PRIORITIES - 1; priority > 0; priority--)
+    {
+        if (taskQueueSkips_[priority] >= MAX_TASK_QUEUE_SKIPS && 
+            xQueueReceive(taskQueues_[priority], &entry, 0) == pdTRUE)
+        {
+            receivedPriority = priority;
+            break;
+        }
+    }
+
+    // Otherwise, strict priority order.
+    for (int priority = 0; receivedPriority < 0 && priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        if (xQueueReceive(taskQueues_[priority], &entry, 0) == pdTRUE)
+        {
+            receivedPriority = priority;
+        }
+    }
+
+    // The semaphore is only given after a message is queued, so 
+    // there must always be one available.
+    assert(receivedPriority >= 0);
+    entry = resolveQueuedEntry_(entry);
 
-    if (xQueueReceive(taskQueue_, &entry, ticksRemaining) == pdTRUE)
+    taskQueueSkips_[receivedPriority] = 0;
+    for (int priority = receivedPriority + 1; priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        if (uxQueueMessagesWaiting(taskQueues_[priority]) > 0)
+        {
+            taskQueueSkips_[priority]++;
+        }
+    }
+
+    return entry;
+}
+
+bool DVTask::hasQueuedMessages_()
+{
+    for (int priority = 0; priority < NUM_MESSAGE_PRIORITIES; priority++)
+    {
+        if (uxQueueMessagesWaiting(taskQueues_[priority]) > 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DVTask::singleMessagingLoop_(int64_t ticksRemaining)
+{
+    MessageEntry* entry = receiveMessage_(ticksRemaining);
+
+    if (entry != nullptr)
     {
         //ESP_LOGI(taskName_.c_str(), "Received message %s:%ld", entry->eventBase, entry->eventId);
-        auto iterPair = eventRegistrationMap_.equal_range(std::make_pair(entry->eventBase, entry->eventId));
-        EventMap::iterator iter = iterPair.first;
-        while (iter != iterPair.second)
+        int64_t dequeueTimeUs = esp_timer_get_time();
+        beginBusyPeriod_(dequeueTimeUs);
+        sampleCore_();
+
+        uint32_t messageIndex = entry->messageIndex;
+        if (messageIndex < dispatchTable_.size())
+        {
+            dispatchDepth_++;
+
+            // Handlers may register or unregister other handlers (for example,
+            // when calling waitFor()), which can reallocate the handler list.
+            // We therefore re-fetch the list on each iteration instead of 
+            // holding onto iterators.
+            for (size_t handlerIndex = 0; handlerIndex < dispatchTable_[messageIndex].size(); handlerIndex++)
+            {
+                EventHandler handler = dispatchTable_[messageIndex][handlerIndex];
+                if (handler.fn != nullptr)
+                {
+                    (*handler.fn)(handler.storage, entry);
+                }
+            }
+
+            if (--dispatchDepth_ == 0 && dispatchTableDirty_)
+            {
+                compactDispatchTable_();
+            }
+
+            // Note: handler time for messages whose handlers wait for other 
+            // messages (e.g. via waitFor()) includes the time spent handling
+            // those messages.
+            int64_t handlerEndTimeUs = esp_timer_get_time();
+            recordMessageStatistics_(entry, dequeueTimeUs, handlerEndTimeUs);
+            endBusyPeriod_(handlerEndTimeUs);
+        }
+        else
+        {
+            endBusyPeriod_(esp_timer_get_time());
+        }
+
+        numMessagesHandled_++;
+
+        // Release message now that we're done with it.
+        ReleaseMessageEntry_(entry);
+    }
+}
+
+void DVTask::beginBusyPeriod_(int64_t nowUs)
+{
+    if (busyDepth_++ == 0)
+    {
+        busyStartUs_ = nowUs;
+        nestedWaitUs_ = 0;
+    }
+}
+
+void DVTask::endBusyPeriod_(int64_t nowUs)
+{
+    if (--busyDepth_ == 0)
+    {
+        portENTER_CRITICAL(&telemetryLock_);
+        busyTimeUs_ += nowUs - busyStartUs_ - nestedWaitUs_;
+        portEXIT_CRITICAL(&telemetryLock_);
+    }
+}
+
+void DVTask::sampleCore_()
+{
+    // Only tasks without affinity can migrate, but checking is cheap.
+    BaseType_t coreId = xPortGetCoreID();
+    BaseType_t lastCoreId = lastCoreId_;
+    if (coreId != lastCoreId)
+    {
+        if (lastCoreId >= 0)
+        {
+            numCoreMigrations_++;
+        }
+        lastCoreId_ = coreId;
+    }
+}
+
+void DVTask::sampleStack_(bool force)
+{
+    TickType_t now = xTaskGetTickCount();
+    if (!force && now - lastStackSampleTick_ < pdMS_TO_TICKS(STACK_SAMPLE_INTERVAL_MS))
+    {
+        return;
+    }
+    lastStackSampleTick_ = now;
+
+    uint32_t stackFree = uxTaskGetStackHighWaterMark(nullptr);
+    if (stackFree < minStackFree_)
+    {
+        minStackFree_ = stackFree;
+        ESP_LOGI(taskName_, "New stack high water mark of %" PRIu32, stackFree);
+    }
+}
+
+void DVTask::getTaskStatistics(TaskStatistics* stats)
+{
+    assert(stats != nullptr);
+
+    stats->sampleTimeUs = esp_timer_get_time();
+
+    portENTER_CRITICAL(&telemetryLock_);
+    stats->busyTimeUs = busyTimeUs_;
+    portEXIT_CRITICAL(&telemetryLock_);
+
+    stats->numMessagesHandled = numMessagesHandled_;
+    stats->numTicks = numTicks_;
+    stats->stackSize = taskStackSize_;
+    stats->minStackFree = minStackFree_;
+    stats->queueCapacity = taskQueueSize_ * NUM_MESSAGE_PRIORITIES;
+    stats->peakQueueDepth = peakQueueDepth_;
+    stats->numCoreMigrations = numCoreMigrations_;
+    stats->lastCoreId = lastCoreId_;
+}
+
+void DVTask::recordMessageStatistics_(MessageEntry* entry, int64_t dequeueTimeUs, int64_t handlerEndTimeUs)
+{
+    uint32_t messageIndex = entry->messageIndex;
+
+    if (messageStats_.size() <= messageIndex)
+    {
+        // Resizing may move entries, so readers must be locked out
+        // (and this can't be done inside a critical section anyway).
+        auto rv = xSemaphoreTake(messageStatsSemaphore_, portMAX_DELAY);
+        assert(rv == pdTRUE);
+        messageStats_.resize(messageIndex + 1);
+        xSemaphoreGive(messageStatsSemaphore_);
+    }
+
+    auto& stats = messageStats_[messageIndex];
+
+    portENTER_CRITICAL(&messageStatsLock_);
+    stats.eventBase = entry->eventBase;
+    stats.eventId = entry->eventId;
+    stats.queueWait.add(dequeueTimeUs - entry->enqueueTimeUs);
+    stats.handlerTime.add(handlerEndTimeUs - dequeueTimeUs);
+    portEXIT_CRITICAL(&messageStatsLock_);
+}
+
+void DVTask::getMessageStatistics(std::vector<MessageStatistics>& stats)
+{
+    stats.clear();
+
+    auto rv = xSemaphoreTake(messageStatsSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+
+    stats.reserve(messageStats_.size());
+    for (auto& messageStats : messageStats_)
+    {
+        MessageStatistics copy;
+
+        portENTER_CRITICAL(&messageStatsLock_);
+        copy = messageStats;
+        portEXIT_CRITICAL(&messageStatsLock_);
+
+        if (copy.queueWait.getCount() > 0)
         {
-            (*iter->second.first)(iter->second.second, entry->eventBase, entry->eventId, &entry);
-            iter++;
+            stats.push_back(copy);
         }
+    }
 
-        // Deallocate message now that we're done with it.
-        char* entryPtr = (char*)entry;
-        delete[] entryPtr;
+    xSemaphoreGive(messageStatsSemaphore_);
+}
+
+void DVTask::resetMessageStatistics()
+{
+    auto rv = xSemaphoreTake(messageStatsSemaphore_, pdMS_TO_TICKS(100));
+    assert(rv == pdTRUE);
+
+    for (auto& messageStats : messageStats_)
+    {
+        portENTER_CRITICAL(&messageStatsLock_);
+        messageStats.queueWait.reset();
+        messageStats.handlerTime.reset();
+        portEXIT_CRITICAL(&messageStatsLock_);
     }
+
+    xSemaphoreGive(messageStatsSemaphore_);
 }
 
 void DVTask::threadEntry_()
 {    
-    UBaseType_t stackWaterMark = INT_MAX;
+    sampleStack_(true);
     
     // Run in an infinite loop, continually waiting for messages
     // and processing them.
@@ -375,15 +1200,14 @@ void DVTask::threadEntry_()
                 ticksRemaining -= xTaskGetTickCount() - tasksBegin;
             }
 
+            beginBusyPeriod_(esp_timer_get_time());
+            sampleCore_();
             onTaskTick_();
+            endBusyPeriod_(esp_timer_get_time());
+            numTicks_++;
         }
         
-        UBaseType_t newStackWaterMark = uxTaskGetStackHighWaterMark(nullptr);
-        if (newStackWaterMark < stackWaterMark)
-        {
-            stackWaterMark = newStackWaterMark;
-            ESP_LOGI(taskName_, "New stack high water mark of %d", newStackWaterMark);
-        }
+        sampleStack_(false);
     }
 }
 
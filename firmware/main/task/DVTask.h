@@ -18,8 +18,12 @@
 #ifndef DV_TASK_H
 #define DV_TASK_H
 
+#include <algorithm>
+#include <cstddef>
 #include <map>
 #include <deque>
+#include <vector>
+#include <atomic>
 #include <functional>
 
 #include "esp_log.h"
@@ -30,6 +34,21 @@
 #include "freertos/semphr.h"
 
 #include "DVTaskControlMessage.h"
+#include "DVMessagePool.h"
+#include "DVLatencyHistogram.h"
+
+// Message pool size classes. Sizes include the MessageEntry header (see
+// DVTask::GetQueuedMessageSize()), which is 40 bytes on the ESP32. The
+// smallest class fits messages with no payload of their own (timer fires,
+// audio data notifications), which make up the vast majority of traffic,
+// so it gets the most blocks. State updates and the like use the medium class.
+#define NUM_MESSAGE_POOLS (3)
+#define SMALL_MESSAGE_POOL_BLOCK_SIZE (48)
+#define SMALL_MESSAGE_POOL_NUM_BLOCKS (256)
+#define MEDIUM_MESSAGE_POOL_BLOCK_SIZE (96)
+#define MEDIUM_MESSAGE_POOL_NUM_BLOCKS (64)
+#define LARGE_MESSAGE_POOL_BLOCK_SIZE (256)
+#define LARGE_MESSAGE_POOL_NUM_BLOCKS (16)
 
 using namespace std::placeholders;
 
@@ -50,7 +69,7 @@ public:
     /// @param taskPriority The task's priority.
     /// @param taskStackSize The task's stack size.
     /// @param pinnedCoreId  The core that the task should be pinned to (tskNO_AFFINITY to disable).
-    /// @param taskQueueSize The maximum number of events that can be queued up at a time.
+    /// @param taskQueueSize The maximum number of events that can be queued up at a time (per priority).
     /// @param taskTick The amount of time to wait for messages before running "tick" method.
     DVTask(const char* taskName, UBaseType_t taskPriority, uint32_t taskStackSize, BaseType_t pinnedCoreId, int32_t taskQueueSize, TickType_t taskTick = portMAX_DELAY);
 
@@ -74,9 +93,10 @@ public:
     /// @param message The message to post to the task.
     void postISR(DVTaskMessage* message);
 
-    /// @brief Posts a message to own event queue (from timer).
+    /// @brief Posts a message to own event queue (from timer). Never blocks.
     /// @param message The message to post to the task.
-    void postTimer(DVTaskMessage* message);
+    /// @return false if the task is asleep or its queue is full.
+    bool postTimer(DVTaskMessage* message);
 
     /// @brief Posts a message to destination's event queue.
     /// @param destination The destination task to send the event to.
@@ -116,8 +136,107 @@ public:
     /// @return true if the task is awake, false otherwise.
     bool isAwake() const { return taskObject_ != nullptr; }
 
+    /// @brief Determines whether the caller is running on this task.
+    /// @return true if called from this task's own thread, false otherwise.
+    bool isCurrentTask() const { return taskObject_ != nullptr && xTaskGetCurrentTaskHandle() == taskObject_; }
+
     /// @brief Static initializer, required before using DVTask.
     static void Initialize();
+
+    /// @brief Returns the number of message pools used for queued messages.
+    static int GetNumMessagePools();
+
+    /// @brief Returns the number of bytes a queued copy of a message takes up, i.e.
+    ///        the block size needed to allocate it from one of the message pools.
+    /// @param messageSize The size of the message (per DVTaskMessage::getSize()).
+    static constexpr uint32_t GetQueuedMessageSize(uint32_t messageSize)
+    {
+        // The message starts right after the header rather than after any
+        // padding at the end of MessageEntry.
+        return std::max<uint32_t>(offsetof(MessageEntry, messageStart) + messageSize, sizeof(MessageEntry));
+    }
+
+    /// @brief Retrieves usage statistics for the given message pool.
+    /// @param index The index of the pool (0 to GetNumMessagePools() - 1).
+    /// @param stats The structure to fill in.
+    static void GetMessagePoolStatistics(int index, DVMessagePool::Statistics* stats);
+
+    /// @brief Returns the number of queued messages that had to be allocated from the heap
+    ///        (i.e. too large for any pool or all suitable pools were exhausted).
+    static uint32_t GetNumHeapMessageAllocations() { return NumHeapMessageAllocations_; }
+
+    /// @brief Returns the number of queued message copies created since startup.
+    static uint32_t GetNumMessageCopies() { return NumMessageCopies_; }
+
+    /// @brief Returns the number of bytes copied into queued messages since startup.
+    static uint32_t GetNumMessageBytesCopied() { return NumMessageBytesCopied_; }
+
+    /// @brief Returns the number of messages delivered to task queues via publish().
+    static uint32_t GetNumPublishDeliveries() { return NumPublishDeliveries_; }
+
+    /// @brief Latency statistics for a single message type handled by a task.
+    struct MessageStatistics
+    {
+        DVEventBaseType eventBase;
+        int32_t eventId;
+
+        /// @brief Time between the message being queued and the task starting to handle it.
+        DVLatencyHistogram queueWait;
+
+        /// @brief Time spent in all of the task's handlers for the message.
+        DVLatencyHistogram handlerTime;
+    };
+
+    /// @brief Returns the friendly name of the task.
+    const char* getName() const { return taskName_; }
+
+    /// @brief Returns the core the task is pinned to (or tskNO_AFFINITY).
+    BaseType_t getPinnedCoreId() const { return pinnedCoreId_; }
+
+    /// @brief Retrieves latency statistics for each message type this task has handled.
+    /// @param stats The vector to fill in. Existing contents are replaced.
+    void getMessageStatistics(std::vector<MessageStatistics>& stats);
+
+    /// @brief Clears the task's latency statistics.
+    void resetMessageStatistics();
+
+    /// @brief Counts of messages affected by each overflow policy.
+    struct OverflowStatistics
+    {
+        uint32_t numBlocked; // OVERFLOW_BLOCK messages that had to wait for space
+        uint32_t numBlockTimeouts; // OVERFLOW_BLOCK messages dropped after waiting
+        uint32_t numDroppedNewest; // messages dropped because there was no space for them
+        uint32_t numDroppedOldest; // queued messages dropped to make room for newer ones
+        uint32_t numCoalesced; // queued messages replaced by a newer copy
+    };
+
+    /// @brief Retrieves the task's overflow policy statistics.
+    void getOverflowStatistics(OverflowStatistics* stats) const;
+
+    /// @brief Runtime telemetry for a task. Counters are cumulative since the task 
+    ///        was created; readers compute rates from the difference between samples.
+    struct TaskStatistics
+    {
+        int64_t sampleTimeUs; // esp_timer_get_time() when these statistics were retrieved
+        uint64_t busyTimeUs; // time spent in handlers and onTaskTick_(), excluding time blocked waiting for messages
+        uint32_t numMessagesHandled;
+        uint32_t numTicks;
+        uint32_t stackSize;
+        uint32_t minStackFree; // smallest amount of stack ever left unused (UINT32_MAX if not sampled yet)
+        uint32_t queueCapacity; // total capacity across all priority lanes
+        uint32_t peakQueueDepth; // most messages ever waiting at once across all priority lanes
+        uint32_t numCoreMigrations; // times the task was seen running on a different core than before
+        BaseType_t lastCoreId; // core the task last handled a message or tick on (-1 if none yet)
+    };
+
+    /// @brief Retrieves the task's runtime telemetry. Safe to call from any task.
+    /// @note Busy time is measured using esp_timer_get_time() and therefore also includes
+    ///       time the task was preempted by higher priority tasks.
+    void getTaskStatistics(TaskStatistics* stats);
+
+    /// @brief Retrieves all tasks that currently exist.
+    /// @param tasks The vector to fill in. Existing contents are replaced.
+    static void GetAllTasks(std::vector<DVTask*>& tasks);
 protected:
     virtual void onTaskStart_(DVTask* origin, TaskStartMessage* message);
     virtual void onTaskSleep_(DVTask* origin, TaskSleepMessage* message);
@@ -139,35 +258,68 @@ protected:
     void sleep(DVTask* taskToSleep, TickType_t ticksToWait = 0);
     
 private:
+    struct MessageEntry;
+
     // Non-template base class to help handle std::function cleanup
     class FnPtrStorage
     {
     public:
         virtual ~FnPtrStorage() = default;
 
+        // The dispatch table slot this handler is registered in.
+        uint32_t messageIndex;
+
     protected:
         FnPtrStorage() = default; // not intended to be called by others
     };
 
-    using EventHandlerFn = void(*)(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data);
-    using EventIdentifierPair = std::pair<DVEventBaseType, int32_t>;
-    using EventMap = std::multimap<EventIdentifierPair, std::pair<EventHandlerFn, FnPtrStorage*>>;
-    using PublishMap = std::multimap<EventIdentifierPair, DVTask*>;
+    using EventHandlerFn = void(*)(FnPtrStorage* storage, MessageEntry* entry);
 
-    template<typename MessageType>
-    class MessageHandler : public FnPtrStorage
+    struct EventHandler
+    {
+        EventHandlerFn fn; // nullptr if unregistered during dispatch
+        FnPtrStorage* storage;
+    };
+
+    // Handlers for each message type, indexed by message index.
+    using DispatchTable = std::vector<std::vector<EventHandler>>;
+
+    // Subscribing tasks (and number of handlers in each) by message index.
+    using PublishMap = std::map<uint32_t, std::map<DVTask*, int>>;
+
+    // Immutable snapshot of PublishMap used by publish(). Indexed by
+    // message index, with each message's subscribing tasks stored 
+    // contiguously. A new snapshot is built every time the set of 
+    // subscriptions changes; readers hold a reference while using it
+    // so that it's never freed out from under them.
+    class SubscriberIndex
     {
     public:
-        virtual ~MessageHandler() = default;
+        struct Entry
+        {
+            uint32_t firstTask;
+            uint32_t numTasks;
+        };
 
-        virtual void call(DVTask* origin, MessageType* message) = 0;
+        SubscriberIndex(const PublishMap& subscribers);
 
-    protected:
-        MessageHandler() = default; // not intended to be called by others
+        /// @brief Finds the tasks subscribing to the given message type.
+        /// @param messageIndex The message index to look up.
+        /// @param numTasks The number of tasks found.
+        /// @return Pointer to the first subscribing task, or nullptr if there aren't any.
+        DVTask* const* find(uint32_t messageIndex, uint32_t* numTasks) const;
+
+        std::atomic<uint32_t> refCount;
+
+    private:
+        std::vector<Entry> entries_;
+        std::vector<DVTask*> tasks_;
     };
 
+    // Note: handler storage classes are final so that HandleEvent_ can
+    // call them directly instead of through the vtable.
     template<typename MessageType>
-    class MessageFnObjStorage : public MessageHandler<MessageType>
+    class MessageFnObjStorage final : public FnPtrStorage
     {
     public:
         MessageFnObjStorage(std::function<void(DVTask*, MessageType*)>* ptrProvided)
@@ -181,7 +333,7 @@ private:
             delete ptr_;
         }
 
-        virtual void call(DVTask* origin, MessageType* message) override 
+        void call(DVTask* origin, MessageType* message)
         {
             (*ptr_)(origin, message);
         }
@@ -191,7 +343,7 @@ private:
     };
 
     template<typename ClassObj, typename MessageType>
-    class MessageFnPtrStorage : public MessageHandler<MessageType>
+    class MessageFnPtrStorage final : public FnPtrStorage
     {
     public:
         MessageFnPtrStorage(ClassObj* classObj, void (ClassObj::*fn)(DVTask* origin, MessageType* msg))
@@ -203,7 +355,7 @@ private:
 
         virtual ~MessageFnPtrStorage() = default;
 
-        virtual void call(DVTask* origin, MessageType* message) override 
+        void call(DVTask* origin, MessageType* message)
         {
             (classObj_->*fn_)(origin, message);
         }
@@ -213,14 +365,22 @@ private:
         void (ClassObj::*fn_)(DVTask* origin, MessageType* msg);
     };
 
-    // Structure to help encode messages for queuing.
+    // Structure to help encode messages for queuing. A single entry may
+    // be shared between several task queues (i.e. when published); it's
+    // treated as immutable once queued and freed when the last task
+    // finishes handling it.
     struct MessageEntry
     {
+        int64_t enqueueTimeUs;
         DVEventBaseType eventBase;
         int32_t eventId;
+        uint32_t messageIndex;
+        DVTaskMessagePriority priority;
+        DVTaskMessageOverflowPolicy overflowPolicy;
 
         DVTask* origin;
         uint32_t size;
+        std::atomic<uint32_t> refCount;
         char messageStart; // Placeholder to help write to correct memory location.
     };
     
@@ -244,20 +404,80 @@ private:
     const char* taskName_;
 
     TaskHandle_t taskObject_;
-    EventMap eventRegistrationMap_;
+    DispatchTable dispatchTable_;
+    int dispatchDepth_;
+    bool dispatchTableDirty_;
 
     int32_t taskQueueSize_;
     int32_t taskStackSize_;
     UBaseType_t taskPriority_;
     BaseType_t pinnedCoreId_;
-    QueueHandle_t taskQueue_;
+
+    // One queue per message priority. taskQueueSemaphore_ counts the 
+    // total number of queued messages so that we can block on all of 
+    // the queues at once.
+    QueueHandle_t taskQueues_[NUM_MESSAGE_PRIORITIES];
+    SemaphoreHandle_t taskQueueSemaphore_;
+
+    // Number of messages handled from higher priority queues while 
+    // the given queue had messages waiting.
+    uint32_t taskQueueSkips_[NUM_MESSAGE_PRIORITIES];
+
+    // Pending OVERFLOW_COALESCE_LATEST messages. Only a token identifying
+    // the slot is queued; whoever dequeues the token takes the latest 
+    // entry from the slot. Slots are permanently assigned to a message
+    // type the first time it's posted.
+    struct CoalesceSlot
+    {
+        uint32_t messageIndex;
+        MessageEntry* entry;
+    };
+    static constexpr int NUM_COALESCE_SLOTS = 8;
+    CoalesceSlot coalesceSlots_[NUM_COALESCE_SLOTS];
+    SemaphoreHandle_t coalesceSemaphore_;
+
+    std::atomic<uint32_t> numBlocked_;
+    std::atomic<uint32_t> numBlockTimeouts_;
+    std::atomic<uint32_t> numDroppedNewest_;
+    std::atomic<uint32_t> numDroppedOldest_;
+    std::atomic<uint32_t> numCoalesced_;
     
     TickType_t taskTick_;
 
-    MessageEntry* createMessageEntry_(DVTask* origin, DVTaskMessage* message);
+    // Telemetry. busyTimeUs_ is protected by telemetryLock_ as 64-bit
+    // accesses aren't atomic; the remaining bookkeeping fields are only 
+    // used by the task itself.
+    uint64_t busyTimeUs_;
+    portMUX_TYPE telemetryLock_;
+    std::atomic<uint32_t> numMessagesHandled_;
+    std::atomic<uint32_t> numTicks_;
+    std::atomic<uint32_t> minStackFree_;
+    std::atomic<uint32_t> peakQueueDepth_;
+    std::atomic<uint32_t> numCoreMigrations_;
+    std::atomic<BaseType_t> lastCoreId_;
+    int busyDepth_;
+    int64_t busyStartUs_;
+    int64_t nestedWaitUs_;
+    TickType_t lastStackSampleTick_;
+
+    // Latency statistics by message index. Only the task itself updates
+    // or resizes this; resizing is done while holding messageStatsSemaphore_
+    // and entries are updated while holding messageStatsLock_.
+    std::vector<MessageStatistics> messageStats_;
+    SemaphoreHandle_t messageStatsSemaphore_;
+    portMUX_TYPE messageStatsLock_;
+
+    MessageEntry* createMessageEntry_(DVTask* origin, DVTaskMessage* message, uint32_t refCount = 1);
+    static void ReleaseMessageEntry_(MessageEntry* entry);
 
     void threadEntry_();
-    void postHelper_(MessageEntry* entry);
+    void postHelper_(MessageEntry* entry, bool toFront = false);
+    bool sendToQueue_(QueueHandle_t queue, MessageEntry* entry, TickType_t ticksToWait, bool toFront);
+    void enqueueWithBlock_(QueueHandle_t queue, MessageEntry* entry, bool toFront);
+    void enqueueWithDropOldest_(QueueHandle_t queue, MessageEntry* entry, bool toFront);
+    void enqueueWithCoalesce_(QueueHandle_t queue, MessageEntry* entry, bool toFront);
+    MessageEntry* resolveQueuedEntry_(MessageEntry* queuedEntry);
+    void dropEntry_(MessageEntry* entry);
     
     void startTask_();
 
@@ -265,16 +485,55 @@ private:
     void waitForOurs_(DVTask* taskToWaitFor, TickType_t ticksToWait);
     
     void singleMessagingLoop_(int64_t ticksRemaining);
+    MessageEntry* receiveMessage_(int64_t ticksRemaining);
+    bool hasQueuedMessages_();
     
     void onTaskQueueMessage_(DVTask* origin, TaskQueueMessage* message);
+
+    void recordMessageStatistics_(MessageEntry* entry, int64_t dequeueTimeUs, int64_t handlerEndTimeUs);
+
+    // Busy periods nest (e.g. waitFor() inside a handler) and only the
+    // outermost one is counted, minus time spent blocked inside it.
+    void beginBusyPeriod_(int64_t nowUs);
+    void endBusyPeriod_(int64_t nowUs);
+    void sampleCore_();
+    void sampleStack_(bool force);
+
+    template<typename MessageType, typename StorageType>
+    MessageHandlerHandle addMessageHandler_(StorageType* storage);
+
+    void compactDispatchTable_();
+
+    void subscribe_(uint32_t messageIndex);
+    void unsubscribe_(uint32_t messageIndex);
     
+    // Master list of subscriptions, only accessed while holding 
+    // SubscriberTasksByMessageTypeSemaphore_.
     static PublishMap SubscriberTasksByMessageType_;
     static SemaphoreHandle_t SubscriberTasksByMessageTypeSemaphore_;
 
+    // Current snapshot of the above for use by publish(). The spinlock only
+    // protects swapping the pointer and taking a reference to it.
+    static SubscriberIndex* CurrentSubscriberIndex_;
+    static portMUX_TYPE CurrentSubscriberIndexLock_;
+
+    static void UpdateSubscriberIndex_();
+    static SubscriberIndex* AcquireSubscriberIndex_();
+    static void ReleaseSubscriberIndex_(SubscriberIndex* index);
+
+    static DVMessagePool* MessagePools_[];
+    static std::atomic<uint32_t> NumHeapMessageAllocations_;
+    static std::atomic<uint32_t> NumMessageCopies_;
+    static std::atomic<uint32_t> NumMessageBytesCopied_;
+    static std::atomic<uint32_t> NumPublishDeliveries_;
+
+    static std::vector<DVTask*> AllTasks_;
+    static SemaphoreHandle_t AllTasksSemaphore_;
+
     static void ThreadEntry_(DVTask* thisObj);
 
-    template<typename MessageType>
-    static void HandleEvent_(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data);
+    template<typename StorageType, typename MessageType>
+    static void HandleEvent_(FnPtrStorage* storage, MessageEntry* entry);
 };
 
 template<typename MessageType>
@@ -286,22 +545,7 @@ DVTask::MessageHandlerHandle DVTask::registerMessageHandler(std::function<void(D
     MessageFnObjStorage<MessageType>* fnPtrStorage = new MessageFnObjStorage<MessageType>(fnPtr);
     assert(fnPtrStorage != nullptr);
 
-    // Register task specific handler.
-    MessageType tmpMessage;
-    auto key = std::make_pair(tmpMessage.getEventBase(), tmpMessage.getEventType());
-    auto val = std::make_pair((EventHandlerFn)&HandleEvent_<MessageType>, (FnPtrStorage*)fnPtrStorage);
-    eventRegistrationMap_.insert(
-        std::make_pair(key, val)        
-    );
-
-    // Register for use by publish.
-    xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    SubscriberTasksByMessageType_.insert(
-        std::make_pair(key, this)
-    );
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
-    
-    return fnPtrStorage;
+    return addMessageHandler_<MessageType>(fnPtrStorage);
 }
 
 template<typename MessageType, typename ObjType>
@@ -310,32 +554,35 @@ DVTask::MessageHandlerHandle DVTask::registerMessageHandler(ObjType* taskObj, vo
     MessageFnPtrStorage<ObjType, MessageType>* fnPtrStorage = new MessageFnPtrStorage<ObjType, MessageType>(taskObj, handler);
     assert(fnPtrStorage != nullptr);
 
+    return addMessageHandler_<MessageType>(fnPtrStorage);
+}
+
+template<typename MessageType, typename StorageType>
+DVTask::MessageHandlerHandle DVTask::addMessageHandler_(StorageType* storage)
+{
     // Register task specific handler.
-    MessageType tmpMessage;
-    auto key = std::make_pair(tmpMessage.getEventBase(), tmpMessage.getEventType());
-    auto val = std::make_pair((EventHandlerFn)&HandleEvent_<MessageType>, (FnPtrStorage*)fnPtrStorage);
-    eventRegistrationMap_.insert(
-        std::make_pair(key, val)        
-    );
+    uint32_t messageIndex = MessageType::GetMessageIndex();
+    storage->messageIndex = messageIndex;
+
+    if (dispatchTable_.size() <= messageIndex)
+    {
+        dispatchTable_.resize(messageIndex + 1);
+    }
+
+    EventHandler handler = { &HandleEvent_<StorageType, MessageType>, storage };
+    dispatchTable_[messageIndex].push_back(handler);
 
     // Register for use by publish.
-    xSemaphoreTake(SubscriberTasksByMessageTypeSemaphore_, pdMS_TO_TICKS(100));
-    SubscriberTasksByMessageType_.insert(
-        std::make_pair(key, this)
-    );
-    xSemaphoreGive(SubscriberTasksByMessageTypeSemaphore_);
-    
-    return fnPtrStorage;
+    subscribe_(messageIndex);
+
+    return storage;
 }
 
-template<typename MessageType>
-void DVTask::HandleEvent_(void *event_handler_arg, DVEventBaseType event_base, int32_t event_id, void *event_data)
+template<typename StorageType, typename MessageType>
+void DVTask::HandleEvent_(FnPtrStorage* storage, MessageEntry* entry)
 {
-    MessageHandler<MessageType>* fnPtrStorage = (MessageHandler<MessageType>*)event_handler_arg;
-    
-    MessageEntry* entry = *(MessageEntry**)event_data;
     MessageType* message = (MessageType*)&entry->messageStart;
-    fnPtrStorage->call(entry->origin, message);
+    static_cast<StorageType*>(storage)->call(entry->origin, message);
 }
 
 template<typename ResultMessageType>
@@ -0,0 +1,42 @@
+/* 
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+
+#include "DVTaskMessage.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+static std::atomic<uint32_t> NumMessageIndices_(0);
+
+uint32_t DVTaskMessage::GetNumMessageIndices()
+{
+    return NumMessageIndices_;
+}
+
+uint32_t DVTaskMessage::AllocateMessageIndex_()
+{
+    return NumMessageIndices_++;
+}
+
+}
+
+}
@@ -31,6 +31,27 @@ namespace ezdv
 namespace task
 {
 
+/// @brief Determines which of a task's queue lanes a message is delivered through.
+///        Lanes are drained in order of priority (i.e. PRIORITY_REALTIME first).
+enum DVTaskMessagePriority
+{
+    PRIORITY_REALTIME = 0, // audio data and timers
+    PRIORITY_CONTROL = 1, // state changes, user input and everything else
+    PRIORITY_BACKGROUND = 2, // settings and reporting
+    
+    NUM_MESSAGE_PRIORITIES
+};
+
+/// @brief Determines what happens when a message is posted to a task whose
+///        queue (for the message's priority) is full.
+enum DVTaskMessageOverflowPolicy
+{
+    OVERFLOW_BLOCK = 0, // wait up to 100ms for space, then drop the message
+    OVERFLOW_DROP_NEWEST = 1, // drop the message being posted
+    OVERFLOW_DROP_OLDEST = 2, // drop the oldest queued message if it also allows it
+    OVERFLOW_COALESCE_LATEST = 3, // keep only the most recent queued copy (regardless of queue usage)
+};
+
 class DVTaskMessage
 {
 public:
@@ -40,9 +61,30 @@ public:
     virtual uint32_t getSize() const = 0;
     virtual DVEventBaseType getEventBase() const = 0;
     virtual int32_t getEventType() const = 0;
+    virtual DVTaskMessagePriority getPriority() const = 0;
+    virtual DVTaskMessageOverflowPolicy getOverflowPolicy() const = 0;
+
+    /// @brief Called on the queued copy of a message if it's dropped (or coalesced
+    ///        away) instead of being handled. Messages that own resources (and
+    ///        thus must only be sent to one task) should free them here.
+    virtual void onDropped() { }
+
+    /// @brief Returns the dense index of this message's type. Used by DVTask 
+    ///        to look up handlers without needing to search.
+    virtual uint32_t getMessageIndex() const = 0;
+
+    /// @brief Returns the number of message types that have been assigned an index.
+    static uint32_t GetNumMessageIndices();
+
+protected:
+    static uint32_t AllocateMessageIndex_();
 };
 
-template<uint32_t EVENT_TYPE_ID, typename MessageType>
+template<
+    uint32_t EVENT_TYPE_ID, 
+    typename MessageType, 
+    DVTaskMessagePriority PRIORITY = PRIORITY_CONTROL, 
+    DVTaskMessageOverflowPolicy OVERFLOW_POLICY = OVERFLOW_BLOCK>
 class DVTaskMessageBase : public DVTaskMessage
 {
 public:
@@ -63,12 +105,36 @@ public:
     {
         return EVENT_TYPE_ID;
     }
+
+    virtual DVTaskMessagePriority getPriority() const override
+    {
+        return PRIORITY;
+    }
+
+    virtual DVTaskMessageOverflowPolicy getOverflowPolicy() const override
+    {
+        return OVERFLOW_POLICY;
+    }
     
     virtual uint32_t getSize() const override
     {
         return sizeof(MessageType);
     }
 
+    virtual uint32_t getMessageIndex() const override
+    {
+        return GetMessageIndex();
+    }
+
+    /// @brief Returns the dense index assigned to MessageType. Indices are
+    ///        handed out sequentially starting at 0 the first time each 
+    ///        message type is used.
+    static uint32_t GetMessageIndex()
+    {
+        static const uint32_t index = DVTaskMessage::AllocateMessageIndex_();
+        return index;
+    }
+
 private:
     const DVEventBaseType base_;
 };
@@ -16,6 +16,7 @@
  */
 
 #include "DVTimer.h"
+#include "DVTimerWheel.h"
 
 extern "C"
 {
@@ -37,104 +38,66 @@ DVTimer::DVTimer(DVTask* owner, TimerHandlerFn fn, uint64_t intervalInMicrosecon
     fn_ = new TimerHandlerFnForwarder(fn);
     assert(fn_ != nullptr);
     
-    esp_timer_create_args_t args = {
-        .callback = &OnESPTimerFire_,
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "DVTimer",
-        .skip_unhandled_events = true,
-    };
-    
-    if (timerName != nullptr)
-    {
-        args.name = timerName;
-    }
-    
-    ESP_ERROR_CHECK(
-        esp_timer_create(
-            &args, &timerHandle_
-        )
-    );
-    
-    owner->registerMessageHandler(this, &DVTimer::onTimerFire_);
+    initialize_(timerName);
 }
 
 DVTimer::~DVTimer()
 {
     stop();
-    
-    ESP_ERROR_CHECK(
-        esp_timer_delete(timerHandle_)
-    );
+    wheel_->unregisterTimer_(this);
 
     delete fn_;
 }
 
-void DVTimer::changeInterval(uint64_t intervalInMicroseconds)
+void DVTimer::initialize_(const char* timerName)
 {
-    bool isRunning = running_;
-
-    if (isRunning)
-    {
-        stop();
-    }
-
-    intervalInMicroseconds_ = intervalInMicroseconds;
-
-    if (isRunning)
-    {
-        start(once_);
-    }
+    assert(owner_ != nullptr);
+
+    name_ = timerName != nullptr ? timerName : "DVTimer";
+    currentDeadlineUs_ = 0;
+    currentMissedPeriods_ = 0;
+    expiryUs_ = 0;
+    missedPeriods_ = 0;
+    wheelNext_ = nullptr;
+    wheelPrev_ = nullptr;
+    wheelLevel_ = -1;
+    wheelSlot_ = -1;
+    fired_ = false;
+    firedDeadlineUs_ = 0;
+    firedMissedPeriods_ = 0;
+    firedNext_ = nullptr;
+
+    wheel_ = DVTimerWheel::Get(owner_->getPinnedCoreId());
+    wheel_->registerTimer_(this);
 }
 
-void DVTimer::start(bool once)
+// running_ is also cleared by the wheel when a one-shot timer expires,
+// so it's only ever checked with the wheel's lock held.
+void DVTimer::changeInterval(uint64_t intervalInMicroseconds)
 {
-    if (!running_)
-    {
-        if (once)
-        {
-            once_ = true;
-            ESP_ERROR_CHECK(esp_timer_start_once(timerHandle_, intervalInMicroseconds_));
-        }
-        else
-        {
-            ESP_ERROR_CHECK(esp_timer_start_periodic(timerHandle_, intervalInMicroseconds_));
-        }
-        
-        running_ = true;
-    }
+    wheel_->changeTimerInterval_(this, intervalInMicroseconds);
 }
 
-void DVTimer::stop()
+void DVTimer::start(bool once)
 {
-    if (running_)
-    {
-        ESP_ERROR_CHECK(esp_timer_stop(timerHandle_));
-        running_ = false;
-        once_ = false;
-    }
+    wheel_->startTimer_(this, once);
 }
 
-void DVTimer::onTimerFire_(DVTask* origin, TimerFireMessage* message)
+void DVTimer::stop()
 {
-    if (message->timer == this)
-    {
-        fn_->call(this);
-    }
+    wheel_->stopTimer_(this);
 }
 
-void DVTimer::OnESPTimerFire_(void* ptr)
+void DVTimer::OnTimerFire_(DVTask* owner)
 {
-    DVTimer* obj = (DVTimer*)ptr;
-    
-    if (obj->once_)
+    // Timers are taken one at a time as a handler may stop or destroy
+    // other timers that have also fired, which removes their expirations.
+    DVTimerWheel* wheel = DVTimerWheel::Get(owner->getPinnedCoreId());
+    DVTimer* timer;
+    while ((timer = wheel->takeFiredTimer_(owner)) != nullptr)
     {
-        obj->once_ = false;
-        obj->running_ = false;
+        timer->fn_->call(timer);
     }
-
-    TimerFireMessage message(obj);
-    obj->owner_->postTimer(&message);
 }
 
 }
@@ -23,7 +23,6 @@
 
 #include "DVTask.h"
 
-#include "esp_timer.h"
 #include "esp_log.h"
 
 // Shared across all files as this is actually used pretty often.
@@ -40,7 +39,14 @@ namespace ezdv
 namespace task
 {
 
+class DVTimerWheel;
+
 /// @brief Represents a timer in the application.
+///
+/// Timers are driven by the DVTimerWheel for the owner's core and fire
+/// in the owner's context. Expirations still queued when a timer is
+/// stopped or destroyed are ignored, but a timer must not be destroyed
+/// from another task while its owner may be running its handler.
 class DVTimer
 {
 public:
@@ -57,17 +63,37 @@ public:
     void stop();
 
     void changeInterval(uint64_t intervalInMicroseconds);
+
+    const char* getName() const { return name_; }
+
+    /// @brief Returns the time (per esp_timer_get_time()) that the expiration currently
+    ///        being handled was scheduled for. Periodic deadlines are anchored to the
+    ///        time start() was called and are always exact multiples of the interval
+    ///        from it, regardless of how late previous expirations were handled.
+    uint64_t getDeadlineUs() const { return currentDeadlineUs_; }
+
+    /// @brief Returns the number of periods skipped immediately before the expiration
+    ///        currently being handled because the timer was running too far behind.
+    uint32_t getMissedPeriods() const { return currentMissedPeriods_; }
+
+    /// @brief Returns the number of periods the expiration currently being handled
+    ///        accounts for (i.e. 1 + getMissedPeriods()). Periodic consumers should
+    ///        do this many periods' worth of work to keep up.
+    uint32_t getPeriodsDue() const { return currentMissedPeriods_ + 1; }
     
 private:
-    class TimerFireMessage : public DVTaskMessageBase<1, TimerFireMessage>
+    friend class DVTimerWheel;
+
+    /// @brief Tells the owner that it has expirations waiting in its wheel.
+    ///        The expirations themselves stay with the wheel so that this
+    ///        fits in the smallest message pool, and the wheel doesn't post
+    ///        another one until the owner has taken them.
+    class TimerFireMessage : public DVTaskMessageBase<1, TimerFireMessage, PRIORITY_REALTIME, OVERFLOW_DROP_NEWEST>
     {
     public:
-        TimerFireMessage(DVTimer* timerProvided = nullptr)
-            : DVTaskMessageBase<1, TimerFireMessage>(DV_TASK_TIMER_MESSAGE)
-            , timer(timerProvided) { }
+        TimerFireMessage()
+            : DVTaskMessageBase<1, TimerFireMessage, PRIORITY_REALTIME, OVERFLOW_DROP_NEWEST>(DV_TASK_TIMER_MESSAGE) { }
         virtual ~TimerFireMessage() = default;
-        
-        DVTimer* timer;
     };
 
     class TimerHandler
@@ -129,11 +155,31 @@ private:
     uint64_t intervalInMicroseconds_;
     bool running_;
     bool once_;
-    esp_timer_handle_t timerHandle_;
+    const char* name_;
+
+    // Details of the expiration currently being handled.
+    uint64_t currentDeadlineUs_;
+    uint32_t currentMissedPeriods_;
+
+    // Wheel state, owned by wheel_ and protected by its lock.
+    DVTimerWheel* wheel_;
+    uint64_t expiryUs_;
+    uint32_t missedPeriods_; // skipped since the last expiration
+    DVTimer* wheelNext_;
+    DVTimer* wheelPrev_;
+    int wheelLevel_; // -1 if not currently in the wheel
+    int wheelSlot_;
+
+    // Expiration waiting for the owner to handle it, also owned by wheel_.
+    // Later expirations are folded into it until it's handled.
+    bool fired_;
+    uint64_t firedDeadlineUs_;
+    uint32_t firedMissedPeriods_;
+    DVTimer* firedNext_; // next in the owner's list of fired timers
+
+    void initialize_(const char* timerName);
     
-    void onTimerFire_(DVTask* origin, TimerFireMessage* message);
-    
-    static void OnESPTimerFire_(void* ptr);
+    static void OnTimerFire_(DVTask* owner);
 };
 
 template<typename ClassObj>
@@ -146,26 +192,7 @@ DVTimer::DVTimer(DVTask* owner, ClassObj* classObj, void (ClassObj::*fn)(DVTimer
     fn_ = new TimerHandlerForwarder<ClassObj>(classObj, fn);
     assert(fn_ != nullptr);
 
-    esp_timer_create_args_t args = {
-        .callback = &OnESPTimerFire_,
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "DVTimer",
-        .skip_unhandled_events = true,
-    };
-    
-    if (timerName != nullptr)
-    {
-        args.name = timerName;
-    }
-    
-    ESP_ERROR_CHECK(
-        esp_timer_create(
-            &args, &timerHandle_
-        )
-    );
-    
-    owner->registerMessageHandler(this, &DVTimer::onTimerFire_);
+    initialize_(timerName);
 }
 
 }
@@ -0,0 +1,718 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "DVTimerWheel.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+DVTimerWheel* DVTimerWheel::Wheels_[portNUM_PROCESSORS];
+
+void DVTimerWheel::Initialize()
+{
+    for (int index = 0; index < portNUM_PROCESSORS; index++)
+    {
+        Wheels_[index] = new DVTimerWheel(index);
+        assert(Wheels_[index] != nullptr);
+    }
+}
+
+DVTimerWheel* DVTimerWheel::Get(BaseType_t coreId)
+{
+    if (coreId < 0 || coreId >= portNUM_PROCESSORS)
+    {
+        // Unpinned tasks share core 0's wheel.
+        coreId = 0;
+    }
+
+    assert(Wheels_[coreId] != nullptr);
+    return Wheels_[coreId];
+}
+
+void DVTimerWheel::RemoveOwner(DVTask* owner)
+{
+    // The owner's handlers are released by ~DVTask() itself.
+    DVTimerWheel* wheel = Get(owner->getPinnedCoreId());
+
+    xSemaphoreTake(wheel->semaphore_, portMAX_DELAY);
+    wheel->owners_.erase(owner);
+    xSemaphoreGive(wheel->semaphore_);
+}
+
+DVTimerWheel::DVTimerWheel(int coreId)
+    : armedUs_(UINT64_MAX)
+    , retryUs_(UINT64_MAX)
+    , numTimers_(0)
+    , numWakeups_(0)
+    , numExpirations_(0)
+    , numMessages_(0)
+    , numDroppedMessages_(0)
+    , numMissedExpirations_(0)
+{
+    // Timer notifications are posted by every wheel from the single esp_timer
+    // task, so they need to come out of the per-class pools rather than the heap.
+#if defined(ESP_PLATFORM)
+    static_assert(
+        DVTask::GetQueuedMessageSize(sizeof(DVTimer::TimerFireMessage)) <= SMALL_MESSAGE_POOL_BLOCK_SIZE,
+        "TimerFireMessage must fit in the small message pool");
+#else
+    static_assert(
+        DVTask::GetQueuedMessageSize(sizeof(DVTimer::TimerFireMessage)) <= MEDIUM_MESSAGE_POOL_BLOCK_SIZE,
+        "TimerFireMessage must fit in the medium message pool");
+#endif // defined(ESP_PLATFORM)
+
+    semaphore_ = xSemaphoreCreateMutex();
+    assert(semaphore_ != nullptr);
+
+    memset(slots_, 0, sizeof(slots_));
+    memset(occupiedSlots_, 0, sizeof(occupiedSlots_));
+    currentTick_ = esp_timer_get_time() / TICK_US;
+
+    ownersToNotify_.reserve(16);
+    ownersNotifying_.reserve(16);
+
+    esp_timer_create_args_t args = {
+        .callback = &OnESPTimerFire_,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = coreId == 0 ? "DVTimerWheel0" : "DVTimerWheel1",
+        .skip_unhandled_events = false,
+    };
+
+    ESP_ERROR_CHECK(
+        esp_timer_create(
+            &args, &timerHandle_
+        )
+    );
+}
+
+void DVTimerWheel::getStatistics(Statistics* stats)
+{
+    assert(stats != nullptr);
+
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    stats->numTimers = numTimers_;
+    stats->numWakeups = numWakeups_;
+    stats->numExpirations = numExpirations_;
+    stats->numMessages = numMessages_;
+    stats->numDroppedMessages = numDroppedMessages_;
+    stats->numMissedExpirations = numMissedExpirations_;
+    stats->drift = drift_;
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::resetStatistics()
+{
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    numWakeups_ = 0;
+    numExpirations_ = 0;
+    numMessages_ = 0;
+    numDroppedMessages_ = 0;
+    numMissedExpirations_ = 0;
+    drift_.reset();
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::registerTimer_(DVTimer* timer)
+{
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    // Only one handler is needed per task regardless of how many timers it
+    // owns since the handler takes every timer that fired from the wheel.
+    DVTask* owner = timer->owner_;
+    auto iter = owners_.find(owner);
+    if (iter == owners_.end())
+    {
+        OwnerRegistration registration;
+        registration.handle = owner->registerMessageHandler(
+            std::function<void(DVTask*, DVTimer::TimerFireMessage*)>(
+                [owner](DVTask*, DVTimer::TimerFireMessage*) { DVTimer::OnTimerFire_(owner); }));
+        registration.numTimers = 1;
+        registration.firedHead = nullptr;
+        registration.firedTail = nullptr;
+        registration.notified = false;
+        owners_[owner] = registration;
+    }
+    else
+    {
+        iter->second.numTimers++;
+    }
+
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::unregisterTimer_(DVTimer* timer)
+{
+    DVTask* owner = timer->owner_;
+    DVTask::MessageHandlerHandle handle = nullptr;
+
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    // Forget any expiration the owner hasn't handled yet.
+    removeFired_(timer);
+
+    auto iter = owners_.find(owner);
+    assert(iter != owners_.end());
+
+    // The owner's dispatch table can only be safely changed from the owner
+    // itself or while it isn't running. Otherwise, leave the handler in
+    // place for the owner's next timer (or ~DVTask()) to deal with.
+    if (--iter->second.numTimers == 0 && (!owner->isAwake() || owner->isCurrentTask()))
+    {
+        handle = iter->second.handle;
+        owners_.erase(iter);
+    }
+
+    xSemaphoreGive(semaphore_);
+
+    if (handle != nullptr)
+    {
+        owner->unregisterMessageHandler(handle);
+    }
+}
+
+DVTimer* DVTimerWheel::takeFiredTimer_(DVTask* owner)
+{
+    DVTimer* timer = nullptr;
+
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    auto iter = owners_.find(owner);
+    if (iter != owners_.end())
+    {
+        auto& registration = iter->second;
+        timer = registration.firedHead;
+        if (timer == nullptr)
+        {
+            // Everything's been handled, so the next expiration needs a new message.
+            registration.notified = false;
+        }
+        else
+        {
+            registration.firedHead = timer->firedNext_;
+            if (registration.firedHead == nullptr)
+            {
+                registration.firedTail = nullptr;
+            }
+
+            timer->fired_ = false;
+            timer->firedNext_ = nullptr;
+            timer->currentDeadlineUs_ = timer->firedDeadlineUs_;
+            timer->currentMissedPeriods_ = timer->firedMissedPeriods_;
+        }
+    }
+
+    xSemaphoreGive(semaphore_);
+
+    return timer;
+}
+
+void DVTimerWheel::startTimer_(DVTimer* timer, bool once)
+{
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    if (timer->running_)
+    {
+        xSemaphoreGive(semaphore_);
+        return;
+    }
+
+    // Expirations from before the restart are no longer of interest.
+    removeFired_(timer);
+    timer->once_ = once;
+    timer->running_ = true;
+    timer->expiryUs_ = esp_timer_get_time() + timer->intervalInMicroseconds_;
+    timer->missedPeriods_ = 0;
+    insert_(timer);
+    rearm_();
+
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::stopTimer_(DVTimer* timer)
+{
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    if (!timer->running_)
+    {
+        xSemaphoreGive(semaphore_);
+        return;
+    }
+
+    if (timer->wheelLevel_ >= 0)
+    {
+        remove_(timer);
+    }
+
+    // Note: we don't bother disarming the esp_timer here. If this was
+    // the next timer to expire, the wheel will just wake up and find
+    // nothing to do.
+    removeFired_(timer);
+    timer->running_ = false;
+    timer->once_ = false;
+
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::changeTimerInterval_(DVTimer* timer, uint64_t intervalInMicroseconds)
+{
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    timer->intervalInMicroseconds_ = intervalInMicroseconds;
+
+    // A running timer restarts with the new interval from now, same as
+    // stopping and starting it again.
+    if (timer->running_)
+    {
+        if (timer->wheelLevel_ >= 0)
+        {
+            remove_(timer);
+        }
+
+        removeFired_(timer);
+        timer->expiryUs_ = esp_timer_get_time() + timer->intervalInMicroseconds_;
+        timer->missedPeriods_ = 0;
+        insert_(timer);
+        rearm_();
+    }
+
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::insert_(DVTimer* timer)
+{
+    assert(timer->wheelLevel_ < 0);
+
+    uint64_t expiryTick = timer->expiryUs_ / TICK_US;
+    if (expiryTick < currentTick_)
+    {
+        expiryTick = currentTick_;
+    }
+
+    uint64_t delta = expiryTick - currentTick_;
+    if (delta > MAX_TICK_DELTA)
+    {
+        delta = MAX_TICK_DELTA;
+        expiryTick = currentTick_ + delta;
+    }
+
+    int level = 0;
+    while (level < NUM_LEVELS - 1 && delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    int slot = (expiryTick >> (SLOT_BITS * level)) & SLOT_MASK;
+
+    timer->wheelLevel_ = level;
+    timer->wheelSlot_ = slot;
+    timer->wheelPrev_ = nullptr;
+    timer->wheelNext_ = slots_[level][slot];
+    if (timer->wheelNext_ != nullptr)
+    {
+        timer->wheelNext_->wheelPrev_ = timer;
+    }
+    slots_[level][slot] = timer;
+    occupiedSlots_[level] |= (uint64_t)1 << slot;
+
+    numTimers_++;
+}
+
+void DVTimerWheel::remove_(DVTimer* timer)
+{
+    int level = timer->wheelLevel_;
+    int slot = timer->wheelSlot_;
+    assert(level >= 0);
+
+    if (timer->wheelPrev_ != nullptr)
+    {
+        timer->wheelPrev_->wheelNext_ = timer->wheelNext_;
+    }
+    else
+    {
+        slots_[level][slot] = timer->wheelNext_;
+    }
+
+    if (timer->wheelNext_ != nullptr)
+    {
+        timer->wheelNext_->wheelPrev_ = timer->wheelPrev_;
+    }
+
+    if (slots_[level][slot] == nullptr)
+    {
+        occupiedSlots_[level] &= ~((uint64_t)1 << slot);
+    }
+
+    timer->wheelNext_ = nullptr;
+    timer->wheelPrev_ = nullptr;
+    timer->wheelLevel_ = -1;
+    timer->wheelSlot_ = -1;
+
+    numTimers_--;
+}
+
+void DVTimerWheel::cascade_(int level)
+{
+    int slot = (currentTick_ >> (SLOT_BITS * level)) & SLOT_MASK;
+
+    DVTimer* timer = slots_[level][slot];
+    while (timer != nullptr)
+    {
+        DVTimer* next = timer->wheelNext_;
+        remove_(timer);
+        insert_(timer);
+        timer = next;
+    }
+}
+
+void DVTimerWheel::advance_(uint64_t nowUs)
+{
+    uint64_t nowTick = nowUs / TICK_US;
+
+    for (;;)
+    {
+        // Move timers down from higher levels as we reach their slots,
+        // highest level first.
+        for (int level = NUM_LEVELS - 1; level > 0; level--)
+        {
+            uint64_t levelMask = ((uint64_t)1 << (SLOT_BITS * level)) - 1;
+            if ((currentTick_ & levelMask) == 0)
+            {
+                cascade_(level);
+            }
+        }
+
+        // Expire everything in the current slot that's due. Only the slot for
+        // the current tick can contain timers that aren't due yet.
+        int slot = currentTick_ & SLOT_MASK;
+        DVTimer* timer = slots_[0][slot];
+        while (timer != nullptr)
+        {
+            DVTimer* next = timer->wheelNext_;
+            if (timer->expiryUs_ <= nowUs)
+            {
+                remove_(timer);
+                expire_(timer, nowUs);
+            }
+            timer = next;
+        }
+
+        if (currentTick_ >= nowTick)
+        {
+            break;
+        }
+
+        currentTick_++;
+
+        // Jump directly to the next tick where something needs to happen.
+        uint64_t nextTick = getNextEventTick_();
+        if (nextTick > currentTick_)
+        {
+            currentTick_ = nextTick < nowTick ? nextTick : nowTick;
+        }
+    }
+}
+
+void DVTimerWheel::expire_(DVTimer* timer, uint64_t nowUs)
+{
+    drift_.add(nowUs - timer->expiryUs_);
+    numExpirations_++;
+
+    auto iter = owners_.find(timer->owner_);
+    assert(iter != owners_.end());
+    auto& registration = iter->second;
+
+    if (timer->fired_)
+    {
+        // The owner hasn't gotten to the previous expiration yet, so
+        // fold this one into it.
+        timer->firedMissedPeriods_ += timer->missedPeriods_ + 1;
+        numMissedExpirations_++;
+    }
+    else
+    {
+        timer->fired_ = true;
+        timer->firedMissedPeriods_ = timer->missedPeriods_;
+        timer->firedNext_ = nullptr;
+        if (registration.firedTail != nullptr)
+        {
+            registration.firedTail->firedNext_ = timer;
+        }
+        else
+        {
+            registration.firedHead = timer;
+        }
+        registration.firedTail = timer;
+    }
+    timer->firedDeadlineUs_ = timer->expiryUs_;
+    timer->missedPeriods_ = 0;
+
+    if (!registration.notified)
+    {
+        registration.notified = true;
+        ownersToNotify_.push_back(timer->owner_);
+    }
+
+    if (timer->once_)
+    {
+        timer->once_ = false;
+        timer->running_ = false;
+    }
+    else
+    {
+        // Schedule relative to the previous deadline to avoid drift. If
+        // we're more than a period late, skip the missed expirations; the
+        // next one will report how many were skipped.
+        uint64_t interval = timer->intervalInMicroseconds_;
+        assert(interval > 0);
+
+        timer->expiryUs_ += interval;
+        if (timer->expiryUs_ <= nowUs)
+        {
+            uint64_t numMissed = (nowUs - timer->expiryUs_) / interval + 1;
+            timer->expiryUs_ += numMissed * interval;
+            timer->missedPeriods_ = numMissed;
+            numMissedExpirations_ += numMissed;
+        }
+
+        insert_(timer);
+    }
+}
+
+void DVTimerWheel::removeFired_(DVTimer* timer)
+{
+    if (!timer->fired_)
+    {
+        return;
+    }
+
+    auto iter = owners_.find(timer->owner_);
+    assert(iter != owners_.end());
+    auto& registration = iter->second;
+
+    DVTimer* prev = nullptr;
+    for (DVTimer* current = registration.firedHead; current != timer; current = current->firedNext_)
+    {
+        assert(current != nullptr);
+        prev = current;
+    }
+
+    if (prev != nullptr)
+    {
+        prev->firedNext_ = timer->firedNext_;
+    }
+    else
+    {
+        registration.firedHead = timer->firedNext_;
+    }
+
+    if (registration.firedTail == timer)
+    {
+        registration.firedTail = prev;
+    }
+
+    timer->fired_ = false;
+    timer->firedNext_ = nullptr;
+}
+
+void DVTimerWheel::clearFired_(OwnerRegistration* registration)
+{
+    DVTimer* timer = registration->firedHead;
+    while (timer != nullptr)
+    {
+        DVTimer* next = timer->firedNext_;
+        timer->fired_ = false;
+        timer->firedNext_ = nullptr;
+        timer = next;
+    }
+
+    registration->firedHead = nullptr;
+    registration->firedTail = nullptr;
+}
+
+uint64_t DVTimerWheel::getNextEventTick_()
+{
+    uint64_t nextTick = UINT64_MAX;
+
+    for (int level = 0; level < NUM_LEVELS; level++)
+    {
+        uint64_t occupied = occupiedSlots_[level];
+        if (occupied == 0)
+        {
+            continue;
+        }
+
+        int shift = SLOT_BITS * level;
+        uint64_t levelTick = currentTick_ >> shift;
+
+        // The current slot is still pending if we haven't passed its start
+        // (always the case for level 0). Otherwise, it's already been
+        // cascaded and anything in it belongs to the next rotation.
+        uint64_t levelMask = ((uint64_t)1 << shift) - 1;
+        int firstOffset = (currentTick_ & levelMask) == 0 ? 0 : 1;
+
+        int rotation = (levelTick + firstOffset) & SLOT_MASK;
+        uint64_t rotated = rotation == 0 ? occupied : (occupied >> rotation) | (occupied << (NUM_SLOTS - rotation));
+        uint64_t offset = firstOffset + __builtin_ctzll(rotated);
+
+        uint64_t candidate = (levelTick + offset) << shift;
+        if (candidate < nextTick)
+        {
+            nextTick = candidate;
+        }
+    }
+
+    return nextTick;
+}
+
+uint64_t DVTimerWheel::getNextEventUs_()
+{
+    uint64_t nextTick = getNextEventTick_();
+    if (nextTick == UINT64_MAX)
+    {
+        return UINT64_MAX;
+    }
+
+    uint64_t nextUs = nextTick * TICK_US;
+
+    // If the next event is a level 0 slot, wake up for the earliest deadline
+    // in it rather than the start of the slot. Otherwise, it's a cascade
+    // and waking up at the start of the slot is fine.
+    if (occupiedSlots_[0] & ((uint64_t)1 << (nextTick & SLOT_MASK)))
+    {
+        uint64_t earliestUs = UINT64_MAX;
+        for (DVTimer* timer = slots_[0][nextTick & SLOT_MASK]; timer != nullptr; timer = timer->wheelNext_)
+        {
+            if (timer->expiryUs_ < earliestUs)
+            {
+                earliestUs = timer->expiryUs_;
+            }
+        }
+
+        if (earliestUs > nextUs)
+        {
+            nextUs = earliestUs;
+        }
+    }
+
+    return nextUs;
+}
+
+void DVTimerWheel::rearm_()
+{
+    uint64_t nextUs = getNextEventUs_();
+    if (retryUs_ < nextUs)
+    {
+        nextUs = retryUs_;
+    }
+
+    if (nextUs == UINT64_MAX || nextUs >= armedUs_)
+    {
+        // Nothing scheduled or we're already going to wake up early enough.
+        return;
+    }
+
+    // The esp_timer may not be running (or may have just fired), so ignore errors here.
+    esp_timer_stop(timerHandle_);
+
+    uint64_t nowUs = esp_timer_get_time();
+    uint64_t timeoutUs = nextUs > nowUs ? nextUs - nowUs : 0;
+
+    ESP_ERROR_CHECK(esp_timer_start_once(timerHandle_, timeoutUs));
+    armedUs_ = nextUs;
+}
+
+void DVTimerWheel::onWheelTimerFire_()
+{
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    numWakeups_++;
+    armedUs_ = UINT64_MAX;
+    retryUs_ = UINT64_MAX;
+    advance_(esp_timer_get_time());
+    ownersNotifying_.swap(ownersToNotify_);
+
+    xSemaphoreGive(semaphore_);
+
+    // Post outside the lock. ownersNotifying_ is only touched from the
+    // esp_timer task so this is safe. Posting never blocks since every
+    // wheel is driven from that one task; owners whose queues are full
+    // are kept for the next attempt.
+    DVTimer::TimerFireMessage message;
+    uint32_t numMessages = 0;
+    size_t numFailed = 0;
+    for (auto owner : ownersNotifying_)
+    {
+        if (owner->postTimer(&message))
+        {
+            numMessages++;
+        }
+        else
+        {
+            ownersNotifying_[numFailed++] = owner;
+        }
+    }
+    ownersNotifying_.resize(numFailed);
+
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+
+    numMessages_ += numMessages;
+    for (auto owner : ownersNotifying_)
+    {
+        auto iter = owners_.find(owner);
+        if (iter == owners_.end())
+        {
+            continue;
+        }
+
+        if (!owner->isAwake())
+        {
+            // Nothing is going to handle these.
+            clearFired_(&iter->second);
+            iter->second.notified = false;
+            continue;
+        }
+
+        numDroppedMessages_++;
+        ownersToNotify_.push_back(owner);
+    }
+    ownersNotifying_.clear();
+
+    if (!ownersToNotify_.empty())
+    {
+        retryUs_ = esp_timer_get_time() + TICK_US;
+    }
+    rearm_();
+
+    xSemaphoreGive(semaphore_);
+}
+
+void DVTimerWheel::OnESPTimerFire_(void* ptr)
+{
+    DVTimerWheel* obj = (DVTimerWheel*)ptr;
+    obj->onWheelTimerFire_();
+}
+
+}
+
+}
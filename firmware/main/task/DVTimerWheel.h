@@ -0,0 +1,187 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DV_TIMER_WHEEL_H
+#define DV_TIMER_WHEEL_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "DVLatencyHistogram.h"
+#include "DVTimer.h"
+
+namespace ezdv
+{
+
+namespace task
+{
+
+/// @brief Hierarchical timer wheel that drives all DVTimers owned by tasks pinned to one
+///        core (unpinned tasks use core 0's wheel).
+///
+/// Splitting timers by core only splits the wheels' state and locks. Every
+/// wheel's esp_timer callback runs in the esp_timer task, so expirations for
+/// all cores are processed in that one context.
+///
+/// Each wheel uses a single one-shot esp_timer that is armed for the earliest
+/// deadline in the next occupied slot. When it fires, every DVTimer that is due
+/// is added to its owner's list of fired timers and the owner is sent a single
+/// (payload-free) TimerFireMessage, unless it already has one it hasn't handled.
+/// Posting never blocks: if the owner's queue is full, the wheel tries again a
+/// tick later, and any further expirations in the meantime are reported to the
+/// handler as missed periods. Periodic timers are re-armed relative to their
+/// previous deadline (not to the time they actually fired), so late wakeups
+/// don't accumulate drift.
+class DVTimerWheel
+{
+public:
+    /// @brief Length of a single wheel tick (i.e. the width of each level 0 slot).
+    ///        The wheel's esp_timer is armed for the exact deadline of the earliest
+    ///        timer, so this only affects how timers are bucketed.
+    static constexpr uint64_t TICK_US = 1000;
+
+    struct Statistics
+    {
+        uint32_t numTimers; // timers currently scheduled
+        uint32_t numWakeups; // times the wheel's esp_timer fired
+        uint32_t numExpirations; // timer expirations delivered
+        uint32_t numMessages; // TimerFireMessages posted to tasks
+        uint32_t numDroppedMessages; // TimerFireMessages that didn't fit in the owner's queue (and were retried)
+        uint32_t numMissedExpirations; // expirations skipped because we or the owner were too late
+
+        /// @brief How late each expiration was delivered relative to its deadline.
+        DVLatencyHistogram drift;
+    };
+
+    /// @brief Creates the timer wheel for each core. Called by DVTask::Initialize().
+    static void Initialize();
+
+    /// @brief Returns the number of timer wheels (one per core).
+    static int GetNumWheels() { return portNUM_PROCESSORS; }
+
+    /// @brief Forgets about a task that is being destroyed. Called by ~DVTask().
+    static void RemoveOwner(DVTask* owner);
+
+    /// @brief Returns the timer wheel for the given core.
+    /// @param coreId The core ID (tskNO_AFFINITY uses core 0's wheel).
+    static DVTimerWheel* Get(BaseType_t coreId);
+
+    /// @brief Retrieves statistics for this wheel.
+    void getStatistics(Statistics* stats);
+
+    /// @brief Clears drift and expiration statistics.
+    void resetStatistics();
+
+private:
+    friend class DVTimer;
+
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int NUM_SLOTS = 1 << SLOT_BITS;
+    static constexpr int NUM_LEVELS = 3;
+    static constexpr uint64_t SLOT_MASK = NUM_SLOTS - 1;
+
+    // Largest number of ticks in the future a timer can be placed directly.
+    // Timers further out than this are parked in the last slot and
+    // re-evaluated when it cascades.
+    static constexpr uint64_t MAX_TICK_DELTA = ((uint64_t)1 << (SLOT_BITS * NUM_LEVELS)) - 1;
+
+    struct OwnerRegistration
+    {
+        DVTask::MessageHandlerHandle handle;
+
+        // The handler is kept (and reused) after this drops to zero if the 
+        // last timer is destroyed while the owner is running on another task.
+        int numTimers;
+
+        // Timers that have fired but haven't been handled yet, oldest first.
+        DVTimer* firedHead;
+        DVTimer* firedTail;
+
+        // Whether a TimerFireMessage has been (or is about to be) posted
+        // that the owner hasn't finished handling.
+        bool notified;
+    };
+
+    static DVTimerWheel* Wheels_[portNUM_PROCESSORS];
+
+    DVTimerWheel(int coreId);
+    ~DVTimerWheel() = delete; // wheels live forever
+
+    // Called by DVTimer.
+    void registerTimer_(DVTimer* timer);
+    void unregisterTimer_(DVTimer* timer);
+    void startTimer_(DVTimer* timer, bool once);
+    void stopTimer_(DVTimer* timer);
+    void changeTimerInterval_(DVTimer* timer, uint64_t intervalInMicroseconds);
+    DVTimer* takeFiredTimer_(DVTask* owner);
+
+    // All of the below must be called with semaphore_ held.
+    void insert_(DVTimer* timer);
+    void remove_(DVTimer* timer);
+    void cascade_(int level);
+    void advance_(uint64_t nowUs);
+    void expire_(DVTimer* timer, uint64_t nowUs);
+    void removeFired_(DVTimer* timer);
+    void clearFired_(OwnerRegistration* registration);
+    uint64_t getNextEventTick_();
+    uint64_t getNextEventUs_();
+    void rearm_();
+
+    void onWheelTimerFire_();
+    static void OnESPTimerFire_(void* ptr);
+
+    SemaphoreHandle_t semaphore_;
+    esp_timer_handle_t timerHandle_;
+
+    DVTimer* slots_[NUM_LEVELS][NUM_SLOTS];
+    uint64_t occupiedSlots_[NUM_LEVELS];
+
+    // Every timer with an expiry tick less than this has already fired.
+    uint64_t currentTick_;
+
+    // Time the esp_timer is currently armed for (UINT64_MAX if disarmed).
+    uint64_t armedUs_;
+
+    // Time to retry posting TimerFireMessages that didn't fit (UINT64_MAX if none).
+    uint64_t retryUs_;
+
+    std::map<DVTask*, OwnerRegistration> owners_;
+
+    // Owners that need a TimerFireMessage. Swapped with ownersNotifying_ so
+    // that posting can be done outside the lock.
+    std::vector<DVTask*> ownersToNotify_;
+    std::vector<DVTask*> ownersNotifying_;
+
+    uint32_t numTimers_;
+    uint32_t numWakeups_;
+    uint32_t numExpirations_;
+    uint32_t numMessages_;
+    uint32_t numDroppedMessages_;
+    uint32_t numMissedExpirations_;
+    DVLatencyHistogram drift_;
+};
+
+}
+
+}
+
+#endif // DV_TIMER_WHEEL_H
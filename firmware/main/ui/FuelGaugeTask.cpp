@@ -41,7 +41,6 @@ FuelGaugeTask::ChargeIndicatorConfiguration FuelGaugeTask::IndicatorConfig_[] =
 
 FuelGaugeTask::FuelGaugeTask()
     : DVTask("FuelGaugeTask", 10, 4096, tskNO_AFFINITY, 32, pdMS_TO_TICKS(1000))
-    , sentRequest_(false)
     , socChangeRate_(0)
 {
     registerMessageHandler(this, &FuelGaugeTask::onButtonLongPressedMessage_);
@@ -75,15 +74,30 @@ void FuelGaugeTask::onButtonLongPressedMessage_(DVTask* origin, driver::ButtonLo
 
 void FuelGaugeTask::onTaskTick_()
 {
-    // Request current battery state once a second to ensure we're still charging.
-    sentRequest_ = true;
+    // Request a fresh battery reading once a second to ensure we're still charging.
     driver::RequestBatteryStateMessage message;
     publish(&message);
+
+    // Update the indicators using the most recent reading. This may be up to a
+    // tick old but avoids waiting on MAX17048, which only publishes on change.
+    if (driver::BatteryStateTopic.hasValue())
+    {
+        auto state = driver::BatteryStateTopic.get();
+
+        // Store off charging rate so we don't unnecessarily blink when charging
+        // is complete.
+        socChangeRate_ = state.socChangeRate;
+
+        for (int index = 0; index < NUM_LEDS; index++)
+        {
+            lightIndicator_(state.soc, &IndicatorConfig_[index]);
+        }
+    }
 }
 
 void FuelGaugeTask::onBatteryStateMessage_(DVTask* origin, driver::BatteryStateMessage* message)
 {
-    // We could get an unsolicited message due to the USB cable being disconnected.
+    // We could get a message due to the USB cable being disconnected.
     // Shut down when this occurs.
     if (!message->usbPowerEnabled)
     {
@@ -91,23 +105,6 @@ void FuelGaugeTask::onBatteryStateMessage_(DVTask* origin, driver::BatteryStateM
         rebootDevice = false;
         StartSleeping();
     }
-
-    // Ignore the unsolicited status messages to ensure that there aren't any glitches
-    // in the blinking.
-    if (!sentRequest_)
-    {
-        return;
-    }
-    sentRequest_ = false;
-
-    // Store off charging rate so we don't unnecessarily blink when charging
-    // is complete.
-    socChangeRate_ = message->socChangeRate;
-
-    for (int index = 0; index < NUM_LEDS; index++)
-    {
-        lightIndicator_(message->soc, &IndicatorConfig_[index]);
-    }
 }
 
 void FuelGaugeTask::lightIndicator_(float chargeLevel, ChargeIndicatorConfiguration* config)
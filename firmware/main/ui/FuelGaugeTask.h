@@ -54,7 +54,6 @@ private:
         driver::SetLedStateMessage::LedLabel ledToLight;
     };
     
-    bool sentRequest_;
     float socChangeRate_;
 
     // Button handling
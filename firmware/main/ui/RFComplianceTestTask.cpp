@@ -59,7 +59,7 @@ namespace ui
 
 RfComplianceTestTask::RfComplianceTestTask(ezdv::driver::LedArray* ledArrayTask, ezdv::driver::TLV320* tlv320Task)
     : DVTask("RfComplianceTestTask", 10, 4096, tskNO_AFFINITY, 32, pdMS_TO_TICKS(20))
-    , AudioInput(1, 2)
+    , AudioInput(0, 2)
     , leftChannelSineWave_(LEFT_FREQ_HZ, SINE_WAVE_AMPLITUDE)
     , rightChannelSineWave_(RIGHT_FREQ_HZ, SINE_WAVE_AMPLITUDE)
     , isActive_(false)
@@ -194,6 +194,8 @@ void RfComplianceTestTask::onButtonReleasedMessage_(DVTask* origin, driver::Butt
 
 void RfComplianceTestTask::onTaskTick_()
 {
+    latchAudioOutputs();
+
     if (isActive_)
     {
         //auto timeBegin = esp_timer_get_time();
@@ -229,8 +231,8 @@ void RfComplianceTestTask::onTaskTick_()
 
 void RfComplianceTestTask::sineWave_()
 {
-    struct FIFO* outputLeftFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* outputRightFifo = getAudioOutput(AudioInput::RIGHT_CHANNEL);
+    AudioRingBuffer* outputLeftFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
+    AudioRingBuffer* outputRightFifo = getAudioOutput(AudioInput::RIGHT_CHANNEL);
     
     if (currentMode_ == 0 || currentMode_ == 1)
     {
@@ -241,10 +243,10 @@ void RfComplianceTestTask::sineWave_()
                 leftChannelCtr_ = 0;
             }
         
-            if (codec2_fifo_free(outputLeftFifo) > 0)
+            if (outputLeftFifo->getFree() > 0)
             {
                 short sample = leftChannelSineWave_.getSample(leftChannelCtr_++);
-                codec2_fifo_write(outputLeftFifo, &sample, 1);
+                outputLeftFifo->write(&sample, 1);
             }
         }
     }
@@ -258,10 +260,10 @@ void RfComplianceTestTask::sineWave_()
                 rightChannelCtr_ = 0;
             }
         
-            if (codec2_fifo_free(outputRightFifo) > 0)
+            if (outputRightFifo->getFree() > 0)
             {
                 short sample = rightChannelSineWave_.getSample(rightChannelCtr_++);
-                codec2_fifo_write(outputRightFifo, &sample, 1);
+                outputRightFifo->write(&sample, 1);
             }
         }
     }
@@ -269,8 +271,8 @@ void RfComplianceTestTask::sineWave_()
 
 void RfComplianceTestTask::squareWave_()
 {
-    struct FIFO* outputLeftFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
-    struct FIFO* outputRightFifo = getAudioOutput(AudioInput::RIGHT_CHANNEL);
+    AudioRingBuffer* outputLeftFifo = getAudioOutput(AudioInput::LEFT_CHANNEL);
+    AudioRingBuffer* outputRightFifo = getAudioOutput(AudioInput::RIGHT_CHANNEL);
     
     if (currentMode_ == 3 || currentMode_ == 4)
     {
@@ -282,11 +284,11 @@ void RfComplianceTestTask::squareWave_()
                 leftChannelCtr_ = 0;
             }
         
-            if (codec2_fifo_free(outputLeftFifo) > 0)
+            if (outputLeftFifo->getFree() > 0)
             {
                 int halfway = numSamplesPerPeriod >> 1;
                 short val = leftChannelCtr_++ < halfway ? SINE_WAVE_AMPLITUDE : -SINE_WAVE_AMPLITUDE;
-                codec2_fifo_write(outputLeftFifo, &val, 1);
+                outputLeftFifo->write(&val, 1);
             }
         }
     }
@@ -301,11 +303,11 @@ void RfComplianceTestTask::squareWave_()
                 rightChannelCtr_ = 0;
             }
         
-            if (codec2_fifo_free(outputRightFifo) > 0)
+            if (outputRightFifo->getFree() > 0)
             {
                 int halfway = numSamplesPerPeriod >> 1;
                 short val = rightChannelCtr_++ < halfway ? SINE_WAVE_AMPLITUDE : -SINE_WAVE_AMPLITUDE;
-                codec2_fifo_write(outputRightFifo, &val, 1);
+                outputRightFifo->write(&val, 1);
             }
         }
     }
@@ -41,6 +41,7 @@ static std::map<audio::FreeDVMode, std::string> ModeList_ = {
     { audio::FREEDV_700D, "  700D" },
     { audio::FREEDV_700E, "  700E" },
     { audio::FREEDV_1600, "  1600" },
+    { audio::FREEDV_SCAN, "  SCAN" },
 };
 
 UserInterfaceTask::UserInterfaceTask()
@@ -320,6 +321,23 @@ void UserInterfaceTask::flashNetworkLight_(DVTimer*)
 
 void UserInterfaceTask::onRequestTxMessage_(DVTask* origin, audio::RequestTxMessage* message)
 {
+    if (currentMode_ == audio::FREEDV_SCAN)
+    {
+        // There's no mode to transmit in until the scan locks onto a signal.
+        // Remind the user that we're still scanning instead of keying up.
+        ESP_LOGW(CURRENT_LOG_TAG, "Not transmitting while scanning for a FreeDV mode");
+
+        if (voiceKeyerRunning_)
+        {
+            audio::RequestStartStopKeyerMessage vkRequest(false);
+            post(&vkRequest);
+        }
+
+        audio::SetBeeperTextMessage beeperMessage(ModeList_[currentMode_].c_str());
+        publish(&beeperMessage);
+        return;
+    }
+
     startTx_();
 }
 
@@ -17,6 +17,7 @@
 
 #include "SineWaveGenerator.h"
 
+#include <cassert>
 #include <cmath>
 #include "esp_heap_caps.h"
 
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the ezDV project (https://github.com/tmiw/ezDV).
+ * Copyright (c) 2024 Mooneer Salem
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATISTICS_REGISTRY_H
+#define STATISTICS_REGISTRY_H
+
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+
+namespace ezdv
+{
+
+namespace util
+{
+
+/// @brief Tracks the live instances of a class so that statistics can be
+///        gathered from all of them at once. T must provide a Statistics
+///        type and getStatistics(Statistics*, bool reset) that is safe to
+///        call from inside a critical section. Instances beyond MaxInstances
+///        aren't tracked.
+template<typename T, int MaxInstances>
+class StatisticsRegistry
+{
+public:
+    void add(T* instance)
+    {
+        portENTER_CRITICAL_SAFE(&lock_);
+        for (auto& entry : instances_)
+        {
+            if (entry == nullptr)
+            {
+                entry = instance;
+                break;
+            }
+        }
+        portEXIT_CRITICAL_SAFE(&lock_);
+    }
+
+    void remove(T* instance)
+    {
+        portENTER_CRITICAL_SAFE(&lock_);
+        for (auto& entry : instances_)
+        {
+            if (entry == instance)
+            {
+                entry = nullptr;
+            }
+        }
+        portEXIT_CRITICAL_SAFE(&lock_);
+    }
+
+    void getAllStatistics(std::vector<typename T::Statistics>& stats, bool reset)
+    {
+        // Copy under the lock, then build the vector outside of it
+        // since that may allocate.
+        typename T::Statistics snapshot[MaxInstances];
+        int numInstances = 0;
+
+        portENTER_CRITICAL_SAFE(&lock_);
+        for (auto instance : instances_)
+        {
+            if (instance != nullptr)
+            {
+                instance->getStatistics(&snapshot[numInstances++], reset);
+            }
+        }
+        portEXIT_CRITICAL_SAFE(&lock_);
+
+        stats.assign(snapshot, snapshot + numInstances);
+    }
+
+private:
+    T* instances_[MaxInstances] = {};
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+}
+
+}
+
+#endif // STATISTICS_REGISTRY_H